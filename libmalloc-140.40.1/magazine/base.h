@@ -30,7 +30,9 @@
 		MALLOC_FATAL_ERROR((cause), message); \
 })
 
-#if defined(__i386__) || defined(__x86_64__) || defined(__arm__) || defined(__arm64__)
+#if defined(__linux__)
+// No commpage; platform.h turns off the CONFIG_HAS_COMMPAGE_* shortcuts.
+#elif defined(__i386__) || defined(__x86_64__) || defined(__arm__) || defined(__arm64__)
 #   define __APPLE_API_PRIVATE
 #   include <machine/cpu_capabilities.h>
 #   if defined(__i386__) || defined(__x86_64__)
@@ -48,7 +50,7 @@
 // for this cache-line size.
 #   define MALLOC_CACHE_LINE 128
 #   define MALLOC_NANO_CACHE_LINE 64
-#elif defined(__arm__) || defined(__arm64__)
+#elif defined(__arm__) || defined(__arm64__) || defined(__aarch64__)
 #   define MALLOC_CACHE_LINE 64
 #   define MALLOC_NANO_CACHE_LINE 64
 #else
@@ -94,6 +96,18 @@
 #define MALLOC_ABORT_ON_CORRUPTION (1 << 6)
 // expanded small-zone free list size (256 slots)
 #define MALLOC_EXTENDED_SMALL_SLOTS (1 << 7)
+// front tiny and small magazines with a per-thread cache of free blocks
+#define MALLOC_THREAD_CACHE (1 << 8)
+// carve small allocations up to SMALL_CLASS_MAX_MSIZE from per-size-class runs
+#define MALLOC_SMALL_CLASSES (1 << 9)
+// return idle tiny and small pages to the system from a background thread
+#define MALLOC_SCAVENGER (1 << 10)
+// back tiny and small regions with transparent huge pages
+#define MALLOC_HUGE_PAGES (1 << 11)
+// group tiny and small magazines per NUMA node and keep their regions local
+#define MALLOC_NUMA_MAGAZINES (1 << 12)
+// grow nano slot bands ahead of use from a background thread
+#define MALLOC_NANO_PREFETCH (1 << 13)
 
 /*
  * msize - a type to refer to the number of quanta of a tiny or small
@@ -107,6 +121,9 @@ typedef struct large_entry_s large_entry_t;
 typedef struct szone_s szone_t;
 typedef struct rack_s rack_t;
 typedef struct magazine_s magazine_t;
+typedef struct magazine_tcache_s magazine_tcache_t;
+typedef struct small_class_run_s small_class_run_t;
+typedef struct mvm_madvise_batch_s mvm_madvise_batch_t;
 typedef int mag_index_t;
 typedef void *region_t;
 
@@ -60,7 +60,11 @@ static MALLOC_INLINE void recirc_list_splice_first(rack_t *rack, magazine_t *mag
 static MALLOC_INLINE void
 yield(void)
 {
+#if MALLOC_TARGET_LINUX
+	sched_yield();
+#else // MALLOC_TARGET_LINUX
 	thread_switch(MACH_PORT_NULL, SWITCH_OPTION_DEPRESS, 1);
+#endif // MALLOC_TARGET_LINUX
 }
 
 static MALLOC_INLINE kern_return_t
@@ -78,6 +82,8 @@ platform_hw_memsize(void)
 {
 #if CONFIG_HAS_COMMPAGE_MEMSIZE
 	return *(uint64_t *)(uintptr_t)_COMM_PAGE_MEMORY_SIZE;
+#elif MALLOC_TARGET_LINUX
+	return (uint64_t)sysconf(_SC_PHYS_PAGES) * (uint64_t)sysconf(_SC_PAGESIZE);
 #else
 	uint64_t hw_memsize = 0;
 	size_t uint64_t_size = sizeof(hw_memsize);
@@ -93,6 +99,9 @@ platform_cpu_count(void)
 {
 #if CONFIG_HAS_COMMPAGE_NCPUS
 	return *(uint8_t *)(uintptr_t)_COMM_PAGE_NCPUS;
+#elif MALLOC_TARGET_LINUX
+	// CPUs that come online later share magazines (see rack_get_thread_index).
+	return sysconf(_SC_NPROCESSORS_ONLN);
 #else
 	return sysconf(_SC_NPROCESSORS_CONF);
 #endif
@@ -124,6 +133,30 @@ SZONE_REINIT_LOCK(szone_t *szone)
 	_malloc_lock_init(&szone->large_szone_lock);
 }
 
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+LARGE_SHARD_LOCK(large_shard_t *shard)
+{
+	_malloc_lock_lock(&shard->large_shard_lock);
+}
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+LARGE_SHARD_UNLOCK(large_shard_t *shard)
+{
+	_malloc_lock_unlock(&shard->large_shard_lock);
+}
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE bool
+LARGE_SHARD_TRY_LOCK(large_shard_t *shard)
+{
+	return _malloc_lock_trylock(&shard->large_shard_lock);
+}
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+LARGE_SHARD_REINIT_LOCK(large_shard_t *shard)
+{
+	_malloc_lock_init(&shard->large_shard_lock);
+}
+
 static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
 SZONE_MAGAZINE_PTR_LOCK(magazine_t *mag_ptr)
 {
@@ -390,6 +423,28 @@ hash_regions_grow_no_lock(region_t *regions, size_t old_size, size_t *mutable_sh
 	return new_regions;
 }
 
+#pragma mark region map
+
+/*
+ * region_map_lookup - Returns the rack owning the tiny or small region that
+ * contains ptr, or NULL. Safe to call without any lock held.
+ */
+static MALLOC_INLINE rack_t *
+region_map_lookup(const void *ptr)
+{
+	uintptr_t chunk = (uintptr_t)ptr >> REGION_MAP_CHUNK_SHIFT;
+	region_map_leaf_t *leaf;
+
+	if (chunk >> REGION_MAP_CHUNK_BITS) {
+		return NULL;
+	}
+	leaf = region_map[chunk >> REGION_MAP_LEAF_SHIFT];
+	if (!leaf) {
+		return NULL;
+	}
+	return leaf->racks[chunk & (REGION_MAP_LEAF_ENTRIES - 1)];
+}
+
 #pragma mark mag lock
 
 /*
@@ -401,9 +456,35 @@ static MALLOC_INLINE MALLOC_ALWAYS_INLINE
 mag_index_t
 mag_get_thread_index(void)
 {
+#if CONFIG_NUMA_MAGAZINES
+	if (mag_numa_enabled) {
+		unsigned int cpu = _os_cpu_number();
+		if (cpu < MAG_NUMA_MAX_CPUS) {
+			return mag_numa_cpu_magazine[cpu];
+		}
+	}
+#endif // CONFIG_NUMA_MAGAZINES
 	return _os_cpu_number() & (TINY_MAX_MAGAZINES - 1);
 }
 
+/*
+ * rack_get_thread_index - The calling CPU's magazine in rack. The magazine
+ * count need not be a power of 2: the CPU number is masked to the next power
+ * of 2 and folded back below the count, so each CPU below the count keeps a
+ * magazine to itself.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE
+mag_index_t
+rack_get_thread_index(rack_t *rack)
+{
+	mag_index_t mag_index = mag_get_thread_index() & rack->num_magazines_mask;
+
+	if (mag_index >= rack->num_magazines) {
+		mag_index -= rack->num_magazines;
+	}
+	return mag_index;
+}
+
 static MALLOC_INLINE magazine_t *
 mag_lock_zine_for_region_trailer(magazine_t *magazines, region_trailer_t *trailer, mag_index_t mag_index)
 {
@@ -428,6 +509,166 @@ mag_lock_zine_for_region_trailer(magazine_t *magazines, region_trailer_t *traile
 	return mag_ptr;
 }
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+#pragma mark remote free list
+
+/*
+ * mag_remote_free_mark - Stamps a block about to be queued with its msize.
+ * Returns FALSE if the block already carried a stamp, which means it is most
+ * likely queued already: the caller must then free it under the magazine lock,
+ * after draining the list, so that a double free shows up as a free block
+ * rather than as a cycle on the list. The exchange settles two threads racing
+ * to free the same block.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE boolean_t
+mag_remote_free_mark(rack_t *rack, void *ptr, msize_t msize)
+{
+	remote_free_entry_t *entry = (remote_free_entry_t *)ptr;
+	uintptr_t old = __atomic_exchange_n(&entry->stamp, rack->cookie ^ msize, __ATOMIC_RELAXED);
+
+	return ((old ^ rack->cookie) >> (8 * sizeof(msize_t))) != 0;
+}
+
+/*
+ * mag_remote_free_msize - The msize a queued block was stamped with. Also
+ * wipes the stamp, since the block is about to be freed for real.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE msize_t
+mag_remote_free_msize(rack_t *rack, remote_free_entry_t *entry)
+{
+	msize_t msize = (msize_t)(entry->stamp ^ rack->cookie);
+
+	entry->stamp = 0;
+	return msize;
+}
+
+/*
+ * mag_remote_free_push - Queues a block, stamped by mag_remote_free_mark, for
+ * the magazine that owns its region without taking that magazine's lock. Any
+ * number of threads may push; only a holder of the magazine lock takes entries
+ * off (see mag_remote_free_take), so the list never suffers from ABA.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+mag_remote_free_push(magazine_t *mag_ptr, void *ptr)
+{
+	remote_free_entry_t *entry = (remote_free_entry_t *)ptr;
+	remote_free_entry_t *head;
+
+	do {
+		head = mag_ptr->mag_remote_free;
+		entry->next = head;
+	} while (!OSAtomicCompareAndSwapPtrBarrier(head, entry, (void *volatile *)&mag_ptr->mag_remote_free));
+}
+
+/*
+ * mag_remote_free_take - Detaches the whole remote free list. Caller holds the
+ * magazine lock.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE remote_free_entry_t *
+mag_remote_free_take(magazine_t *mag_ptr)
+{
+	remote_free_entry_t *head;
+
+	do {
+		head = mag_ptr->mag_remote_free;
+	} while (head && !OSAtomicCompareAndSwapPtrBarrier(head, NULL, (void *volatile *)&mag_ptr->mag_remote_free));
+	return head;
+}
+
+/*
+ * mag_should_free_remotely - Whether a free of a block whose region belongs to
+ * mag_index should be queued rather than done under that magazine's lock.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE boolean_t
+mag_should_free_remotely(rack_t *rack, mag_index_t mag_index)
+{
+	return (DEPOT_MAGAZINE_INDEX != mag_index) && (rack->num_magazines > 1) &&
+			(mag_index != rack_get_thread_index(rack));
+}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
+#if CONFIG_KNOWN_ZERO_PAGES
+#pragma mark known-zero granules
+
+/*
+ * A set bit in a region trailer's zero_granules says that every free byte in
+ * that granule is zero, other than the free list linkage kept at the edges of
+ * free blocks. Bits are set once pages wholly inside a free block have been
+ * given back with advice that drops their contents (MVM_ADVICE_ZEROES), and
+ * cleared whenever a free leaves dirty bytes in the granule. A calloc() of a
+ * block that lies in set granules then only has to clear the block's edges.
+ */
+static MALLOC_INLINE void
+region_zero_granules_mark(region_trailer_t *node, uintptr_t base, unsigned shift, uintptr_t lo, uintptr_t hi)
+{
+	uintptr_t g = (lo - base + ((uintptr_t)1 << shift) - 1) >> shift;
+	uintptr_t end = (hi - base) >> shift;
+
+	for (; g < end; g++) {
+		OSAtomicOr32Barrier(1U << (g & 31), &node->zero_granules[g >> 5]);
+	}
+}
+
+/*
+ * region_zero_granules_unmark - Clears the bits of the granules overlapping
+ * [lo, hi), which must lie in the region. Caller holds the magazine lock.
+ */
+static MALLOC_INLINE void
+region_zero_granules_unmark(region_trailer_t *node, uintptr_t base, unsigned shift, uintptr_t lo, uintptr_t hi)
+{
+	uintptr_t g = (lo - base) >> shift;
+	uintptr_t last = (hi - 1 - base) >> shift;
+
+	for (; g <= last; g++) {
+		uint32_t bit = 1U << (g & 31);
+
+		if (node->zero_granules[g >> 5] & bit) {
+			OSAtomicAnd32Barrier(~bit, &node->zero_granules[g >> 5]);
+		}
+	}
+}
+
+/*
+ * region_zero_granules_test - Whether all of the granules overlapping
+ * [lo, hi) are marked. Caller holds the magazine lock.
+ */
+static MALLOC_INLINE boolean_t
+region_zero_granules_test(region_trailer_t *node, uintptr_t base, unsigned shift, uintptr_t lo, uintptr_t hi)
+{
+	uintptr_t g = (lo - base) >> shift;
+	uintptr_t last = (hi - 1 - base) >> shift;
+
+	for (; g <= last; g++) {
+		if (!(node->zero_granules[g >> 5] & (1U << (g & 31)))) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * rack_zero_granules_mark - Marks the granules wholly inside [pgLo, pgHi),
+ * pages of one of the rack's regions that have just been advised. Scribbling
+ * refills free blocks, so nothing is marked while it is enabled.
+ */
+static MALLOC_INLINE void
+rack_zero_granules_mark(rack_t *rack, uintptr_t pgLo, uintptr_t pgHi)
+{
+	region_t r;
+
+	if (rack->debug_flags & MALLOC_DO_SCRIBBLE) {
+		return;
+	}
+	if (rack->type == RACK_TYPE_TINY) {
+		r = TINY_REGION_FOR_PTR(pgLo);
+		region_zero_granules_mark(REGION_TRAILER_FOR_TINY_REGION(r), (uintptr_t)r, TINY_ZERO_GRANULE_SHIFT, pgLo, pgHi);
+	} else if (rack->type == RACK_TYPE_SMALL) {
+		r = SMALL_REGION_FOR_PTR(pgLo);
+		region_zero_granules_mark(REGION_TRAILER_FOR_SMALL_REGION(r), (uintptr_t)r, SMALL_ZERO_GRANULE_SHIFT, pgLo, pgHi);
+	}
+}
+#endif // CONFIG_KNOWN_ZERO_PAGES
+
 #pragma mark tiny allocator
 
 /*
@@ -437,6 +678,13 @@ mag_lock_zine_for_region_trailer(magazine_t *magazines, region_trailer_t *traile
 static MALLOC_INLINE region_t
 tiny_region_for_ptr_no_lock(rack_t *rack, const void *ptr)
 {
+	if (region_map_lookup(ptr) == rack) {
+		return TINY_REGION_FOR_PTR(ptr);
+	}
+	if (!rack->region_map_overflow) {
+		return NULL;
+	}
+
 	rgnhdl_t r = hash_lookup_region_no_lock(rack->region_generation->hashed_regions,
 			rack->region_generation->num_regions_allocated,
 			rack->region_generation->num_regions_allocated_shift,
@@ -524,6 +772,13 @@ get_tiny_meta_header(const void *ptr, boolean_t *is_free)
 static MALLOC_INLINE region_t
 small_region_for_ptr_no_lock(rack_t *rack, const void *ptr)
 {
+	if (region_map_lookup(ptr) == rack) {
+		return SMALL_REGION_FOR_PTR(ptr);
+	}
+	if (!rack->region_map_overflow) {
+		return NULL;
+	}
+
 	rgnhdl_t r = hash_lookup_region_no_lock(rack->region_generation->hashed_regions,
 			rack->region_generation->num_regions_allocated, rack->region_generation->num_regions_allocated_shift,
 			SMALL_REGION_FOR_PTR(ptr));
@@ -23,18 +23,89 @@
 
 #include "internal.h"
 
+/*
+ * Large allocations are tracked in LARGE_SHARD_COUNT shards (see large_shard_t
+ * in magazine_zone.h). Table operations lock only the shard a block's address
+ * hashes to; the death-row cache is filled and searched through the calling
+ * CPU's shard.
+ */
+
+static MALLOC_INLINE large_shard_t *
+large_shard_for_pointer(szone_t *szone, const void *ptr)
+{
+	uint64_t page = (uintptr_t)ptr >> vm_page_quanta_shift;
+
+	// Large blocks tend to share a stride, which would pile them into a few
+	// shards if the low page bits were used directly, so mix them first.
+	return &szone->large_shards[(page * 0x9e3779b97f4a7c15ULL) >> (64 - LARGE_SHARD_SHIFT)];
+}
+
+#if CONFIG_LARGE_CACHE
+static MALLOC_INLINE unsigned
+large_shard_index_for_cpu(void)
+{
+	return mag_get_thread_index() & (LARGE_SHARD_COUNT - 1);
+}
+
+/*
+ * Death-row size buckets: sizes under four pages get a bucket each, after
+ * which every power of two pages is split into four buckets. A bucket holds
+ * sizes from its own lower bound up to the next bucket's.
+ */
+static MALLOC_INLINE unsigned
+large_entry_cache_bucket(size_t size)
+{
+	unsigned long pages = size >> vm_page_quanta_shift;
+	unsigned lg;
+
+	if (pages < 4) {
+		return (unsigned)pages;
+	}
+	lg = (unsigned)(sizeof(pages) * CHAR_BIT - 1 - __builtin_clzl(pages));
+	return MIN(4 * (lg - 1) + (unsigned)((pages >> (lg - 2)) & 3), LARGE_CACHE_BUCKETS - 1);
+}
+
+static void
+large_entry_cache_init_no_lock(large_shard_t *shard)
+{
+	unsigned index;
+
+	memset(shard->large_entry_cache_bucket_head, LARGE_CACHE_NIL, sizeof(shard->large_entry_cache_bucket_head));
+	memset(shard->large_entry_cache_bucket_tail, LARGE_CACHE_NIL, sizeof(shard->large_entry_cache_bucket_tail));
+	shard->large_entry_cache_buckets = 0;
+	shard->large_entry_cache_lru_head = shard->large_entry_cache_lru_tail = LARGE_CACHE_NIL;
+	shard->large_entry_cache_count = 0;
+
+	for (index = 0; index < LARGE_ENTRY_CACHE_SIZE; index++) {
+		memset(&shard->large_entry_cache[index], 0, sizeof(large_cache_entry_t));
+		shard->large_entry_cache[index].lru_next = (index + 1 < LARGE_ENTRY_CACHE_SIZE) ? index + 1 : LARGE_CACHE_NIL;
+	}
+	shard->large_entry_cache_free_head = 0;
+}
+#endif
+
 #if DEBUG_MALLOC
 static void
 large_debug_print(szone_t *szone)
 {
+	unsigned shard_index;
 	unsigned index;
 	large_entry_t *range;
 	_SIMPLE_STRING b = _simple_salloc();
 
 	if (b) {
-		for (index = 0, range = szone->large_entries; index < szone->num_large_entries; index++, range++) {
-			if (range->address) {
-				_simple_sprintf(b, "%d: %p(%y);  ", index, range->address, range->size);
+		for (shard_index = 0; shard_index < LARGE_SHARD_COUNT; shard_index++) {
+			large_shard_t *shard = &szone->large_shards[shard_index];
+
+			for (index = 0, range = shard->large_entries; index < shard->num_large_entries; index++, range++) {
+				if (range->address) {
+					_simple_sprintf(b, "%d.%d: %p(%y);  ", shard_index, index, range->address, range->size);
+				}
+			}
+			for (index = 0, range = shard->large_entries_old; index < shard->num_large_entries_old; index++, range++) {
+				if (range->address) {
+					_simple_sprintf(b, "%d.old.%d: %p(%y);  ", shard_index, index, range->address, range->size);
+				}
 			}
 		}
 
@@ -45,26 +116,24 @@ large_debug_print(szone_t *szone)
 #endif
 
 /*
- * Scan the hash ring looking for an entry for the given pointer.
+ * Scan a hash ring looking for an entry for the given pointer.
  */
-large_entry_t *
-large_entry_for_pointer_no_lock(szone_t *szone, const void *ptr)
+static large_entry_t *
+large_entries_lookup(large_entry_t *entries, unsigned num_entries, const void *ptr)
 {
-	// result only valid with lock held
-	unsigned num_large_entries = szone->num_large_entries;
 	unsigned hash_index;
 	unsigned index;
 	large_entry_t *range;
 
-	if (!num_large_entries) {
+	if (!num_entries) {
 		return NULL;
 	}
 
-	hash_index = ((uintptr_t)ptr >> vm_page_quanta_shift) % num_large_entries;
+	hash_index = ((uintptr_t)ptr >> vm_page_quanta_shift) % num_entries;
 	index = hash_index;
 
 	do {
-		range = szone->large_entries + index;
+		range = entries + index;
 		if (range->address == (vm_address_t)ptr) {
 			return range;
 		}
@@ -72,7 +141,7 @@ large_entry_for_pointer_no_lock(szone_t *szone, const void *ptr)
 			return NULL; // end of chain
 		}
 		index++;
-		if (index == num_large_entries) {
+		if (index == num_entries) {
 			index = 0;
 		}
 	} while (index != hash_index);
@@ -80,24 +149,35 @@ large_entry_for_pointer_no_lock(szone_t *szone, const void *ptr)
 	return NULL;
 }
 
+static large_entry_t *
+large_entry_for_pointer_no_lock(large_shard_t *shard, const void *ptr)
+{
+	// result only valid with the shard lock held
+	large_entry_t *entry = large_entries_lookup(shard->large_entries, shard->num_large_entries, ptr);
+
+	if (!entry && shard->large_entries_old) {
+		entry = large_entries_lookup(shard->large_entries_old, shard->num_large_entries_old, ptr);
+	}
+	return entry;
+}
+
 static void
-large_entry_insert_no_lock(szone_t *szone, large_entry_t range)
+large_entries_insert(large_entry_t *entries, unsigned num_entries, large_entry_t range)
 {
-	unsigned num_large_entries = szone->num_large_entries;
-	unsigned hash_index = (((uintptr_t)(range.address)) >> vm_page_quanta_shift) % num_large_entries;
+	unsigned hash_index = (((uintptr_t)(range.address)) >> vm_page_quanta_shift) % num_entries;
 	unsigned index = hash_index;
 	large_entry_t *entry;
 
-	// assert(szone->num_large_objects_in_use < szone->num_large_entries); /* must be called with room to spare */
+	// assert(shard->num_large_objects_in_use < num_entries); /* must be called with room to spare */
 
 	do {
-		entry = szone->large_entries + index;
+		entry = entries + index;
 		if (0 == entry->address) {
 			*entry = range;
 			return; // end of chain
 		}
 		index++;
-		if (index == num_large_entries) {
+		if (index == num_entries) {
 			index = 0;
 		}
 	} while (index != hash_index);
@@ -107,10 +187,9 @@ large_entry_insert_no_lock(szone_t *szone, large_entry_t range)
 
 // FIXME: can't we simply swap the (now empty) entry with the last entry on the collision chain for this hash slot?
 static MALLOC_INLINE void
-large_entries_rehash_after_entry_no_lock(szone_t *szone, large_entry_t *entry)
+large_entries_rehash_after_entry_no_lock(large_entry_t *entries, unsigned num_entries, large_entry_t *entry)
 {
-	unsigned num_large_entries = szone->num_large_entries;
-	uintptr_t hash_index = entry - szone->large_entries;
+	uintptr_t hash_index = entry - entries;
 	uintptr_t index = hash_index;
 	large_entry_t range;
 
@@ -118,17 +197,17 @@ large_entries_rehash_after_entry_no_lock(szone_t *szone, large_entry_t *entry)
 
 	do {
 		index++;
-		if (index == num_large_entries) {
+		if (index == num_entries) {
 			index = 0;
 		}
-		range = szone->large_entries[index];
+		range = entries[index];
 		if (0 == range.address) {
 			return;
 		}
-		szone->large_entries[index].address = (vm_address_t)0;
-		szone->large_entries[index].size = 0;
-		szone->large_entries[index].did_madvise_reusable = FALSE;
-		large_entry_insert_no_lock(szone, range); // this will reinsert in the
+		entries[index].address = (vm_address_t)0;
+		entries[index].size = 0;
+		entries[index].did_madvise_reusable = FALSE;
+		large_entries_insert(entries, num_entries, range); // this will reinsert in the
 		// proper place
 	} while (index != hash_index);
 
@@ -148,8 +227,8 @@ large_entries_alloc_no_lock(unsigned num)
 	return mvm_allocate_pages(round_page_quanta(size), 0, 0, VM_MEMORY_MALLOC_LARGE);
 }
 
-void
-large_entries_free_no_lock(szone_t *szone, large_entry_t *entries, unsigned num, vm_range_t *range_to_deallocate)
+static void
+large_entries_free_no_lock(large_entry_t *entries, unsigned num, vm_range_t *range_to_deallocate)
 {
 	size_t size = num * sizeof(large_entry_t);
 
@@ -157,41 +236,73 @@ large_entries_free_no_lock(szone_t *szone, large_entry_t *entries, unsigned num,
 	range_to_deallocate->size = round_page_quanta(size);
 }
 
+/*
+ * Move the entry in slot "index" of the previous table, and every entry after
+ * it up to the end of its collision chain, into the current table. Entries
+ * left behind all precede the emptied slot on their chains, so the previous
+ * table stays searchable.
+ */
+static void
+large_entries_evacuate_no_lock(large_shard_t *shard, unsigned index)
+{
+	large_entry_t *old_entries = shard->large_entries_old;
+
+	while (old_entries[index].address) {
+		large_entries_insert(shard->large_entries, shard->num_large_entries, old_entries[index]);
+		old_entries[index].address = (vm_address_t)0;
+		old_entries[index].size = 0;
+		old_entries[index].did_madvise_reusable = FALSE;
+		index++;
+		if (index == shard->num_large_entries_old) {
+			index = 0;
+		}
+	}
+}
+
+/*
+ * Advance an in-progress table migration by up to "slots" slots. Once the
+ * previous table is empty it is retired and range_to_deallocate is set.
+ */
+static void
+large_entries_migrate_no_lock(large_shard_t *shard, unsigned slots, vm_range_t *range_to_deallocate)
+{
+	while (shard->large_entries_old && slots--) {
+		large_entries_evacuate_no_lock(shard, shard->large_entries_migrate_index);
+
+		if (++shard->large_entries_migrate_index == shard->num_large_entries_old) {
+			large_entries_free_no_lock(shard->large_entries_old, shard->num_large_entries_old, range_to_deallocate);
+			shard->large_entries_old = NULL;
+			shard->num_large_entries_old = 0;
+			shard->large_entries_migrate_index = 0;
+		}
+	}
+}
+
 static large_entry_t *
-large_entries_grow_no_lock(szone_t *szone, vm_range_t *range_to_deallocate)
+large_entries_grow_no_lock(large_shard_t *shard, vm_range_t *range_to_deallocate)
 {
-	// sets range_to_deallocate
-	unsigned old_num_entries = szone->num_large_entries;
-	large_entry_t *old_entries = szone->large_entries;
+	// may set range_to_deallocate
+	unsigned old_num_entries = shard->num_large_entries;
 	// always an odd number for good hashing
 	unsigned new_num_entries =
 	(old_num_entries) ? old_num_entries * 2 + 1 : (unsigned)((vm_page_quanta_size / sizeof(large_entry_t)) - 1);
 	large_entry_t *new_entries = large_entries_alloc_no_lock(new_num_entries);
-	unsigned index = old_num_entries;
-	large_entry_t oldRange;
 
 	// if the allocation of new entries failed, bail
 	if (new_entries == NULL) {
 		return NULL;
 	}
 
-	szone->num_large_entries = new_num_entries;
-	szone->large_entries = new_entries;
+	// Only one previous table is kept; finish any migration still under way.
+	large_entries_migrate_no_lock(shard, UINT_MAX, range_to_deallocate);
 
-	/* rehash entries into the new list */
-	while (index--) {
-		oldRange = old_entries[index];
-		if (oldRange.address) {
-			large_entry_insert_no_lock(szone, oldRange);
-		}
-	}
-
-	if (old_entries) {
-		large_entries_free_no_lock(szone, old_entries, old_num_entries, range_to_deallocate);
-	} else {
-		range_to_deallocate->address = (vm_address_t)0;
-		range_to_deallocate->size = 0;
+	if (old_num_entries) {
+		shard->large_entries_old = shard->large_entries;
+		shard->num_large_entries_old = old_num_entries;
+		shard->large_entries_migrate_index = 0;
 	}
+	shard->num_large_entries = new_num_entries;
+	shard->large_entries = new_entries;
 
 	return new_entries;
 }
@@ -199,7 +310,7 @@ large_entries_grow_no_lock(szone_t *szone, vm_range_t *range_to_deallocate)
 // frees the specific entry in the size table
 // returns a range to truly deallocate
 static vm_range_t
-large_entry_free_no_lock(szone_t *szone, large_entry_t *entry)
+large_entry_free_no_lock(szone_t *szone, large_shard_t *shard, large_entry_t *entry)
 {
 	vm_range_t range;
 
@@ -217,11 +328,21 @@ large_entry_free_no_lock(szone_t *szone, large_entry_t *entry)
 	entry->address = 0;
 	entry->size = 0;
 	entry->did_madvise_reusable = FALSE;
-	large_entries_rehash_after_entry_no_lock(szone, entry);
+	if (entry >= shard->large_entries && entry < shard->large_entries + shard->num_large_entries) {
+		large_entries_rehash_after_entry_no_lock(shard->large_entries, shard->num_large_entries, entry);
+	} else {
+		// The entry was still in the previous table: rather than rehashing its
+		// chain in place, move the rest of the chain over to the current table.
+		unsigned index = (unsigned)(entry - shard->large_entries_old) + 1;
+		if (index == shard->num_large_entries_old) {
+			index = 0;
+		}
+		large_entries_evacuate_no_lock(shard, index);
+	}
 
 #if DEBUG_MALLOC
-	if (large_entry_for_pointer_no_lock(szone, (void *)range.address)) {
-		malloc_printf("*** freed entry %p still in use; num_large_entries=%d\n", range.address, szone->num_large_entries);
+	if (large_entry_for_pointer_no_lock(shard, (void *)range.address)) {
+		malloc_printf("*** freed entry %p still in use; num_large_entries=%d\n", range.address, shard->num_large_entries);
 		large_debug_print(szone);
 		szone_sleep();
 	}
@@ -229,8 +350,532 @@ large_entry_free_no_lock(szone_t *szone, large_entry_t *entry)
 	return range;
 }
 
-kern_return_t
-large_in_use_enumerator(task_t task,
+/*
+ * Enter a block in the table of the shard its address hashes to. Returns FALSE
+ * if the table had to grow and could not.
+ */
+static boolean_t
+large_entry_insert(szone_t *szone, large_entry_t large_entry)
+{
+	large_shard_t *shard = large_shard_for_pointer(szone, (void *)large_entry.address);
+	vm_range_t range_to_deallocate = {0, 0};
+	boolean_t inserted = TRUE;
+
+	LARGE_SHARD_LOCK(shard);
+	large_entries_migrate_no_lock(shard, LARGE_ENTRY_MIGRATE_SLOTS, &range_to_deallocate);
+
+	if ((shard->num_large_objects_in_use + 1) * 4 > shard->num_large_entries) {
+		// density of hash table too high; grow table
+		// we do that under lock to avoid a race
+		if (large_entries_grow_no_lock(shard, &range_to_deallocate) == NULL) {
+			inserted = FALSE;
+		}
+	}
+
+	if (inserted) {
+		large_entries_insert(shard->large_entries, shard->num_large_entries, large_entry);
+		shard->num_large_objects_in_use++;
+		shard->num_bytes_in_large_objects += large_entry.size;
+	}
+	LARGE_SHARD_UNLOCK(shard);
+
+	if (range_to_deallocate.size) {
+		// we deallocate outside the lock
+		mvm_deallocate_pages((void *)range_to_deallocate.address, range_to_deallocate.size, 0);
+	}
+	return inserted;
+}
+
+void
+large_shards_init(szone_t *szone)
+{
+	unsigned index;
+
+	for (index = 0; index < LARGE_SHARD_COUNT; index++) {
+		LARGE_SHARD_REINIT_LOCK(&szone->large_shards[index]);
+#if CONFIG_LARGE_CACHE
+		large_entry_cache_init_no_lock(&szone->large_shards[index]);
+#endif
+	}
+}
+
+size_t
+large_size(szone_t *szone, const void *ptr)
+{
+	large_shard_t *shard = large_shard_for_pointer(szone, ptr);
+	large_entry_t *entry;
+	size_t size = 0;
+
+	LARGE_SHARD_LOCK(shard);
+	entry = large_entry_for_pointer_no_lock(shard, ptr);
+	if (entry) {
+		size = entry->size;
+	}
+	LARGE_SHARD_UNLOCK(shard);
+	return size;
+}
+
+void
+large_statistics(szone_t *szone, unsigned *blocks_in_use, size_t *size_in_use)
+{
+	unsigned index;
+
+	// We do not lock to facilitate debug
+	*blocks_in_use = 0;
+	*size_in_use = 0;
+	for (index = 0; index < LARGE_SHARD_COUNT; index++) {
+		*blocks_in_use += szone->large_shards[index].num_large_objects_in_use;
+		*size_in_use += szone->large_shards[index].num_bytes_in_large_objects;
+	}
+}
+
+void
+large_force_lock(szone_t *szone)
+{
+	unsigned index;
+
+	for (index = 0; index < LARGE_SHARD_COUNT; index++) {
+		LARGE_SHARD_LOCK(&szone->large_shards[index]);
+	}
+}
+
+void
+large_force_unlock(szone_t *szone)
+{
+	unsigned index = LARGE_SHARD_COUNT;
+
+	while (index--) {
+		LARGE_SHARD_UNLOCK(&szone->large_shards[index]);
+	}
+}
+
+void
+large_reinit_lock(szone_t *szone)
+{
+	unsigned index;
+
+	for (index = 0; index < LARGE_SHARD_COUNT; index++) {
+		LARGE_SHARD_REINIT_LOCK(&szone->large_shards[index]);
+	}
+}
+
+boolean_t
+large_locked(szone_t *szone)
+{
+	unsigned index;
+
+	for (index = 0; index < LARGE_SHARD_COUNT; index++) {
+		if (!LARGE_SHARD_TRY_LOCK(&szone->large_shards[index])) {
+			return 1;
+		}
+		LARGE_SHARD_UNLOCK(&szone->large_shards[index]);
+	}
+	return 0;
+}
+
+#if CONFIG_LARGE_CACHE
+// Put "entry" at the front of its bucket and of the shard's LRU list. The
+// caller has checked that a node is free.
+static void
+large_entry_cache_link_no_lock(large_shard_t *shard, large_entry_t entry)
+{
+	uint8_t index = shard->large_entry_cache_free_head;
+	large_cache_entry_t *node = &shard->large_entry_cache[index];
+	unsigned bucket = large_entry_cache_bucket(entry.size);
+
+	shard->large_entry_cache_free_head = node->lru_next;
+
+	node->entry = entry;
+	node->stamp = shard->large_entry_cache_clock[bucket]++;
+	node->bucket = bucket;
+
+	node->bucket_prev = LARGE_CACHE_NIL;
+	node->bucket_next = shard->large_entry_cache_bucket_head[bucket];
+	if (node->bucket_next != LARGE_CACHE_NIL) {
+		shard->large_entry_cache[node->bucket_next].bucket_prev = index;
+	} else {
+		shard->large_entry_cache_bucket_tail[bucket] = index;
+	}
+	shard->large_entry_cache_bucket_head[bucket] = index;
+	shard->large_entry_cache_buckets |= 1ULL << bucket;
+
+	node->lru_prev = LARGE_CACHE_NIL;
+	node->lru_next = shard->large_entry_cache_lru_head;
+	if (node->lru_next != LARGE_CACHE_NIL) {
+		shard->large_entry_cache[node->lru_next].lru_prev = index;
+	} else {
+		shard->large_entry_cache_lru_tail = index;
+	}
+	shard->large_entry_cache_lru_head = index;
+
+	shard->large_entry_cache_count++;
+}
+
+// Take node "index" off both lists, account for it leaving death row, and
+// return its block.
+static large_entry_t
+large_entry_cache_unlink_no_lock(szone_t *szone, large_shard_t *shard, uint8_t index)
+{
+	large_cache_entry_t *node = &shard->large_entry_cache[index];
+	large_entry_t entry = node->entry;
+	int64_t cache_bytes;
+
+	if (node->bucket_prev != LARGE_CACHE_NIL) {
+		shard->large_entry_cache[node->bucket_prev].bucket_next = node->bucket_next;
+	} else {
+		shard->large_entry_cache_bucket_head[node->bucket] = node->bucket_next;
+		if (node->bucket_next == LARGE_CACHE_NIL) {
+			shard->large_entry_cache_buckets &= ~(1ULL << node->bucket);
+		}
+	}
+	if (node->bucket_next != LARGE_CACHE_NIL) {
+		shard->large_entry_cache[node->bucket_next].bucket_prev = node->bucket_prev;
+	} else {
+		shard->large_entry_cache_bucket_tail[node->bucket] = node->bucket_prev;
+	}
+
+	if (node->lru_prev != LARGE_CACHE_NIL) {
+		shard->large_entry_cache[node->lru_prev].lru_next = node->lru_next;
+	} else {
+		shard->large_entry_cache_lru_head = node->lru_next;
+	}
+	if (node->lru_next != LARGE_CACHE_NIL) {
+		shard->large_entry_cache[node->lru_next].lru_prev = node->lru_prev;
+	} else {
+		shard->large_entry_cache_lru_tail = node->lru_prev;
+	}
+
+	memset(node, 0, sizeof(large_cache_entry_t));
+	node->lru_next = shard->large_entry_cache_free_head;
+	shard->large_entry_cache_free_head = index;
+	shard->large_entry_cache_count--;
+
+	if (!entry.did_madvise_reusable) {
+		OSAtomicAdd64Barrier(-(int64_t)entry.size, &szone->large_entry_cache_reserve_bytes);
+	}
+	cache_bytes = OSAtomicAdd64Barrier(-(int64_t)entry.size, &szone->large_entry_cache_bytes);
+	if (szone->flotsam_enabled && cache_bytes < SZONE_FLOTSAM_THRESHOLD_LOW) {
+		szone->flotsam_enabled = FALSE;
+	}
+	return entry;
+}
+
+/*
+ * Take a fit for "size" (and "alignment") off a shard's death row: the most
+ * recently freed suitable block from the lowest bucket that has one. Only
+ * buckets that can hold a block less than twice "size" are searched, which
+ * limits fragmentation to 50%.
+ */
+static boolean_t
+large_entry_cache_take_no_lock(szone_t *szone, large_shard_t *shard, size_t size, unsigned char alignment, large_entry_t *taken)
+{
+	unsigned first = large_entry_cache_bucket(size);
+	unsigned last = large_entry_cache_bucket(2 * size - vm_page_quanta_size);
+	uint64_t buckets = shard->large_entry_cache_buckets & (~0ULL << first) & (~0ULL >> (63 - last));
+
+	while (buckets) {
+		unsigned bucket = __builtin_ctzll(buckets);
+		uint8_t index = shard->large_entry_cache_bucket_head[bucket];
+
+		buckets &= buckets - 1;
+		while (index != LARGE_CACHE_NIL) {
+			large_cache_entry_t *node = &shard->large_entry_cache[index];
+			size_t this_size = node->entry.size;
+
+			if (size <= this_size && (this_size - size) < size &&
+				(0 == alignment || 0 == (node->entry.address & (((uintptr_t)1 << alignment) - 1)))) {
+				*taken = large_entry_cache_unlink_no_lock(szone, shard, index);
+				return TRUE;
+			}
+			index = node->bucket_next;
+		}
+	}
+	return FALSE;
+}
+
+/*
+ * Look for a block on death row, starting with the calling CPU's shard. Other
+ * shards are only tried if they have cached blocks and their lock is free; a
+ * miss just means a fresh mapping.
+ */
+static boolean_t
+large_entry_cache_take(szone_t *szone, size_t size, unsigned char alignment, large_entry_t *taken)
+{
+	unsigned home = large_shard_index_for_cpu();
+	unsigned i;
+
+	for (i = 0; i < LARGE_SHARD_COUNT; i++) {
+		large_shard_t *shard = &szone->large_shards[(home + i) & (LARGE_SHARD_COUNT - 1)];
+		boolean_t found;
+
+		if (i) {
+			// Unlocked peek: skip shards that look empty.
+			if (0 == shard->large_entry_cache_count) {
+				continue;
+			}
+			if (!LARGE_SHARD_TRY_LOCK(shard)) {
+				continue;
+			}
+		} else {
+			LARGE_SHARD_LOCK(shard);
+		}
+
+		found = large_entry_cache_take_no_lock(szone, shard, size, alignment, taken);
+		LARGE_SHARD_UNLOCK(shard);
+		if (found) {
+			OSAtomicIncrement64(&szone->large_entry_cache_hits);
+			return TRUE;
+		}
+	}
+	OSAtomicIncrement64(&szone->large_entry_cache_misses);
+	return FALSE;
+}
+
+/*
+ * Put a block that has just left the table on the calling CPU's death row,
+ * first evicting up to LARGE_CACHE_EVICT_MAX of that shard's blocks: aged out
+ * ones of the same bucket, then the least recently freed to make room. Returns FALSE if the block is unfit for reuse or
+ * there is still no room for it, and should be deallocated by the caller.
+ */
+static boolean_t
+large_entry_cache_insert(szone_t *szone, large_entry_t this_entry)
+{
+	large_shard_t *shard;
+	boolean_t reusable = TRUE;
+	boolean_t should_madvise, fits;
+	large_entry_t victims[LARGE_CACHE_EVICT_MAX];
+	unsigned idx, bucket, num_victims = 0;
+	int64_t cache_bytes;
+
+	if (-1 == madvise((void *)(this_entry.address), this_entry.size, MADV_CAN_REUSE)) {
+		return FALSE;
+	}
+
+	should_madvise = (size_t)szone->large_entry_cache_reserve_bytes + this_entry.size > szone->large_entry_cache_reserve_limit;
+
+	if (szone->debug_flags & MALLOC_PURGEABLE) { // Are we a purgable zone?
+		int state = VM_PURGABLE_NONVOLATILE;			  // restore to default condition
+
+		if (KERN_SUCCESS != vm_purgable_control(mach_task_self(), this_entry.address, VM_PURGABLE_SET_STATE, &state)) {
+			malloc_printf("*** can't vm_purgable_control(..., VM_PURGABLE_SET_STATE) for large freed block at %p\n",
+						  this_entry.address);
+			reusable = FALSE;
+		}
+	}
+
+	if (szone->large_legacy_reset_mprotect) { // Linked for Leopard?
+		// Accomodate Leopard apps that (illegally) mprotect() their own guard pages on large malloc'd allocations
+		int err = mprotect((void *)(this_entry.address), this_entry.size, PROT_READ | PROT_WRITE);
+		if (err) {
+			malloc_printf("*** can't reset protection for large freed block at %p\n", this_entry.address);
+			reusable = FALSE;
+		}
+	}
+
+	// madvise(..., MADV_REUSABLE) death-row arrivals if hoarding would exceed large_entry_cache_reserve_limit
+	if (should_madvise) {
+		// Issue madvise to avoid paging out the dirtied free()'d pages in "entry"
+		MAGMALLOC_MADVFREEREGION(
+								 (void *)szone, (void *)0, (void *)(this_entry.address), (int)this_entry.size); // DTrace USDT Probe
+
+#if TARGET_OS_EMBEDDED
+		// Ok to do this madvise on embedded because we won't call MADV_FREE_REUSABLE on a large
+		// cache block twice without MADV_FREE_REUSE in between.
+#endif
+		if (-1 == madvise((void *)(this_entry.address), this_entry.size, CONFIG_LARGE_MADVISE_STYLE)) {
+			/* -1 return: VM map entry change makes this unfit for reuse. */
+#if DEBUG_MADVISE
+			szone_error(szone->debug_flags, 0,
+						"free_large madvise(..., MADV_FREE_REUSABLE) failed",
+						(void *)this_entry.address,
+						"length=%d\n", this_entry.size);
+#endif
+			reusable = FALSE;
+		}
+	}
+
+#if CONFIG_KNOWN_ZERO_PAGES
+	// The whole block reads back as zero if its contents were just dropped,
+	// unless scribbling is about to fill it again.
+	this_entry.zero_lo = this_entry.zero_hi = 0;
+	if (should_madvise && MVM_ADVICE_ZEROES(CONFIG_LARGE_MADVISE_STYLE) && !(szone->debug_flags & MALLOC_DO_SCRIBBLE)) {
+		this_entry.zero_hi = this_entry.size;
+	}
+#endif // CONFIG_KNOWN_ZERO_PAGES
+
+	if (!reusable) {
+		return FALSE;
+	}
+
+	if ((szone->debug_flags & MALLOC_DO_SCRIBBLE)) {
+		malloc_fill((void *)(this_entry.address), should_madvise ? SCRUBBLE_BYTE : SCRABBLE_BYTE, this_entry.size);
+	}
+	this_entry.did_madvise_reusable = should_madvise; // Was madvise()'d above?
+
+	shard = &szone->large_shards[large_shard_index_for_cpu()];
+	LARGE_SHARD_LOCK(shard);
+
+	// Already freed?
+	// [Note that repeated entries in death-row risk vending the same entry subsequently
+	// to two different malloc() calls. By checking here the (illegal) double free
+	// is accommodated, matching the behavior of the previous implementation.]
+	bucket = large_entry_cache_bucket(this_entry.size);
+	idx = shard->large_entry_cache_bucket_head[bucket];
+	while (idx != LARGE_CACHE_NIL) {
+		if (shard->large_entry_cache[idx].entry.address == this_entry.address) {
+			szone_error(szone->debug_flags, 1, "pointer being freed already on death-row", (void *)this_entry.address, NULL);
+			LARGE_SHARD_UNLOCK(shard);
+			return TRUE;
+		}
+		idx = shard->large_entry_cache[idx].bucket_next;
+	}
+
+	// Age out the oldest blocks of the bucket this one joins, then make room
+	// from the least recently freed end of the shard while it is full or the
+	// zone's death row would exceed its byte limit.
+	while (num_victims < LARGE_CACHE_EVICT_MAX && shard->large_entry_cache_bucket_tail[bucket] != LARGE_CACHE_NIL) {
+		large_cache_entry_t *oldest = &shard->large_entry_cache[shard->large_entry_cache_bucket_tail[bucket]];
+
+		if (shard->large_entry_cache_clock[bucket] - oldest->stamp < LARGE_CACHE_AGE_LIMIT) {
+			break;
+		}
+		victims[num_victims++] = large_entry_cache_unlink_no_lock(szone, shard, shard->large_entry_cache_bucket_tail[bucket]);
+	}
+	while (num_victims < LARGE_CACHE_EVICT_MAX && shard->large_entry_cache_lru_tail != LARGE_CACHE_NIL) {
+		if (shard->large_entry_cache_count < LARGE_ENTRY_CACHE_SIZE &&
+			(size_t)szone->large_entry_cache_bytes + this_entry.size <= LARGE_CACHE_SIZE_LIMIT) {
+			break;
+		}
+		victims[num_victims++] = large_entry_cache_unlink_no_lock(szone, shard, shard->large_entry_cache_lru_tail);
+	}
+
+	fits = shard->large_entry_cache_count < LARGE_ENTRY_CACHE_SIZE &&
+		   (size_t)szone->large_entry_cache_bytes + this_entry.size <= LARGE_CACHE_SIZE_LIMIT;
+	if (fits) {
+		if (!should_madvise) { // Entered on death-row without madvise() => up the hoard total
+			OSAtomicAdd64Barrier((int64_t)this_entry.size, &szone->large_entry_cache_reserve_bytes);
+		}
+
+		cache_bytes = OSAtomicAdd64Barrier((int64_t)this_entry.size, &szone->large_entry_cache_bytes);
+		if (!szone->flotsam_enabled && cache_bytes > SZONE_FLOTSAM_THRESHOLD_HIGH) {
+			szone->flotsam_enabled = TRUE;
+		}
+
+		large_entry_cache_link_no_lock(shard, this_entry);
+	}
+	LARGE_SHARD_UNLOCK(shard);
+
+	if (num_victims) {
+		OSAtomicAdd64Barrier((int64_t)num_victims, &szone->large_entry_cache_evictions);
+	}
+	for (idx = 0; idx < num_victims; idx++) {
+		// we deallocate_pages, including guard pages, outside the lock
+		malloc_zone_owner_release((void *)victims[idx].address, victims[idx].size);
+		mvm_deallocate_pages((void *)victims[idx].address, victims[idx].size, 0);
+	}
+	return fits;
+}
+
+/*
+ * Empty every shard's death row, deallocating the blocks outside the shard
+ * locks. Returns the number of bytes released.
+ */
+size_t
+large_entry_cache_flush(szone_t *szone)
+{
+	large_entry_t local_entry_cache[LARGE_ENTRY_CACHE_SIZE];
+	unsigned shard_index;
+	size_t total = 0;
+
+	for (shard_index = 0; shard_index < LARGE_SHARD_COUNT; shard_index++) {
+		large_shard_t *shard = &szone->large_shards[shard_index];
+		unsigned idx, count = 0;
+
+		LARGE_SHARD_LOCK(shard);
+
+		// stack allocated copy of the death-row cache
+		while (shard->large_entry_cache_lru_head != LARGE_CACHE_NIL) {
+			local_entry_cache[count++] = large_entry_cache_unlink_no_lock(szone, shard, shard->large_entry_cache_lru_head);
+		}
+
+		LARGE_SHARD_UNLOCK(shard);
+
+		// deallocate the death-row cache outside the shard lock
+		for (idx = 0; idx < count; idx++) {
+			malloc_zone_owner_release((void *)local_entry_cache[idx].address, local_entry_cache[idx].size);
+			mvm_deallocate_pages((void *)local_entry_cache[idx].address, local_entry_cache[idx].size, 0);
+			total += local_entry_cache[idx].size;
+		}
+	}
+	return total;
+}
+
+void
+large_entry_cache_statistics(szone_t *szone, malloc_large_cache_statistics_t *stats)
+{
+	unsigned shard_index;
+
+	stats->hits = (unsigned long long)szone->large_entry_cache_hits;
+	stats->misses = (unsigned long long)szone->large_entry_cache_misses;
+	stats->evictions = (unsigned long long)szone->large_entry_cache_evictions;
+	stats->entries = 0;
+	for (shard_index = 0; shard_index < LARGE_SHARD_COUNT; shard_index++) {
+		stats->entries += szone->large_shards[shard_index].large_entry_cache_count;
+	}
+	stats->bytes = (size_t)szone->large_entry_cache_bytes;
+	stats->clear_avoided = (unsigned long long)szone->large_entry_cache_clear_avoided;
+}
+#endif /* CONFIG_LARGE_CACHE */
+
+static void
+large_entries_destroy(szone_t *szone, large_entry_t *entries, unsigned num_entries)
+{
+	vm_range_t range_to_deallocate;
+	unsigned index = num_entries;
+	large_entry_t *large;
+
+	if (!entries) {
+		return;
+	}
+
+	while (index--) {
+		large = entries + index;
+		if (large->address) {
+			// we deallocate_pages, including guard pages
+			malloc_zone_owner_release((void *)(large->address), large->size);
+			mvm_deallocate_pages((void *)(large->address), large->size, szone->debug_flags);
+		}
+	}
+	large_entries_free_no_lock(entries, num_entries, &range_to_deallocate);
+	if (range_to_deallocate.size) {
+		mvm_deallocate_pages((void *)range_to_deallocate.address, (size_t)range_to_deallocate.size, 0);
+	}
+}
+
+// FIXME: Suppose one of the locks is held?
+void
+large_destroy(szone_t *szone)
+{
+	unsigned shard_index;
+
+#if CONFIG_LARGE_CACHE
+	/* disable any memory pressure responder */
+	szone->flotsam_enabled = FALSE;
+
+	(void)large_entry_cache_flush(szone);
+#endif
+
+	/* destroy large entries */
+	for (shard_index = 0; shard_index < LARGE_SHARD_COUNT; shard_index++) {
+		large_shard_t *shard = &szone->large_shards[shard_index];
+
+		large_entries_destroy(szone, shard->large_entries, shard->num_large_entries);
+		large_entries_destroy(szone, shard->large_entries_old, shard->num_large_entries_old);
+	}
+}
+
+static kern_return_t
+large_entries_in_use_enumerator(task_t task,
 						void *context,
 						unsigned type_mask,
 						vm_address_t large_entries_address,
@@ -277,11 +922,43 @@ large_in_use_enumerator(task_t task,
 	return 0;
 }
 
+kern_return_t
+large_in_use_enumerator(task_t task,
+						void *context,
+						unsigned type_mask,
+						szone_t *szone,
+						memory_reader_t reader,
+						vm_range_recorder_t recorder)
+{
+	unsigned shard_index;
+	kern_return_t err;
+
+	// szone is the caller's copy of the zone; the tables are read through reader
+	for (shard_index = 0; shard_index < LARGE_SHARD_COUNT; shard_index++) {
+		large_shard_t *shard = &szone->large_shards[shard_index];
+
+		if (shard->large_entries) {
+			err = large_entries_in_use_enumerator(task, context, type_mask, (vm_address_t)shard->large_entries,
+					shard->num_large_entries, reader, recorder);
+			if (err) {
+				return err;
+			}
+		}
+		if (shard->large_entries_old) {
+			err = large_entries_in_use_enumerator(task, context, type_mask, (vm_address_t)shard->large_entries_old,
+					shard->num_large_entries_old, reader, recorder);
+			if (err) {
+				return err;
+			}
+		}
+	}
+	return 0;
+}
+
 void *
 large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment, boolean_t cleared_requested)
 {
 	void *addr;
-	vm_range_t range_to_deallocate;
 	size_t size;
 	large_entry_t large_entry;
 
@@ -295,203 +972,89 @@ large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment, b
 		num_kernel_pages = 1; // minimal allocation size for this szone
 	}
 	size = (size_t)num_kernel_pages << vm_page_quanta_shift;
-	range_to_deallocate.size = 0;
-	range_to_deallocate.address = 0;
 
 #if CONFIG_LARGE_CACHE
-	if (size < LARGE_CACHE_SIZE_ENTRY_LIMIT) { // Look for a large_entry_t on the death-row cache?
-		SZONE_LOCK(szone);
-
-		int i, best = -1, idx = szone->large_entry_cache_newest, stop_idx = szone->large_entry_cache_oldest;
-		size_t best_size = SIZE_T_MAX;
-
-		while (1) { // Scan large_entry_cache for best fit, starting with most recent entry
-			size_t this_size = szone->large_entry_cache[idx].size;
-			addr = (void *)szone->large_entry_cache[idx].address;
-
-			if (0 == alignment || 0 == (((uintptr_t)addr) & (((uintptr_t)1 << alignment) - 1))) {
-				if (size == this_size) { // size match!
-					best = idx;
-					best_size = this_size;
-					break;
-				}
-
-				if (size <= this_size && this_size < best_size) { // improved fit?
-					best = idx;
-					best_size = this_size;
-				}
-			}
-
-			if (idx == stop_idx) { // exhausted live ring?
-				break;
-			}
-
-			if (idx) {
-				idx--; // bump idx down
-			} else {
-				idx = LARGE_ENTRY_CACHE_SIZE - 1; // wrap idx
-			}
+	if (size < LARGE_CACHE_SIZE_ENTRY_LIMIT && // Look for a large_entry_t on the death-row cache?
+		large_entry_cache_take(szone, size, alignment, &large_entry)) {
+		boolean_t was_madvised_reusable = large_entry.did_madvise_reusable;
+
+		addr = (void *)large_entry.address;
+		large_entry.did_madvise_reusable = FALSE;
+		if (!large_entry_insert(szone, large_entry)) {
+			malloc_zone_owner_release(addr, large_entry.size);
+			mvm_deallocate_pages(addr, large_entry.size, 0);
+			return NULL;
 		}
 
-		if (best > -1 && (best_size - size) < size) { // limit fragmentation to 50%
-			addr = (void *)szone->large_entry_cache[best].address;
-			boolean_t was_madvised_reusable = szone->large_entry_cache[best].did_madvise_reusable;
-
-			// Compact live ring to fill entry now vacated at large_entry_cache[best]
-			// while preserving time-order
-			if (szone->large_entry_cache_oldest < szone->large_entry_cache_newest) {
-				// Ring hasn't wrapped. Fill in from right.
-				for (i = best; i < szone->large_entry_cache_newest; ++i) {
-					szone->large_entry_cache[i] = szone->large_entry_cache[i + 1];
-				}
-
-				szone->large_entry_cache_newest--; // Pull in right endpoint.
-
-			} else if (szone->large_entry_cache_newest < szone->large_entry_cache_oldest) {
-				// Ring has wrapped. Arrange to fill in from the contiguous side.
-				if (best <= szone->large_entry_cache_newest) {
-					// Fill from right.
-					for (i = best; i < szone->large_entry_cache_newest; ++i) {
-						szone->large_entry_cache[i] = szone->large_entry_cache[i + 1];
-					}
-
-					if (0 < szone->large_entry_cache_newest) {
-						szone->large_entry_cache_newest--;
-					} else {
-						szone->large_entry_cache_newest = LARGE_ENTRY_CACHE_SIZE - 1;
-					}
-				} else {
-					// Fill from left.
-					for (i = best; i > szone->large_entry_cache_oldest; --i) {
-						szone->large_entry_cache[i] = szone->large_entry_cache[i - 1];
-					}
-
-					if (szone->large_entry_cache_oldest < LARGE_ENTRY_CACHE_SIZE - 1) {
-						szone->large_entry_cache_oldest++;
-					} else {
-						szone->large_entry_cache_oldest = 0;
-					}
-				}
-
-			} else {
-				// By trichotomy, large_entry_cache_newest == large_entry_cache_oldest.
-				// That implies best == large_entry_cache_newest == large_entry_cache_oldest
-				// and the ring is now empty.
-				szone->large_entry_cache[best].address = 0;
-				szone->large_entry_cache[best].size = 0;
-				szone->large_entry_cache[best].did_madvise_reusable = FALSE;
-			}
-
-			if ((szone->num_large_objects_in_use + 1) * 4 > szone->num_large_entries) {
-				// density of hash table too high; grow table
-				// we do that under lock to avoid a race
-				large_entry_t *entries = large_entries_grow_no_lock(szone, &range_to_deallocate);
-				if (entries == NULL) {
-					SZONE_UNLOCK(szone);
-					return NULL;
-				}
-			}
-
-			large_entry.address = (vm_address_t)addr;
-			large_entry.size = best_size;
-			large_entry.did_madvise_reusable = FALSE;
-			large_entry_insert_no_lock(szone, large_entry);
-
-			szone->num_large_objects_in_use++;
-			szone->num_bytes_in_large_objects += best_size;
-			if (!was_madvised_reusable) {
-				szone->large_entry_cache_reserve_bytes -= best_size;
-			}
-
-			szone->large_entry_cache_bytes -= best_size;
-
-			if (szone->flotsam_enabled && szone->large_entry_cache_bytes < SZONE_FLOTSAM_THRESHOLD_LOW) {
-				szone->flotsam_enabled = FALSE;
-			}
-
-			SZONE_UNLOCK(szone);
-
-			if (range_to_deallocate.size) {
-				// we deallocate outside the lock
-				mvm_deallocate_pages((void *)range_to_deallocate.address, range_to_deallocate.size, 0);
-			}
-
-			// Perform the madvise() outside the lock.
-			// Typically the madvise() is successful and we'll quickly return from this routine.
-			// In the unusual case of failure, reacquire the lock to unwind.
+		// Perform the madvise() outside the lock.
+		// Typically the madvise() is successful and we'll quickly return from this routine.
+		// In the unusual case of failure, reacquire the lock to unwind.
 #if TARGET_OS_EMBEDDED
-			// Ok to do this madvise on embedded because we won't call MADV_FREE_REUSABLE on a large
-			// cache block twice without MADV_FREE_REUSE in between.
+		// Ok to do this madvise on embedded because we won't call MADV_FREE_REUSABLE on a large
+		// cache block twice without MADV_FREE_REUSE in between.
 #endif
-			if (was_madvised_reusable && -1 == madvise(addr, size, MADV_FREE_REUSE)) {
-				/* -1 return: VM map entry change makes this unfit for reuse. */
+		if (was_madvised_reusable && -1 == madvise(addr, size, MADV_FREE_REUSE)) {
+			/* -1 return: VM map entry change makes this unfit for reuse. */
 #if DEBUG_MADVISE
-				szone_error(szone->debug_flags, 0, "large_malloc madvise(..., MADV_FREE_REUSE) failed", addr, "length=%d\n", size);
+			szone_error(szone->debug_flags, 0, "large_malloc madvise(..., MADV_FREE_REUSE) failed", addr, "length=%d\n", size);
 #endif
-
-				SZONE_LOCK(szone);
-				szone->num_large_objects_in_use--;
-				szone->num_bytes_in_large_objects -= large_entry.size;
-
-				// Re-acquire "entry" after interval just above where we let go the lock.
-				large_entry_t *entry = large_entry_for_pointer_no_lock(szone, addr);
-				if (NULL == entry) {
-					szone_error(szone->debug_flags, 1, "entry for pointer being discarded from death-row vanished", addr, NULL);
-					SZONE_UNLOCK(szone);
-				} else {
-					range_to_deallocate = large_entry_free_no_lock(szone, entry);
-					SZONE_UNLOCK(szone);
-
-					if (range_to_deallocate.size) {
-						// we deallocate outside the lock
-						mvm_deallocate_pages((void *)range_to_deallocate.address, range_to_deallocate.size, 0);
-					}
-				}
-				/* Fall through to allocate_pages() afresh. */
+			large_shard_t *shard = large_shard_for_pointer(szone, addr);
+			vm_range_t range_to_deallocate;
+
+			LARGE_SHARD_LOCK(shard);
+			// Re-acquire "entry" after interval just above where we let go the lock.
+			large_entry_t *entry = large_entry_for_pointer_no_lock(shard, addr);
+			if (NULL == entry) {
+				szone_error(szone->debug_flags, 1, "entry for pointer being discarded from death-row vanished", addr, NULL);
+				LARGE_SHARD_UNLOCK(shard);
 			} else {
-				if (cleared_requested) {
-					memset(addr, 0, size);
+				shard->num_large_objects_in_use--;
+				shard->num_bytes_in_large_objects -= entry->size;
+				range_to_deallocate = large_entry_free_no_lock(szone, shard, entry);
+				LARGE_SHARD_UNLOCK(shard);
+
+				if (range_to_deallocate.size) {
+					// we deallocate outside the lock
+					malloc_zone_owner_release((void *)range_to_deallocate.address, range_to_deallocate.size);
+					mvm_deallocate_pages((void *)range_to_deallocate.address, range_to_deallocate.size, 0);
 				}
-
-				return addr;
 			}
+			/* Fall through to allocate_pages() afresh. */
 		} else {
-			SZONE_UNLOCK(szone);
+			if (cleared_requested) {
+#if CONFIG_KNOWN_ZERO_PAGES
+				// Only the bytes outside the known-zero range can be dirty.
+				size_t lo = MIN((size_t)large_entry.zero_lo, size);
+				size_t hi = MAX(MIN((size_t)large_entry.zero_hi, size), lo);
+
+				malloc_clear(addr, lo);
+				malloc_clear((unsigned char *)addr + hi, size - hi);
+				if (hi > lo) {
+					OSAtomicAdd64Barrier((int64_t)(hi - lo), &szone->large_entry_cache_clear_avoided);
+				}
+#else // CONFIG_KNOWN_ZERO_PAGES
+				malloc_clear(addr, size);
+#endif // CONFIG_KNOWN_ZERO_PAGES
+			}
+
+			return addr;
 		}
 	}
-
-	range_to_deallocate.size = 0;
-	range_to_deallocate.address = 0;
 #endif /* CONFIG_LARGE_CACHE */
 
 	addr = mvm_allocate_pages(size, alignment, szone->debug_flags, VM_MEMORY_MALLOC_LARGE);
 	if (addr == NULL) {
 		return NULL;
 	}
-
-	SZONE_LOCK(szone);
-	if ((szone->num_large_objects_in_use + 1) * 4 > szone->num_large_entries) {
-		// density of hash table too high; grow table
-		// we do that under lock to avoid a race
-		large_entry_t *entries = large_entries_grow_no_lock(szone, &range_to_deallocate);
-		if (entries == NULL) {
-			SZONE_UNLOCK(szone);
-			return NULL;
-		}
-	}
+	malloc_zone_owner_claim(szone->zone_owner, addr, size);
 
 	large_entry.address = (vm_address_t)addr;
 	large_entry.size = size;
 	large_entry.did_madvise_reusable = FALSE;
-	large_entry_insert_no_lock(szone, large_entry);
-
-	szone->num_large_objects_in_use++;
-	szone->num_bytes_in_large_objects += size;
-	SZONE_UNLOCK(szone);
-
-	if (range_to_deallocate.size) {
-		// we deallocate outside the lock
-		mvm_deallocate_pages((void *)range_to_deallocate.address, range_to_deallocate.size, 0);
+	if (!large_entry_insert(szone, large_entry)) {
+		malloc_zone_owner_release(addr, size);
+		mvm_deallocate_pages(addr, size, szone->debug_flags);
+		return NULL;
 	}
 	return addr;
 }
@@ -500,204 +1063,57 @@ void
 free_large(szone_t *szone, void *ptr)
 {
 	// We have established ptr is page-aligned and neither tiny nor small
+	large_shard_t *shard = large_shard_for_pointer(szone, ptr);
 	large_entry_t *entry;
+	large_entry_t this_entry;
 	vm_range_t vm_range_to_deallocate;
+	vm_range_t range_to_deallocate = {0, 0};
 
-	SZONE_LOCK(szone);
-	entry = large_entry_for_pointer_no_lock(szone, ptr);
-	if (entry) {
-#if CONFIG_LARGE_CACHE
-		if (entry->size < LARGE_CACHE_SIZE_ENTRY_LIMIT &&
-			-1 != madvise((void *)(entry->address), entry->size,
-						  MADV_CAN_REUSE)) { // Put the large_entry_t on the death-row cache?
-				int idx = szone->large_entry_cache_newest, stop_idx = szone->large_entry_cache_oldest;
-				large_entry_t this_entry = *entry; // Make a local copy, "entry" is volatile when lock is let go.
-				boolean_t reusable = TRUE;
-				boolean_t should_madvise =
-				szone->large_entry_cache_reserve_bytes + this_entry.size > szone->large_entry_cache_reserve_limit;
-
-				// Already freed?
-				// [Note that repeated entries in death-row risk vending the same entry subsequently
-				// to two different malloc() calls. By checking here the (illegal) double free
-				// is accommodated, matching the behavior of the previous implementation.]
-				while (1) { // Scan large_entry_cache starting with most recent entry
-					if (szone->large_entry_cache[idx].address == entry->address) {
-						szone_error(szone->debug_flags, 1, "pointer being freed already on death-row", ptr, NULL);
-						SZONE_UNLOCK(szone);
-						return;
-					}
-
-					if (idx == stop_idx) { // exhausted live ring?
-						break;
-					}
-
-					if (idx) {
-						idx--; // bump idx down
-					} else {
-						idx = LARGE_ENTRY_CACHE_SIZE - 1; // wrap idx
-					}
-				}
-
-				SZONE_UNLOCK(szone);
-
-				if (szone->debug_flags & MALLOC_PURGEABLE) { // Are we a purgable zone?
-					int state = VM_PURGABLE_NONVOLATILE;			  // restore to default condition
-
-					if (KERN_SUCCESS != vm_purgable_control(mach_task_self(), this_entry.address, VM_PURGABLE_SET_STATE, &state)) {
-						malloc_printf("*** can't vm_purgable_control(..., VM_PURGABLE_SET_STATE) for large freed block at %p\n",
-									  this_entry.address);
-						reusable = FALSE;
-					}
-				}
-
-				if (szone->large_legacy_reset_mprotect) { // Linked for Leopard?
-					// Accomodate Leopard apps that (illegally) mprotect() their own guard pages on large malloc'd allocations
-					int err = mprotect((void *)(this_entry.address), this_entry.size, PROT_READ | PROT_WRITE);
-					if (err) {
-						malloc_printf("*** can't reset protection for large freed block at %p\n", this_entry.address);
-						reusable = FALSE;
-					}
-				}
-
-				// madvise(..., MADV_REUSABLE) death-row arrivals if hoarding would exceed large_entry_cache_reserve_limit
-				if (should_madvise) {
-					// Issue madvise to avoid paging out the dirtied free()'d pages in "entry"
-					MAGMALLOC_MADVFREEREGION(
-											 (void *)szone, (void *)0, (void *)(this_entry.address), (int)this_entry.size); // DTrace USDT Probe
-
-#if TARGET_OS_EMBEDDED
-					// Ok to do this madvise on embedded because we won't call MADV_FREE_REUSABLE on a large
-					// cache block twice without MADV_FREE_REUSE in between.
-#endif
-					if (-1 == madvise((void *)(this_entry.address), this_entry.size, MADV_FREE_REUSABLE)) {
-						/* -1 return: VM map entry change makes this unfit for reuse. */
-#if DEBUG_MADVISE
-						szone_error(szone->debug_flags, 0,
-									"free_large madvise(..., MADV_FREE_REUSABLE) failed",
-									(void *)this_entry.address,
-									"length=%d\n", this_entry.size);
+	LARGE_SHARD_LOCK(shard);
+	entry = large_entry_for_pointer_no_lock(shard, ptr);
+	if (!entry) {
+#if DEBUG_MALLOC
+		large_debug_print(szone);
 #endif
-						reusable = FALSE;
-					}
-				}
-
-				SZONE_LOCK(szone);
+		szone_error(szone->debug_flags, 1, "pointer being freed was not allocated", ptr, NULL);
+		LARGE_SHARD_UNLOCK(shard);
+		return;
+	}
 
-				// Re-acquire "entry" after interval just above where we let go the lock.
-				entry = large_entry_for_pointer_no_lock(szone, ptr);
-				if (NULL == entry) {
-					szone_error(szone->debug_flags, 1, "entry for pointer being freed from death-row vanished", ptr, NULL);
-					SZONE_UNLOCK(szone);
-					return;
-				}
+	this_entry = *entry; // Make a local copy, "entry" is volatile when lock is let go.
+	shard->num_large_objects_in_use--;
+	shard->num_bytes_in_large_objects -= this_entry.size;
 
-				// Add "entry" to death-row ring
-				if (reusable) {
-					int idx = szone->large_entry_cache_newest; // Most recently occupied
-					vm_address_t addr;
-					size_t adjsize;
-
-					if (szone->large_entry_cache_newest == szone->large_entry_cache_oldest &&
-						0 == szone->large_entry_cache[idx].address) {
-						// Ring is empty, idx is good as it stands
-						addr = 0;
-						adjsize = 0;
-					} else {
-						// Extend the queue to the "right" by bumping up large_entry_cache_newest
-						if (idx == LARGE_ENTRY_CACHE_SIZE - 1) {
-							idx = 0; // Wrap index
-						} else {
-							idx++; // Bump index
-						}
-						if (idx == szone->large_entry_cache_oldest) { // Fully occupied
-							// Drop this entry from the cache and deallocate the VM
-							addr = szone->large_entry_cache[idx].address;
-							adjsize = szone->large_entry_cache[idx].size;
-							szone->large_entry_cache_bytes -= adjsize;
-							if (!szone->large_entry_cache[idx].did_madvise_reusable) {
-								szone->large_entry_cache_reserve_bytes -= adjsize;
-							}
-						} else {
-							// Using an unoccupied cache slot
-							addr = 0;
-							adjsize = 0;
-						}
-					}
-
-					if ((szone->debug_flags & MALLOC_DO_SCRIBBLE)) {
-						memset((void *)(entry->address), should_madvise ? SCRUBBLE_BYTE : SCRABBLE_BYTE, entry->size);
-					}
-
-					entry->did_madvise_reusable = should_madvise; // Was madvise()'d above?
-					if (!should_madvise) {						  // Entered on death-row without madvise() => up the hoard total
-						szone->large_entry_cache_reserve_bytes += entry->size;
-					}
-
-					szone->large_entry_cache_bytes += entry->size;
-
-					if (!szone->flotsam_enabled && szone->large_entry_cache_bytes > SZONE_FLOTSAM_THRESHOLD_HIGH) {
-						szone->flotsam_enabled = TRUE;
-					}
-
-					szone->large_entry_cache[idx] = *entry;
-					szone->large_entry_cache_newest = idx;
-
-					szone->num_large_objects_in_use--;
-					szone->num_bytes_in_large_objects -= entry->size;
-
-					(void)large_entry_free_no_lock(szone, entry);
-
-					if (0 == addr) {
-						SZONE_UNLOCK(szone);
-						return;
-					}
-
-					// Fall through to drop large_entry_cache_oldest from the cache,
-					// and then deallocate its pages.
-
-					// Trim the queue on the "left" by bumping up large_entry_cache_oldest
-					if (szone->large_entry_cache_oldest == LARGE_ENTRY_CACHE_SIZE - 1) {
-						szone->large_entry_cache_oldest = 0;
-					} else {
-						szone->large_entry_cache_oldest++;
-					}
-
-					// we deallocate_pages, including guard pages, outside the lock
-					SZONE_UNLOCK(szone);
-					mvm_deallocate_pages((void *)addr, (size_t)adjsize, 0);
-					return;
-				} else {
-					/* fall through to discard an allocation that is not reusable */
-				}
-			}
-#endif /* CONFIG_LARGE_CACHE */
+	vm_range_to_deallocate = large_entry_free_no_lock(szone, shard, entry);
+	large_entries_migrate_no_lock(shard, LARGE_ENTRY_MIGRATE_SLOTS, &range_to_deallocate);
+	LARGE_SHARD_UNLOCK(shard); // we release the lock asap
 
-		szone->num_large_objects_in_use--;
-		szone->num_bytes_in_large_objects -= entry->size;
+	if (range_to_deallocate.size) {
+		// a retired table; we deallocate outside the lock
+		mvm_deallocate_pages((void *)range_to_deallocate.address, range_to_deallocate.size, 0);
+	}
 
-		vm_range_to_deallocate = large_entry_free_no_lock(szone, entry);
-	} else {
-#if DEBUG_MALLOC
-		large_debug_print(szone);
-#endif
-		szone_error(szone->debug_flags, 1, "pointer being freed was not allocated", ptr, NULL);
-		SZONE_UNLOCK(szone);
+#if CONFIG_LARGE_CACHE
+	if (this_entry.size < LARGE_CACHE_SIZE_ENTRY_LIMIT && large_entry_cache_insert(szone, this_entry)) {
 		return;
 	}
-	SZONE_UNLOCK(szone); // we release the lock asap
+	/* fall through to discard an allocation that is not reusable */
+#endif /* CONFIG_LARGE_CACHE */
+
 	CHECK(szone, __PRETTY_FUNCTION__);
 
 	// we deallocate_pages, including guard pages, outside the lock
 	if (vm_range_to_deallocate.address) {
 #if DEBUG_MALLOC
 		// FIXME: large_entry_for_pointer_no_lock() needs the lock held ...
-		if (large_entry_for_pointer_no_lock(szone, (void *)vm_range_to_deallocate.address)) {
+		if (large_entry_for_pointer_no_lock(shard, (void *)vm_range_to_deallocate.address)) {
 			malloc_printf("*** invariant broken: %p still in use num_large_entries=%d\n", vm_range_to_deallocate.address,
-						  szone->num_large_entries);
+						  shard->num_large_entries);
 			large_debug_print(szone);
 			szone_sleep();
 		}
 #endif
+		malloc_zone_owner_release((void *)vm_range_to_deallocate.address, (size_t)vm_range_to_deallocate.size);
 		mvm_deallocate_pages((void *)vm_range_to_deallocate.address, (size_t)vm_range_to_deallocate.size, 0);
 	}
 }
@@ -708,20 +1124,23 @@ large_try_shrink_in_place(szone_t *szone, void *ptr, size_t old_size, size_t new
 	size_t shrinkage = old_size - new_good_size;
 
 	if (shrinkage) {
-		SZONE_LOCK(szone);
+		large_shard_t *shard = large_shard_for_pointer(szone, ptr);
+
+		LARGE_SHARD_LOCK(shard);
 		/* contract existing large entry */
-		large_entry_t *large_entry = large_entry_for_pointer_no_lock(szone, ptr);
+		large_entry_t *large_entry = large_entry_for_pointer_no_lock(shard, ptr);
 		if (!large_entry) {
 			szone_error(szone->debug_flags, 1, "large entry reallocated is not properly in table", ptr, NULL);
-			SZONE_UNLOCK(szone);
+			LARGE_SHARD_UNLOCK(shard);
 			return ptr;
 		}
 
 		large_entry->address = (vm_address_t)ptr;
 		large_entry->size = new_good_size;
-		szone->num_bytes_in_large_objects -= shrinkage;
-		SZONE_UNLOCK(szone); // we release the lock asap
+		shard->num_bytes_in_large_objects -= shrinkage;
+		LARGE_SHARD_UNLOCK(shard); // we release the lock asap
 
+		malloc_zone_owner_release((void *)((uintptr_t)ptr + new_good_size), shrinkage);
 		mvm_deallocate_pages((void *)((uintptr_t)ptr + new_good_size), shrinkage, 0);
 	}
 	return ptr;
@@ -731,14 +1150,13 @@ int
 large_try_realloc_in_place(szone_t *szone, void *ptr, size_t old_size, size_t new_size)
 {
 	vm_address_t addr = (vm_address_t)ptr + old_size;
+	large_shard_t *shard;
 	large_entry_t *large_entry;
+#if !CONFIG_MVM_POSIX
 	kern_return_t err;
+#endif // !CONFIG_MVM_POSIX
 
-	SZONE_LOCK(szone);
-	large_entry = large_entry_for_pointer_no_lock(szone, (void *)addr);
-	SZONE_UNLOCK(szone);
-
-	if (large_entry) { // check if "addr = ptr + old_size" is already spoken for
+	if (large_size(szone, (void *)addr)) { // check if "addr = ptr + old_size" is already spoken for
 		return 0;	  // large pointer already exists in table - extension is not going to work
 	}
 
@@ -747,24 +1165,32 @@ large_try_realloc_in_place(szone_t *szone, void *ptr, size_t old_size, size_t ne
 	 * Ask for allocation at a specific address, and mark as realloc
 	 * to request coalescing with previous realloc'ed extensions.
 	 */
+#if CONFIG_MVM_POSIX
+	if (!mvm_allocate_pages_at(addr, new_size - old_size, TRUE)) {
+		return 0;
+	}
+#else // CONFIG_MVM_POSIX
 	err = vm_allocate(mach_task_self(), &addr, new_size - old_size, VM_MAKE_TAG(VM_MEMORY_REALLOC));
 	if (err != KERN_SUCCESS) {
 		return 0;
 	}
+#endif // CONFIG_MVM_POSIX
+	malloc_zone_owner_claim(szone->zone_owner, (void *)addr, new_size - old_size);
 
-	SZONE_LOCK(szone);
+	shard = large_shard_for_pointer(szone, ptr);
+	LARGE_SHARD_LOCK(shard);
 	/* extend existing large entry */
-	large_entry = large_entry_for_pointer_no_lock(szone, ptr);
+	large_entry = large_entry_for_pointer_no_lock(shard, ptr);
 	if (!large_entry) {
 		szone_error(szone->debug_flags, 1, "large entry reallocated is not properly in table", ptr, NULL);
-		SZONE_UNLOCK(szone);
+		LARGE_SHARD_UNLOCK(shard);
 		return 0; // Bail, leaking "addr"
 	}
-	
+
 	large_entry->address = (vm_address_t)ptr;
 	large_entry->size = new_size;
-	szone->num_bytes_in_large_objects += new_size - old_size;
-	SZONE_UNLOCK(szone); // we release the lock asap
-	
+	shard->num_bytes_in_large_objects += new_size - old_size;
+	LARGE_SHARD_UNLOCK(shard); // we release the lock asap
+
 	return 1;
 }
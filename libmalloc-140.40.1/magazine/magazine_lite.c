@@ -27,6 +27,128 @@ typedef uint64_t malloc_stack_id;
 
 uint64_t max_lite_mallocs = 0;
 
+/*
+ * Sampling (MallocStackLogging=sample, MallocStackLoggingSampleInterval).
+ * As in tcmalloc's heap profiler, each thread counts allocated bytes down
+ * from an interval drawn from an exponential distribution with a mean of
+ * stack_logging_sample_interval bytes, and the allocation that takes the
+ * count to zero is sampled. The distribution is memoryless, so an allocation
+ * of s bytes is sampled with probability p(s) = 1 - e^(-s / interval)
+ * whatever came before it.
+ *
+ * Unsampled allocations go straight to the helper zone. Sampled ones carry
+ * their requested size ahead of their stack id and count s / p(s) bytes into
+ * the refcounts of the uniquing table, so that the refcounts estimate the
+ * live bytes of each stack without bias.
+ */
+static boolean_t lite_sample_key_created = false;
+static pthread_key_t lite_sample_key; // per-thread byte count, 0 until the thread first allocates
+static volatile int64_t lite_sample_random = 0;
+
+// ln(x) for x in (0, 1], without libm: x = m * 2^e with m in [1, 2), and
+// ln(m) = 2 * atanh((m - 1) / (m + 1)), whose series converges quickly there.
+static double
+lite_sample_log(double x)
+{
+	union {
+		double d;
+		uint64_t u;
+	} bits = { .d = x };
+	int e = (int)((bits.u >> 52) & 0x7ff) - 1023;
+	bits.u = (bits.u & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+
+	double t = (bits.d - 1) / (bits.d + 1);
+	double t2 = t * t;
+	return e * 0.69314718055994530942 +
+			2 * t * (1 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7 + t2 * (1.0 / 9 + t2 / 11)))));
+}
+
+// 1 - e^(-x) for x >= 0: the series where it converges quickly, and
+// e^(-x) = (e^(-x / 2^n))^(2^n) beyond.
+static double
+lite_sample_probability(double x)
+{
+	double y = x, ey;
+	int halvings = 0;
+
+	if (x > 40) {
+		return 1;
+	}
+	while (y > 0.5) {
+		y /= 2;
+		halvings++;
+	}
+
+	double p = y * (1 - y / 2 * (1 - y / 3 * (1 - y / 4 * (1 - y / 5 * (1 - y / 6 * (1 - y / 7 * (1 - y / 8)))))));
+	if (!halvings) {
+		return p;
+	}
+	for (ey = 1 - p; halvings; halvings--) {
+		ey *= ey;
+	}
+	return 1 - ey;
+}
+
+static intptr_t
+lite_sample_next_interval(void)
+{
+	// splitmix64 over a shared counter; threads only contend on sampled allocations.
+	uint64_t z = (uint64_t)OSAtomicAdd64((int64_t)0x9e3779b97f4a7c15ULL, &lite_sample_random);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+
+	// -ln(u) * interval for u uniform in (0, 1]
+	double u = (double)((z >> 11) + 1) * (1.0 / 9007199254740992.0);
+	double interval = -lite_sample_log(u) * (double)stack_logging_sample_interval;
+	if (interval < 1) {
+		return 1;
+	}
+	return (interval < (double)(INTPTR_MAX / 2)) ? (intptr_t)interval : INTPTR_MAX / 2;
+}
+
+static boolean_t
+lite_should_sample(size_t size)
+{
+	if (!stack_logging_sample_interval) {
+		return true;
+	}
+
+	intptr_t bytes_until_sample = (intptr_t)pthread_getspecific(lite_sample_key);
+	boolean_t sampled = false;
+
+	if (!bytes_until_sample) {
+		bytes_until_sample = lite_sample_next_interval();
+	}
+	if (size >= (size_t)bytes_until_sample) {
+		sampled = true;
+		bytes_until_sample = lite_sample_next_interval();
+	} else {
+		bytes_until_sample -= size;
+	}
+	pthread_setspecific(lite_sample_key, (void *)bytes_until_sample);
+	return sampled;
+}
+
+// The live bytes a sampled allocation of 'size' bytes stands for.
+static size_t
+lite_sample_weight(size_t size)
+{
+	if (!size) {
+		return (size_t)stack_logging_sample_interval;
+	}
+	double weight = (double)size / lite_sample_probability((double)size / (double)stack_logging_sample_interval);
+	return (weight < (double)SIZE_MAX) ? MAX((size_t)(weight + 0.5), size) : SIZE_MAX;
+}
+
+// Every block of the lite zone ends with its stack id; with sampling, the
+// requested size comes just before it.
+static inline size_t
+lite_trailer_size(void)
+{
+	return sizeof(malloc_stack_id) + (stack_logging_sample_interval ? sizeof(uint64_t) : 0);
+}
+
 static malloc_stack_id
 get_stack_id_from_ptr(void *ptr, size_t ptr_size)
 {
@@ -35,6 +157,18 @@ get_stack_id_from_ptr(void *ptr, size_t ptr_size)
 	return * (malloc_stack_id *) idptr;
 }
 
+// What the block added to the refcounts of its stack.
+static size_t
+get_refcount_from_ptr(void *ptr, size_t ptr_size)
+{
+	if (!stack_logging_sample_interval) {
+		return ptr_size;
+	}
+	void *sizeptr = ptr + ptr_size - sizeof(malloc_stack_id) - sizeof(uint64_t);
+	
+	return lite_sample_weight((size_t) * (uint64_t *) sizeptr);
+}
+
 static void
 set_stack_id_in_ptr(void *ptr, size_t requested_size, size_t ptr_size, malloc_stack_id	stack_id)
 {
@@ -51,6 +185,7 @@ add_stack_to_ptr(szone_t *szone, size_t requested_size, void *ptr)
 	vm_address_t self_thread = (vm_address_t)_os_tsd_get_direct(__TSD_THREAD_SELF);
 	
 	size_t ptr_size = szone_size(szone, ptr);
+	size_t refcount = stack_logging_sample_interval ? lite_sample_weight(requested_size) : ptr_size;
 	
 	__malloc_lock_stack_logging();
 	
@@ -60,7 +195,7 @@ add_stack_to_ptr(szone_t *szone, size_t requested_size, void *ptr)
 		return;
 	}
 
-	malloc_stack_id stack_id = __enter_stack_into_table_while_locked(self_thread, 0, false, ptr_size);
+	malloc_stack_id stack_id = __enter_stack_into_table_while_locked(self_thread, 0, false, refcount);
 	
 	__malloc_unlock_stack_logging();
 	
@@ -69,6 +204,10 @@ add_stack_to_ptr(szone_t *szone, size_t requested_size, void *ptr)
 		turn_off_stack_logging();
 	} else {
 		set_stack_id_in_ptr(ptr, requested_size, ptr_size, stack_id);
+		if (stack_logging_sample_interval) {
+			void *sizeptr = ptr + ptr_size - sizeof(malloc_stack_id) - sizeof(uint64_t);
+			* (uint64_t *) sizeptr = requested_size;
+		}
 	}
 }
 
@@ -81,6 +220,14 @@ boolean_t is_stack_logging_lite_enabled(void) {
 void
 enable_stack_logging_lite()
 {
+	if (stack_logging_sample_interval && !lite_sample_key_created) {
+		if (pthread_key_create(&lite_sample_key, NULL)) {
+			malloc_printf("unable to create stack logging sample key. not enabling lite mode\n");
+			return;
+		}
+		lite_sample_random = (int64_t)malloc_entropy[0];
+		lite_sample_key_created = true;
+	}
 	stack_logging_lite_enabled = true;
 }
 
@@ -91,50 +238,56 @@ disable_stack_logging_lite()
 }
 
 static void *
-stack_logging_lite_malloc(malloc_zone_t *zone, size_t size)
+stack_logging_lite_malloc_sampled(szone_t *szone, size_t size)
 {
-	szone_t *szone = (szone_t *) zone;
 	void* p = NULL;
 	static uint64_t num_mallocs = 0;
 	
-	if (stack_logging_lite_enabled) {
-		__prepare_to_log_stacks(true);	// do this again in case stack logging was postponed
-		
-		p = szone_malloc(szone, size + sizeof(malloc_stack_id));
-		
-		if (p) {
-			add_stack_to_ptr(szone, size, p);
-		}
-		
-		// this value doesn't need to be exact, so no need for atomic operations
-		num_mallocs++;
-		
-		if (max_lite_mallocs > 0 && num_mallocs > max_lite_mallocs) {
-			malloc_printf("lite allocations exceeded limit. disabling lite mode\n");
-			disable_stack_logging_lite();
-		}
-	} else {
-		p = szone->helper_zone->basic_zone.malloc((malloc_zone_t *) szone->helper_zone, size);
+	__prepare_to_log_stacks(true);	// do this again in case stack logging was postponed
+	
+	p = szone_malloc(szone, size + lite_trailer_size());
+	
+	if (p) {
+		add_stack_to_ptr(szone, size, p);
+	}
+	
+	// this value doesn't need to be exact, so no need for atomic operations
+	num_mallocs++;
+	
+	if (max_lite_mallocs > 0 && num_mallocs > max_lite_mallocs) {
+		malloc_printf("lite allocations exceeded limit. disabling lite mode\n");
+		disable_stack_logging_lite();
 	}
 	
 	return p;
 }
 
+static void *
+stack_logging_lite_malloc(malloc_zone_t *zone, size_t size)
+{
+	szone_t *szone = (szone_t *) zone;
+	
+	if (stack_logging_lite_enabled && lite_should_sample(size)) {
+		return stack_logging_lite_malloc_sampled(szone, size);
+	}
+	return szone->helper_zone->basic_zone.malloc((malloc_zone_t *) szone->helper_zone, size);
+}
+
 static void *
 stack_logging_lite_calloc(struct _malloc_zone_t *zone, size_t num_items, size_t size)
 {
 	szone_t *szone = (szone_t *) zone;
 	void *p = NULL;
 	
-	if (stack_logging_lite_enabled) {
-		size_t total_bytes = (num_items * size) + sizeof(malloc_stack_id);
+	if (stack_logging_lite_enabled && lite_should_sample(num_items * size)) {
+		size_t total_bytes = (num_items * size) + lite_trailer_size();
 		
 		if (num_items > 1) {
 			
 #if __LP64__ /* size_t is uint64_t */
 			if ((num_items | size) & 0xffffffff00000000ul) {
 				// num_items or size equals or exceeds sqrt(2^64) == 2^32, appeal to wider arithmetic
-				__uint128_t product = (((__uint128_t)num_items) * ((__uint128_t)size)) + sizeof(malloc_stack_id);
+				__uint128_t product = (((__uint128_t)num_items) * ((__uint128_t)size)) + lite_trailer_size();
 				if ((uint64_t)(product >> 64)) { // compiles to test on upper register of register pair
 					return NULL;
 				}
@@ -142,7 +295,7 @@ stack_logging_lite_calloc(struct _malloc_zone_t *zone, size_t num_items, size_t
 #else /* size_t is uint32_t */
 			if ((num_items | size) & 0xffff0000ul) {
 				// num_items or size equals or exceeds sqrt(2^32) == 2^16, appeal to wider arithmetic
-				uint64_t product = ((uint64_t)num_items) * ((uint64_t)size) + sizeof(malloc_stack_id);;
+				uint64_t product = ((uint64_t)num_items) * ((uint64_t)size) + lite_trailer_size();
 				if ((uint32_t)(product >> 32)) { // compiles to test on upper register of register pair
 					return NULL;
 				}
@@ -169,8 +322,8 @@ stack_logging_lite_valloc(malloc_zone_t *zone, size_t size)
 	szone_t *szone = (szone_t *) zone;
 	void *p = NULL;
 	
-	if (stack_logging_lite_enabled) {
-		p = szone_valloc(szone, size + sizeof(malloc_stack_id));
+	if (stack_logging_lite_enabled && lite_should_sample(size)) {
+		p = szone_valloc(szone, size + lite_trailer_size());
 		
 		if (p) {
 			add_stack_to_ptr(szone, size, p);
@@ -191,7 +344,7 @@ stack_logging_lite_free(malloc_zone_t *zone, void *ptr)
 	// see if it's in our zone
 	if (size) {
 		malloc_stack_id stack_id = get_stack_id_from_ptr(ptr, size);
-		__decrement_table_slot_refcount(stack_id, size);
+		__decrement_table_slot_refcount(stack_id, get_refcount_from_ptr(ptr, size));
 		szone_free(szone, ptr);
 	} else {
 		szone->helper_zone->basic_zone.free((malloc_zone_t *) szone->helper_zone, ptr);
@@ -218,18 +371,22 @@ stack_logging_lite_realloc(malloc_zone_t *zone, void *ptr, size_t new_size)
 	
 	size_t old_size = szone_size(szone, ptr);
 	
-	// if we own the ptr and lite enabled do our thing
-	if (old_size && stack_logging_lite_enabled) {
+	// the result is sampled afresh, as for a free and a malloc
+	boolean_t sampled = stack_logging_lite_enabled && lite_should_sample(new_size);
+	
+	// if we own the ptr and lite mode keeps the result, do our thing
+	if (old_size && sampled) {
 		// need to get the old stackid and decrement
 		malloc_stack_id stack_id = get_stack_id_from_ptr(ptr, old_size);
-		new_ptr = szone_realloc(szone, ptr, new_size + sizeof(malloc_stack_id));
+		size_t old_refcount = get_refcount_from_ptr(ptr, old_size);
+		new_ptr = szone_realloc(szone, ptr, new_size + lite_trailer_size());
 		
 		if (new_ptr) {
-			__decrement_table_slot_refcount(stack_id, old_size);
+			__decrement_table_slot_refcount(stack_id, old_refcount);
 			add_stack_to_ptr(szone, new_size, new_ptr);
 		}
-	} else if (!old_size && !stack_logging_lite_enabled) {
-		// we don't own the pointer and lite mode is disabled, so just pass the realloc on to the helper zone
+	} else if (!old_size && !sampled) {
+		// we don't own the pointer and lite mode is disabled or passed on it, so just pass the realloc on to the helper zone
 		return szone->helper_zone->basic_zone.realloc((malloc_zone_t *) szone->helper_zone, ptr, new_size);
 	} else {
 		// otherwise perform the realloc by hand:
@@ -238,7 +395,8 @@ stack_logging_lite_realloc(malloc_zone_t *zone, void *ptr, size_t new_size)
 		// 3. free old ptr
 		
 		// this will add the stack id if needed
-		new_ptr = stack_logging_lite_malloc(zone, new_size);
+		new_ptr = sampled ? stack_logging_lite_malloc_sampled(szone, new_size) :
+				szone->helper_zone->basic_zone.malloc((malloc_zone_t *) szone->helper_zone, new_size);
 		
 		if (new_ptr) {
 			size_t old_size = malloc_size(ptr);
@@ -261,8 +419,8 @@ stack_logging_lite_memalign(malloc_zone_t *zone, size_t alignment, size_t size)
 	szone_t *szone = (szone_t *) zone;
 	void *ptr = NULL;
 	
-	if (stack_logging_lite_enabled) {
-		ptr = szone_memalign(szone, alignment, size + sizeof(malloc_stack_id));
+	if (stack_logging_lite_enabled && lite_should_sample(size)) {
+		ptr = szone_memalign(szone, alignment, size + lite_trailer_size());
 		
 		if (ptr) {
 			add_stack_to_ptr(szone, size, ptr);
@@ -281,7 +439,7 @@ stack_logging_lite_size(malloc_zone_t *zone, const void *ptr)
 	size_t size = szone_size(szone, ptr);
 	
 	if (size) {
-		size -= sizeof(malloc_stack_id);
+		size -= lite_trailer_size();
 	} else {
 		size = szone->helper_zone->basic_zone.size((malloc_zone_t *) szone->helper_zone, ptr);
 	}
@@ -294,7 +452,13 @@ stack_logging_lite_batch_malloc(szone_t *szone, size_t size, void **results, uns
 {
 	unsigned num_allocated = 0;
 	
-	if (stack_logging_lite_enabled) {
+	if (stack_logging_lite_enabled && stack_logging_sample_interval) {
+		// each block is sampled on its own
+		while (num_allocated < count &&
+				(results[num_allocated] = stack_logging_lite_malloc((malloc_zone_t *) szone, size))) {
+			num_allocated++;
+		}
+	} else if (stack_logging_lite_enabled) {
 		num_allocated = szone_batch_malloc(szone, size + sizeof(malloc_stack_id), results, count);
 		
 		for (unsigned i = 0; i < num_allocated; i++) {
@@ -319,7 +483,7 @@ stack_logging_lite_batch_free(szone_t *szone, void **to_be_freed, unsigned count
 			// see if it's in our zone
 			if (size) {
 				malloc_stack_id stack_id = get_stack_id_from_ptr(p, size);
-				__decrement_table_slot_refcount(stack_id, size);
+				__decrement_table_slot_refcount(stack_id, get_refcount_from_ptr(p, size));
 				szone_free(szone, p);
 			} else {
 				szone->helper_zone->basic_zone.free((malloc_zone_t *) szone->helper_zone, p);
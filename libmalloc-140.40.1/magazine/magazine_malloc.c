@@ -264,7 +264,7 @@ szone_malloc_should_clear(szone_t *szone, size_t size, boolean_t cleared_request
 		&& ptr
 		&& !cleared_requested
 		&& size) {
-		memset(ptr, SCRIBBLE_BYTE, szone_size(szone, ptr));
+		malloc_fill(ptr, SCRIBBLE_BYTE, szone_size(szone, ptr));
 	}
 
 	return ptr;
@@ -331,15 +331,8 @@ szone_valloc(szone_t *szone, size_t size)
 size_t
 szone_size_try_large(szone_t *szone, const void *ptr)
 {
-	size_t size = 0;
-	large_entry_t *entry;
+	size_t size = large_size(szone, ptr);
 
-	SZONE_LOCK(szone);
-	entry = large_entry_for_pointer_no_lock(szone, ptr);
-	if (entry) {
-		size = entry->size;
-	}
-	SZONE_UNLOCK(szone);
 #if DEBUG_MALLOC
 	if (LOG(szone, ptr)) {
 		malloc_printf("szone_size for %p returned %d\n", ptr, (unsigned)size);
@@ -369,9 +362,15 @@ szone_size(szone_t *szone, const void *ptr)
 		return 0;
 	}
 
-	sz = tiny_size(&szone->tiny_rack, ptr);
-	if (sz) {
-		return sz;
+	// The region map names the rack owning ptr, if any, so at most one of
+	// the tiny and small lookups below needs to run.
+	rack_t *rack = region_map_lookup(ptr);
+
+	if (rack == &szone->tiny_rack || szone->tiny_rack.region_map_overflow) {
+		sz = tiny_size(&szone->tiny_rack, ptr);
+		if (sz) {
+			return sz;
+		}
 	}
 
 	/*
@@ -381,9 +380,11 @@ szone_size(szone_t *szone, const void *ptr)
 		return 0;
 	}
 
-	sz = small_size(&szone->small_rack, ptr);
-	if (sz) {
-		return sz;
+	if (rack == &szone->small_rack || szone->small_rack.region_map_overflow) {
+		sz = small_size(&szone->small_rack, ptr);
+		if (sz) {
+			return sz;
+		}
 	}
 
 	/*
@@ -593,7 +594,7 @@ szone_batch_malloc(szone_t *szone, size_t size, void **results, unsigned count)
 {
 	msize_t msize = TINY_MSIZE_FOR_BYTES(size + TINY_QUANTUM - 1);
 	unsigned found = 0;
-	mag_index_t mag_index = mag_get_thread_index() % szone->tiny_rack.num_magazines;
+	mag_index_t mag_index = rack_get_thread_index(&szone->tiny_rack);
 	magazine_t *tiny_mag_ptr = &(szone->tiny_rack.magazines[mag_index]);
 
 	// only bother implementing this for tiny
@@ -705,55 +706,10 @@ szone_batch_free(szone_t *szone, void **to_be_freed, unsigned count)
 static void
 szone_destroy(szone_t *szone)
 {
-	size_t index;
-	large_entry_t *large;
-	vm_range_t range_to_deallocate;
-
-#if CONFIG_LARGE_CACHE
-	SZONE_LOCK(szone);
-
-	/* disable any memory pressure responder */
-	szone->flotsam_enabled = FALSE;
-
-	// stack allocated copy of the death-row cache
-	int idx = szone->large_entry_cache_oldest, idx_max = szone->large_entry_cache_newest;
-	large_entry_t local_entry_cache[LARGE_ENTRY_CACHE_SIZE];
-
-	memcpy((void *)local_entry_cache, (void *)szone->large_entry_cache, sizeof(local_entry_cache));
-
-	szone->large_entry_cache_oldest = szone->large_entry_cache_newest = 0;
-	szone->large_entry_cache[0].address = 0x0;
-	szone->large_entry_cache[0].size = 0;
-	szone->large_entry_cache_bytes = 0;
-	szone->large_entry_cache_reserve_bytes = 0;
-
-	SZONE_UNLOCK(szone);
-
-	// deallocate the death-row cache outside the zone lock
-	while (idx != idx_max) {
-		mvm_deallocate_pages((void *)local_entry_cache[idx].address, local_entry_cache[idx].size, 0);
-		if (++idx == LARGE_ENTRY_CACHE_SIZE) {
-			idx = 0;
-		}
-	}
-	if (0 != local_entry_cache[idx].address && 0 != local_entry_cache[idx].size) {
-		mvm_deallocate_pages((void *)local_entry_cache[idx].address, local_entry_cache[idx].size, 0);
-	}
+#if CONFIG_MAGAZINE_SCAVENGER
+	szone_scavenger_stop(szone);
 #endif
-
-	/* destroy large entries */
-	index = szone->num_large_entries;
-	while (index--) {
-		large = szone->large_entries + index;
-		if (large->address) {
-			// we deallocate_pages, including guard pages
-			mvm_deallocate_pages((void *)(large->address), large->size, szone->debug_flags);
-		}
-	}
-	large_entries_free_no_lock(szone, szone->large_entries, szone->num_large_entries, &range_to_deallocate);
-	if (range_to_deallocate.size) {
-		mvm_deallocate_pages((void *)range_to_deallocate.address, (size_t)range_to_deallocate.size, 0);
-	}
+	large_destroy(szone);
 
 	/* destroy allocator regions */
 	rack_destroy_regions(&szone->tiny_rack, TINY_REGION_SIZE);
@@ -763,6 +719,7 @@ szone_destroy(szone_t *szone)
 	rack_destroy(&szone->tiny_rack);
 	rack_destroy(&szone->small_rack);
 
+	malloc_zone_owner_remove(szone->zone_owner);
 	mvm_deallocate_pages((void *)szone, SZONE_PAGED_SIZE, 0);
 }
 
@@ -786,6 +743,11 @@ szone_good_size(szone_t *szone, size_t size)
 		if (!msize) {
 			msize = 1;
 		}
+#if CONFIG_SMALL_CLASSES
+		if ((szone->debug_flags & MALLOC_SMALL_CLASSES) && msize <= SMALL_CLASS_MAX_MSIZE) {
+			msize = small_class_msize[small_class_for_msize[msize]];
+		}
+#endif
 		return SMALL_BYTES_FOR_MSIZE(msize);
 	}
 
@@ -934,8 +896,7 @@ szone_ptr_in_use_enumerator(task_t task,
 		return err;
 	}
 
-	err = large_in_use_enumerator(
-			task, context, type_mask, (vm_address_t)szone->large_entries, szone->num_large_entries, reader, recorder);
+	err = large_in_use_enumerator(task, context, type_mask, szone, reader, recorder);
 	return err;
 }
 
@@ -973,8 +934,9 @@ scalable_zone_info(malloc_zone_t *zone, unsigned *info_to_fill, unsigned count)
 	info[6] = (unsigned)t;
 	info[7] = (unsigned)u;
 
-	info[8] = (unsigned)szone->num_large_objects_in_use;
-	info[9] = (unsigned)szone->num_bytes_in_large_objects;
+	large_statistics(szone, &t, &u);
+	info[8] = (unsigned)t;
+	info[9] = (unsigned)u;
 
 	info[10] = 0; // DEPRECATED szone->num_huge_entries;
 	info[11] = 0; // DEPRECATED szone->num_bytes_in_huge_objects;
@@ -1005,6 +967,47 @@ szone_print(szone_t *szone, boolean_t verbose)
 			info[12]);
 	_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "\ttiny=%u(%y) small=%u(%y) large=%u(%y) huge=%u(%y)\n", info[4],
 			info[5], info[6], info[7], info[8], info[9], info[10], info[11]);
+#if CONFIG_LARGE_CACHE
+	{
+		malloc_large_cache_statistics_t cache;
+
+		large_entry_cache_statistics(szone, &cache);
+		_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "\tlarge cache=%u(%y) hits=%llu misses=%llu evictions=%llu clears avoided=%y\n",
+				cache.entries, cache.bytes, cache.hits, cache.misses, cache.evictions, (size_t)cache.clear_avoided);
+	}
+#endif
+#if CONFIG_MADVISE_PRESSURE_RELIEF
+	if (szone->relief_calls) {
+		_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "\tpressure relief calls=%llu ranges=%llu syscalls=%llu advised=%y\n",
+				szone->relief_calls, szone->relief_ranges, szone->relief_syscalls, (size_t)szone->relief_bytes);
+	}
+#endif
+#if CONFIG_MAGAZINE_SCAVENGER
+	if (szone->scavenger_running) {
+		_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "\tscavenger ticks=%u pages=%llu\n", szone->scavenger_tick,
+				szone->scavenger_pages);
+	}
+#endif
+#if CONFIG_NUMA_MAGAZINES
+	if ((szone->debug_flags & MALLOC_NUMA_MAGAZINES) && mag_numa_enabled) {
+		_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "\tmagazines grouped over %u NUMA nodes\n", mag_numa_node_count);
+	}
+#endif
+	{
+		size_t tiny_avoided = 0, small_avoided = 0;
+		mag_index_t mag_index;
+
+		for (mag_index = -1; mag_index < szone->tiny_rack.num_magazines; mag_index++) {
+			tiny_avoided += szone->tiny_rack.magazines[mag_index].mag_bytes_clear_avoided;
+		}
+		for (mag_index = -1; mag_index < szone->small_rack.num_magazines; mag_index++) {
+			small_avoided += szone->small_rack.magazines[mag_index].mag_bytes_clear_avoided;
+		}
+		if (tiny_avoided || small_avoided) {
+			_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "\tcalloc clears avoided tiny=%y small=%y\n", tiny_avoided,
+					small_avoided);
+		}
+	}
 	// tiny
 	_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "%lu tiny regions:\n", szone->tiny_rack.num_regions);
 	if (szone->tiny_rack.num_regions_dealloc) {
@@ -1078,6 +1081,12 @@ szone_force_lock(szone_t *szone)
 {
 	mag_index_t i;
 
+#if CONFIG_MAGAZINE_TCACHE
+	// Keeps pressure relief from being caught holding a thread cache lock.
+	_malloc_lock_lock(&szone->tiny_rack.tcache_lock);
+	_malloc_lock_lock(&szone->small_rack.tcache_lock);
+#endif // CONFIG_MAGAZINE_TCACHE
+
 	for (i = 0; i < szone->tiny_rack.num_magazines; ++i) {
 		szone_force_lock_magazine(szone, &szone->tiny_rack.magazines[i]);
 	}
@@ -1089,6 +1098,7 @@ szone_force_lock(szone_t *szone)
 	szone_force_lock_magazine(szone, &szone->small_rack.magazines[DEPOT_MAGAZINE_INDEX]);
 
 	SZONE_LOCK(szone);
+	large_force_lock(szone);
 }
 
 static void
@@ -1096,6 +1106,7 @@ szone_force_unlock(szone_t *szone)
 {
 	mag_index_t i;
 
+	large_force_unlock(szone);
 	SZONE_UNLOCK(szone);
 
 	for (i = -1; i < szone->small_rack.num_magazines; ++i) {
@@ -1105,6 +1116,11 @@ szone_force_unlock(szone_t *szone)
 	for (i = -1; i < szone->tiny_rack.num_magazines; ++i) {
 		SZONE_MAGAZINE_PTR_UNLOCK((&(szone->tiny_rack.magazines[i])));
 	}
+
+#if CONFIG_MAGAZINE_TCACHE
+	_malloc_lock_unlock(&szone->small_rack.tcache_lock);
+	_malloc_lock_unlock(&szone->tiny_rack.tcache_lock);
+#endif // CONFIG_MAGAZINE_TCACHE
 }
 
 static void
@@ -1113,6 +1129,7 @@ szone_reinit_lock(szone_t *szone)
 	mag_index_t i;
 
 	SZONE_REINIT_LOCK(szone);
+	large_reinit_lock(szone);
 
 	for (i = -1; i < szone->small_rack.num_magazines; ++i) {
 		SZONE_MAGAZINE_PTR_REINIT_LOCK((&(szone->small_rack.magazines[i])));
@@ -1121,6 +1138,16 @@ szone_reinit_lock(szone_t *szone)
 	for (i = -1; i < szone->tiny_rack.num_magazines; ++i) {
 		SZONE_MAGAZINE_PTR_REINIT_LOCK((&(szone->tiny_rack.magazines[i])));
 	}
+
+#if CONFIG_MAGAZINE_TCACHE
+	_malloc_lock_init(&szone->tiny_rack.tcache_lock);
+	_malloc_lock_init(&szone->small_rack.tcache_lock);
+#endif // CONFIG_MAGAZINE_TCACHE
+
+#if CONFIG_MAGAZINE_SCAVENGER
+	// Only the forking thread survives into the child.
+	szone->scavenger_running = FALSE;
+#endif
 }
 
 static boolean_t
@@ -1135,6 +1162,10 @@ szone_locked(szone_t *szone)
 	}
 	SZONE_UNLOCK(szone);
 
+	if (large_locked(szone)) {
+		return 1;
+	}
+
 	for (i = -1; i < szone->small_rack.num_magazines; ++i) {
 		tookLock = SZONE_MAGAZINE_PTR_TRY_LOCK((&(szone->small_rack.magazines[i])));
 		if (tookLock == 0) {
@@ -1153,20 +1184,103 @@ szone_locked(szone_t *szone)
 	return 0;
 }
 
+#if CONFIG_MADVISE_PRESSURE_RELIEF
+/*
+ * The free pages pressure relief has collected from the regions it moved to a
+ * rack's depot, and those regions, which stay pinned to the depot until the
+ * pages have been advised.
+ */
+typedef struct {
+	mvm_madvise_batch_t ranges;
+	unsigned num_pinned;
+	region_trailer_t *pinned[MAGAZINE_RELIEF_BATCH_REGIONS];
+} szone_relief_batch_t;
+
+// Called without holding any lock.
+static void
+szone_relief_batch_flush(rack_t *rack, szone_relief_batch_t *batch)
+{
+	unsigned i;
+
+	mvm_madvise_batch_flush(rack, &batch->ranges);
+	for (i = 0; i < batch->num_pinned; i++) {
+		OSAtomicDecrement32Barrier(&(batch->pinned[i]->pinned_to_depot));
+	}
+	batch->num_pinned = 0;
+}
+
+/*
+ * Pin "r", which has just been moved to the (locked) depot, and collect its
+ * free pages. If the batch fills up part way through the region, the depot
+ * lock is dropped while the pages collected so far are advised.
+ */
+static void
+szone_relief_batch_collect(rack_t *rack,
+		magazine_t *depot_ptr,
+		region_t r,
+		region_trailer_t *node,
+		uintptr_t (*collect)(region_t, uintptr_t, mvm_madvise_batch_t *),
+		szone_relief_batch_t *batch)
+{
+	uintptr_t from = 0;
+
+	OSAtomicIncrement32Barrier(&(node->pinned_to_depot));
+	batch->pinned[batch->num_pinned++] = node;
+
+	while ((from = collect(r, from, &batch->ranges))) {
+		SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+		mvm_madvise_batch_flush(rack, &batch->ranges);
+		SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+	}
+}
+#endif // CONFIG_MADVISE_PRESSURE_RELIEF
+
 size_t
 szone_pressure_relief(szone_t *szone, size_t goal)
 {
 	size_t total = 0;
 
+#if CONFIG_MAGAZINE_TCACHE
+	// Hand cached blocks back to the magazines first so that the scan below
+	// can find them free.
+	rack_tcache_flush_all(&szone->tiny_rack);
+	rack_tcache_flush_all(&szone->small_rack);
+#endif // CONFIG_MAGAZINE_TCACHE
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	// Likewise for blocks still waiting on a magazine's remote free list.
+	for (mag_index_t i = 0; i < szone->tiny_rack.num_magazines; i++) {
+		magazine_t *mag_ptr = &(szone->tiny_rack.magazines[i]);
+		SZONE_MAGAZINE_PTR_LOCK(mag_ptr);
+		tiny_remote_free_drain_no_lock(&szone->tiny_rack, mag_ptr, i);
+		SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
+	}
+	for (mag_index_t i = 0; i < szone->small_rack.num_magazines; i++) {
+		magazine_t *mag_ptr = &(szone->small_rack.magazines[i]);
+		SZONE_MAGAZINE_PTR_LOCK(mag_ptr);
+		small_remote_free_drain_no_lock(&szone->small_rack, mag_ptr, i);
+		SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 #if CONFIG_MADVISE_PRESSURE_RELIEF
 	mag_index_t mag_index;
+	szone_relief_batch_t batch;
 
 	magazine_t *tiny_depot_ptr = (&szone->tiny_rack.magazines[DEPOT_MAGAZINE_INDEX]);
 	magazine_t *small_depot_ptr = (&szone->small_rack.magazines[DEPOT_MAGAZINE_INDEX]);
 
+	batch.num_pinned = 0;
+	mvm_madvise_batch_init(&batch.ranges);
+	batch.ranges.pressure = TRUE;
+
 	for (mag_index = 0; mag_index < szone->tiny_rack.num_magazines; mag_index++) {
 		size_t index;
 		for (index = 0; index < szone->tiny_rack.region_generation->num_regions_allocated; ++index) {
+			if (batch.num_pinned == MAGAZINE_RELIEF_BATCH_REGIONS) {
+				szone_relief_batch_flush(&szone->tiny_rack, &batch);
+			}
+
 			SZONE_LOCK(szone);
 
 			region_t tiny = szone->tiny_rack.region_generation->hashed_regions[index];
@@ -1224,10 +1338,11 @@ szone_pressure_relief(szone_t *szone, size_t goal)
 
 			recirc_list_splice_last(&szone->tiny_rack, tiny_depot_ptr, REGION_TRAILER_FOR_TINY_REGION(tiny));
 
-			/* Actually do the scan, done holding the depot lock, the call will drop the lock
-			 * around the actual madvise syscalls.
+			/* Collect the region's free pages holding the depot lock. They are advised
+			 * in batches once all locks have been dropped.
 			 */
-			tiny_free_scan_madvise_free(&szone->tiny_rack, tiny_depot_ptr, tiny);
+			szone_relief_batch_collect(&szone->tiny_rack, tiny_depot_ptr, tiny, REGION_TRAILER_FOR_TINY_REGION(tiny),
+					tiny_free_scan_madvise_collect, &batch);
 
 			/* Now the region is in the recirc depot, the next allocations to require more
 			 * blocks will come along and take one of these regions back out of the depot.
@@ -1238,9 +1353,15 @@ szone_pressure_relief(szone_t *szone, size_t goal)
 		}
 	}
 
+	szone_relief_batch_flush(&szone->tiny_rack, &batch);
+
 	for (mag_index = 0; mag_index < szone->small_rack.num_magazines; mag_index++) {
 		size_t index;
 		for (index = 0; index < szone->small_rack.region_generation->num_regions_allocated; ++index) {
+			if (batch.num_pinned == MAGAZINE_RELIEF_BATCH_REGIONS) {
+				szone_relief_batch_flush(&szone->small_rack, &batch);
+			}
+
 			SZONE_LOCK(szone);
 
 			region_t small = szone->small_rack.region_generation->hashed_regions[index];
@@ -1298,10 +1419,11 @@ szone_pressure_relief(szone_t *szone, size_t goal)
 
 			recirc_list_splice_last(&szone->small_rack, small_depot_ptr, REGION_TRAILER_FOR_SMALL_REGION(small));
 
-			/* Actually do the scan, done holding the depot lock, the call will drop the lock
-			 * around the actual madvise syscalls.
+			/* Collect the region's free pages holding the depot lock. They are advised
+			 * in batches once all locks have been dropped.
 			 */
-			small_free_scan_madvise_free(&szone->small_rack, small_depot_ptr, small);
+			szone_relief_batch_collect(&szone->small_rack, small_depot_ptr, small, REGION_TRAILER_FOR_SMALL_REGION(small),
+					small_free_scan_madvise_collect, &batch);
 
 			/* Now the region is in the recirc depot, the next allocations to require more
 			 * blocks will come along and take one of these regions back out of the depot.
@@ -1311,41 +1433,18 @@ szone_pressure_relief(szone_t *szone, size_t goal)
 			SZONE_MAGAZINE_PTR_UNLOCK(small_depot_ptr);
 		}
 	}
+	szone_relief_batch_flush(&szone->small_rack, &batch);
+
+	OSAtomicAdd64Barrier(1, &szone->relief_calls);
+	OSAtomicAdd64Barrier(batch.ranges.added, &szone->relief_ranges);
+	OSAtomicAdd64Barrier(batch.ranges.syscalls, &szone->relief_syscalls);
+	OSAtomicAdd64Barrier(batch.ranges.bytes, &szone->relief_bytes);
 #endif
 
 #if CONFIG_LARGE_CACHE
 	if (szone->flotsam_enabled) {
-		SZONE_LOCK(szone);
-
-		// stack allocated copy of the death-row cache
-		int idx = szone->large_entry_cache_oldest, idx_max = szone->large_entry_cache_newest;
-		large_entry_t local_entry_cache[LARGE_ENTRY_CACHE_SIZE];
-
-		memcpy((void *)local_entry_cache, (void *)szone->large_entry_cache, sizeof(local_entry_cache));
-
-		szone->large_entry_cache_oldest = szone->large_entry_cache_newest = 0;
-		szone->large_entry_cache[0].address = 0x0;
-		szone->large_entry_cache[0].size = 0;
-		szone->large_entry_cache_bytes = 0;
-		szone->large_entry_cache_reserve_bytes = 0;
-
 		szone->flotsam_enabled = FALSE;
-
-		SZONE_UNLOCK(szone);
-
-		// deallocate the death-row cache outside the zone lock
-		size_t total = 0;
-		while (idx != idx_max) {
-			mvm_deallocate_pages((void *)local_entry_cache[idx].address, local_entry_cache[idx].size, 0);
-			total += local_entry_cache[idx].size;
-			if (++idx == LARGE_ENTRY_CACHE_SIZE) {
-				idx = 0;
-			}
-		}
-		if (0 != local_entry_cache[idx].address && 0 != local_entry_cache[idx].size) {
-			mvm_deallocate_pages((void *)local_entry_cache[idx].address, local_entry_cache[idx].size, 0);
-			total += local_entry_cache[idx].size;
-		}
+		total = large_entry_cache_flush(szone);
 	}
 #endif
 
@@ -1397,11 +1496,16 @@ scalable_zone_statistics(malloc_zone_t *zone, malloc_statistics_t *stats, unsign
 		stats->max_size_in_use = stats->size_allocated - s;
 		return 1;
 	}
-	case 2:
-		stats->blocks_in_use = szone->num_large_objects_in_use;
-		stats->size_in_use = szone->num_bytes_in_large_objects;
+	case 2: {
+		unsigned t = 0;
+		size_t u = 0;
+
+		large_statistics(szone, &t, &u);
+		stats->blocks_in_use = t;
+		stats->size_in_use = u;
 		stats->max_size_in_use = stats->size_allocated = stats->size_in_use;
 		return 1;
+	}
 	case 3:
 		stats->blocks_in_use = 0; // DEPRECATED szone->num_huge_entries;
 		stats->size_in_use = 0;   // DEPRECATED szone->num_bytes_in_huge_objects;
@@ -1411,6 +1515,35 @@ scalable_zone_statistics(malloc_zone_t *zone, malloc_statistics_t *stats, unsign
 	return 0;
 }
 
+boolean_t
+scalable_zone_large_cache_statistics(malloc_zone_t *zone, malloc_large_cache_statistics_t *stats)
+{
+#if CONFIG_LARGE_CACHE
+	large_entry_cache_statistics((szone_t *)zone, stats);
+	return 1;
+#else
+	memset(stats, 0, sizeof(*stats));
+	return 0;
+#endif
+}
+
+boolean_t
+scalable_zone_pressure_relief_statistics(malloc_zone_t *zone, malloc_pressure_relief_statistics_t *stats)
+{
+#if CONFIG_MADVISE_PRESSURE_RELIEF
+	szone_t *szone = (szone_t *)zone;
+
+	stats->calls = szone->relief_calls;
+	stats->ranges = szone->relief_ranges;
+	stats->syscalls = szone->relief_syscalls;
+	stats->bytes = szone->relief_bytes;
+	return 1;
+#else
+	memset(stats, 0, sizeof(*stats));
+	return 0;
+#endif
+}
+
 static void
 szone_statistics(szone_t *szone, malloc_statistics_t *stats)
 {
@@ -1435,9 +1568,11 @@ szone_statistics(szone_t *szone, malloc_statistics_t *stats)
 		u += szone->small_rack.magazines[mag_index].mag_num_bytes_in_objects;
 	}
 
-	large = szone->num_bytes_in_large_objects + 0; // DEPRECATED szone->num_bytes_in_huge_objects;
+	unsigned large_blocks;
+	large_statistics(szone, &large_blocks, &large);
+	large += 0; // DEPRECATED szone->num_bytes_in_huge_objects;
 
-	stats->blocks_in_use = t + szone->num_large_objects_in_use + 0; // DEPRECATED szone->num_huge_entries;
+	stats->blocks_in_use = t + large_blocks + 0; // DEPRECATED szone->num_huge_entries;
 	stats->size_in_use = u + large;
 	stats->max_size_in_use = stats->size_allocated =
 			(szone->tiny_rack.num_regions - szone->tiny_rack.num_regions_dealloc) * TINY_REGION_SIZE +
@@ -1458,7 +1593,7 @@ create_scalable_szone(size_t initial_size, unsigned debug_flags)
 {
 	szone_t *szone;
 
-#if defined(__i386__) || defined(__x86_64__)
+#if !MALLOC_TARGET_LINUX && (defined(__i386__) || defined(__x86_64__))
 	if (_COMM_PAGE_VERSION_REQD > (*((uint16_t *)_COMM_PAGE_VERSION))) {
 		MALLOC_PRINTF_FATAL_ERROR((*((uint16_t *)_COMM_PAGE_VERSION)), "comm page version mismatch");
 	}
@@ -1498,12 +1633,13 @@ create_scalable_szone(size_t initial_size, unsigned debug_flags)
 	szone->vm_copy_threshold = VM_COPY_THRESHOLD;
 #endif // CONFIG_SMALL_CUTTOFF_127KB
 
-	// Query the number of configured processors.
-	// Uniprocessor case gets just one tiny and one small magazine (whose index is zero). This gives
-	// the same behavior as the original scalable malloc. MP gets per-CPU magazines
-	// that scale (way) better.
-	uint32_t nproc = platform_cpu_count();
-	uint32_t num_magazines = (nproc > 1) ? MIN(nproc, TINY_MAX_MAGAZINES) : 1;
+	// MP gets per-CPU magazines that scale (way) better.
+	uint32_t num_magazines = rack_magazine_count();
+#if CONFIG_NUMA_MAGAZINES
+	if (debug_flags & MALLOC_NUMA_MAGAZINES) {
+		mag_numa_init(num_magazines);
+	}
+#endif // CONFIG_NUMA_MAGAZINES
 	rack_init(&szone->tiny_rack, RACK_TYPE_TINY, num_magazines, debug_flags);
 	rack_init(&szone->small_rack, RACK_TYPE_SMALL, num_magazines, debug_flags);
 
@@ -1548,9 +1684,16 @@ create_scalable_szone(size_t initial_size, unsigned debug_flags)
 
 	szone->debug_flags = debug_flags;
 	_malloc_lock_init(&szone->large_szone_lock);
+	large_shards_init(szone);
 
 	szone->cpu_id_key = -1UL; // Unused.
 
+	// Claim regions and large allocations in the zone ownership map, so that
+	// find_registered_zone() can resolve our pointers without asking us.
+	szone->zone_owner = malloc_zone_owner_add((malloc_zone_t *)szone);
+	szone->tiny_rack.zone_owner = szone->zone_owner;
+	szone->small_rack.zone_owner = szone->zone_owner;
+
 	CHECK(szone, __PRETTY_FUNCTION__);
 	return szone;
 }
@@ -38,6 +38,14 @@ MALLOC_EXPORT
 boolean_t
 scalable_zone_statistics(malloc_zone_t *zone, malloc_statistics_t *stats, unsigned subzone);
 
+MALLOC_EXPORT
+boolean_t
+scalable_zone_large_cache_statistics(malloc_zone_t *zone, malloc_large_cache_statistics_t *stats);
+
+MALLOC_EXPORT
+boolean_t
+scalable_zone_pressure_relief_statistics(malloc_zone_t *zone, malloc_pressure_relief_statistics_t *stats);
+
 MALLOC_NOINLINE __printflike(5, 6)
 void
 szone_error(uint32_t debug_flags, int is_corruption, const char *msg, const void *ptr, const char *fmt, ...);
@@ -126,10 +134,24 @@ MALLOC_NOEXPORT
 size_t
 tiny_free_reattach_region(rack_t *rack, magazine_t *tiny_mag_ptr, region_t r);
 
+MALLOC_NOEXPORT
+void
+tiny_remote_free_drain_no_lock(rack_t *rack, magazine_t *tiny_mag_ptr, mag_index_t mag_index);
+
+MALLOC_NOEXPORT
+uintptr_t
+tiny_free_scan_madvise_collect(region_t r, uintptr_t from, mvm_madvise_batch_t *batch);
+
 MALLOC_NOEXPORT
 void
 tiny_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r);
 
+#if CONFIG_MAGAZINE_SCAVENGER
+MALLOC_NOEXPORT
+size_t
+tiny_scavenge(rack_t *rack, uint32_t tick, size_t max_pages);
+#endif // CONFIG_MAGAZINE_SCAVENGER
+
 MALLOC_NOEXPORT
 kern_return_t
 tiny_in_use_enumerator(task_t task, void *context, unsigned type_mask, szone_t *szone, memory_reader_t reader,
@@ -173,6 +195,16 @@ print_tiny_region(boolean_t verbose, region_t region, size_t bytes_at_start, siz
 
 // MARK: small region allocation functions
 
+#if CONFIG_SMALL_CLASSES
+MALLOC_NOEXPORT
+extern const
+msize_t small_class_msize[]; // SMALL_CLASS_COUNT entries
+
+MALLOC_NOEXPORT
+extern const
+uint8_t small_class_for_msize[]; // indexed by msize, up to SMALL_CLASS_MAX_MSIZE
+#endif // CONFIG_SMALL_CLASSES
+
 MALLOC_NOEXPORT
 boolean_t
 small_check_region(rack_t *rack, region_t region);
@@ -189,19 +221,41 @@ MALLOC_NOEXPORT
 boolean_t
 small_free_list_check(rack_t *rack, grain_t slot);
 
+MALLOC_NOEXPORT
+boolean_t
+small_free_no_lock(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_index, region_t region, void *ptr, msize_t msize);
+
 MALLOC_NOEXPORT
 size_t
 small_free_reattach_region(rack_t *rack, magazine_t *small_mag_ptr, region_t r);
 
+MALLOC_NOEXPORT
+void
+small_remote_free_drain_no_lock(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_index);
+
+MALLOC_NOEXPORT
+uintptr_t
+small_free_scan_madvise_collect(region_t r, uintptr_t from, mvm_madvise_batch_t *batch);
+
 MALLOC_NOEXPORT
 void
 small_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r);
 
+#if CONFIG_MAGAZINE_SCAVENGER
+MALLOC_NOEXPORT
+size_t
+small_scavenge(rack_t *rack, uint32_t tick, size_t max_pages);
+#endif // CONFIG_MAGAZINE_SCAVENGER
+
 MALLOC_NOEXPORT
 kern_return_t
 small_in_use_enumerator(task_t task, void *context, unsigned type_mask, szone_t *szone, memory_reader_t reader,
 		vm_range_recorder_t recorder);
 
+MALLOC_NOEXPORT
+void *
+small_malloc_from_free_list(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_index, msize_t msize);
+
 MALLOC_NOEXPORT
 void *
 small_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requested);
@@ -242,16 +296,50 @@ free_large(szone_t *szone, void *ptr);
 
 MALLOC_NOEXPORT
 void
-large_entries_free_no_lock(szone_t *szone, large_entry_t *entries, unsigned num, vm_range_t *range_to_deallocate);
+large_shards_init(szone_t *szone);
+
+MALLOC_NOEXPORT
+size_t
+large_size(szone_t *szone, const void *ptr);
+
+MALLOC_NOEXPORT
+void
+large_statistics(szone_t *szone, unsigned *blocks_in_use, size_t *size_in_use);
+
+#if CONFIG_LARGE_CACHE
+MALLOC_NOEXPORT
+size_t
+large_entry_cache_flush(szone_t *szone);
+
+MALLOC_NOEXPORT
+void
+large_entry_cache_statistics(szone_t *szone, malloc_large_cache_statistics_t *stats);
+#endif
+
+MALLOC_NOEXPORT
+void
+large_destroy(szone_t *szone);
 
 MALLOC_NOEXPORT
-large_entry_t *
-large_entry_for_pointer_no_lock(szone_t *szone, const void *ptr);
+void
+large_force_lock(szone_t *szone);
+
+MALLOC_NOEXPORT
+void
+large_force_unlock(szone_t *szone);
+
+MALLOC_NOEXPORT
+void
+large_reinit_lock(szone_t *szone);
+
+MALLOC_NOEXPORT
+boolean_t
+large_locked(szone_t *szone);
 
 MALLOC_NOEXPORT
 kern_return_t
-large_in_use_enumerator(task_t task, void *context, unsigned type_mask, vm_address_t large_entries_address, unsigned num_entries,
-		memory_reader_t reader, vm_range_recorder_t recorder);
+large_in_use_enumerator(task_t task, void *context, unsigned type_mask, szone_t *szone, memory_reader_t reader,
+		vm_range_recorder_t recorder);
 
 MALLOC_NOEXPORT
 int
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+#include "internal.h"
+
+#if CONFIG_NUMA_MAGAZINES
+
+boolean_t mag_numa_enabled = FALSE;
+unsigned mag_numa_node_count = 0;
+uint8_t mag_numa_cpu_magazine[MAG_NUMA_MAX_CPUS];
+uint8_t mag_numa_magazine_node[TINY_MAX_MAGAZINES];
+
+/*
+ * mag_numa_read_cpulist - Reads /sys/devices/system/node/node<n>/cpulist
+ * into buf without stdio, which could allocate. Returns the length read, or
+ * 0 if the node does not exist or has no CPUs.
+ */
+static size_t
+mag_numa_read_cpulist(unsigned n, char *buf, size_t size)
+{
+	static const char prefix[] = "/sys/devices/system/node/node";
+	static const char suffix[] = "/cpulist";
+	char path[sizeof(prefix) + 10 + sizeof(suffix)];
+	char digits[10];
+	size_t len = 0, ndigits = 0;
+	ssize_t got;
+	int fd;
+
+	memcpy(path, prefix, sizeof(prefix) - 1);
+	len = sizeof(prefix) - 1;
+	do {
+		digits[ndigits++] = (char)('0' + n % 10);
+		n /= 10;
+	} while (n);
+	while (ndigits) {
+		path[len++] = digits[--ndigits];
+	}
+	memcpy(path + len, suffix, sizeof(suffix));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return 0;
+	}
+	got = read(fd, buf, size - 1);
+	close(fd);
+	if (got <= 0) {
+		return 0;
+	}
+	buf[got] = '\0';
+	return (size_t)got;
+}
+
+/*
+ * mag_numa_parse_cpulist - Stores the CPUs of a cpulist such as "0-15,32-47"
+ * in cpus and returns how many there were. CPUs at or above
+ * MAG_NUMA_MAX_CPUS are skipped.
+ */
+static unsigned
+mag_numa_parse_cpulist(const char *p, uint16_t *cpus, unsigned max)
+{
+	unsigned count = 0;
+
+	while (*p >= '0' && *p <= '9') {
+		unsigned lo = 0, hi;
+
+		while (*p >= '0' && *p <= '9') {
+			lo = lo * 10 + (unsigned)(*p++ - '0');
+		}
+		hi = lo;
+		if (*p == '-') {
+			hi = 0;
+			for (p++; *p >= '0' && *p <= '9'; p++) {
+				hi = hi * 10 + (unsigned)(*p - '0');
+			}
+		}
+		for (unsigned cpu = lo; cpu <= hi && cpu < MAG_NUMA_MAX_CPUS && count < max; cpu++) {
+			cpus[count++] = (uint16_t)cpu;
+		}
+		if (*p == ',') {
+			p++;
+		}
+	}
+	return count;
+}
+
+/*
+ * mag_numa_init - Builds the CPU to magazine mapping for racks of
+ * num_magazines magazines. Node k (counting only nodes with CPUs) of K gets
+ * magazines [k * num_magazines / K, (k + 1) * num_magazines / K), and its
+ * CPUs are dealt out over them in turn. CPUs the kernel did not list keep
+ * the usual mapping. Nothing is enabled unless there are at least two such
+ * nodes and a magazine for each of them.
+ */
+void
+mag_numa_init(uint32_t num_magazines)
+{
+	uint8_t cpu_node[MAG_NUMA_MAX_CPUS];
+	uint8_t nodes[MAG_NUMA_MAX_NODES];
+	uint16_t cpus[MAG_NUMA_MAX_CPUS];
+	char buf[4096];
+	unsigned count = 0;
+
+	if (mag_numa_enabled || num_magazines < 2) {
+		return;
+	}
+
+	for (unsigned cpu = 0; cpu < MAG_NUMA_MAX_CPUS; cpu++) {
+		mag_numa_cpu_magazine[cpu] = (uint8_t)((cpu & (TINY_MAX_MAGAZINES - 1)) % num_magazines);
+		cpu_node[cpu] = 0xff;
+	}
+
+	// Node numbers may have holes, so look at all of them.
+	for (unsigned n = 0; n < MAG_NUMA_MAX_NODES; n++) {
+		if (!mag_numa_read_cpulist(n, buf, sizeof(buf))) {
+			continue;
+		}
+		unsigned ncpus = mag_numa_parse_cpulist(buf, cpus, MAG_NUMA_MAX_CPUS);
+		if (!ncpus) {
+			continue; // memory-only node
+		}
+		for (unsigned i = 0; i < ncpus; i++) {
+			cpu_node[cpus[i]] = (uint8_t)count;
+		}
+		nodes[count++] = (uint8_t)n;
+	}
+	if (count < 2 || count > num_magazines) {
+		return;
+	}
+
+	for (unsigned k = 0; k < count; k++) {
+		unsigned first = k * num_magazines / count;
+		unsigned limit = (k + 1) * num_magazines / count;
+		unsigned next = first;
+
+		for (unsigned mag = first; mag < limit; mag++) {
+			mag_numa_magazine_node[mag] = nodes[k];
+		}
+		for (unsigned cpu = 0; cpu < MAG_NUMA_MAX_CPUS; cpu++) {
+			if (cpu_node[cpu] == k) {
+				mag_numa_cpu_magazine[cpu] = (uint8_t)next;
+				if (++next == limit) {
+					next = first;
+				}
+			}
+		}
+	}
+
+	mag_numa_node_count = count;
+	OSMemoryBarrier();
+	mag_numa_enabled = TRUE;
+}
+
+/*
+ * mag_numa_depot_find - Looks in the (locked) depot for a region that lives
+ * on numa_node and has at least size bytes free. Unpinned regions are
+ * preferred; a pinned one is returned only if there is nothing else, for the
+ * caller to wait on. Returns NULL if the depot holds nothing for this node,
+ * in which case the caller allocates a fresh region rather than take memory
+ * from another node.
+ */
+region_trailer_t *
+mag_numa_depot_find(magazine_t *depot_ptr, unsigned numa_node, size_t region_payload_bytes, size_t size)
+{
+	region_trailer_t *pinned = NULL;
+
+	for (region_trailer_t *node = depot_ptr->firstNode; node; node = node->next) {
+		if (node->numa_node != numa_node || region_payload_bytes - node->bytes_used < size) {
+			continue;
+		}
+		if (0 >= node->pinned_to_depot) {
+			return node;
+		}
+		if (!pinned) {
+			pinned = node;
+		}
+	}
+	return pinned;
+}
+
+#endif // CONFIG_NUMA_MAGAZINES
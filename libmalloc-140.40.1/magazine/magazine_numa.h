@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+#ifndef __MAGAZINE_NUMA_H
+#define __MAGAZINE_NUMA_H
+
+#if CONFIG_NUMA_MAGAZINES
+
+/*******************************************************************************
+ * NUMA-aware magazines
+ *
+ * With MALLOC_NUMA_MAGAZINES set, the magazines of every tiny and small rack
+ * are split into one contiguous group per memory node that has CPUs, and
+ * mag_get_thread_index() maps each CPU onto a magazine of its own node. Fresh
+ * regions are bound to their magazine's node (MPOL_PREFERRED) before they are
+ * first touched and remember that node in their trailer, and a magazine only
+ * takes regions of its own node from the depot, so recirculation keeps
+ * memory on the socket it was placed on.
+ *
+ * The mapping is read from /sys/devices/system/node once, by the first zone
+ * created with the flag. On a machine with a single node the flag does
+ * nothing.
+ ******************************************************************************/
+
+MALLOC_NOEXPORT
+extern boolean_t mag_numa_enabled;
+
+MALLOC_NOEXPORT
+extern unsigned mag_numa_node_count;
+
+MALLOC_NOEXPORT
+extern uint8_t mag_numa_cpu_magazine[MAG_NUMA_MAX_CPUS];
+
+MALLOC_NOEXPORT
+extern uint8_t mag_numa_magazine_node[TINY_MAX_MAGAZINES];
+
+MALLOC_NOEXPORT
+void
+mag_numa_init(uint32_t num_magazines);
+
+MALLOC_NOEXPORT
+region_trailer_t *
+mag_numa_depot_find(magazine_t *depot_ptr, unsigned numa_node, size_t region_payload_bytes, size_t size);
+
+#endif // CONFIG_NUMA_MAGAZINES
+
+#endif // __MAGAZINE_NUMA_H
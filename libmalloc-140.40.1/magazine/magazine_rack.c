@@ -23,6 +23,78 @@
 
 #include "internal.h"
 
+region_map_leaf_t *volatile region_map[REGION_MAP_ROOT_ENTRIES];
+static _malloc_lock_s region_map_lock = _MALLOC_LOCK_INIT;
+uint32_t rack_max_magazines = MIN(TINY_MAX_MAGAZINES, SMALL_MAX_MAGAZINES);
+
+static size_t
+rack_region_size(rack_t *rack)
+{
+	return (rack->type == RACK_TYPE_TINY) ? TINY_REGION_SIZE : SMALL_REGION_SIZE;
+}
+
+/*
+ * region_map_set - Points every chunk covered by [region, region + size) at
+ * rack (or clears them for NULL). Returns FALSE, having changed nothing, if the
+ * range lies outside the map or a leaf could not be allocated.
+ */
+static boolean_t
+region_map_set(region_t region, size_t size, rack_t *rack)
+{
+	uintptr_t first = (uintptr_t)region >> REGION_MAP_CHUNK_SHIFT;
+	uintptr_t last = ((uintptr_t)region + size - 1) >> REGION_MAP_CHUNK_SHIFT;
+	uintptr_t chunk;
+
+	if (last >> REGION_MAP_CHUNK_BITS) {
+		return FALSE;
+	}
+
+	for (chunk = first >> REGION_MAP_LEAF_SHIFT; chunk <= last >> REGION_MAP_LEAF_SHIFT; chunk++) {
+		if (region_map[chunk] || !rack) {
+			continue;
+		}
+		_malloc_lock_lock(&region_map_lock);
+		if (!region_map[chunk]) {
+			region_map_leaf_t *leaf = mvm_allocate_pages(round_page_quanta(sizeof(region_map_leaf_t)), 0, 0,
+					VM_MEMORY_MALLOC);
+			if (!leaf) {
+				_malloc_lock_unlock(&region_map_lock);
+				return FALSE;
+			}
+			// Publish the (zero-filled) leaf only once it is visible in full.
+			OSMemoryBarrier();
+			region_map[chunk] = leaf;
+		}
+		_malloc_lock_unlock(&region_map_lock);
+	}
+
+	for (chunk = first; chunk <= last; chunk++) {
+		region_map_leaf_t *leaf = region_map[chunk >> REGION_MAP_LEAF_SHIFT];
+		if (leaf) {
+			leaf->racks[chunk & (REGION_MAP_LEAF_ENTRIES - 1)] = rack;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * rack_magazine_count - The number of magazines to give the racks of a new
+ * zone: one per online CPU, up to rack_max_magazines. A uniprocessor gets a
+ * single magazine (whose index is zero), which behaves like the original
+ * scalable malloc.
+ */
+uint32_t
+rack_magazine_count(void)
+{
+	uint32_t nproc = platform_cpu_count();
+	uint32_t ceiling = MIN(rack_max_magazines, MIN(TINY_MAX_MAGAZINES, SMALL_MAX_MAGAZINES));
+
+	if (nproc <= 1 || ceiling <= 1) {
+		return 1;
+	}
+	return MIN(nproc, ceiling);
+}
+
 void
 rack_init(rack_t *rack, rack_type_t type, uint32_t num_magazines, uint32_t debug_flags)
 {
@@ -36,6 +108,8 @@ rack_init(rack_t *rack, rack_type_t type, uint32_t num_magazines, uint32_t debug
 	rack->region_generation->num_regions_allocated_shift = INITIAL_NUM_REGIONS_SHIFT;
 
 	memset(rack->initial_regions, '\0', sizeof(region_t) * INITIAL_NUM_REGIONS);
+	rack->region_map_overflow = FALSE;
+	rack->zone_owner = 0;
 
 	rack->cookie = (uintptr_t)malloc_entropy[0];
 
@@ -80,6 +154,10 @@ rack_init(rack_t *rack, rack_type_t type, uint32_t num_magazines, uint32_t debug
 		for (int i=0; i < rack->num_magazines; i++) {
 			_malloc_lock_init(&rack->magazines[i].magazine_lock);
 		}
+
+#if CONFIG_MAGAZINE_TCACHE
+		rack_tcache_init(rack);
+#endif // CONFIG_MAGAZINE_TCACHE
 	}
 }
 
@@ -91,6 +169,8 @@ rack_destroy_regions(rack_t *rack, size_t region_size)
 		if ((rack->region_generation->hashed_regions[i] != HASHRING_OPEN_ENTRY) &&
 			(rack->region_generation->hashed_regions[i] != HASHRING_REGION_DEALLOCATED))
 		{
+			region_map_set(rack->region_generation->hashed_regions[i], region_size, NULL);
+			malloc_zone_owner_release(rack->region_generation->hashed_regions[i], region_size);
 			mvm_deallocate_pages(rack->region_generation->hashed_regions[i], region_size, 0);
 			rack->region_generation->hashed_regions[i] = HASHRING_REGION_DEALLOCATED;
 		}
@@ -107,6 +187,10 @@ rack_destroy(rack_t *rack)
 	}
 
 	if (rack->num_magazines > 0) {
+#if CONFIG_MAGAZINE_TCACHE
+		rack_tcache_destroy(rack);
+#endif // CONFIG_MAGAZINE_TCACHE
+
 		size_t size = round_page_quanta(sizeof(magazine_t) * (rack->num_magazines + 1));
 		mvm_deallocate_pages(&rack->magazines[-1], size, MALLOC_ADD_GUARD_PAGES);
 		rack->magazines = NULL;
@@ -155,5 +239,19 @@ rack_region_insert(rack_t *rack, region_t region)
 							   region);
 
 	rack->num_regions++;
+
+	// Advertise the region in the region map last, so that a pointer resolved
+	// through the map always finds the region on the hash ring as well.
+	if (!region_map_set(region, rack_region_size(rack), rack)) {
+		rack->region_map_overflow = TRUE;
+	}
+	malloc_zone_owner_claim(rack->zone_owner, region, rack_region_size(rack));
 	_malloc_lock_unlock(&rack->region_lock);
 }
+
+void
+rack_region_map_remove(rack_t *rack, region_t region)
+{
+	region_map_set(region, rack_region_size(rack), NULL);
+	malloc_zone_owner_release(region, rack_region_size(rack));
+}
@@ -44,6 +44,36 @@ typedef struct region_hash_generation {
 	struct region_hash_generation *nextgen;
 } region_hash_generation_t;
 
+/*******************************************************************************
+ * Definitions for region map
+ *
+ * A process-wide two-level radix map from each 1MB chunk of the address space
+ * (ptr >> REGION_MAP_CHUNK_SHIFT) to the rack whose tiny or small region covers
+ * it. Regions are aligned to at least a chunk, so resolving a pointer is two
+ * dependent loads with no probing. Leaves are allocated on first use and never
+ * freed, and entries are written only under the owning rack's region_lock or
+ * magazine lock, so lookups take no lock. The hash ring remains the rack's
+ * list of regions for enumeration and introspection.
+ ******************************************************************************/
+
+#define REGION_MAP_CHUNK_SHIFT (SHIFT_TINY_CEIL_BLOCKS + SHIFT_TINY_QUANTUM) // TINY_BLOCKS_ALIGN
+#if MALLOC_TARGET_64BIT
+#define REGION_MAP_ADDRESS_BITS 48
+#else // MALLOC_TARGET_64BIT
+#define REGION_MAP_ADDRESS_BITS 32
+#endif // MALLOC_TARGET_64BIT
+#define REGION_MAP_CHUNK_BITS (REGION_MAP_ADDRESS_BITS - REGION_MAP_CHUNK_SHIFT)
+#define REGION_MAP_LEAF_SHIFT (REGION_MAP_CHUNK_BITS / 2)
+#define REGION_MAP_LEAF_ENTRIES (1 << REGION_MAP_LEAF_SHIFT)
+#define REGION_MAP_ROOT_ENTRIES (1 << (REGION_MAP_CHUNK_BITS - REGION_MAP_LEAF_SHIFT))
+
+typedef struct region_map_leaf_s {
+	struct rack_s *volatile racks[REGION_MAP_LEAF_ENTRIES];
+} region_map_leaf_t;
+
+MALLOC_NOEXPORT
+extern region_map_leaf_t *volatile region_map[REGION_MAP_ROOT_ENTRIES];
+
 OS_ENUM(rack_type, uint32_t,
 	RACK_TYPE_NONE = 0,
 	RACK_TYPE_TINY,
@@ -64,6 +94,12 @@ typedef struct rack_s {
 	region_hash_generation_t *region_generation;
 	region_hash_generation_t rg[2];
 	region_t initial_regions[INITIAL_NUM_REGIONS];
+	// set once a region falls outside the region map; lookups then fall back
+	// to the hash ring
+	boolean_t region_map_overflow;
+	// slot under which regions are claimed in the zone ownership map, 0 for
+	// racks outside a registered zone
+	malloc_zone_owner_index_t zone_owner;
 
 	int num_magazines;
 	unsigned num_magazines_mask;
@@ -75,9 +111,26 @@ typedef struct rack_s {
 
 	uintptr_t cookie;
 	uintptr_t last_madvise;
+
+#if CONFIG_MAGAZINE_TCACHE
+	// per-thread caches in front of the magazines (MALLOC_THREAD_CACHE)
+	pthread_key_t tcache_key;
+	_malloc_lock_s tcache_lock;
+	magazine_tcache_t *tcache_list;
+	volatile int32_t tcache_generation;
+#endif // CONFIG_MAGAZINE_TCACHE
 } rack_t;
 
 
+// Ceiling on the number of magazines of racks created from now on
+// (MallocMaxMagazines); at most TINY_MAX_MAGAZINES.
+MALLOC_NOEXPORT
+extern uint32_t rack_max_magazines;
+
+MALLOC_NOEXPORT
+uint32_t
+rack_magazine_count(void);
+
 MALLOC_NOEXPORT
 void
 rack_init(rack_t *rack, rack_type_t type, uint32_t num_magazines, uint32_t debug_flags);
@@ -94,4 +147,8 @@ MALLOC_NOEXPORT
 void
 rack_region_insert(rack_t *rack, region_t region);
 
+MALLOC_NOEXPORT
+void
+rack_region_map_remove(rack_t *rack, region_t region);
+
 #endif // __MAGAZINE_RACK_H
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#include "internal.h"
+
+#if CONFIG_MAGAZINE_SCAVENGER
+
+unsigned malloc_scavenger_interval_ms = MAGAZINE_SCAVENGE_INTERVAL_MS;
+size_t malloc_scavenger_rss_target = 0;
+size_t malloc_scavenger_max_pages = MAGAZINE_SCAVENGE_PAGES;
+
+/*
+ * szone_scavenge - Runs one scavenger tick over the zone's tiny and small
+ * racks. Returns the number of pages handed back to the system.
+ */
+size_t
+szone_scavenge(szone_t *szone)
+{
+	uint32_t tick = ++szone->scavenger_tick;
+	size_t max_pages = malloc_scavenger_max_pages;
+	size_t pages;
+
+	// Below the target the regions still age, so that they are ready to go as
+	// soon as the process is over it.
+	if (malloc_scavenger_rss_target && mvm_resident_bytes() <= malloc_scavenger_rss_target) {
+		max_pages = 0;
+	}
+
+	pages = tiny_scavenge(&szone->tiny_rack, tick, max_pages);
+	pages += small_scavenge(&szone->small_rack, tick, max_pages - pages);
+	szone->scavenger_pages += pages;
+	return pages;
+}
+
+static void *
+szone_scavenger_main(void *arg)
+{
+	szone_t *szone = arg;
+	struct timespec interval = {
+		.tv_sec = malloc_scavenger_interval_ms / 1000,
+		.tv_nsec = (long)(malloc_scavenger_interval_ms % 1000) * 1000000,
+	};
+
+	while (!szone->scavenger_stop) {
+		nanosleep(&interval, NULL);
+		if (szone->scavenger_stop) {
+			break;
+		}
+		(void)szone_scavenge(szone);
+	}
+	return NULL;
+}
+
+void
+szone_scavenger_start(szone_t *szone)
+{
+	sigset_t all, saved;
+	int err;
+
+	if (!(szone->debug_flags & MALLOC_SCAVENGER) || szone->scavenger_running) {
+		return;
+	}
+
+	// Keep the process's signals off the scavenger thread.
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+	szone->scavenger_stop = FALSE;
+	err = pthread_create(&szone->scavenger_thread, NULL, szone_scavenger_main, szone);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	if (err) {
+		malloc_printf("*** can't start the scavenger thread (error %d)\n", err);
+		return;
+	}
+	szone->scavenger_running = TRUE;
+}
+
+void
+szone_scavenger_stop(szone_t *szone)
+{
+	if (!szone->scavenger_running) {
+		return;
+	}
+	szone->scavenger_stop = TRUE;
+	pthread_join(szone->scavenger_thread, NULL);
+	szone->scavenger_running = FALSE;
+}
+
+#endif // CONFIG_MAGAZINE_SCAVENGER
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __MAGAZINE_SCAVENGER_H
+#define __MAGAZINE_SCAVENGER_H
+
+#if CONFIG_MAGAZINE_SCAVENGER
+
+/*******************************************************************************
+ * Background scavenger
+ *
+ * With MALLOC_SCAVENGER set, the default zone gets a thread that wakes every
+ * malloc_scavenger_interval_ms and returns free pages of tiny and small
+ * regions to the system, instead of leaving that to the free path and to
+ * pressure relief. Only regions that have seen no allocation or free for
+ * MAGAZINE_SCAVENGE_IDLE_TICKS ticks are touched, so regions that are being
+ * allocated from keep their pages. Each tick returns at most
+ * malloc_scavenger_max_pages pages, taking one magazine lock at a time for at
+ * most MAGAZINE_SCAVENGE_LOCK_PAGES of them, and does nothing while the
+ * process stays at or below malloc_scavenger_rss_target bytes.
+ *
+ * The thread does not survive fork(); the child runs without it.
+ ******************************************************************************/
+
+MALLOC_NOEXPORT
+extern unsigned malloc_scavenger_interval_ms;
+
+MALLOC_NOEXPORT
+extern size_t malloc_scavenger_rss_target;
+
+MALLOC_NOEXPORT
+extern size_t malloc_scavenger_max_pages;
+
+MALLOC_NOEXPORT
+void
+szone_scavenger_start(szone_t *szone);
+
+MALLOC_NOEXPORT
+void
+szone_scavenger_stop(szone_t *szone);
+
+MALLOC_NOEXPORT
+size_t
+szone_scavenge(szone_t *szone);
+
+#endif // CONFIG_MAGAZINE_SCAVENGER
+
+#endif // __MAGAZINE_SCAVENGER_H
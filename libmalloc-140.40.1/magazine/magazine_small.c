@@ -25,6 +25,27 @@
 
 /*********************	SMALL FREE LIST UTILITIES	************************/
 
+#if CONFIG_KNOWN_ZERO_PAGES
+// The in-place free list linkage a free block keeps in its first bytes, which
+// is all that can be dirty in a block carved from known-zero granules. Sizes
+// live out of band, so there is nothing at the tail.
+#define SMALL_FREE_HEAD_BYTES sizeof(small_inplace_free_entry_s)
+
+/*
+ * small_zero_granules_unmark - Forgets that the free bytes of [lo, hi), clipped
+ * to the region, are zero.
+ */
+static MALLOC_INLINE void
+small_zero_granules_unmark(region_t region, uintptr_t lo, uintptr_t hi)
+{
+	hi = MIN(hi, (uintptr_t)SMALL_REGION_END(region));
+	if (lo >= hi) {
+		return;
+	}
+	region_zero_granules_unmark(REGION_TRAILER_FOR_SMALL_REGION(region), (uintptr_t)region, SMALL_ZERO_GRANULE_SHIFT, lo, hi);
+}
+#endif // CONFIG_KNOWN_ZERO_PAGES
+
 #pragma mark meta header helpers
 
 /*
@@ -56,6 +77,99 @@ small_meta_header_set_middle(msize_t *meta_headers, msize_t index)
 	meta_headers[index] = 0;
 }
 
+#if CONFIG_SMALL_CLASSES
+#pragma mark size class runs
+
+MALLOC_STATIC_ASSERT(SMALL_CLASS_MAX_MSIZE == 30, "small_class_for_msize covers msizes up to 30");
+
+const msize_t small_class_msize[SMALL_CLASS_COUNT] = {
+	2, 3, 4, 5, 6, 7, 8, 10, 12, 14, 16, 20, 24, 28, SMALL_CLASS_MAX_MSIZE,
+};
+
+const uint8_t small_class_for_msize[SMALL_CLASS_MAX_MSIZE + 1] = {
+	0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+	11, 11, 11, 11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14,
+};
+
+static MALLOC_INLINE unsigned
+small_class_run_slots(msize_t class_msize)
+{
+	unsigned num_slots = SMALL_CLASS_RUN_QUANTA / class_msize;
+
+	if (num_slots < SMALL_CLASS_RUN_MIN_SLOTS) {
+		return SMALL_CLASS_RUN_MIN_SLOTS;
+	}
+	if (num_slots > SMALL_CLASS_RUN_MAX_SLOTS) {
+		return SMALL_CLASS_RUN_MAX_SLOTS;
+	}
+	return num_slots;
+}
+
+static MALLOC_INLINE uint64_t
+small_class_run_all_slots(small_class_run_t *run)
+{
+	return (run->num_slots == 64) ? ~0ULL : ((1ULL << run->num_slots) - 1);
+}
+
+static MALLOC_INLINE unsigned
+small_class_run_slots_in_use(small_class_run_t *run)
+{
+	return run->num_slots - __builtin_popcountll(run->free_slots);
+}
+
+/*
+ * Find the run holding the slot at ptr, given the slot's metadata word.
+ */
+static MALLOC_INLINE small_class_run_t *
+small_class_run_for_slot(const void *ptr, msize_t meta)
+{
+	msize_t class_msize = small_class_msize[SMALL_CLASS_META_CLASS(meta)];
+
+	return (small_class_run_t *)((uintptr_t)ptr - SMALL_BYTES_FOR_MSIZE(1 + SMALL_CLASS_META_SLOT(meta) * class_msize));
+}
+
+/*
+ * Returns the run starting at the in-use block ptr of the given msize, or NULL
+ * if the block is an ordinary allocation.
+ */
+static MALLOC_INLINE small_class_run_t *
+small_class_run_for_block(msize_t *meta_headers, unsigned index, msize_t msize, void *ptr)
+{
+	if (msize > 1 && (meta_headers[index + 1] & SMALL_IS_CLASS)) {
+		return (small_class_run_t *)ptr;
+	}
+	return NULL;
+}
+
+static MALLOC_INLINE void
+small_class_run_link(magazine_t *small_mag_ptr, small_class_run_t *run)
+{
+	small_class_run_t **head = &small_mag_ptr->mag_class_runs[run->class_index];
+
+	run->prev = NULL;
+	run->next = *head;
+	if (*head) {
+		(*head)->prev = run;
+	}
+	*head = run;
+	run->linked = TRUE;
+}
+
+static MALLOC_INLINE void
+small_class_run_unlink(magazine_t *small_mag_ptr, small_class_run_t *run)
+{
+	if (run->prev) {
+		run->prev->next = run->next;
+	} else {
+		small_mag_ptr->mag_class_runs[run->class_index] = run->next;
+	}
+	if (run->next) {
+		run->next->prev = run->prev;
+	}
+	run->linked = FALSE;
+}
+#endif // CONFIG_SMALL_CLASSES
+
 #pragma mark in-place free list
 
 static MALLOC_INLINE void
@@ -526,6 +640,10 @@ small_finalize_region(rack_t *rack, magazine_t *small_mag_ptr)
 			next = small_free_list_find_by_ptr(rack, small_mag_ptr, next_block, next_msize);
 			small_free_list_remove_ptr(rack, small_mag_ptr, next, next_msize);
 			last_msize += next_msize;
+#if CONFIG_KNOWN_ZERO_PAGES
+			small_zero_granules_unmark(small_mag_ptr->mag_last_region, (uintptr_t)next_block,
+					(uintptr_t)next_block + SMALL_FREE_HEAD_BYTES);
+#endif // CONFIG_KNOWN_ZERO_PAGES
 		}
 
 		// splice last_block into the free list
@@ -547,6 +665,9 @@ small_free_detach_region(rack_t *rack, magazine_t *small_mag_ptr, region_t r)
 	uintptr_t current = start;
 	uintptr_t limit = (uintptr_t)SMALL_REGION_END(r);
 	int total_alloc = 0;
+#if CONFIG_SMALL_CLASSES
+	small_class_run_t *run;
+#endif
 
 	while (current < limit) {
 		unsigned index = SMALL_META_INDEX_FOR_PTR(current);
@@ -565,6 +686,14 @@ small_free_detach_region(rack_t *rack, magazine_t *small_mag_ptr, region_t r)
 		if (is_free) {
 			free_list_t entry = small_free_list_find_by_ptr(rack, small_mag_ptr, (void *)current, msize);
 			small_free_list_remove_ptr_no_clear(rack, small_mag_ptr, entry, msize);
+#if CONFIG_SMALL_CLASSES
+		} else if ((run = small_class_run_for_block(meta_headers, index, msize, (void *)current))) {
+			// Only the slots are accounted for; the run leaves its list with the region
+			if (run->linked) {
+				small_class_run_unlink(small_mag_ptr, run);
+			}
+			total_alloc += small_class_run_slots_in_use(run);
+#endif // CONFIG_SMALL_CLASSES
 		} else {
 			total_alloc++;
 		}
@@ -582,6 +711,9 @@ small_free_reattach_region(rack_t *rack, magazine_t *small_mag_ptr, region_t r)
 	uintptr_t current = start;
 	uintptr_t limit = (uintptr_t)SMALL_REGION_END(r);
 	size_t total_alloc = 0;
+#if CONFIG_SMALL_CLASSES
+	small_class_run_t *run;
+#endif
 
 	while (current < limit) {
 		unsigned index = SMALL_META_INDEX_FOR_PTR(current);
@@ -597,6 +729,15 @@ small_free_reattach_region(rack_t *rack, magazine_t *small_mag_ptr, region_t r)
 		}
 		if (is_free) {
 			small_free_list_add_ptr(rack, small_mag_ptr, (void *)current, msize);
+#if CONFIG_SMALL_CLASSES
+		} else if ((run = small_class_run_for_block(meta_headers, index, msize, (void *)current))) {
+			// The Depot never allocates, so its runs stay off the class lists
+			unsigned in_use = small_class_run_slots_in_use(run);
+			if (in_use < run->num_slots && DEPOT_MAGAZINE_INDEX != MAGAZINE_INDEX_FOR_SMALL_REGION(r)) {
+				small_class_run_link(small_mag_ptr, run);
+			}
+			total_alloc += in_use * SMALL_BYTES_FOR_MSIZE(small_class_msize[run->class_index]);
+#endif // CONFIG_SMALL_CLASSES
 		} else {
 			total_alloc += SMALL_BYTES_FOR_MSIZE(msize);
 		}
@@ -605,77 +746,90 @@ small_free_reattach_region(rack_t *rack, magazine_t *small_mag_ptr, region_t r)
 	return total_alloc;
 }
 
-typedef struct {
-	uint16_t pnum, size;
-} small_pg_pair_t;
-
-void
-small_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
+/*
+ * Append the free pages of "r" at or above "from" to "batch", taking care to
+ * preserve free list management data. Returns 0 once the whole region has been
+ * covered, or the address to pick up from once the (full) batch has been
+ * flushed. The scan always starts over at the first block, so the blocks may
+ * have been coalesced in between.
+ */
+uintptr_t
+small_free_scan_madvise_collect(region_t r, uintptr_t from, mvm_madvise_batch_t *batch)
 {
 	uintptr_t start = (uintptr_t)SMALL_REGION_ADDRESS(r);
 	uintptr_t current = start;
 	uintptr_t limit = (uintptr_t)SMALL_REGION_END(r);
 	msize_t *meta_headers = SMALL_META_HEADER_FOR_PTR(start);
-	small_pg_pair_t advisory[((SMALL_REGION_PAYLOAD_BYTES + vm_kernel_page_size - 1) >> vm_kernel_page_shift) >>
-							 1]; // 4096bytes stack allocated
-	int advisories = 0;
 
-	// Scan the metadata identifying blocks which span one or more pages. Mark the pages MADV_FREE taking care to preserve free list
-	// management data.
+	// Scan the metadata identifying blocks which span one or more pages.
 	while (current < limit) {
+		uintptr_t pgLo, pgHi;
 		unsigned index = SMALL_META_INDEX_FOR_PTR(current);
 		msize_t msize_and_free = meta_headers[index];
 		boolean_t is_free = msize_and_free & SMALL_IS_FREE;
 		msize_t msize = msize_and_free & ~SMALL_IS_FREE;
 
 		if (is_free && !msize && (current == start)) {
-#if DEBUG_MALLOC
 			// first block is all free
+#if DEBUG_MALLOC
 			malloc_printf("*** small_free_scan_madvise_free first block is all free! %p: msize=%d is_free =%d\n", (void *)current,
 						  msize, is_free);
 #endif
-			uintptr_t pgLo = round_page_kernel(start + sizeof(free_list_t) + sizeof(msize_t));
-			uintptr_t pgHi = trunc_page_kernel(start + SMALL_REGION_SIZE - sizeof(msize_t));
-
-			if (pgLo < pgHi) {
-				advisory[advisories].pnum = (pgLo - start) >> vm_kernel_page_shift;
-				advisory[advisories].size = (pgHi - pgLo) >> vm_kernel_page_shift;
-				advisories++;
-			}
-			break;
-		}
-		if (!msize) {
+			pgLo = round_page_kernel(start + sizeof(free_list_t) + sizeof(msize_t));
+			pgHi = trunc_page_kernel(start + SMALL_REGION_SIZE - sizeof(msize_t));
+			current = limit;
+		} else if (!msize) {
 #if DEBUG_MALLOC
 			malloc_printf(
 						  "*** small_free_scan_madvise_free error with %p: msize=%d is_free =%d\n", (void *)current, msize, is_free);
 #endif
 			break;
+		} else if (is_free) {
+			pgLo = round_page_kernel(current + sizeof(free_list_t) + sizeof(msize_t));
+			pgHi = trunc_page_kernel(current + SMALL_BYTES_FOR_MSIZE(msize) - sizeof(msize_t));
+			current += SMALL_BYTES_FOR_MSIZE(msize);
+		} else {
+			current += SMALL_BYTES_FOR_MSIZE(msize);
+			continue;
 		}
-		if (is_free) {
-			uintptr_t pgLo = round_page_kernel(current + sizeof(free_list_t) + sizeof(msize_t));
-			uintptr_t pgHi = trunc_page_kernel(current + SMALL_BYTES_FOR_MSIZE(msize) - sizeof(msize_t));
 
-			if (pgLo < pgHi) {
-				advisory[advisories].pnum = (pgLo - start) >> vm_kernel_page_shift;
-				advisory[advisories].size = (pgHi - pgLo) >> vm_kernel_page_shift;
-				advisories++;
-			}
+		pgLo = MAX(pgLo, from);
+		if (pgLo < pgHi && !mvm_madvise_batch_add(batch, pgLo, pgHi)) {
+			return pgLo;
 		}
-		current += SMALL_BYTES_FOR_MSIZE(msize);
 	}
+	return 0;
+}
 
-	if (advisories > 0) {
-		int i;
-
-		OSAtomicIncrement32Barrier(&(REGION_TRAILER_FOR_SMALL_REGION(r)->pinned_to_depot));
-		SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
-		for (i = 0; i < advisories; ++i) {
-			uintptr_t addr = (advisory[i].pnum << vm_page_quanta_shift) + start;
-			size_t size = advisory[i].size << vm_page_quanta_shift;
-
-			mvm_madvise_free(rack, r, addr, addr + size, NULL);
+void
+small_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
+{
+	mvm_madvise_batch_t batch;
+	uintptr_t from = 0;
+	boolean_t pinned = FALSE;
+
+	// So long as the following hold for this region:
+	// (1) No malloc()'s are ever performed from the depot (hence free pages remain free,)
+	// (2) The region is not handed over to a per-CPU magazine (where malloc()'s could be performed),
+	// (3) The entire region is not mumap()'d (so the madvise's are applied to the intended addresses),
+	// then the madvise opportunities collected below can be applied outside all locks.
+	// (1) is ensured by design, (2) and (3) are ensured by bumping the globally visible counter node->pinned_to_depot.
+	mvm_madvise_batch_init(&batch);
+	do {
+		from = small_free_scan_madvise_collect(r, from, &batch);
+		if (!batch.count) {
+			break;
+		}
+		if (!pinned) {
+			OSAtomicIncrement32Barrier(&(REGION_TRAILER_FOR_SMALL_REGION(r)->pinned_to_depot));
+			pinned = TRUE;
 		}
+		SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+		mvm_madvise_batch_flush(rack, &batch);
 		SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+	} while (from);
+
+	if (pinned) {
 		OSAtomicDecrement32Barrier(&(REGION_TRAILER_FOR_SMALL_REGION(r)->pinned_to_depot));
 	}
 }
@@ -688,7 +842,7 @@ small_find_msize_region(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag
 	free_list_t *free_list = small_mag_ptr->mag_free_list;
 	free_list_t *the_slot = free_list + slot;
 	free_list_t *limit;
-	unsigned bitmap;
+	int next_slot;
 
 	// Assumes we've locked the magazine
 	CHECK_MAGAZINE_PTR_LOCKED(szone, small_mag_ptr, __PRETTY_FUNCTION__);
@@ -701,34 +855,13 @@ small_find_msize_region(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag
 
 	// Mask off the bits representing slots holding free blocks smaller than
 	// the size we need.
-	if (rack->debug_flags & MALLOC_EXTENDED_SMALL_SLOTS) {
-		// BITMAPN_CTZ implementation
-		unsigned idx = slot >> 5;
-		bitmap = 0;
-		unsigned mask = ~((1 << (slot & 31)) - 1);
-		for (; idx < SMALL_BITMAP_WORDS; ++idx) {
-			bitmap = small_mag_ptr->mag_bitmap[idx] & mask;
-			if (bitmap != 0) {
-				break;
-			}
-			mask = ~0U;
-		}
-		// Check for fallthrough: No bits set in bitmap
-		if ((bitmap == 0) && (idx == SMALL_BITMAP_WORDS)) {
-			return NULL;
-		}
-
-		// Start looking at the first set bit, plus 32 bits for every word of
-		// zeroes or entries that were too small.
-		slot = BITMAP32_CTZ((&bitmap)) + (idx * 32);
-	} else {
-		bitmap = small_mag_ptr->mag_bitmap[0] & ~((1 << slot) - 1);
-		if (!bitmap) {
-			return NULL;
-		}
-
-		slot = BITMAP32_CTZ((&bitmap));
+	// Without MALLOC_EXTENDED_SMALL_SLOTS only the first word is ever
+	// populated, so one search over the whole bitmap serves both layouts.
+	next_slot = BITMAPN_FFS_FROM(small_mag_ptr->mag_bitmap, slot);
+	if (next_slot < 0) {
+		return NULL;
 	}
+	slot = (grain_t)next_slot;
 	limit = free_list + SMALL_FREE_SLOT_COUNT(rack) - 1;
 	free_list += slot;
 
@@ -778,13 +911,27 @@ small_get_region_from_depot(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t
 	region_t sparse_region;
 
 	while (1) {
-		sparse_region = small_find_msize_region(rack, depot_ptr, DEPOT_MAGAZINE_INDEX, msize);
-		if (NULL == sparse_region) { // Depot empty?
-			SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
-			return 0;
-		}
+#if CONFIG_NUMA_MAGAZINES
+		if (mag_numa_enabled) {
+			// Only take regions from this magazine's node.
+			node = mag_numa_depot_find(depot_ptr, mag_numa_magazine_node[mag_index],
+					SMALL_REGION_PAYLOAD_BYTES, SMALL_BYTES_FOR_MSIZE(msize));
+			if (NULL == node) { // Nothing here for this node?
+				SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				return 0;
+			}
+			sparse_region = SMALL_REGION_FOR_PTR(node);
+		} else
+#endif // CONFIG_NUMA_MAGAZINES
+		{
+			sparse_region = small_find_msize_region(rack, depot_ptr, DEPOT_MAGAZINE_INDEX, msize);
+			if (NULL == sparse_region) { // Depot empty?
+				SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				return 0;
+			}
 
-		node = REGION_TRAILER_FOR_SMALL_REGION(sparse_region);
+			node = REGION_TRAILER_FOR_SMALL_REGION(sparse_region);
+		}
 		if (0 >= node->pinned_to_depot) {
 			break;
 		}
@@ -911,6 +1058,7 @@ small_free_try_depot_unmap_no_lock(rack_t *rack, magazine_t *depot_ptr, region_t
 			return NULL;
 		}
 		*pSlot = HASHRING_REGION_DEALLOCATED;
+		rack_region_map_remove(rack, sparse_region);
 		depot_ptr->num_bytes_in_magazine -= SMALL_REGION_PAYLOAD_BYTES;
 		// Atomically increment num_regions_dealloc
 #ifdef __LP64___
@@ -1067,7 +1215,154 @@ small_free_try_recirc_to_depot(rack_t *rack,
 }
 #endif // CONFIG_RECIRC_DEPOT
 
-static MALLOC_INLINE boolean_t
+#if CONFIG_MAGAZINE_SCAVENGER
+/*
+ * Return the free pages of one idle region until "*budget" runs out, resuming
+ * at the block at node->scavenge_offset and skipping pages below
+ * node->scavenge_advised. The magazine lock is held throughout, so the free
+ * blocks cannot be handed out while their pages are being advised. Returns
+ * TRUE when the whole region has been covered.
+ */
+static boolean_t
+small_scavenge_region_no_lock(rack_t *rack, region_t r, region_trailer_t *node, size_t *budget, size_t *pages)
+{
+	uintptr_t start = (uintptr_t)SMALL_REGION_ADDRESS(r);
+	uintptr_t current = start + node->scavenge_offset;
+	uintptr_t advised = start + node->scavenge_advised;
+	uintptr_t limit = (uintptr_t)SMALL_REGION_END(r);
+	msize_t *meta_headers = SMALL_META_HEADER_FOR_PTR(start);
+
+	// The region's generation should keep the block boundaries from having
+	// moved since the last visit; should the saved offset be no longer a block
+	// start all the same, walk the region again from the top.
+	if (current != start) {
+		msize_t resume = meta_headers[SMALL_META_INDEX_FOR_PTR(current)];
+
+		if (!(resume & ~SMALL_IS_FREE) || (resume & SMALL_IS_CLASS)) {
+			current = advised = start;
+		}
+	}
+
+	while (current < limit && *budget) {
+		uintptr_t next, pgLo = 0, pgHi = 0;
+		msize_t msize_and_free = meta_headers[SMALL_META_INDEX_FOR_PTR(current)];
+		boolean_t is_free = msize_and_free & SMALL_IS_FREE;
+		msize_t msize = msize_and_free & ~SMALL_IS_FREE;
+
+#if CONFIG_SMALL_CLASSES
+		if (msize_and_free & SMALL_IS_CLASS) {
+			// A slot inside a size-class run. Its header holds the slot's
+			// class and index, not an msize; step over the whole run, which
+			// is an in-use block.
+			small_class_run_t *run = small_class_run_for_slot((void *)current, msize_and_free);
+
+			current = (uintptr_t)run + SMALL_BYTES_FOR_MSIZE(meta_headers[SMALL_META_INDEX_FOR_PTR(run)]);
+			continue;
+		}
+#endif
+
+		if (is_free && !msize && (current == start)) {
+			// first block is all free
+			pgLo = round_page_kernel(start + sizeof(free_list_t) + sizeof(msize_t));
+			pgHi = trunc_page_kernel(limit - sizeof(msize_t));
+			next = limit;
+		} else if (!msize) {
+			// Not a block start; give up on the rest of the region rather
+			// than guess where the next block begins.
+			next = limit;
+		} else {
+			if (is_free) {
+				pgLo = round_page_kernel(current + sizeof(free_list_t) + sizeof(msize_t));
+				pgHi = trunc_page_kernel(current + SMALL_BYTES_FOR_MSIZE(msize) - sizeof(msize_t));
+			}
+			next = current + SMALL_BYTES_FOR_MSIZE(msize);
+		}
+
+		pgLo = MAX(pgLo, advised);
+		pgHi = MIN(pgHi, limit);
+		if (pgLo < pgHi) {
+			size_t n = MIN((pgHi - pgLo) >> vm_kernel_page_shift, *budget);
+
+			advised = pgLo + (n << vm_kernel_page_shift);
+			mvm_madvise_release(rack, r, pgLo, advised);
+			*budget -= n;
+			*pages += n;
+			if (advised < pgHi) {
+				break; // out of budget part way through this block
+			}
+		}
+		current = next;
+	}
+
+	if (current < limit) {
+		node->scavenge_offset = (uint32_t)(current - start);
+		node->scavenge_advised = (uint32_t)(advised - start);
+		return FALSE;
+	}
+	node->scavenge_offset = node->scavenge_advised = 0;
+	return TRUE;
+}
+
+/*
+ * Age the regions of one locked magazine, returning the free pages of those
+ * that have sat unchanged for MAGAZINE_SCAVENGE_IDLE_TICKS ticks while the
+ * budget lasts. Returns TRUE if the budget ran out part way through a region
+ * and the caller should come back after dropping the lock.
+ */
+static boolean_t
+small_scavenge_magazine_no_lock(rack_t *rack, magazine_t *small_mag_ptr, uint32_t tick, size_t *budget, size_t *pages)
+{
+	region_trailer_t *node;
+
+	for (node = small_mag_ptr->firstNode; node; node = node->next) {
+		region_t r = SMALL_REGION_FOR_PTR(node);
+
+		if (r == small_mag_ptr->mag_last_region || node->pinned_to_depot) {
+			continue;
+		}
+		if (node->generation != node->scavenge_generation || 0 == node->scavenge_since) {
+			node->scavenge_generation = node->generation;
+			node->scavenge_since = tick;
+			node->scavenge_offset = node->scavenge_advised = 0;
+			continue;
+		}
+		if (node->scavenge_since == SCAVENGE_CLEAN || tick - node->scavenge_since < MAGAZINE_SCAVENGE_IDLE_TICKS ||
+			0 == *budget) {
+			continue;
+		}
+		if (!small_scavenge_region_no_lock(rack, r, node, budget, pages)) {
+			return TRUE;
+		}
+		node->scavenge_since = SCAVENGE_CLEAN;
+	}
+	return FALSE;
+}
+
+size_t
+small_scavenge(rack_t *rack, uint32_t tick, size_t max_pages)
+{
+	size_t pages = 0;
+	mag_index_t mag_index;
+
+	for (mag_index = DEPOT_MAGAZINE_INDEX; mag_index < rack->num_magazines; mag_index++) {
+		magazine_t *small_mag_ptr = &rack->magazines[mag_index];
+		boolean_t more;
+
+		// With the budget spent this still ages the regions, it just leaves
+		// them be.
+		do {
+			size_t budget = MIN(max_pages - pages, MAGAZINE_SCAVENGE_LOCK_PAGES);
+
+			SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
+			more = small_scavenge_magazine_no_lock(rack, small_mag_ptr, tick, &budget, &pages);
+			SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
+		} while (more);
+	}
+	return pages;
+}
+#endif // CONFIG_MAGAZINE_SCAVENGER
+
+boolean_t
 small_free_no_lock(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_index, region_t region, void *ptr, msize_t msize)
 {
 	msize_t *meta_headers = SMALL_META_HEADER_FOR_PTR(ptr);
@@ -1119,11 +1414,16 @@ small_free_no_lock(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_inde
 		msize += next_msize;
 	}
 
+#if CONFIG_KNOWN_ZERO_PAGES
+	// The freed bytes, and any linkage the next block leaves behind, are dirty.
+	small_zero_granules_unmark(region, (uintptr_t)next_block - original_size, (uintptr_t)next_block + SMALL_FREE_HEAD_BYTES);
+#endif // CONFIG_KNOWN_ZERO_PAGES
+
 	if (rack->debug_flags & MALLOC_DO_SCRIBBLE) {
 		if (!msize) {
 			szone_error(rack->debug_flags, 1, "incorrect size information - block header was damaged", ptr, NULL);
 		} else {
-			memset(ptr, SCRABBLE_BYTE, SMALL_BYTES_FOR_MSIZE(msize));
+			malloc_fill(ptr, SCRABBLE_BYTE, SMALL_BYTES_FOR_MSIZE(msize));
 		}
 	}
 
@@ -1137,6 +1437,7 @@ small_free_no_lock(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_inde
 	region_trailer_t *node = REGION_TRAILER_FOR_SMALL_REGION(region);
 	size_t bytes_used = node->bytes_used - original_size;
 	node->bytes_used = (unsigned int)bytes_used;
+	REGION_TRAILER_CHANGED(node);
 
 #if CONFIG_AGGRESSIVE_MADVISE
 	small_madvise_free_range_no_lock(rack, small_mag_ptr, region, freee, msize, original_ptr, original_size);
@@ -1152,6 +1453,199 @@ small_free_no_lock(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_inde
 	return needs_unlock;
 }
 
+#if CONFIG_SMALL_CLASSES
+/*
+ * small_class_run_init - Turns the in-use block at ptr, just handed out by the
+ * generic allocator, into a run of empty slots of the given class. The block
+ * itself stops being accounted for; from here on only its slots are.
+ */
+static small_class_run_t *
+small_class_run_init(magazine_t *small_mag_ptr, void *ptr, grain_t class_index)
+{
+	msize_t *meta_headers = SMALL_META_HEADER_FOR_PTR(ptr);
+	unsigned index = SMALL_META_INDEX_FOR_PTR(ptr);
+	msize_t run_msize = meta_headers[index];
+	msize_t class_msize = small_class_msize[class_index];
+	small_class_run_t *run = (small_class_run_t *)ptr;
+	unsigned slot;
+
+	run->class_index = (uint8_t)class_index;
+	run->num_slots = (uint8_t)small_class_run_slots(class_msize);
+	run->free_slots = small_class_run_all_slots(run);
+	run->next = run->prev = NULL;
+	run->linked = FALSE;
+
+	// The block may have been carved from coalesced blocks whose old headers
+	// are still in place; clear them so nothing but slots remains.
+	memset(&meta_headers[index + 1], 0, (run_msize - 1) * sizeof(msize_t));
+	for (slot = 0; slot < run->num_slots; slot++) {
+		meta_headers[index + 1 + slot * class_msize] = SMALL_CLASS_META(class_index, slot) | SMALL_IS_FREE;
+	}
+
+	region_trailer_t *node = REGION_TRAILER_FOR_SMALL_REGION(SMALL_REGION_FOR_PTR(ptr));
+	node->bytes_used -= SMALL_BYTES_FOR_MSIZE(run_msize);
+	REGION_TRAILER_CHANGED(node);
+	small_mag_ptr->mag_num_bytes_in_objects -= SMALL_BYTES_FOR_MSIZE(run_msize);
+	small_mag_ptr->mag_num_objects--;
+	return run;
+}
+
+static MALLOC_INLINE void *
+small_class_run_take_slot(magazine_t *small_mag_ptr, small_class_run_t *run)
+{
+	unsigned slot = __builtin_ctzll(run->free_slots);
+	msize_t class_msize = small_class_msize[run->class_index];
+	void *ptr = (unsigned char *)run + SMALL_BYTES_FOR_MSIZE(1 + slot * class_msize);
+	size_t bytes = SMALL_BYTES_FOR_MSIZE(class_msize);
+
+	run->free_slots &= ~(1ULL << slot);
+	if (!run->free_slots && run->linked) {
+		small_class_run_unlink(small_mag_ptr, run);
+	}
+	*SMALL_METADATA_FOR_PTR(ptr) = SMALL_CLASS_META(run->class_index, slot);
+
+	small_mag_ptr->mag_num_objects++;
+	small_mag_ptr->mag_num_bytes_in_objects += bytes;
+
+	// Update this region's bytes in use count
+	region_trailer_t *node = REGION_TRAILER_FOR_SMALL_REGION(SMALL_REGION_FOR_PTR(ptr));
+	size_t bytes_used = node->bytes_used + bytes;
+	node->bytes_used = (unsigned int)bytes_used;
+	REGION_TRAILER_CHANGED(node);
+
+	// Emptiness discriminant
+	if (bytes_used >= DENSITY_THRESHOLD(SMALL_REGION_PAYLOAD_BYTES)) {
+		node->recirc_suitable = FALSE;
+	}
+	return ptr;
+}
+
+/*
+ * small_class_malloc_should_clear - Hands out a slot of the class covering
+ * msize from the calling thread's magazine. When the magazine has no run with
+ * a free slot, a new run is allocated like any other block and set up under
+ * the lock of whichever magazine owns its region by then.
+ */
+static void *
+small_class_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requested)
+{
+	grain_t class_index = small_class_for_msize[msize];
+	mag_index_t mag_index = rack_get_thread_index(rack);
+	magazine_t *small_mag_ptr = &(rack->magazines[mag_index]);
+	small_class_run_t *run;
+	void *ptr;
+
+	SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	if (small_mag_ptr->mag_remote_free) {
+		small_remote_free_drain_no_lock(rack, small_mag_ptr, mag_index);
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
+	run = small_mag_ptr->mag_class_runs[class_index];
+	if (!run) {
+		msize_t class_msize = small_class_msize[class_index];
+		msize_t run_msize = 1 + small_class_run_slots(class_msize) * class_msize;
+
+		SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
+		ptr = small_malloc_should_clear(rack, run_msize, FALSE);
+		if (!ptr) {
+			return NULL;
+		}
+
+		region_t region = SMALL_REGION_FOR_PTR(ptr);
+		small_mag_ptr = mag_lock_zine_for_region_trailer(rack->magazines, REGION_TRAILER_FOR_SMALL_REGION(region),
+				MAGAZINE_INDEX_FOR_SMALL_REGION(region));
+		run = small_class_run_init(small_mag_ptr, ptr, class_index);
+		if (DEPOT_MAGAZINE_INDEX != MAGAZINE_INDEX_FOR_SMALL_REGION(region)) {
+			small_class_run_link(small_mag_ptr, run);
+		}
+	}
+
+	ptr = small_class_run_take_slot(small_mag_ptr, run);
+	SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
+	CHECK(szone, __PRETTY_FUNCTION__);
+	if (cleared_requested) {
+		malloc_clear(ptr, SMALL_BYTES_FOR_MSIZE(msize));
+	}
+	return ptr;
+}
+
+/*
+ * small_class_free_no_lock - Returns the slot at ptr to its run; same contract
+ * as small_free_no_lock. A run left empty goes back to the free lists as an
+ * ordinary block, unless it is the only run its magazine has for the class.
+ */
+static boolean_t
+small_class_free_no_lock(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_index, region_t region, void *ptr)
+{
+	msize_t *meta = SMALL_METADATA_FOR_PTR(ptr);
+	msize_t slot_meta = *meta;
+	small_class_run_t *run = small_class_run_for_slot(ptr, slot_meta);
+	size_t bytes = SMALL_BYTES_FOR_MSIZE(small_class_msize[run->class_index]);
+	region_trailer_t *node = REGION_TRAILER_FOR_SMALL_REGION(region);
+
+	MALLOC_TRACE(TRACE_small_free, (uintptr_t)rack, (uintptr_t)small_mag_ptr, (uintptr_t)ptr, bytes);
+
+	if (rack->debug_flags & MALLOC_DO_SCRIBBLE) {
+		malloc_fill(ptr, SCRABBLE_BYTE, bytes);
+	}
+
+	*meta = slot_meta | SMALL_IS_FREE;
+	run->free_slots |= 1ULL << SMALL_CLASS_META_SLOT(slot_meta);
+
+	small_mag_ptr->mag_num_bytes_in_objects -= bytes;
+	small_mag_ptr->mag_num_objects--;
+	node->bytes_used -= bytes;
+	REGION_TRAILER_CHANGED(node);
+
+	if (run->free_slots == small_class_run_all_slots(run) &&
+			(DEPOT_MAGAZINE_INDEX == mag_index || small_mag_ptr->mag_class_runs[run->class_index] != run || run->next)) {
+		msize_t *meta_headers = SMALL_META_HEADER_FOR_PTR(run);
+		unsigned index = SMALL_META_INDEX_FOR_PTR(run);
+		msize_t run_msize = meta_headers[index];
+
+		if (run->linked) {
+			small_class_run_unlink(small_mag_ptr, run);
+		}
+		memset(&meta_headers[index + 1], 0, (run_msize - 1) * sizeof(msize_t));
+
+		// Account for the run as the block it was allocated as, and free that.
+		node->bytes_used += SMALL_BYTES_FOR_MSIZE(run_msize);
+		small_mag_ptr->mag_num_bytes_in_objects += SMALL_BYTES_FOR_MSIZE(run_msize);
+		small_mag_ptr->mag_num_objects++;
+		return small_free_no_lock(rack, small_mag_ptr, mag_index, region, run, run_msize);
+	}
+
+	if (!run->linked && DEPOT_MAGAZINE_INDEX != mag_index) {
+		small_class_run_link(small_mag_ptr, run);
+	}
+
+#if CONFIG_RECIRC_DEPOT
+	if (DEPOT_MAGAZINE_INDEX != mag_index) {
+		return small_free_try_recirc_to_depot(rack, small_mag_ptr, mag_index, region, (free_list_t){ .p = NULL }, 0, ptr, bytes);
+	}
+#endif
+	return TRUE;
+}
+#endif // CONFIG_SMALL_CLASSES
+
+/*
+ * small_free_block_no_lock - small_free_no_lock for a block that may be a
+ * size-class slot.
+ */
+static MALLOC_INLINE boolean_t
+small_free_block_no_lock(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_index, region_t region, void *ptr, msize_t msize)
+{
+#if CONFIG_SMALL_CLASSES
+	if (*SMALL_METADATA_FOR_PTR(ptr) & SMALL_IS_CLASS) {
+		return small_class_free_no_lock(rack, small_mag_ptr, mag_index, region, ptr);
+	}
+#endif
+	return small_free_no_lock(rack, small_mag_ptr, mag_index, region, ptr, msize);
+}
+
 // Allocates from the last region or a freshly allocated region
 static void *
 small_malloc_from_region_no_lock(rack_t *rack,
@@ -1172,6 +1666,9 @@ small_malloc_from_region_no_lock(rack_t *rack,
 	// and so put it under the protection of the magazine lock we are holding.
 	// Do this before advertising "aligned_address" on the hash ring(!)
 	MAGAZINE_INDEX_FOR_SMALL_REGION(aligned_address) = mag_index;
+#if CONFIG_NUMA_MAGAZINES
+	REGION_TRAILER_FOR_SMALL_REGION(aligned_address)->numa_node = mag_numa_magazine_node[mag_index];
+#endif // CONFIG_NUMA_MAGAZINES
 
 	// Insert the new region into the hash ring
 	rack_region_insert(rack, (region_t)aligned_address);
@@ -1228,7 +1725,23 @@ small_memalign(szone_t *szone, size_t alignment, size_t size, size_t span)
 	}
 
 	msize_t mspan = SMALL_MSIZE_FOR_BYTES(span + SMALL_QUANTUM - 1);
-	void *p = szone_malloc(szone, span); // avoid inlining small_malloc_should_clear(szone, mspan, 0);
+	void *p;
+
+#if CONFIG_SMALL_CLASSES
+	if ((szone->debug_flags & MALLOC_SMALL_CLASSES) && mspan <= SMALL_CLASS_MAX_MSIZE) {
+		// A slot cannot be split, so take an ordinary block too large for any
+		// class; the excess goes back to the free list below.
+		mspan = SMALL_CLASS_MAX_MSIZE + 1;
+		p = small_malloc_should_clear(&szone->small_rack, mspan, 0);
+		if (p && (szone->debug_flags & MALLOC_DO_SCRIBBLE)) {
+			// szone_malloc would have scribbled on it
+			malloc_fill(p, SCRIBBLE_BYTE, SMALL_BYTES_FOR_MSIZE(mspan));
+		}
+	} else
+#endif // CONFIG_SMALL_CLASSES
+	{
+		p = szone_malloc(szone, span); // avoid inlining small_malloc_should_clear(szone, mspan, 0);
+	}
 
 	if (NULL == p) {
 		return NULL;
@@ -1284,6 +1797,19 @@ small_try_shrink_in_place(rack_t *rack, void *ptr, size_t old_size, size_t new_g
 	msize_t new_msize = SMALL_MSIZE_FOR_BYTES(new_good_size);
 	msize_t mshrinkage = SMALL_MSIZE_FOR_BYTES(old_size) - new_msize;
 
+#if CONFIG_SMALL_CLASSES
+	if (*SMALL_METADATA_FOR_PTR(ptr) & SMALL_IS_CLASS) {
+		// Slots cannot be split; move to a slot of the smaller class instead.
+		void *q = small_malloc_should_clear(rack, new_msize, FALSE);
+		if (q) {
+			memcpy(q, ptr, new_good_size);
+			free_small(rack, ptr, SMALL_REGION_FOR_PTR(ptr), 0);
+			return q;
+		}
+		return ptr;
+	}
+#endif // CONFIG_SMALL_CLASSES
+
 	if (mshrinkage) {
 		void *q = (void *)((uintptr_t)ptr + SMALL_BYTES_FOR_MSIZE(new_msize));
 		magazine_t *small_mag_ptr = mag_lock_zine_for_region_trailer(rack->magazines,
@@ -1324,6 +1850,11 @@ small_try_realloc_in_place(rack_t *rack, void *ptr, size_t old_size, size_t new_
 	if (next_index >= NUM_SMALL_BLOCKS) {
 		return 0;
 	}
+#if CONFIG_SMALL_CLASSES
+	if (meta_headers[index] & SMALL_IS_CLASS) {
+		return 0; // a slot only ever grows into a larger class
+	}
+#endif
 	next_block = (char *)ptr + old_size;
 
 #if DEBUG_MALLOC
@@ -1389,6 +1920,7 @@ small_try_realloc_in_place(rack_t *rack, void *ptr, size_t old_size, size_t new_
 	region_trailer_t *node = REGION_TRAILER_FOR_SMALL_REGION(SMALL_REGION_FOR_PTR(ptr));
 	size_t bytes_used = node->bytes_used + SMALL_BYTES_FOR_MSIZE(new_msize - old_msize);
 	node->bytes_used = (unsigned int)bytes_used;
+	REGION_TRAILER_CHANGED(node);
 
 	// Emptiness discriminant
 	if (bytes_used < DENSITY_THRESHOLD(SMALL_REGION_PAYLOAD_BYTES)) {
@@ -1440,7 +1972,11 @@ small_check_region(rack_t *rack, region_t region)
 				return 0;
 			}
 #if !CONFIG_RELAXED_INVARIANT_CHECKS
-			if (SMALL_BYTES_FOR_MSIZE(msize) > szone->large_threshold) {
+			if (SMALL_BYTES_FOR_MSIZE(msize) > szone->large_threshold
+#if CONFIG_SMALL_CLASSES
+					&& !small_class_run_for_block(meta_headers, index, msize, ptr)
+#endif
+					) {
 				malloc_printf("*** invariant broken for %p this small msize=%d - size is too large\n", ptr, msize_and_free);
 				return 0;
 			}
@@ -1598,6 +2134,28 @@ small_in_use_enumerator(task_t task,
 				while (block_index < block_limit) {
 					msize_and_free = block_header[block_index];
 					msize = msize_and_free & ~SMALL_IS_FREE;
+#if CONFIG_SMALL_CLASSES
+					if (!(msize_and_free & SMALL_IS_FREE) && msize > 1 && (block_header[block_index + 1] & SMALL_IS_CLASS)) {
+						// A run; report its allocated slots rather than the run itself
+						unsigned slot_index = block_index + 1;
+						while (slot_index < block_index + msize) {
+							msize_t slot_meta = block_header[slot_index];
+							msize_t class_msize = small_class_msize[SMALL_CLASS_META_CLASS(slot_meta)];
+							if (!(slot_meta & SMALL_IS_FREE)) {
+								buffer[count].address = range.address + SMALL_BYTES_FOR_MSIZE(slot_index);
+								buffer[count].size = SMALL_BYTES_FOR_MSIZE(class_msize);
+								count++;
+								if (count >= MAX_RECORDER_BUFFER) {
+									recorder(task, context, MALLOC_PTR_IN_USE_RANGE_TYPE, buffer, count);
+									count = 0;
+								}
+							}
+							slot_index += class_msize;
+						}
+						block_index += msize;
+						continue;
+					}
+#endif // CONFIG_SMALL_CLASSES
 					if (!(msize_and_free & SMALL_IS_FREE) &&
 						range.address + SMALL_BYTES_FOR_MSIZE(block_index) != mag_last_free_ptr) {
 						// Block in use
@@ -1625,7 +2183,7 @@ small_in_use_enumerator(task_t task,
 	return 0;
 }
 
-static void *
+void *
 small_malloc_from_free_list(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_index, msize_t msize)
 {
 	msize_t this_msize;
@@ -1633,7 +2191,7 @@ small_malloc_from_free_list(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t
 	free_list_t *free_list = small_mag_ptr->mag_free_list;
 	free_list_t *the_slot = free_list + slot;
 	free_list_t *limit;
-	unsigned bitmap;
+	int next_slot;
 	msize_t leftover_msize;
 	void *leftover_ptr;
 	void *ptr;
@@ -1653,34 +2211,13 @@ small_malloc_from_free_list(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t
 	// Mask off the bits representing slots holding free blocks smaller than
 	// the size we need.  If there are no larger free blocks, try allocating
 	// from the free space at the end of the small region.
-	if (rack->debug_flags & MALLOC_EXTENDED_SMALL_SLOTS) {
-		// BITMAPN_CTZ implementation
-		unsigned idx = slot >> 5;
-		bitmap = 0;
-		unsigned mask = ~((1 << (slot & 31)) - 1);
-		for (; idx < SMALL_BITMAP_WORDS; ++idx) {
-			bitmap = small_mag_ptr->mag_bitmap[idx] & mask;
-			if (bitmap != 0) {
-				break;
-			}
-			mask = ~0U;
-		}
-		// Check for fallthrough: No bits set in bitmap
-		if ((bitmap == 0) && (idx == SMALL_BITMAP_WORDS)) {
-			goto try_small_from_end;
-		}
-
-		// Start looking at the first set bit, plus 32 bits for every word of
-		// zeroes or entries that were too small.
-		slot = BITMAP32_CTZ((&bitmap)) + (idx * 32);
-	} else {
-		bitmap = small_mag_ptr->mag_bitmap[0] & ~((1 << slot) - 1);
-		if (!bitmap) {
-			goto try_small_from_end;
-		}
-
-		slot = BITMAP32_CTZ((&bitmap));
+	// Without MALLOC_EXTENDED_SMALL_SLOTS only the first word is ever
+	// populated, so one search over the whole bitmap serves both layouts.
+	next_slot = BITMAPN_FFS_FROM(small_mag_ptr->mag_bitmap, slot);
+	if (next_slot < 0) {
+		goto try_small_from_end;
 	}
+	slot = (grain_t)next_slot;
 	// FIXME: Explain use of - 1 here, last slot has special meaning
 	limit = free_list + SMALL_FREE_SLOT_COUNT(rack) - 1;
 	free_list += slot;
@@ -1748,6 +2285,7 @@ return_small_alloc:
 	region_trailer_t *node = REGION_TRAILER_FOR_SMALL_REGION(SMALL_REGION_FOR_PTR(ptr));
 	size_t bytes_used = node->bytes_used + SMALL_BYTES_FOR_MSIZE(this_msize);
 	node->bytes_used = (unsigned int)bytes_used;
+	REGION_TRAILER_CHANGED(node);
 
 	// Emptiness discriminant
 	if (bytes_used < DENSITY_THRESHOLD(SMALL_REGION_PAYLOAD_BYTES)) {
@@ -1767,17 +2305,79 @@ return_small_alloc:
 	return ptr;
 }
 
+#if CONFIG_KNOWN_ZERO_PAGES
+/*
+ * small_block_known_zero_no_lock - Whether a block just taken from the free
+ * list lies in known-zero granules, so that only its head can be dirty. Counts
+ * the clearing that this saves.
+ */
+static boolean_t
+small_block_known_zero_no_lock(magazine_t *small_mag_ptr, void *ptr, msize_t msize)
+{
+	size_t bytes = SMALL_BYTES_FOR_MSIZE(msize);
+	region_t region = SMALL_REGION_FOR_PTR(ptr);
+
+	if (!region_zero_granules_test(REGION_TRAILER_FOR_SMALL_REGION(region), (uintptr_t)region, SMALL_ZERO_GRANULE_SHIFT,
+				(uintptr_t)ptr, (uintptr_t)ptr + bytes)) {
+		return FALSE;
+	}
+	small_mag_ptr->mag_bytes_clear_avoided += bytes - SMALL_FREE_HEAD_BYTES;
+	return TRUE;
+}
+#endif // CONFIG_KNOWN_ZERO_PAGES
+
+/*
+ * small_calloc_clear - Clears a block for calloc(), or only the free list
+ * linkage at its head when the rest is known to be zero.
+ */
+static MALLOC_INLINE void
+small_calloc_clear(void *ptr, msize_t msize, boolean_t known_zero)
+{
+#if CONFIG_KNOWN_ZERO_PAGES
+	if (known_zero) {
+		malloc_clear(ptr, SMALL_FREE_HEAD_BYTES);
+		return;
+	}
+#endif // CONFIG_KNOWN_ZERO_PAGES
+	malloc_clear(ptr, SMALL_BYTES_FOR_MSIZE(msize));
+}
+
 void *
 small_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requested)
 {
 	void *ptr;
-	mag_index_t mag_index = mag_get_thread_index() % rack->num_magazines;
+	boolean_t known_zero = FALSE;
+	mag_index_t mag_index = rack_get_thread_index(rack);
 	magazine_t *small_mag_ptr = &(rack->magazines[mag_index]);
 
 	MALLOC_TRACE(TRACE_small_malloc, (uintptr_t)rack, SMALL_BYTES_FOR_MSIZE(msize), (uintptr_t)small_mag_ptr, cleared_requested);
 
+#if CONFIG_SMALL_CLASSES
+	if ((rack->debug_flags & MALLOC_SMALL_CLASSES) && msize <= SMALL_CLASS_MAX_MSIZE) {
+		return small_class_malloc_should_clear(rack, msize, cleared_requested);
+	}
+#endif // CONFIG_SMALL_CLASSES
+
+#if CONFIG_MAGAZINE_TCACHE
+	if ((rack->debug_flags & MALLOC_THREAD_CACHE) && msize <= MAGAZINE_TCACHE_SMALL_SLOTS) {
+		ptr = rack_tcache_malloc(rack, msize);
+		if (ptr) {
+			if (cleared_requested) {
+				malloc_clear(ptr, SMALL_BYTES_FOR_MSIZE(msize));
+			}
+			return ptr;
+		}
+	}
+#endif /* CONFIG_MAGAZINE_TCACHE */
+
 	SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	if (small_mag_ptr->mag_remote_free) {
+		small_remote_free_drain_no_lock(rack, small_mag_ptr, mag_index);
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 #if CONFIG_SMALL_CACHE
 	ptr = (void *)small_mag_ptr->mag_last_free;
 
@@ -1789,19 +2389,33 @@ small_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_request
 		CHECK(szone, __PRETTY_FUNCTION__);
 		ptr = (void *)((uintptr_t)ptr & ~(SMALL_QUANTUM - 1));
 		if (cleared_requested) {
-			memset(ptr, 0, SMALL_BYTES_FOR_MSIZE(msize));
+			malloc_clear(ptr, SMALL_BYTES_FOR_MSIZE(msize));
 		}
 		return ptr;
 	}
 #endif /* CONFIG_SMALL_CACHE */
 
 	while (1) {
+		// Blocks carved from mag_bytes_free_at_end have not been touched since
+		// their region was mapped, so they are still zero.
+		size_t pristine_bytes = small_mag_ptr->mag_bytes_free_at_end;
+		uintptr_t pristine = (uintptr_t)SMALL_REGION_END(small_mag_ptr->mag_last_region) - pristine_bytes;
+
 		ptr = small_malloc_from_free_list(rack, small_mag_ptr, mag_index, msize);
 		if (ptr) {
+			if (cleared_requested && (uintptr_t)ptr - pristine < pristine_bytes) {
+				small_mag_ptr->mag_bytes_clear_avoided += SMALL_BYTES_FOR_MSIZE(msize);
+				cleared_requested = FALSE;
+			}
+#if CONFIG_KNOWN_ZERO_PAGES
+			if (cleared_requested) {
+				known_zero = small_block_known_zero_no_lock(small_mag_ptr, ptr, msize);
+			}
+#endif // CONFIG_KNOWN_ZERO_PAGES
 			SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
 			CHECK(szone, __PRETTY_FUNCTION__);
 			if (cleared_requested) {
-				memset(ptr, 0, SMALL_BYTES_FOR_MSIZE(msize));
+				small_calloc_clear(ptr, msize, known_zero);
 			}
 			return ptr;
 		}
@@ -1809,10 +2423,15 @@ small_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_request
 		if (small_get_region_from_depot(rack, small_mag_ptr, mag_index, msize)) {
 			ptr = small_malloc_from_free_list(rack, small_mag_ptr, mag_index, msize);
 			if (ptr) {
+#if CONFIG_KNOWN_ZERO_PAGES
+				if (cleared_requested) {
+					known_zero = small_block_known_zero_no_lock(small_mag_ptr, ptr, msize);
+				}
+#endif // CONFIG_KNOWN_ZERO_PAGES
 				SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
 				CHECK(szone, __PRETTY_FUNCTION__);
 				if (cleared_requested) {
-					memset(ptr, 0, SMALL_BYTES_FOR_MSIZE(msize));
+					small_calloc_clear(ptr, msize, known_zero);
 				}
 				return ptr;
 			}
@@ -1832,6 +2451,11 @@ small_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_request
 			OSMemoryBarrier();
 			SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
 			fresh_region = mvm_allocate_pages_securely(SMALL_REGION_SIZE, SMALL_BLOCKS_ALIGN, VM_MEMORY_MALLOC_SMALL, rack->debug_flags);
+#if CONFIG_NUMA_MAGAZINES
+			if (fresh_region && mag_numa_enabled) {
+				mvm_numa_bind(fresh_region, SMALL_REGION_SIZE, mag_numa_magazine_node[mag_index]);
+			}
+#endif // CONFIG_NUMA_MAGAZINES
 			SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
 
 			// DTrace USDT Probe
@@ -1847,6 +2471,9 @@ small_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_request
 			ptr = small_malloc_from_region_no_lock(rack, small_mag_ptr, mag_index, msize, fresh_region);
 
 			// we don't clear because this freshly allocated space is pristine
+			if (cleared_requested) {
+				small_mag_ptr->mag_bytes_clear_avoided += SMALL_BYTES_FOR_MSIZE(msize);
+			}
 			small_mag_ptr->alloc_underway = FALSE;
 			OSMemoryBarrier();
 			SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
@@ -1872,6 +2499,11 @@ small_size(rack_t *rack, const void *ptr)
 		if (msize_and_free & SMALL_IS_FREE) {
 			return 0;
 		}
+#if CONFIG_SMALL_CLASSES
+		if (msize_and_free & SMALL_IS_CLASS) {
+			return SMALL_BYTES_FOR_MSIZE(small_class_msize[SMALL_CLASS_META_CLASS(msize_and_free)]);
+		}
+#endif
 #if CONFIG_SMALL_CACHE
 		{
 			mag_index_t mag_index = MAGAZINE_INDEX_FOR_SMALL_REGION(SMALL_REGION_FOR_PTR(ptr));
@@ -1898,6 +2530,69 @@ small_size(rack_t *rack, const void *ptr)
 	return 0;
 }
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+/*
+ * small_remote_free_drain_no_lock - Frees the blocks other CPUs queued on this
+ * magazine's remote free list. Caller holds the magazine lock, and still holds
+ * it on return.
+ *
+ * A queued block's region may have moved on while it sat on the list. Blocks of
+ * regions now in the Depot are freed under the Depot lock (magazine lock first,
+ * then Depot, as everywhere else); blocks of regions that now belong to another
+ * magazine are simply queued on that magazine instead.
+ */
+void
+small_remote_free_drain_no_lock(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_index)
+{
+	remote_free_entry_t *entry = mag_remote_free_take(small_mag_ptr);
+
+	while (entry) {
+		remote_free_entry_t *next = entry->next;
+		void *ptr = (void *)entry;
+		msize_t msize = mag_remote_free_msize(rack, entry);
+
+		if (next == entry) {
+			// Queued twice in a row, which mag_remote_free_mark should have
+			// caught. Give up on the rest of the list rather than spin.
+			szone_error(rack->debug_flags, 1, "double free", ptr, NULL);
+			next = NULL;
+		}
+		region_t region = SMALL_REGION_FOR_PTR(ptr);
+		region_trailer_t *trailer = REGION_TRAILER_FOR_SMALL_REGION(region);
+		mag_index_t owner = trailer->mag_index;
+
+		if (owner == mag_index) {
+			if (SMALL_PTR_IS_FREE(ptr)) {
+				szone_error(rack->debug_flags, 1, "double free", ptr, NULL);
+			} else if (!small_free_block_no_lock(rack, small_mag_ptr, mag_index, region, ptr, msize)) {
+				// The region was recirculated and the lock dropped; take it back.
+				SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
+			}
+		} else if (owner == DEPOT_MAGAZINE_INDEX) {
+			magazine_t *depot_ptr = &(rack->magazines[DEPOT_MAGAZINE_INDEX]);
+
+			SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+			if (trailer->mag_index == DEPOT_MAGAZINE_INDEX) {
+				if (small_free_block_no_lock(rack, depot_ptr, DEPOT_MAGAZINE_INDEX, region, ptr, msize)) {
+					SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				}
+			} else {
+				// Adopted by some other magazine in the meantime. It cannot be
+				// this one, since that would have needed the lock we hold.
+				owner = trailer->mag_index;
+				SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				mag_remote_free_mark(rack, ptr, msize);
+				mag_remote_free_push(&(rack->magazines[owner]), ptr);
+			}
+		} else {
+			mag_remote_free_mark(rack, ptr, msize);
+			mag_remote_free_push(&(rack->magazines[owner]), ptr);
+		}
+		entry = next;
+	}
+}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 static MALLOC_NOINLINE void
 free_small_botch(rack_t *rack, void *ptr)
 {
@@ -1907,12 +2602,81 @@ free_small_botch(rack_t *rack, void *ptr)
 	szone_error(rack->debug_flags, 1, "double free", ptr, NULL);
 }
 
+#if CONFIG_SMALL_CLASSES
+static void
+free_small_class(rack_t *rack, void *ptr, region_t small_region)
+{
+	mag_index_t mag_index = MAGAZINE_INDEX_FOR_SMALL_REGION(small_region);
+	magazine_t *small_mag_ptr = &(rack->magazines[mag_index]);
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	boolean_t queued = FALSE;
+
+	if (mag_should_free_remotely(rack, mag_index)) {
+		// The slot's metadata says the rest, so there is no msize to stamp.
+		if (mag_remote_free_mark(rack, ptr, 0)) {
+			if (rack->debug_flags & MALLOC_DO_SCRIBBLE) {
+				size_t bytes = SMALL_BYTES_FOR_MSIZE(small_class_msize[SMALL_CLASS_META_CLASS(*SMALL_METADATA_FOR_PTR(ptr))]);
+
+				malloc_fill((char *)ptr + sizeof(remote_free_entry_t), SCRABBLE_BYTE, bytes - sizeof(remote_free_entry_t));
+			}
+			mag_remote_free_push(small_mag_ptr, ptr);
+			return;
+		}
+		queued = TRUE;
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
+	SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	if (DEPOT_MAGAZINE_INDEX != mag_index && small_mag_ptr->mag_remote_free) {
+		small_remote_free_drain_no_lock(rack, small_mag_ptr, mag_index);
+	}
+	if (queued && SMALL_PTR_IS_FREE(ptr)) {
+		free_small_botch(rack, ptr);
+		return;
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
+	// As in free_small, chase the region should it have changed hands.
+	region_trailer_t *trailer = REGION_TRAILER_FOR_SMALL_REGION(small_region);
+	mag_index_t refreshed_index;
+
+	while (mag_index != (refreshed_index = trailer->mag_index)) { // Note assignment
+		SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
+		mag_index = refreshed_index;
+		small_mag_ptr = &(rack->magazines[mag_index]);
+		SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
+	}
+
+	if (SMALL_PTR_IS_FREE(ptr)) {
+		free_small_botch(rack, ptr);
+		return;
+	}
+	if (small_class_free_no_lock(rack, small_mag_ptr, mag_index, small_region, ptr)) {
+		SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
+	}
+
+	CHECK(szone, __PRETTY_FUNCTION__);
+}
+#endif // CONFIG_SMALL_CLASSES
+
 void
 free_small(rack_t *rack, void *ptr, region_t small_region, size_t known_size)
 {
 	msize_t msize;
 	mag_index_t mag_index = MAGAZINE_INDEX_FOR_SMALL_REGION(SMALL_REGION_FOR_PTR(ptr));
 	magazine_t *small_mag_ptr = &(rack->magazines[mag_index]);
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	boolean_t queued = FALSE;
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
+#if CONFIG_SMALL_CLASSES
+	if ((rack->debug_flags & MALLOC_SMALL_CLASSES) && (*SMALL_METADATA_FOR_PTR(ptr) & SMALL_IS_CLASS)) {
+		free_small_class(rack, ptr, small_region);
+		return;
+	}
+#endif // CONFIG_SMALL_CLASSES
 
 	// ptr is known to be in small_region
 	if (known_size) {
@@ -1925,8 +2689,44 @@ free_small(rack_t *rack, void *ptr, region_t small_region, size_t known_size)
 		}
 	}
 
+#if CONFIG_MAGAZINE_TCACHE
+	// With MALLOC_SMALL_CLASSES the cache is never consulted for these sizes.
+	if ((rack->debug_flags & (MALLOC_THREAD_CACHE | MALLOC_SMALL_CLASSES)) == MALLOC_THREAD_CACHE &&
+			msize <= MAGAZINE_TCACHE_SMALL_SLOTS && rack_tcache_free(rack, ptr, msize)) {
+		return;
+	}
+#endif /* CONFIG_MAGAZINE_TCACHE */
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	// A block owned by another CPU's magazine is queued for that magazine rather
+	// than pulling its lock over here.
+	// A block that already looks queued is freed under the lock instead, where
+	// the drain turns a double free into a free block.
+	if (mag_should_free_remotely(rack, mag_index)) {
+		if (mag_remote_free_mark(rack, ptr, msize)) {
+			if (rack->debug_flags & MALLOC_DO_SCRIBBLE) {
+				malloc_fill((char *)ptr + sizeof(remote_free_entry_t), SCRABBLE_BYTE,
+						SMALL_BYTES_FOR_MSIZE(msize) - sizeof(remote_free_entry_t));
+			}
+			mag_remote_free_push(small_mag_ptr, ptr);
+			return;
+		}
+		queued = TRUE;
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 	SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	if (DEPOT_MAGAZINE_INDEX != mag_index && small_mag_ptr->mag_remote_free) {
+		small_remote_free_drain_no_lock(rack, small_mag_ptr, mag_index);
+	}
+	if (queued && SMALL_PTR_IS_FREE(ptr)) {
+		free_small_botch(rack, ptr);
+		return;
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 #if CONFIG_SMALL_CACHE
 	// Depot does not participate in CONFIG_SMALL_CACHE since it can't be directly malloc()'d
 	if (DEPOT_MAGAZINE_INDEX != mag_index) {
@@ -1940,7 +2740,7 @@ free_small(rack_t *rack, void *ptr, region_t small_region, size_t known_size)
 		}
 
 		if ((rack->debug_flags & MALLOC_DO_SCRIBBLE) && msize) {
-			memset(ptr, SCRABBLE_BYTE, SMALL_BYTES_FOR_MSIZE(msize));
+			malloc_fill(ptr, SCRABBLE_BYTE, SMALL_BYTES_FOR_MSIZE(msize));
 		}
 
 		small_mag_ptr->mag_last_free = (void *)(((uintptr_t)ptr) | msize);
@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "internal.h"
+
+#if CONFIG_MAGAZINE_TCACHE
+
+#define TCACHE_ALLOCATION_SIZE round_page_quanta(sizeof(magazine_tcache_t))
+
+/*********************	REFILL AND DRAIN	************************/
+
+/*
+ * tcache_refill_no_lock - Moves up to "count" blocks of the given msize from
+ * the magazine free lists onto the bin. Caller holds the magazine lock.
+ */
+static unsigned
+tcache_refill_no_lock(magazine_tcache_t *tc, magazine_t *mag_ptr, mag_index_t mag_index, msize_t msize, unsigned count)
+{
+	rack_t *rack = tc->rack;
+	tcache_bin_t *bin = &tc->bins[msize];
+	unsigned refilled = 0;
+
+	while (refilled < count) {
+		void *ptr;
+
+		if (rack->type == RACK_TYPE_TINY) {
+			ptr = tiny_malloc_from_free_list(rack, mag_ptr, mag_index, msize);
+		} else {
+			ptr = small_malloc_from_free_list(rack, mag_ptr, mag_index, msize);
+		}
+		if (!ptr) {
+			break;
+		}
+		*(void **)ptr = bin->head;
+		bin->head = ptr;
+		bin->count++;
+		refilled++;
+	}
+	tc->bytes_cached += ((size_t)refilled * msize) << tc->quantum_shift;
+	return refilled;
+}
+
+/*
+ * tcache_drain_bin - Returns up to "count" blocks from the bin to the magazines
+ * that own their regions. Consecutive blocks whose regions share a magazine are
+ * freed under a single acquisition of that magazine's lock.
+ */
+static void
+tcache_drain_bin(magazine_tcache_t *tc, msize_t msize, unsigned count)
+{
+	rack_t *rack = tc->rack;
+	tcache_bin_t *bin = &tc->bins[msize];
+	magazine_t *mag_ptr = NULL;
+	mag_index_t mag_index = DEPOT_MAGAZINE_INDEX;
+
+	while (count-- && bin->head) {
+		void *ptr = bin->head;
+		region_t region;
+		region_trailer_t *trailer;
+
+		bin->head = *(void **)ptr;
+		bin->count--;
+		tc->bytes_cached -= ((size_t)msize << tc->quantum_shift);
+
+		if (rack->type == RACK_TYPE_TINY) {
+			region = TINY_REGION_FOR_PTR(ptr);
+			trailer = REGION_TRAILER_FOR_TINY_REGION(region);
+		} else {
+			region = SMALL_REGION_FOR_PTR(ptr);
+			trailer = REGION_TRAILER_FOR_SMALL_REGION(region);
+		}
+
+		// Regions migrate between magazines, so only keep the lock we hold if
+		// it still covers this block's region.
+		if (mag_ptr && mag_index != trailer->mag_index) {
+			SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
+			mag_ptr = NULL;
+		}
+		if (!mag_ptr) {
+			mag_ptr = mag_lock_zine_for_region_trailer(rack->magazines, trailer, trailer->mag_index);
+			mag_index = trailer->mag_index;
+		}
+
+		boolean_t needs_unlock;
+		if (rack->type == RACK_TYPE_TINY) {
+			needs_unlock = tiny_free_no_lock(rack, mag_ptr, mag_index, region, ptr, msize);
+		} else {
+			needs_unlock = small_free_no_lock(rack, mag_ptr, mag_index, region, ptr, msize);
+		}
+		if (!needs_unlock) {
+			// The free recirculated the region to the depot and dropped the lock.
+			mag_ptr = NULL;
+		}
+	}
+
+	if (mag_ptr) {
+		SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
+	}
+}
+
+/*
+ * tcache_flush - Returns every cached block to the magazines. Caller holds
+ * tc->lock.
+ */
+static void
+tcache_flush(magazine_tcache_t *tc)
+{
+	for (msize_t msize = 1; msize < MAGAZINE_TCACHE_MAX_SLOTS; msize++) {
+		if (tc->bins[msize].count) {
+			tcache_drain_bin(tc, msize, tc->bins[msize].count);
+		}
+	}
+	tc->generation = tc->rack->tcache_generation;
+}
+
+/*********************	LIFECYCLE	************************/
+
+static void
+tcache_unlink(magazine_tcache_t *tc)
+{
+	rack_t *rack = tc->rack;
+
+	_malloc_lock_lock(&rack->tcache_lock);
+	if (tc->prev) {
+		tc->prev->next = tc->next;
+	} else {
+		rack->tcache_list = tc->next;
+	}
+	if (tc->next) {
+		tc->next->prev = tc->prev;
+	}
+	_malloc_lock_unlock(&rack->tcache_lock);
+}
+
+/*
+ * tcache_thread_exit - pthread key destructor, returns the exiting thread's
+ * cached blocks to the magazines.
+ */
+static void
+tcache_thread_exit(void *arg)
+{
+	magazine_tcache_t *tc = arg;
+
+	_malloc_lock_lock(&tc->lock);
+	tcache_flush(tc);
+	_malloc_lock_unlock(&tc->lock);
+	tcache_unlink(tc);
+	mvm_deallocate_pages(tc, TCACHE_ALLOCATION_SIZE, 0);
+}
+
+static magazine_tcache_t *
+tcache_create(rack_t *rack)
+{
+	// The cache is carved straight from the VM so that setting up a thread
+	// never recurses into malloc.
+	magazine_tcache_t *tc = mvm_allocate_pages(TCACHE_ALLOCATION_SIZE, 0, 0, VM_MEMORY_MALLOC);
+	if (!tc) {
+		return NULL;
+	}
+
+	_malloc_lock_init(&tc->lock);
+	tc->rack = rack;
+	tc->generation = rack->tcache_generation;
+	tc->quantum_shift = (rack->type == RACK_TYPE_TINY) ? SHIFT_TINY_QUANTUM : SHIFT_SMALL_QUANTUM;
+
+	_malloc_lock_lock(&rack->tcache_lock);
+	tc->prev = NULL;
+	tc->next = rack->tcache_list;
+	if (tc->next) {
+		tc->next->prev = tc;
+	}
+	rack->tcache_list = tc;
+	_malloc_lock_unlock(&rack->tcache_lock);
+
+	if (pthread_setspecific(rack->tcache_key, tc)) {
+		tcache_unlink(tc);
+		mvm_deallocate_pages(tc, TCACHE_ALLOCATION_SIZE, 0);
+		return NULL;
+	}
+	return tc;
+}
+
+void
+rack_tcache_init(rack_t *rack)
+{
+	rack->tcache_list = NULL;
+	rack->tcache_generation = 0;
+	_malloc_lock_init(&rack->tcache_lock);
+
+	if (!(rack->debug_flags & MALLOC_THREAD_CACHE)) {
+		return;
+	}
+	if (pthread_key_create(&rack->tcache_key, tcache_thread_exit)) {
+		malloc_printf("*** unable to create thread cache key, thread cache disabled\n");
+		rack->debug_flags &= ~MALLOC_THREAD_CACHE;
+	}
+}
+
+void
+rack_tcache_destroy(rack_t *rack)
+{
+	if (!(rack->debug_flags & MALLOC_THREAD_CACHE)) {
+		return;
+	}
+
+	// The rack's regions are going away wholesale, so there is nothing to
+	// return; just release the caches themselves.
+	pthread_key_delete(rack->tcache_key);
+
+	_malloc_lock_lock(&rack->tcache_lock);
+	magazine_tcache_t *tc = rack->tcache_list;
+	while (tc) {
+		magazine_tcache_t *next = tc->next;
+		mvm_deallocate_pages(tc, TCACHE_ALLOCATION_SIZE, 0);
+		tc = next;
+	}
+	rack->tcache_list = NULL;
+	_malloc_lock_unlock(&rack->tcache_lock);
+}
+
+/*********************	SLOW PATHS	************************/
+
+void *
+rack_tcache_malloc_slow(rack_t *rack, msize_t msize)
+{
+	magazine_tcache_t *tc = pthread_getspecific(rack->tcache_key);
+
+	if (!tc) {
+		tc = tcache_create(rack);
+		if (!tc) {
+			return NULL;
+		}
+	}
+	_malloc_lock_lock(&tc->lock);
+	if (tc->generation != rack->tcache_generation) {
+		tcache_flush(tc);
+	}
+
+	// Refill only as far as the byte budget allows; with no room left, leave
+	// this request to the magazine.
+	size_t size = (size_t)msize << tc->quantum_shift;
+	size_t room = (MAGAZINE_TCACHE_BYTES_LIMIT - MIN(tc->bytes_cached, MAGAZINE_TCACHE_BYTES_LIMIT)) / size;
+	unsigned count = (unsigned)MIN(room, MAGAZINE_TCACHE_BATCH);
+	if (!count) {
+		_malloc_lock_unlock(&tc->lock);
+		return NULL;
+	}
+
+	mag_index_t mag_index = rack_get_thread_index(rack);
+	magazine_t *mag_ptr = &(rack->magazines[mag_index]);
+
+	SZONE_MAGAZINE_PTR_LOCK(mag_ptr);
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	if (mag_ptr->mag_remote_free) {
+		if (rack->type == RACK_TYPE_TINY) {
+			tiny_remote_free_drain_no_lock(rack, mag_ptr, mag_index);
+		} else {
+			small_remote_free_drain_no_lock(rack, mag_ptr, mag_index);
+		}
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+	unsigned refilled = tcache_refill_no_lock(tc, mag_ptr, mag_index, msize, count);
+	SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
+
+	if (!refilled) {
+		// The magazine is out of free blocks; the locked path knows how to go
+		// to the depot or map a fresh region.
+		_malloc_lock_unlock(&tc->lock);
+		return NULL;
+	}
+
+	tcache_bin_t *bin = &tc->bins[msize];
+	void *ptr = bin->head;
+	bin->head = *(void **)ptr;
+	bin->count--;
+	tc->bytes_cached -= size;
+	_malloc_lock_unlock(&tc->lock);
+	return ptr;
+}
+
+boolean_t
+rack_tcache_free_slow(rack_t *rack, void *ptr, msize_t msize)
+{
+	magazine_tcache_t *tc = pthread_getspecific(rack->tcache_key);
+
+	if (!tc) {
+		tc = tcache_create(rack);
+		if (!tc) {
+			return FALSE;
+		}
+	}
+	_malloc_lock_lock(&tc->lock);
+	if (tc->generation != rack->tcache_generation) {
+		tcache_flush(tc);
+	}
+
+	tcache_bin_t *bin = &tc->bins[msize];
+	size_t size = (size_t)msize << tc->quantum_shift;
+
+	// Only catches a free of the block last cached (see magazine_tcache.h).
+	if (ptr == bin->head) {
+		_malloc_lock_unlock(&tc->lock);
+		szone_error(rack->debug_flags, 1, "double free", ptr, NULL);
+		return TRUE;
+	}
+
+	if (tc->bytes_cached + size > MAGAZINE_TCACHE_BYTES_LIMIT) {
+		if (bin->count) {
+			// Draining half of this bin always makes room for one more block of
+			// the same size and keeps the other half hot.
+			tcache_drain_bin(tc, msize, (bin->count + 1) / 2);
+		} else {
+			tcache_flush(tc);
+		}
+	}
+
+	tcache_bin_push(tc, bin, ptr, size);
+	_malloc_lock_unlock(&tc->lock);
+	return TRUE;
+}
+
+/*
+ * rack_tcache_flush_all - Returns the cached blocks of every thread to the
+ * magazines. A cache whose owner is using it right now is left for the owner
+ * to flush on its next cached malloc or free.
+ */
+void
+rack_tcache_flush_all(rack_t *rack)
+{
+	if (!(rack->debug_flags & MALLOC_THREAD_CACHE)) {
+		return;
+	}
+
+	OSAtomicIncrement32Barrier(&rack->tcache_generation);
+
+	_malloc_lock_lock(&rack->tcache_lock);
+	for (magazine_tcache_t *tc = rack->tcache_list; tc; tc = tc->next) {
+		if (_malloc_lock_trylock(&tc->lock)) {
+			tcache_flush(tc);
+			_malloc_lock_unlock(&tc->lock);
+		}
+	}
+	_malloc_lock_unlock(&rack->tcache_lock);
+}
+
+#endif // CONFIG_MAGAZINE_TCACHE
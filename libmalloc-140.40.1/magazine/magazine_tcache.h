@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef __MAGAZINE_TCACHE_H
+#define __MAGAZINE_TCACHE_H
+
+#if CONFIG_MAGAZINE_TCACHE
+
+/*******************************************************************************
+ * Per-thread tiny/small block cache
+ *
+ * With MALLOC_THREAD_CACHE set, each thread keeps a stash of free blocks per
+ * msize for every rack it allocates from. Stashed blocks stay marked in-use in
+ * the region metadata (exactly like mag_last_free), so a malloc/free pair that
+ * hits the stash never touches the magazine and takes no lock. Blocks move
+ * between the stash and the magazines MAGAZINE_TCACHE_BATCH at a time.
+ *
+ * A stash is touched by its owning thread, which holds the stash's own lock for
+ * the length of each cached malloc or free, and by pressure relief, which walks
+ * rack->tcache_list and empties every stash whose lock it can get. Relief also
+ * bumps rack->tcache_generation, so that an owner that was busy at the time
+ * notices on its next cached malloc or free and returns everything to the
+ * magazines itself. Relief never waits for a stash lock; the owner only waits
+ * for relief in the slow paths.
+ *
+ * Only the most common double free, of the block last pushed onto a bin, is
+ * caught. A block deeper in the bin is indistinguishable from an allocated
+ * one, and scanning a bin (up to MAGAZINE_TCACHE_BYTES_LIMIT bytes of blocks)
+ * on every free would cost more than the stash saves.
+ ******************************************************************************/
+
+typedef struct tcache_bin_s {
+	void *head; // linked through the first word of each block
+	uint32_t count;
+} tcache_bin_t;
+
+typedef struct magazine_tcache_s {
+	_malloc_lock_s lock; // owner for each use, relief while emptying the stash
+	rack_t *rack;
+	magazine_tcache_t *next; // rack->tcache_list, under rack->tcache_lock
+	magazine_tcache_t *prev;
+	size_t bytes_cached;
+	int32_t generation; // rack->tcache_generation at the last flush
+	uint32_t quantum_shift;
+	tcache_bin_t bins[MAGAZINE_TCACHE_MAX_SLOTS]; // indexed by msize
+} magazine_tcache_t;
+
+MALLOC_NOEXPORT
+void
+rack_tcache_init(rack_t *rack);
+
+MALLOC_NOEXPORT
+void
+rack_tcache_destroy(rack_t *rack);
+
+MALLOC_NOEXPORT
+void *
+rack_tcache_malloc_slow(rack_t *rack, msize_t msize);
+
+MALLOC_NOEXPORT
+boolean_t
+rack_tcache_free_slow(rack_t *rack, void *ptr, msize_t msize);
+
+MALLOC_NOEXPORT
+void
+rack_tcache_flush_all(rack_t *rack);
+
+/*
+ * rack_tcache_malloc - Pops a block of the given msize off the calling thread's
+ * cache, refilling it from the thread's magazine when it runs dry. Returns NULL
+ * when the caller should fall back to the locked magazine path.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void *
+rack_tcache_malloc(rack_t *rack, msize_t msize)
+{
+	magazine_tcache_t *tc = pthread_getspecific(rack->tcache_key);
+
+	if (tc && tc->generation == rack->tcache_generation && _malloc_lock_trylock(&tc->lock)) {
+		tcache_bin_t *bin = &tc->bins[msize];
+		void *ptr = bin->head;
+
+		if (ptr) {
+			bin->head = *(void **)ptr;
+			bin->count--;
+			tc->bytes_cached -= ((size_t)msize << tc->quantum_shift);
+			_malloc_lock_unlock(&tc->lock);
+			return ptr;
+		}
+		_malloc_lock_unlock(&tc->lock);
+	}
+	return rack_tcache_malloc_slow(rack, msize);
+}
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+tcache_bin_push(magazine_tcache_t *tc, tcache_bin_t *bin, void *ptr, size_t size)
+{
+	if (tc->rack->debug_flags & MALLOC_DO_SCRIBBLE) {
+		memset(ptr, SCRABBLE_BYTE, size);
+	}
+	*(void **)ptr = bin->head;
+	bin->head = ptr;
+	bin->count++;
+	tc->bytes_cached += size;
+}
+
+/*
+ * rack_tcache_free - Pushes a block onto the calling thread's cache, draining
+ * part of the cache back to the magazines when the byte budget is exhausted.
+ * Returns FALSE when the block was not taken and must be freed normally.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE boolean_t
+rack_tcache_free(rack_t *rack, void *ptr, msize_t msize)
+{
+	magazine_tcache_t *tc = pthread_getspecific(rack->tcache_key);
+
+	if (tc && tc->generation == rack->tcache_generation && _malloc_lock_trylock(&tc->lock)) {
+		tcache_bin_t *bin = &tc->bins[msize];
+		size_t size = (size_t)msize << tc->quantum_shift;
+
+		// Cheap guard against the most common double free; anything deeper in
+		// the bin is indistinguishable from an allocated block.
+		if (ptr != bin->head && tc->bytes_cached + size <= MAGAZINE_TCACHE_BYTES_LIMIT) {
+			tcache_bin_push(tc, bin, ptr, size);
+			_malloc_lock_unlock(&tc->lock);
+			return TRUE;
+		}
+		_malloc_lock_unlock(&tc->lock);
+	}
+	return rack_tcache_free_slow(rack, ptr, msize);
+}
+
+#endif // CONFIG_MAGAZINE_TCACHE
+
+#endif // __MAGAZINE_TCACHE_H
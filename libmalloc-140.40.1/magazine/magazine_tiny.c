@@ -23,6 +23,28 @@
 
 #include "internal.h"
 
+#if CONFIG_KNOWN_ZERO_PAGES
+// The free list linkage a free block keeps in its first and last bytes, which
+// is all that can be dirty in a block carved from known-zero granules.
+#define TINY_FREE_HEAD_BYTES (sizeof(tiny_free_list_t) + sizeof(msize_t))
+#define TINY_FREE_TAIL_BYTES sizeof(msize_t)
+
+/*
+ * tiny_zero_granules_unmark - Forgets that the free bytes of [lo, hi), clipped
+ * to the region, are zero.
+ */
+static MALLOC_INLINE void
+tiny_zero_granules_unmark(region_t region, uintptr_t lo, uintptr_t hi)
+{
+	lo = MAX(lo, (uintptr_t)TINY_REGION_ADDRESS(region));
+	hi = MIN(hi, (uintptr_t)TINY_REGION_END(region));
+	if (lo >= hi) {
+		return;
+	}
+	region_zero_granules_unmark(REGION_TRAILER_FOR_TINY_REGION(region), (uintptr_t)region, TINY_ZERO_GRANULE_SHIFT, lo, hi);
+}
+#endif // CONFIG_KNOWN_ZERO_PAGES
+
 /*
  * Get the size of the previous free block, which is stored in the last two
  * bytes of the block.  If the previous block is not free, then the result is
@@ -153,6 +175,11 @@ set_tiny_meta_header_middle(const void *ptr)
 
 	BITARRAY_CLR(block_header, index);
 	BITARRAY_CLR(in_use, index);
+
+#if CONFIG_KNOWN_ZERO_PAGES
+	// Coalescing leaves the linkage of the blocks that met here inside a free block.
+	tiny_zero_granules_unmark(TINY_REGION_FOR_PTR(ptr), (uintptr_t)ptr - TINY_FREE_TAIL_BYTES, (uintptr_t)ptr + TINY_FREE_HEAD_BYTES);
+#endif // CONFIG_KNOWN_ZERO_PAGES
 }
 
 static MALLOC_INLINE void
@@ -482,80 +509,87 @@ tiny_free_reattach_region(rack_t *rack, magazine_t *tiny_mag_ptr, region_t r)
 	return total_alloc;
 }
 
-typedef struct {
-	uint8_t pnum, size;
-} tiny_pg_pair_t;
-
-void
-tiny_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
+/*
+ * Append the free pages of "r" at or above "from" to "batch", taking care to
+ * preserve free list management data. Returns 0 once the whole region has been
+ * covered, or the address to pick up from once the (full) batch has been
+ * flushed. The scan always starts over at the first block, so the blocks may
+ * have been coalesced in between.
+ */
+uintptr_t
+tiny_free_scan_madvise_collect(region_t r, uintptr_t from, mvm_madvise_batch_t *batch)
 {
 	uintptr_t start = (uintptr_t)TINY_REGION_ADDRESS(r);
 	uintptr_t current = start;
 	uintptr_t limit = (uintptr_t)TINY_REGION_END(r);
 	boolean_t is_free;
 	msize_t msize;
-	tiny_pg_pair_t advisory[((TINY_REGION_PAYLOAD_BYTES + vm_page_quanta_size - 1) >> vm_page_quanta_shift) >>
-							1]; // 256bytes stack allocated
-	int advisories = 0;
 
-	// Scan the metadata identifying blocks which span one or more pages. Mark the pages MADV_FREE taking care to preserve free list
-	// management data.
+	// Scan the metadata identifying blocks which span one or more pages.
 	while (current < limit) {
+		uintptr_t pgLo, pgHi;
 		msize = get_tiny_meta_header((void *)current, &is_free);
+
 		if (is_free && !msize && (current == start)) {
 			// first block is all free
 #if DEBUG_MALLOC
 			malloc_printf("*** tiny_free_scan_madvise_free first block is all free! %p: msize=%d is_free =%d\n", (void *)current,
 						  msize, is_free);
 #endif
-			uintptr_t pgLo = round_page_kernel(start + sizeof(tiny_free_list_t) + sizeof(msize_t));
-			uintptr_t pgHi = trunc_page_kernel(start + TINY_REGION_SIZE - sizeof(msize_t));
-
-			if (pgLo < pgHi) {
-				advisory[advisories].pnum = (pgLo - start) >> vm_kernel_page_shift;
-				advisory[advisories].size = (pgHi - pgLo) >> vm_kernel_page_shift;
-				advisories++;
-			}
-			break;
-		}
-		if (!msize) {
+			pgLo = round_page_kernel(start + sizeof(tiny_free_list_t) + sizeof(msize_t));
+			pgHi = trunc_page_kernel(start + TINY_REGION_SIZE - sizeof(msize_t));
+			current = limit;
+		} else if (!msize) {
 #if DEBUG_MALLOC
 			malloc_printf("*** tiny_free_scan_madvise_free error with %p: msize=%d is_free =%d\n", (void *)current, msize, is_free);
 #endif
 			break;
+		} else if (is_free) {
+			pgLo = round_page_kernel(current + sizeof(tiny_free_list_t) + sizeof(msize_t));
+			pgHi = trunc_page_kernel(current + TINY_BYTES_FOR_MSIZE(msize) - sizeof(msize_t));
+			current += TINY_BYTES_FOR_MSIZE(msize);
+		} else {
+			current += TINY_BYTES_FOR_MSIZE(msize);
+			continue;
 		}
-		if (is_free) {
-			uintptr_t pgLo = round_page_kernel(current + sizeof(tiny_free_list_t) + sizeof(msize_t));
-			uintptr_t pgHi = trunc_page_kernel(current + TINY_BYTES_FOR_MSIZE(msize) - sizeof(msize_t));
 
-			if (pgLo < pgHi) {
-				advisory[advisories].pnum = (pgLo - start) >> vm_kernel_page_shift;
-				advisory[advisories].size = (pgHi - pgLo) >> vm_kernel_page_shift;
-				advisories++;
-			}
+		pgLo = MAX(pgLo, from);
+		if (pgLo < pgHi && !mvm_madvise_batch_add(batch, pgLo, pgHi)) {
+			return pgLo;
 		}
-		current += TINY_BYTES_FOR_MSIZE(msize);
 	}
+	return 0;
+}
 
-	if (advisories > 0) {
-		int i;
-
-		// So long as the following hold for this region:
-		// (1) No malloc()'s are ever performed from the depot (hence free pages remain free,)
-		// (2) The region is not handed over to a per-CPU magazine (where malloc()'s could be performed),
-		// (3) The entire region is not mumap()'d (so the madvise's are applied to the intended addresses),
-		// then the madvise opportunities collected just above can be applied outside all locks.
-		// (1) is ensured by design, (2) and (3) are ensured by bumping the globally visible counter node->pinned_to_depot.
-
-		OSAtomicIncrement32Barrier(&(REGION_TRAILER_FOR_TINY_REGION(r)->pinned_to_depot));
-		SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
-		for (i = 0; i < advisories; ++i) {
-			uintptr_t addr = (advisory[i].pnum << vm_kernel_page_shift) + start;
-			size_t size = advisory[i].size << vm_kernel_page_shift;
-
-			mvm_madvise_free(rack, r, addr, addr + size, NULL);
+void
+tiny_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
+{
+	mvm_madvise_batch_t batch;
+	uintptr_t from = 0;
+	boolean_t pinned = FALSE;
+
+	// So long as the following hold for this region:
+	// (1) No malloc()'s are ever performed from the depot (hence free pages remain free,)
+	// (2) The region is not handed over to a per-CPU magazine (where malloc()'s could be performed),
+	// (3) The entire region is not mumap()'d (so the madvise's are applied to the intended addresses),
+	// then the madvise opportunities collected below can be applied outside all locks.
+	// (1) is ensured by design, (2) and (3) are ensured by bumping the globally visible counter node->pinned_to_depot.
+	mvm_madvise_batch_init(&batch);
+	do {
+		from = tiny_free_scan_madvise_collect(r, from, &batch);
+		if (!batch.count) {
+			break;
+		}
+		if (!pinned) {
+			OSAtomicIncrement32Barrier(&(REGION_TRAILER_FOR_TINY_REGION(r)->pinned_to_depot));
+			pinned = TRUE;
 		}
+		SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+		mvm_madvise_batch_flush(rack, &batch);
 		SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+	} while (from);
+
+	if (pinned) {
 		OSAtomicDecrement32Barrier(&(REGION_TRAILER_FOR_TINY_REGION(r)->pinned_to_depot));
 	}
 }
@@ -693,13 +727,27 @@ tiny_get_region_from_depot(rack_t *rack, magazine_t *tiny_mag_ptr, mag_index_t m
 	region_t sparse_region;
 
 	while (1) {
-		sparse_region = tiny_find_msize_region(rack, depot_ptr, DEPOT_MAGAZINE_INDEX, msize);
-		if (NULL == sparse_region) { // Depot empty?
-			SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
-			return 0;
-		}
+#if CONFIG_NUMA_MAGAZINES
+		if (mag_numa_enabled) {
+			// Only take regions from this magazine's node.
+			node = mag_numa_depot_find(depot_ptr, mag_numa_magazine_node[mag_index],
+					TINY_REGION_PAYLOAD_BYTES, TINY_BYTES_FOR_MSIZE(msize));
+			if (NULL == node) { // Nothing here for this node?
+				SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				return 0;
+			}
+			sparse_region = TINY_REGION_FOR_PTR(node);
+		} else
+#endif // CONFIG_NUMA_MAGAZINES
+		{
+			sparse_region = tiny_find_msize_region(rack, depot_ptr, DEPOT_MAGAZINE_INDEX, msize);
+			if (NULL == sparse_region) { // Depot empty?
+				SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				return 0;
+			}
 
-		node = REGION_TRAILER_FOR_TINY_REGION(sparse_region);
+			node = REGION_TRAILER_FOR_TINY_REGION(sparse_region);
+		}
 		if (0 >= node->pinned_to_depot) {
 			break;
 		}
@@ -776,6 +824,7 @@ tiny_free_try_depot_unmap_no_lock(rack_t *rack, magazine_t *depot_ptr, region_tr
 			return NULL;
 		}
 		*pSlot = HASHRING_REGION_DEALLOCATED;
+		rack_region_map_remove(rack, sparse_region);
 		depot_ptr->num_bytes_in_magazine -= TINY_REGION_PAYLOAD_BYTES;
 
 		// Atomically increment num_regions_dealloc
@@ -930,6 +979,133 @@ tiny_free_try_recirc_to_depot(rack_t *rack,
 }
 #endif // CONFIG_RECIRC_DEPOT
 
+#if CONFIG_MAGAZINE_SCAVENGER
+/*
+ * Return the free pages of one idle region until "*budget" runs out, resuming
+ * at the block at node->scavenge_offset and skipping pages below
+ * node->scavenge_advised. The magazine lock is held throughout, so the free
+ * blocks cannot be handed out while their pages are being advised. Returns
+ * TRUE when the whole region has been covered.
+ */
+static boolean_t
+tiny_scavenge_region_no_lock(rack_t *rack, region_t r, region_trailer_t *node, size_t *budget, size_t *pages)
+{
+	uintptr_t start = (uintptr_t)TINY_REGION_ADDRESS(r);
+	uintptr_t current = start + node->scavenge_offset;
+	uintptr_t advised = start + node->scavenge_advised;
+	uintptr_t limit = (uintptr_t)TINY_REGION_END(r);
+	boolean_t restarted = FALSE;
+
+	while (current < limit && *budget) {
+		uintptr_t next, pgLo = 0, pgHi = 0;
+		boolean_t is_free;
+		msize_t msize = get_tiny_meta_header((void *)current, &is_free);
+
+		if (is_free && !msize && (current == start)) {
+			// first block is all free
+			pgLo = round_page_kernel(start + sizeof(tiny_free_list_t) + sizeof(msize_t));
+			pgHi = trunc_page_kernel(limit - sizeof(msize_t));
+			next = limit;
+		} else if (!msize && !restarted) {
+			// Not a block start, so the saved offset went stale (the region's
+			// generation should have caught that). Walk the region again from
+			// the top rather than take the rest of it for covered.
+			current = advised = start;
+			restarted = TRUE;
+			continue;
+		} else if (!msize) {
+			next = limit;
+		} else {
+			if (is_free) {
+				pgLo = round_page_kernel(current + sizeof(tiny_free_list_t) + sizeof(msize_t));
+				pgHi = trunc_page_kernel(current + TINY_BYTES_FOR_MSIZE(msize) - sizeof(msize_t));
+			}
+			next = current + TINY_BYTES_FOR_MSIZE(msize);
+		}
+
+		pgLo = MAX(pgLo, advised);
+		if (pgLo < pgHi) {
+			size_t n = MIN((pgHi - pgLo) >> vm_kernel_page_shift, *budget);
+
+			advised = pgLo + (n << vm_kernel_page_shift);
+			mvm_madvise_release(rack, r, pgLo, advised);
+			*budget -= n;
+			*pages += n;
+			if (advised < pgHi) {
+				break; // out of budget part way through this block
+			}
+		}
+		current = next;
+	}
+
+	if (current < limit) {
+		node->scavenge_offset = (uint32_t)(current - start);
+		node->scavenge_advised = (uint32_t)(advised - start);
+		return FALSE;
+	}
+	node->scavenge_offset = node->scavenge_advised = 0;
+	return TRUE;
+}
+
+/*
+ * Age the regions of one locked magazine, returning the free pages of those
+ * that have sat unchanged for MAGAZINE_SCAVENGE_IDLE_TICKS ticks while the
+ * budget lasts. Returns TRUE if the budget ran out part way through a region
+ * and the caller should come back after dropping the lock.
+ */
+static boolean_t
+tiny_scavenge_magazine_no_lock(rack_t *rack, magazine_t *tiny_mag_ptr, uint32_t tick, size_t *budget, size_t *pages)
+{
+	region_trailer_t *node;
+
+	for (node = tiny_mag_ptr->firstNode; node; node = node->next) {
+		region_t r = TINY_REGION_FOR_PTR(node);
+
+		if (r == tiny_mag_ptr->mag_last_region || node->pinned_to_depot) {
+			continue;
+		}
+		if (node->generation != node->scavenge_generation || 0 == node->scavenge_since) {
+			node->scavenge_generation = node->generation;
+			node->scavenge_since = tick;
+			node->scavenge_offset = node->scavenge_advised = 0;
+			continue;
+		}
+		if (node->scavenge_since == SCAVENGE_CLEAN || tick - node->scavenge_since < MAGAZINE_SCAVENGE_IDLE_TICKS ||
+			0 == *budget) {
+			continue;
+		}
+		if (!tiny_scavenge_region_no_lock(rack, r, node, budget, pages)) {
+			return TRUE;
+		}
+		node->scavenge_since = SCAVENGE_CLEAN;
+	}
+	return FALSE;
+}
+
+size_t
+tiny_scavenge(rack_t *rack, uint32_t tick, size_t max_pages)
+{
+	size_t pages = 0;
+	mag_index_t mag_index;
+
+	for (mag_index = DEPOT_MAGAZINE_INDEX; mag_index < rack->num_magazines; mag_index++) {
+		magazine_t *tiny_mag_ptr = &rack->magazines[mag_index];
+		boolean_t more;
+
+		// With the budget spent this still ages the regions, it just leaves
+		// them be.
+		do {
+			size_t budget = MIN(max_pages - pages, MAGAZINE_SCAVENGE_LOCK_PAGES);
+
+			SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
+			more = tiny_scavenge_magazine_no_lock(rack, tiny_mag_ptr, tick, &budget, &pages);
+			SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
+		} while (more);
+	}
+	return pages;
+}
+#endif // CONFIG_MAGAZINE_SCAVENGER
+
 boolean_t
 tiny_free_no_lock(rack_t *rack, magazine_t *tiny_mag_ptr, mag_index_t mag_index, region_t region, void *ptr, msize_t msize)
 {
@@ -952,6 +1128,10 @@ tiny_free_no_lock(rack_t *rack, magazine_t *tiny_mag_ptr, mag_index_t mag_index,
 	}
 #endif
 
+#if CONFIG_KNOWN_ZERO_PAGES
+	tiny_zero_granules_unmark(region, (uintptr_t)original_ptr, (uintptr_t)original_ptr + original_size);
+#endif // CONFIG_KNOWN_ZERO_PAGES
+
 	// We try to coalesce this block with the preceeding one
 	previous = tiny_previous_preceding_free(ptr, &previous_msize);
 	if (previous) {
@@ -1015,7 +1195,7 @@ tiny_free_no_lock(rack_t *rack, magazine_t *tiny_mag_ptr, mag_index_t mag_index,
 	// The tiny cache already scribbles free blocks as they go through the
 	// cache whenever msize < TINY_QUANTUM , so we do not need to do it here.
 	if ((rack->debug_flags & MALLOC_DO_SCRIBBLE) && msize && (msize >= TINY_QUANTUM)) {
-		memset(ptr, SCRABBLE_BYTE, TINY_BYTES_FOR_MSIZE(msize));
+		malloc_fill(ptr, SCRABBLE_BYTE, TINY_BYTES_FOR_MSIZE(msize));
 	}
 
 	tiny_free_list_add_ptr(rack, tiny_mag_ptr, ptr, msize);
@@ -1030,6 +1210,7 @@ tiny_free_ending:
 	region_trailer_t *node = REGION_TRAILER_FOR_TINY_REGION(region);
 	size_t bytes_used = node->bytes_used - original_size;
 	node->bytes_used = (unsigned int)bytes_used;
+	REGION_TRAILER_CHANGED(node);
 
 #if CONFIG_AGGRESSIVE_MADVISE
 	// Platforms that want to madvise every freed allocation do so here, even if we continue
@@ -1075,6 +1256,9 @@ tiny_malloc_from_region_no_lock(rack_t *rack,
 	// and so put it under the protection of the magazine lock we are holding.
 	// Do this before advertising "aligned_address" on the hash ring(!)
 	MAGAZINE_INDEX_FOR_TINY_REGION(aligned_address) = mag_index;
+#if CONFIG_NUMA_MAGAZINES
+	REGION_TRAILER_FOR_TINY_REGION(aligned_address)->numa_node = mag_numa_magazine_node[mag_index];
+#endif // CONFIG_NUMA_MAGAZINES
 
 	// Insert the new region into the hash ring
 	rack_region_insert(rack, (region_t)aligned_address);
@@ -1277,6 +1461,7 @@ tiny_try_realloc_in_place(rack_t *rack, void *ptr, size_t old_size, size_t new_s
 	region_trailer_t *node = REGION_TRAILER_FOR_TINY_REGION(TINY_REGION_FOR_PTR(ptr));
 	size_t bytes_used = node->bytes_used + TINY_BYTES_FOR_MSIZE(coalesced_msize);
 	node->bytes_used = (unsigned int)bytes_used;
+	REGION_TRAILER_CHANGED(node);
 
 	// Emptiness discriminant
 	if (bytes_used < DENSITY_THRESHOLD(TINY_REGION_PAYLOAD_BYTES)) {
@@ -1762,6 +1947,7 @@ return_tiny_alloc:
 	region_trailer_t *node = REGION_TRAILER_FOR_TINY_REGION(TINY_REGION_FOR_PTR(ptr));
 	size_t bytes_used = node->bytes_used + TINY_BYTES_FOR_MSIZE(this_msize);
 	node->bytes_used = (unsigned int)bytes_used;
+	REGION_TRAILER_CHANGED(node);
 
 	// Emptiness discriminant
 	if (bytes_used < DENSITY_THRESHOLD(TINY_REGION_PAYLOAD_BYTES)) {
@@ -1785,11 +1971,55 @@ return_tiny_alloc:
 	return ptr;
 }
 
+#if CONFIG_KNOWN_ZERO_PAGES
+/*
+ * tiny_block_known_zero_no_lock - Whether a block just taken from the free list
+ * lies in known-zero granules, so that only its edges can be dirty. Counts the
+ * clearing that this saves.
+ */
+static boolean_t
+tiny_block_known_zero_no_lock(magazine_t *tiny_mag_ptr, void *ptr, msize_t msize)
+{
+	size_t bytes = TINY_BYTES_FOR_MSIZE(msize);
+	region_t region = TINY_REGION_FOR_PTR(ptr);
+
+	if (bytes <= TINY_FREE_HEAD_BYTES + TINY_FREE_TAIL_BYTES) {
+		return FALSE;
+	}
+	if (!region_zero_granules_test(REGION_TRAILER_FOR_TINY_REGION(region), (uintptr_t)region, TINY_ZERO_GRANULE_SHIFT,
+				(uintptr_t)ptr, (uintptr_t)ptr + bytes)) {
+		return FALSE;
+	}
+	tiny_mag_ptr->mag_bytes_clear_avoided += bytes - TINY_FREE_HEAD_BYTES - TINY_FREE_TAIL_BYTES;
+	return TRUE;
+}
+#endif // CONFIG_KNOWN_ZERO_PAGES
+
+/*
+ * tiny_calloc_clear - Clears a block for calloc(), or only the free list
+ * linkage at its edges when the rest is known to be zero.
+ */
+static MALLOC_INLINE void
+tiny_calloc_clear(void *ptr, msize_t msize, boolean_t known_zero)
+{
+	size_t bytes = TINY_BYTES_FOR_MSIZE(msize);
+
+#if CONFIG_KNOWN_ZERO_PAGES
+	if (known_zero) {
+		malloc_clear(ptr, TINY_FREE_HEAD_BYTES);
+		malloc_clear((unsigned char *)ptr + bytes - TINY_FREE_TAIL_BYTES, TINY_FREE_TAIL_BYTES);
+		return;
+	}
+#endif // CONFIG_KNOWN_ZERO_PAGES
+	malloc_clear(ptr, bytes);
+}
+
 void *
 tiny_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requested)
 {
 	void *ptr;
-	mag_index_t mag_index = mag_get_thread_index() % rack->num_magazines;
+	boolean_t known_zero = FALSE;
+	mag_index_t mag_index = rack_get_thread_index(rack);
 	magazine_t *tiny_mag_ptr = &(rack->magazines[mag_index]);
 
 	MALLOC_TRACE(TRACE_tiny_malloc, (uintptr_t)rack, TINY_BYTES_FOR_MSIZE(msize), (uintptr_t)tiny_mag_ptr, cleared_requested);
@@ -1806,8 +2036,26 @@ tiny_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requeste
 	}
 #endif
 
+#if CONFIG_MAGAZINE_TCACHE
+	if (rack->debug_flags & MALLOC_THREAD_CACHE) {
+		ptr = rack_tcache_malloc(rack, msize);
+		if (ptr) {
+			if (cleared_requested) {
+				malloc_clear(ptr, TINY_BYTES_FOR_MSIZE(msize));
+			}
+			return ptr;
+		}
+	}
+#endif /* CONFIG_MAGAZINE_TCACHE */
+
 	SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	if (tiny_mag_ptr->mag_remote_free) {
+		tiny_remote_free_drain_no_lock(rack, tiny_mag_ptr, mag_index);
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 #if CONFIG_TINY_CACHE
 	ptr = tiny_mag_ptr->mag_last_free;
 
@@ -1819,7 +2067,7 @@ tiny_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requeste
 		CHECK(szone, __PRETTY_FUNCTION__);
 		ptr = (void *)((uintptr_t)ptr & ~(TINY_QUANTUM - 1));
 		if (cleared_requested) {
-			memset(ptr, 0, TINY_BYTES_FOR_MSIZE(msize));
+			malloc_clear(ptr, TINY_BYTES_FOR_MSIZE(msize));
 		}
 #if DEBUG_MALLOC
 		if (LOG(szone, ptr)) {
@@ -1831,12 +2079,26 @@ tiny_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requeste
 #endif /* CONFIG_TINY_CACHE */
 
 	while (1) {
+		// Blocks carved from mag_bytes_free_at_end have not been touched since
+		// their region was mapped, so they are still zero.
+		size_t pristine_bytes = tiny_mag_ptr->mag_bytes_free_at_end;
+		uintptr_t pristine = (uintptr_t)TINY_REGION_END(tiny_mag_ptr->mag_last_region) - pristine_bytes;
+
 		ptr = tiny_malloc_from_free_list(rack, tiny_mag_ptr, mag_index, msize);
 		if (ptr) {
+			if (cleared_requested && (uintptr_t)ptr - pristine < pristine_bytes) {
+				tiny_mag_ptr->mag_bytes_clear_avoided += TINY_BYTES_FOR_MSIZE(msize);
+				cleared_requested = FALSE;
+			}
+#if CONFIG_KNOWN_ZERO_PAGES
+			if (cleared_requested) {
+				known_zero = tiny_block_known_zero_no_lock(tiny_mag_ptr, ptr, msize);
+			}
+#endif // CONFIG_KNOWN_ZERO_PAGES
 			SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
 			CHECK(szone, __PRETTY_FUNCTION__);
 			if (cleared_requested) {
-				memset(ptr, 0, TINY_BYTES_FOR_MSIZE(msize));
+				tiny_calloc_clear(ptr, msize, known_zero);
 			}
 			return ptr;
 		}
@@ -1844,10 +2106,15 @@ tiny_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requeste
 		if (tiny_get_region_from_depot(rack, tiny_mag_ptr, mag_index, msize)) {
 			ptr = tiny_malloc_from_free_list(rack, tiny_mag_ptr, mag_index, msize);
 			if (ptr) {
+#if CONFIG_KNOWN_ZERO_PAGES
+				if (cleared_requested) {
+					known_zero = tiny_block_known_zero_no_lock(tiny_mag_ptr, ptr, msize);
+				}
+#endif // CONFIG_KNOWN_ZERO_PAGES
 				SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
 				CHECK(szone, __PRETTY_FUNCTION__);
 				if (cleared_requested) {
-					memset(ptr, 0, TINY_BYTES_FOR_MSIZE(msize));
+					tiny_calloc_clear(ptr, msize, known_zero);
 				}
 				return ptr;
 			}
@@ -1867,6 +2134,11 @@ tiny_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requeste
 			OSMemoryBarrier();
 			SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
 			fresh_region = mvm_allocate_pages_securely(TINY_REGION_SIZE, TINY_BLOCKS_ALIGN, VM_MEMORY_MALLOC_TINY, rack->debug_flags);
+#if CONFIG_NUMA_MAGAZINES
+			if (fresh_region && mag_numa_enabled) {
+				mvm_numa_bind(fresh_region, TINY_REGION_SIZE, mag_numa_magazine_node[mag_index]);
+			}
+#endif // CONFIG_NUMA_MAGAZINES
 			SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
 
 			// DTrace USDT Probe
@@ -1882,6 +2154,9 @@ tiny_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requeste
 			ptr = tiny_malloc_from_region_no_lock(rack, tiny_mag_ptr, mag_index, msize, fresh_region);
 
 			// we don't clear because this freshly allocated space is pristine
+			if (cleared_requested) {
+				tiny_mag_ptr->mag_bytes_clear_avoided += TINY_BYTES_FOR_MSIZE(msize);
+			}
 			tiny_mag_ptr->alloc_underway = FALSE;
 			OSMemoryBarrier();
 			SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
@@ -1936,6 +2211,69 @@ tiny_size(rack_t *rack, const void *ptr)
 	return 0;
 }
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+/*
+ * tiny_remote_free_drain_no_lock - Frees the blocks other CPUs queued on this
+ * magazine's remote free list. Caller holds the magazine lock, and still holds
+ * it on return.
+ *
+ * A queued block's region may have moved on while it sat on the list. Blocks of
+ * regions now in the Depot are freed under the Depot lock (magazine lock first,
+ * then Depot, as everywhere else); blocks of regions that now belong to another
+ * magazine are simply queued on that magazine instead.
+ */
+void
+tiny_remote_free_drain_no_lock(rack_t *rack, magazine_t *tiny_mag_ptr, mag_index_t mag_index)
+{
+	remote_free_entry_t *entry = mag_remote_free_take(tiny_mag_ptr);
+
+	while (entry) {
+		remote_free_entry_t *next = entry->next;
+		void *ptr = (void *)entry;
+		msize_t msize = mag_remote_free_msize(rack, entry);
+
+		if (next == entry) {
+			// Queued twice in a row, which mag_remote_free_mark should have
+			// caught. Give up on the rest of the list rather than spin.
+			szone_error(rack->debug_flags, 1, "double free", ptr, NULL);
+			next = NULL;
+		}
+		region_t region = TINY_REGION_FOR_PTR(ptr);
+		region_trailer_t *trailer = REGION_TRAILER_FOR_TINY_REGION(region);
+		mag_index_t owner = trailer->mag_index;
+
+		if (owner == mag_index) {
+			if (tiny_meta_header_is_free(ptr)) {
+				szone_error(rack->debug_flags, 1, "double free", ptr, NULL);
+			} else if (!tiny_free_no_lock(rack, tiny_mag_ptr, mag_index, region, ptr, msize)) {
+				// The region was recirculated and the lock dropped; take it back.
+				SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
+			}
+		} else if (owner == DEPOT_MAGAZINE_INDEX) {
+			magazine_t *depot_ptr = &(rack->magazines[DEPOT_MAGAZINE_INDEX]);
+
+			SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+			if (trailer->mag_index == DEPOT_MAGAZINE_INDEX) {
+				if (tiny_free_no_lock(rack, depot_ptr, DEPOT_MAGAZINE_INDEX, region, ptr, msize)) {
+					SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				}
+			} else {
+				// Adopted by some other magazine in the meantime. It cannot be
+				// this one, since that would have needed the lock we hold.
+				owner = trailer->mag_index;
+				SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				mag_remote_free_mark(rack, ptr, msize);
+				mag_remote_free_push(&(rack->magazines[owner]), ptr);
+			}
+		} else {
+			mag_remote_free_mark(rack, ptr, msize);
+			mag_remote_free_push(&(rack->magazines[owner]), ptr);
+		}
+		entry = next;
+	}
+}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 static MALLOC_NOINLINE void
 free_tiny_botch(rack_t *rack, tiny_free_list_t *ptr)
 {
@@ -1952,6 +2290,9 @@ free_tiny(rack_t *rack, void *ptr, region_t tiny_region, size_t known_size)
 	boolean_t is_free;
 	mag_index_t mag_index = MAGAZINE_INDEX_FOR_TINY_REGION(tiny_region);
 	magazine_t *tiny_mag_ptr = &(rack->magazines[mag_index]);
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	boolean_t queued = FALSE;
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
 
 	MALLOC_TRACE(TRACE_tiny_free, (uintptr_t)rack, (uintptr_t)ptr, (uintptr_t)tiny_mag_ptr, known_size);
 
@@ -1972,8 +2313,43 @@ free_tiny(rack_t *rack, void *ptr, region_t tiny_region, size_t known_size)
 	}
 #endif
 
+#if CONFIG_MAGAZINE_TCACHE
+	if ((rack->debug_flags & MALLOC_THREAD_CACHE) && rack_tcache_free(rack, ptr, msize)) {
+		return;
+	}
+#endif /* CONFIG_MAGAZINE_TCACHE */
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	// A block owned by another CPU's magazine is queued for that magazine rather
+	// than pulling its lock over here. Only tiny cache sized blocks need the
+	// scribble; tiny_free_no_lock takes care of the rest when the queue drains.
+	// A block that already looks queued is freed under the lock instead, where
+	// the drain turns a double free into a free block.
+	if (mag_should_free_remotely(rack, mag_index)) {
+		if (mag_remote_free_mark(rack, ptr, msize)) {
+			if ((rack->debug_flags & MALLOC_DO_SCRIBBLE) && msize < TINY_QUANTUM) {
+				malloc_fill((char *)ptr + sizeof(remote_free_entry_t), SCRABBLE_BYTE,
+						TINY_BYTES_FOR_MSIZE(msize) - sizeof(remote_free_entry_t));
+			}
+			mag_remote_free_push(tiny_mag_ptr, ptr);
+			return;
+		}
+		queued = TRUE;
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 	SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	if (DEPOT_MAGAZINE_INDEX != mag_index && tiny_mag_ptr->mag_remote_free) {
+		tiny_remote_free_drain_no_lock(rack, tiny_mag_ptr, mag_index);
+	}
+	if (queued && tiny_meta_header_is_free(ptr)) {
+		free_tiny_botch(rack, ptr);
+		return;
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 #if CONFIG_TINY_CACHE
 	// Depot does not participate in CONFIG_TINY_CACHE since it can't be directly malloc()'d
 	if (DEPOT_MAGAZINE_INDEX != mag_index) {
@@ -1988,7 +2364,7 @@ free_tiny(rack_t *rack, void *ptr, region_t tiny_region, size_t known_size)
 			}
 
 			if ((rack->debug_flags & MALLOC_DO_SCRIBBLE) && msize) {
-				memset(ptr, SCRABBLE_BYTE, TINY_BYTES_FOR_MSIZE(msize));
+				malloc_fill(ptr, SCRABBLE_BYTE, TINY_BYTES_FOR_MSIZE(msize));
 			}
 
 			tiny_mag_ptr->mag_last_free = (void *)(((uintptr_t)ptr) | msize);
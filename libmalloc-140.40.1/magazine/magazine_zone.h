@@ -199,6 +199,14 @@ typedef struct tiny_header_inuse_pair {
 	uint32_t inuse;
 } tiny_header_inuse_pair_t;
 
+#if CONFIG_KNOWN_ZERO_PAGES
+// Tiny and small regions are split into this many granules for tracking the
+// free memory that is known to be zero (see region_zero_granules_mark()).
+#define REGION_ZERO_GRANULES 256
+#define TINY_ZERO_GRANULE_SHIFT (TINY_BLOCKS_ALIGN - 8)
+#define SMALL_ZERO_GRANULE_SHIFT (SMALL_BLOCKS_ALIGN - 8)
+#endif // CONFIG_KNOWN_ZERO_PAGES
+
 typedef struct region_trailer {
 	struct region_trailer *prev;
 	struct region_trailer *next;
@@ -206,8 +214,40 @@ typedef struct region_trailer {
 	volatile int pinned_to_depot;
 	unsigned bytes_used;
 	mag_index_t mag_index;
+#if CONFIG_MAGAZINE_SCAVENGER
+	// Background scavenger state, only touched under the region's magazine
+	// lock: a count of the allocations and frees in the region, its value
+	// when last looked at, the tick it last changed (or SCAVENGE_CLEAN once
+	// its free pages have been returned), and the block and page offsets to
+	// resume returning them at.
+	uint32_t generation;
+	uint32_t scavenge_generation;
+	uint32_t scavenge_since;
+	uint32_t scavenge_offset;
+	uint32_t scavenge_advised;
+#endif // CONFIG_MAGAZINE_SCAVENGER
+#if CONFIG_NUMA_MAGAZINES
+	// The memory node the region was bound to when it was created.
+	uint8_t numa_node;
+#endif // CONFIG_NUMA_MAGAZINES
+#if CONFIG_KNOWN_ZERO_PAGES
+	// One bit per granule whose free bytes are known to be zero; updated
+	// atomically, as pages are advised outside the magazine lock.
+	volatile uint32_t zero_granules[REGION_ZERO_GRANULES / 32];
+#endif // CONFIG_KNOWN_ZERO_PAGES
 } region_trailer_t;
 
+#define SCAVENGE_CLEAN ((uint32_t)-1)
+
+// Every allocation and free bumps its region's generation, so that the
+// scavenger can tell a region that sat idle from one whose blocks were freed
+// and handed out again without bytes_used moving.
+#if CONFIG_MAGAZINE_SCAVENGER
+#define REGION_TRAILER_CHANGED(node) ((node)->generation++)
+#else
+#define REGION_TRAILER_CHANGED(node) ((void)0)
+#endif
+
 typedef struct tiny_region {
 	tiny_block_t blocks[NUM_TINY_BLOCKS];
 
@@ -314,6 +354,34 @@ typedef struct tiny_region {
 #define SMALL_IS_FREE (1 << 15)
 #define FOLLOWING_SMALL_PTR(ptr, msize) (((unsigned char *)(ptr)) + ((msize) << SHIFT_SMALL_QUANTUM))
 
+/*
+ * Size-class runs (MALLOC_SMALL_CLASSES).
+ *
+ * A run is an ordinary in-use block whose first quantum holds a
+ * small_class_run_t and whose remaining quanta are cut into equally sized
+ * slots. The first short of each slot is marked SMALL_IS_CLASS, together with
+ * the slot's class and its index in the run, and SMALL_IS_FREE while the slot
+ * is free; every other short of the run is "middle". Slots are at least two
+ * quanta, so the last short of a run, which a following block consults when
+ * coalescing, is always "middle". msize never exceeds NUM_SMALL_BLOCKS, so
+ * bit 14 is otherwise unused. Code walking a region block by block only ever
+ * sees the run itself.
+ */
+#define SMALL_IS_CLASS (1 << 14)
+#define SMALL_CLASS_SLOT_BITS 6
+#define SMALL_CLASS_META(class, slot) (SMALL_IS_CLASS | ((class) << SMALL_CLASS_SLOT_BITS) | (slot))
+#define SMALL_CLASS_META_CLASS(meta) (((meta) & ~(SMALL_IS_FREE | SMALL_IS_CLASS)) >> SMALL_CLASS_SLOT_BITS)
+#define SMALL_CLASS_META_SLOT(meta) ((meta) & ((1 << SMALL_CLASS_SLOT_BITS) - 1))
+
+struct small_class_run_s {
+	small_class_run_t *next; // magazine's mag_class_runs list, under its lock
+	small_class_run_t *prev;
+	uint64_t free_slots; // bit n set while slot n is free
+	uint8_t class_index;
+	uint8_t num_slots;
+	boolean_t linked; // on its magazine's mag_class_runs list
+};
+
 /*
  * SMALL_IS_OOB is used mark to the MSB of OOB free list entries to show that they are in use, and 
  * distinguish them from their initial, empty, state.
@@ -441,12 +509,79 @@ typedef struct large_entry_s {
 	vm_address_t address;
 	vm_size_t size;
 	boolean_t did_madvise_reusable;
+#if CONFIG_KNOWN_ZERO_PAGES
+	vm_size_t zero_lo, zero_hi; // on death row, byte offsets of a range known to be zero
+#endif
 } large_entry_t;
 
+#define LARGE_CACHE_NIL 0xff
+
+typedef struct large_cache_entry_s {
+	large_entry_t entry;
+	uint32_t stamp; // its bucket's clock when the block arrived
+	uint8_t bucket;
+	uint8_t bucket_prev, bucket_next;
+	uint8_t lru_prev, lru_next;
+} large_cache_entry_t;
+
+/*
+ * One shard of the large allocator. A block's table entry lives in the shard
+ * its address hashes to (see large_shard_for_pointer()), while death-row rings
+ * are filled and drained by CPU, so a ring may hold blocks whose entries
+ * belonged to another shard. No path holds two shard locks at once.
+ *
+ * Each death-row cache keeps its blocks in large_entry_cache[] nodes linked
+ * into two lists: one per size bucket, and one across the shard. Both are
+ * ordered most recently freed first. large_entry_cache_buckets has a bit set
+ * for every non-empty bucket, so a fit is found by bit scan rather than by
+ * walking the cache. Unused nodes are chained through lru_next. Each bucket
+ * counts its own arrivals, so that a block ages against frees of its own size
+ * only and a busy size cannot age out the blocks of a quiet one.
+ *
+ * A table grows by installing a larger large_entries and keeping the previous
+ * one in large_entries_old; inserts and frees then move its slots over,
+ * starting at large_entries_migrate_index, until it is empty and released.
+ * Lookups search both tables while a migration is in progress.
+ */
+typedef struct large_shard_s {
+	_malloc_lock_s large_shard_lock MALLOC_CACHE_ALIGN;
+	unsigned num_large_objects_in_use;
+	unsigned num_large_entries;
+	large_entry_t *large_entries; // hashed by location; null entries don't count
+	size_t num_bytes_in_large_objects;
+
+	unsigned num_large_entries_old;
+	unsigned large_entries_migrate_index;
+	large_entry_t *large_entries_old; // table being migrated from, or NULL
+
+#if CONFIG_LARGE_CACHE
+	uint64_t large_entry_cache_buckets; // bit per non-empty size bucket
+	uint8_t large_entry_cache_bucket_head[LARGE_CACHE_BUCKETS];
+	uint8_t large_entry_cache_bucket_tail[LARGE_CACHE_BUCKETS];
+	uint8_t large_entry_cache_lru_head;
+	uint8_t large_entry_cache_lru_tail;
+	uint8_t large_entry_cache_free_head;
+	unsigned large_entry_cache_count;
+	uint32_t large_entry_cache_clock[LARGE_CACHE_BUCKETS]; // arrivals per bucket, for aging
+	large_cache_entry_t large_entry_cache[LARGE_ENTRY_CACHE_SIZE]; // "death row" for large malloc/free
+#endif
+} large_shard_t;
+
 #if !CONFIG_LARGE_CACHE && DEBUG_MALLOC
 #warning CONFIG_LARGE_CACHE turned off
 #endif
 
+/*
+ * A block waiting on a magazine's remote free list. The block is still marked
+ * in use; its first two words hold the link and its msize, stamped with the
+ * rack cookie (see mag_remote_free_mark), until the owning magazine drains the
+ * list.
+ */
+typedef struct remote_free_entry_s {
+	struct remote_free_entry_s *next;
+	uintptr_t stamp;
+} remote_free_entry_t;
+
 /*******************************************************************************
  * Per-processor magazine for tiny and small allocators
  ******************************************************************************/
@@ -473,6 +608,7 @@ typedef struct magazine_s { // vm_allocate()'d, so the array of magazines is pag
 	unsigned mag_num_objects;
 	size_t mag_num_bytes_in_objects;
 	size_t num_bytes_in_magazine;
+	size_t mag_bytes_clear_avoided; // calloc bytes not cleared because they were known to be zero
 
 	// recirculation list -- invariant: all regions owned by this magazine that meet the emptiness criteria
 	// are located nearer to the head of the list than any region that doesn't satisfy that criteria.
@@ -481,7 +617,15 @@ typedef struct magazine_s { // vm_allocate()'d, so the array of magazines is pag
 	region_trailer_t *firstNode;
 	region_trailer_t *lastNode;
 
-	uintptr_t pad[50 - MALLOC_CACHE_LINE / sizeof(uintptr_t)];
+	// runs with at least one free slot, per small size class (MALLOC_SMALL_CLASSES)
+	small_class_run_t *mag_class_runs[SMALL_CLASS_COUNT];
+
+	uintptr_t pad[48 - MALLOC_CACHE_LINE / sizeof(uintptr_t) - SMALL_CLASS_COUNT];
+
+	// Blocks freed by threads running on other CPUs, pushed without the
+	// magazine_lock and drained by whoever next holds it. Kept at the far end
+	// so that remote pushes do not share a cache line with the lock.
+	remote_free_entry_t *volatile mag_remote_free;
 } magazine_t;
 
 #if MALLOC_TARGET_64BIT
@@ -490,16 +634,30 @@ MALLOC_STATIC_ASSERT(sizeof(magazine_t) == 2560, "Incorrect padding in magazine_
 MALLOC_STATIC_ASSERT(sizeof(magazine_t) == 1280, "Incorrect padding in magazine_t");
 #endif
 
-#define TINY_MAX_MAGAZINES 32 /* MUST BE A POWER OF 2! */
+/*
+ * The most magazines a rack may have; a build may override these. The count a
+ * rack actually gets is sized from the online CPUs when the zone is created
+ * (see rack_magazine_count).
+ */
+#ifndef TINY_MAX_MAGAZINES
+#define TINY_MAX_MAGAZINES 256 /* MUST BE A POWER OF 2! */
+#endif
 #define TINY_MAGAZINE_PAGED_SIZE                                                   \
 	(((sizeof(magazine_t) * (TINY_MAX_MAGAZINES + 1)) + vm_page_quanta_size - 1) & \
 	~(vm_page_quanta_size - 1)) /* + 1 for the Depot */
 
-#define SMALL_MAX_MAGAZINES 32 /* MUST BE A POWER OF 2! */
+#ifndef SMALL_MAX_MAGAZINES
+#define SMALL_MAX_MAGAZINES 256 /* MUST BE A POWER OF 2! */
+#endif
 #define SMALL_MAGAZINE_PAGED_SIZE                                                   \
 	(((sizeof(magazine_t) * (SMALL_MAX_MAGAZINES + 1)) + vm_page_quanta_size - 1) & \
 	~(vm_page_quanta_size - 1)) /* + 1 for the Depot */
 
+MALLOC_STATIC_ASSERT((TINY_MAX_MAGAZINES & (TINY_MAX_MAGAZINES - 1)) == 0 &&
+		(SMALL_MAX_MAGAZINES & (SMALL_MAX_MAGAZINES - 1)) == 0, "magazine ceilings must be powers of 2");
+MALLOC_STATIC_ASSERT(TINY_MAX_MAGAZINES <= 256 && SMALL_MAX_MAGAZINES <= 256,
+		"the NUMA magazine map holds magazine indices in a byte");
+
 #define DEPOT_MAGAZINE_INDEX -1
 
 /****************************** zone itself ***********************************/
@@ -524,20 +682,18 @@ typedef struct szone_s {	  // vm_allocate()'d, so page-aligned to begin with.
 	struct rack_s small_rack;
 
 	/* large objects: all the rest */
-	_malloc_lock_s large_szone_lock MALLOC_CACHE_ALIGN; // One customer at a time for large
-	unsigned num_large_objects_in_use;
-	unsigned num_large_entries;
-	large_entry_t *large_entries; // hashed by location; null entries don't count
-	size_t num_bytes_in_large_objects;
+	_malloc_lock_s large_szone_lock MALLOC_CACHE_ALIGN; // Zone-wide walks; large objects lock per shard
+	large_shard_t large_shards[LARGE_SHARD_COUNT];
 
 #if CONFIG_LARGE_CACHE
-	int large_entry_cache_oldest;
-	int large_entry_cache_newest;
-	large_entry_t large_entry_cache[LARGE_ENTRY_CACHE_SIZE]; // "death row" for large malloc/free
 	boolean_t large_legacy_reset_mprotect;
-	size_t large_entry_cache_reserve_bytes;
+	volatile int64_t large_entry_cache_reserve_bytes; // updated atomically, summed over all shards
 	size_t large_entry_cache_reserve_limit;
-	size_t large_entry_cache_bytes; // total size of death row, bytes
+	volatile int64_t large_entry_cache_bytes; // total size of death row, bytes (atomic)
+	volatile int64_t large_entry_cache_hits;	 // statistics, updated atomically
+	volatile int64_t large_entry_cache_misses;
+	volatile int64_t large_entry_cache_evictions;
+	volatile int64_t large_entry_cache_clear_avoided; // calloc bytes of death-row blocks known to be zero
 #endif
 
 	/* flag and limits pertaining to altered malloc behavior for systems with
@@ -554,6 +710,27 @@ typedef struct szone_s {	  // vm_allocate()'d, so page-aligned to begin with.
 	struct szone_s *helper_zone;
 
 	boolean_t flotsam_enabled;
+
+	/* Slot under which this zone claims its regions and large allocations in the
+	 * zone ownership map (0 if it does not participate). */
+	malloc_zone_owner_index_t zone_owner;
+
+#if CONFIG_MADVISE_PRESSURE_RELIEF
+	/* Pressure relief statistics, updated atomically */
+	volatile int64_t relief_calls;
+	volatile int64_t relief_ranges;	// free page ranges found
+	volatile int64_t relief_syscalls; // madvise/process_madvise calls made for them
+	volatile int64_t relief_bytes;
+#endif // CONFIG_MADVISE_PRESSURE_RELIEF
+
+#if CONFIG_MAGAZINE_SCAVENGER
+	/* Background scavenger thread (MALLOC_SCAVENGER), see magazine_scavenger.c */
+	pthread_t scavenger_thread;
+	volatile boolean_t scavenger_running;
+	volatile boolean_t scavenger_stop;
+	uint32_t scavenger_tick;
+	uint64_t scavenger_pages; // pages returned to the system so far
+#endif // CONFIG_MAGAZINE_SCAVENGER
 } szone_t;
 
 #define SZONE_PAGED_SIZE round_page_quanta((sizeof(szone_t)))
@@ -23,9 +23,13 @@
 
 #import <stdbool.h>
 #import <malloc/malloc.h>
+#if !defined(__linux__)
 #import <mach/vm_statistics.h>
+#endif // !__linux__
 #import <sys/cdefs.h>
+#if !defined(__linux__)
 #import <os/availability.h>
+#endif // !__linux__
 
 #define STACK_LOGGING_MAX_STACK_SIZE 512
 
@@ -120,6 +124,13 @@ extern kern_return_t __mach_stack_logging_get_frames_for_stackid(task_t task, ui
 extern uint64_t __mach_stack_logging_stackid_for_vm_region(task_t task, mach_vm_address_t address);
 	/* given the address of a vm region, lookup it's stackid */
 
+extern kern_return_t __mach_stack_logging_get_sample_interval(task_t task, uint64_t *sample_interval);
+	/* Gets the mean number of bytes between sampled allocations of a task logging in lite mode with
+	 * MallocStackLogging=sample, or 0 if every allocation is recorded.  Only sampled allocations carry a
+	 * stack id; an allocation of size bytes was sampled with probability p = 1 - exp(-size / sample_interval),
+	 * so it stands for size / p live bytes.  The refcounts of the task's uniquing table are already such
+	 * estimates. */
+
 
 struct backtrace_uniquing_table;
 
@@ -91,12 +91,7 @@ purgeable_valloc(szone_t *szone, size_t size)
 static void
 purgeable_free(szone_t *szone, void *ptr)
 {
-	large_entry_t *entry;
-
-	SZONE_LOCK(szone);
-	entry = large_entry_for_pointer_no_lock(szone, ptr);
-	SZONE_UNLOCK(szone);
-	if (entry) {
+	if (large_size(szone, ptr)) {
 		return free_large(szone, ptr);
 	} else {
 		return szone_free(szone->helper_zone, ptr);
@@ -178,21 +173,7 @@ static void
 purgeable_destroy(szone_t *szone)
 {
 	/* destroy large entries */
-	size_t index = szone->num_large_entries;
-	large_entry_t *large;
-	vm_range_t range_to_deallocate;
-
-	while (index--) {
-		large = szone->large_entries + index;
-		if (large->address) {
-			// we deallocate_pages, including guard pages
-			mvm_deallocate_pages((void *)(large->address), large->size, szone->debug_flags);
-		}
-	}
-	large_entries_free_no_lock(szone, szone->large_entries, szone->num_large_entries, &range_to_deallocate);
-	if (range_to_deallocate.size) {
-		mvm_deallocate_pages((void *)range_to_deallocate.address, (size_t)range_to_deallocate.size, 0);
-	}
+	large_destroy(szone);
 
 	/* Now destroy the separate szone region */
 	mvm_deallocate_pages((void *)szone, SZONE_PAGED_SIZE, 0);
@@ -240,8 +221,7 @@ purgeable_ptr_in_use_enumerator(task_t task,
 		return err;
 	}
 
-	err = large_in_use_enumerator(
-								  task, context, type_mask, (vm_address_t)szone->large_entries, szone->num_large_entries, reader, recorder);
+	err = large_in_use_enumerator(task, context, type_mask, szone, reader, recorder);
 	return err;
 }
 
@@ -264,8 +244,12 @@ purgeable_check(szone_t *szone)
 static void
 purgeable_print(szone_t *szone, boolean_t verbose)
 {
+	unsigned blocks_in_use;
+	size_t size_in_use;
+
+	large_statistics(szone, &blocks_in_use, &size_in_use);
 	_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "Scalable zone %p: inUse=%u(%y) flags=%d\n", szone,
-				   szone->num_large_objects_in_use, szone->num_bytes_in_large_objects, szone->debug_flags);
+				   blocks_in_use, size_in_use, szone->debug_flags);
 }
 
 static void
@@ -280,11 +264,13 @@ static void
 purgeable_force_lock(szone_t *szone)
 {
 	SZONE_LOCK(szone);
+	large_force_lock(szone);
 }
 
 static void
 purgeable_force_unlock(szone_t *szone)
 {
+	large_force_unlock(szone);
 	SZONE_UNLOCK(szone);
 }
 
@@ -292,13 +278,18 @@ static void
 purgeable_reinit_lock(szone_t *szone)
 {
 	SZONE_REINIT_LOCK(szone);
+	large_reinit_lock(szone);
 }
 
 static void
 purgeable_statistics(szone_t *szone, malloc_statistics_t *stats)
 {
-	stats->blocks_in_use = szone->num_large_objects_in_use;
-	stats->size_in_use = stats->max_size_in_use = stats->size_allocated = szone->num_bytes_in_large_objects;
+	unsigned blocks_in_use;
+	size_t size_in_use;
+
+	large_statistics(szone, &blocks_in_use, &size_in_use);
+	stats->blocks_in_use = blocks_in_use;
+	stats->size_in_use = stats->max_size_in_use = stats->size_allocated = size_in_use;
 }
 
 static boolean_t
@@ -311,7 +302,7 @@ purgeable_locked(szone_t *szone)
 		return 1;
 	}
 	SZONE_UNLOCK(szone);
-	return 0;
+	return large_locked(szone);
 }
 
 static size_t
@@ -402,6 +393,7 @@ create_purgeable_zone(size_t initial_size, malloc_zone_t *malloc_default_zone, u
 	}
 
 	_malloc_lock_init(&szone->large_szone_lock);
+	large_shards_init(szone);
 
 	szone->helper_zone = (struct szone_s *)malloc_default_zone;
 
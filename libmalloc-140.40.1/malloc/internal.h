@@ -26,6 +26,9 @@
 
 #define __OS_EXPOSE_INTERNALS__ 1
 
+#if defined(__linux__)
+#include "linux_shims.h"
+#else // __linux__
 #include <Availability.h>
 #include <TargetConditionals.h>
 #include <_simple.h>
@@ -34,15 +37,9 @@ static size_t _platform_strlen(const char *s);
 static size_t _platform_strlcpy(char * restrict dst, const char * restrict src, size_t maxlen);
 #define memcpy _platform_memmove
 #include <platform/compat.h>
-#include <assert.h>
 #include <crt_externs.h>
-#include <dirent.h>
-#include <dlfcn.h>
-#include <errno.h>
-#include <fcntl.h>
 #include <libc.h>
 #include <libkern/OSAtomic.h>
-#include <limits.h>
 #include <mach-o/dyld.h>
 #include <mach-o/dyld_priv.h>
 #include <mach/mach.h>
@@ -59,7 +56,18 @@ static size_t _platform_strlcpy(char * restrict dst, const char * restrict src,
 #include <os/once_private.h>
 #include <os/overflow.h>
 #include <os/tsd.h>
+#include <sys/sysctl.h>
+#include <sys/vmparam.h>
+#include <xlocale.h>
+#endif // __linux__
+#include <assert.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <paths.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -71,12 +79,10 @@ static size_t _platform_strlcpy(char * restrict dst, const char * restrict src,
 #include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/stat.h>
-#include <sys/sysctl.h>
 #include <sys/random.h>
 #include <sys/types.h>
-#include <sys/vmparam.h>
+#include <sys/uio.h>
 #include <unistd.h>
-#include <xlocale.h>
 
 #include "dtrace.h"
 
@@ -87,20 +93,27 @@ static size_t _platform_strlcpy(char * restrict dst, const char * restrict src,
 #include "locking.h"
 #include "bitarray.h"
 #include "malloc.h"
+#include "malloc_zone.h"
+#include "malloc_zone_introspection.h"
+#include "malloc_zone_owner.h"
+#include "malloc_private.h"
 #include "printf.h"
 #include "frozen_malloc.h"
 #include "legacy_malloc.h"
 #include "magazine_malloc.h"
 #include "nano_malloc.h"
 #include "purgeable_malloc.h"
-#include "malloc_private.h"
 #include "stack_logging.h"
 #include "stack_logging_internal.h"
 #include "thresholds.h"
 #include "vm.h"
+#include "fill.h"
 
 #include "magazine_rack.h"
 #include "magazine_zone.h"
+#include "magazine_tcache.h"
+#include "magazine_scavenger.h"
+#include "magazine_numa.h"
 #include "nano_zone.h"
 
 #include "magazine_inline.h"
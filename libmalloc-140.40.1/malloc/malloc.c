@@ -380,6 +380,19 @@ find_registered_zone(const void *ptr, size_t *returned_size)
 	//      are still valid). It also ensures that all the pointers in the zones array are
 	//      valid until it returns, so that a stale value in limit is not dangerous.
 
+	// Zones that record their address ranges in the zone ownership map are
+	// resolved with a single lookup. The owner's answer is final: no other zone
+	// can claim a pointer into pages the owner has mapped.
+	zone = malloc_zone_owner_lookup(ptr);
+	if (zone) {
+		size = zone->size(zone, ptr);
+		if (!size) {
+			zone = NULL;
+		}
+		goto out;
+	}
+
+	// Otherwise ask every zone in turn.
 	for (index = 1; index < limit; ++index, ++zones) {
 		zone = *zones;
 		size = zone->size(zone, ptr);
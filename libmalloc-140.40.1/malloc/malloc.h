@@ -6,9 +6,15 @@
 #define _MALLOC_MALLOC_H_
 
 #include <stddef.h>
+#if defined(__linux__)
+#include "linux_shims.h"
+#else // __linux__
 #include <mach/mach_types.h>
+#endif // __linux__
 #include <sys/cdefs.h>
+#if !defined(__linux__)
 #include <Availability.h>
+#endif // !__linux__
 
 __BEGIN_DECLS
 /*********	Type definitions	************/
@@ -64,5 +70,6 @@ typedef struct _malloc_zone_t {
     size_t 	(*pressure_relief)(struct _malloc_zone_t *zone, size_t goal);
 } malloc_zone_t;
 
+__END_DECLS
 
 #endif /* _MALLOC_MALLOC_H_ */
@@ -0,0 +1,482 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#include "internal.h"
+#include "malloc_zone_block.h"
+#include "malloc_zone_create.h"
+
+#if MALLOC_TARGET_LINUX
+
+#include <sys/auxv.h>
+
+/*
+ * Front end for Linux builds. The Darwin front end leans on libsystem for zone
+ * registration, stack logging and remote introspection; this file carries just
+ * enough to run the scalable zone as a process heap: the default zone, the zone
+ * API used by the engines and by MallocBench and, when built with
+ * MALLOC_PRELOAD, the C library allocation entry points so that the library
+ * can be interposed with LD_PRELOAD.
+ *
+ * There is no zone registry. Zones made here are entered in the zone ownership
+ * map as they are created, so free(), realloc() and malloc_size() of a pointer
+ * from any of them reach the right zone; anything else is handed to the
+ * default zone.
+ */
+
+static int malloc_debug_file = STDERR_FILENO;
+static unsigned malloc_debug_flags = 0;
+static malloc_zone_t *volatile default_zone = NULL;
+static pthread_once_t _malloc_initialize_pred = PTHREAD_ONCE_INIT;
+
+#pragma mark printing
+
+void
+_malloc_vprintf(int flags, const char *format, va_list ap)
+{
+	_SIMPLE_STRING b;
+
+	if ((flags & MALLOC_PRINTF_NOLOG) || (b = _simple_salloc()) == NULL) {
+		if (!(flags & MALLOC_PRINTF_NOPREFIX)) {
+			_simple_dprintf(malloc_debug_file, "%s(%d,%p) malloc: ", program_invocation_short_name, getpid(),
+					(void *)pthread_self());
+		}
+		_simple_vdprintf(malloc_debug_file, format, ap);
+		return;
+	}
+	if (!(flags & MALLOC_PRINTF_NOPREFIX)) {
+		_simple_sprintf(b, "%s(%d,%p) malloc: ", program_invocation_short_name, getpid(), (void *)pthread_self());
+	}
+	_simple_vsprintf(b, format, ap);
+	_simple_put(b, malloc_debug_file);
+	_simple_sfree(b);
+}
+
+void
+_malloc_printf(int flags, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	_malloc_vprintf(flags, format, ap);
+	va_end(ap);
+}
+
+void
+malloc_printf(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	_malloc_vprintf(ASL_LEVEL_ERR, format, ap);
+	va_end(ap);
+}
+
+void
+malloc_error_break(void)
+{
+	// Provides a non-inlined place for various malloc error procedures to call
+	// that will be called after an error message appears.
+	MAGMALLOC_MALLOCERRORBREAK(); // DTrace USDT probe
+	__asm__ __volatile__("");
+}
+
+#pragma mark initialization
+
+static void
+set_flags_from_environment(void)
+{
+	const char *flag;
+	int fd;
+
+	malloc_debug_flags = MALLOC_ABORT_ON_CORRUPTION; // Set always on 64-bit processes
+
+	// Ignore the environment in setuid/setgid processes.
+	if (getauxval(AT_SECURE)) {
+		return;
+	}
+
+	flag = getenv("MallocLogFile");
+	if (flag) {
+		fd = open(flag, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+		if (fd >= 0) {
+			malloc_debug_file = fd;
+		} else {
+			malloc_printf("Could not open %s, using stderr\n", flag);
+		}
+	}
+	if (getenv("MallocGuardEdges")) {
+		malloc_debug_flags |= MALLOC_ADD_GUARD_PAGES;
+		_malloc_printf(ASL_LEVEL_INFO, "protecting edges\n");
+		if (getenv("MallocDoNotProtectPrelude")) {
+			malloc_debug_flags |= MALLOC_DONT_PROTECT_PRELUDE;
+			_malloc_printf(ASL_LEVEL_INFO, "... but not protecting prelude guard page\n");
+		}
+		if (getenv("MallocDoNotProtectPostlude")) {
+			malloc_debug_flags |= MALLOC_DONT_PROTECT_POSTLUDE;
+			_malloc_printf(ASL_LEVEL_INFO, "... but not protecting postlude guard page\n");
+		}
+	}
+	if (getenv("MallocScribble")) {
+		malloc_debug_flags |= MALLOC_DO_SCRIBBLE;
+		_malloc_printf(ASL_LEVEL_INFO, "enabling scribbling to detect mods to free blocks\n");
+	}
+	if (getenv("MallocErrorAbort")) {
+		malloc_debug_flags |= MALLOC_ABORT_ON_ERROR;
+		_malloc_printf(ASL_LEVEL_INFO, "enabling abort() on bad malloc or free\n");
+	}
+	flag = getenv("MallocCorruptionAbort");
+	if (flag && (flag[0] == '0')) {
+		malloc_debug_flags &= ~MALLOC_ABORT_ON_CORRUPTION;
+	}
+	flag = getenv("MallocThreadCache");
+	if (flag && flag[0] != '0') {
+		malloc_debug_flags |= MALLOC_THREAD_CACHE;
+	}
+	flag = getenv("MallocMaxMagazines");
+	if (flag && strtoul(flag, NULL, 0)) {
+		rack_max_magazines = (uint32_t)MIN(strtoul(flag, NULL, 0), TINY_MAX_MAGAZINES);
+	}
+	flag = getenv("MallocSmallClasses");
+	if (flag && flag[0] != '0') {
+		malloc_debug_flags |= MALLOC_SMALL_CLASSES;
+	}
+#if CONFIG_MAGAZINE_SCAVENGER
+	flag = getenv("MallocScavenger");
+	if (flag && flag[0] != '0') {
+		malloc_debug_flags |= MALLOC_SCAVENGER;
+		flag = getenv("MallocScavengerInterval");
+		if (flag && strtoul(flag, NULL, 0)) {
+			malloc_scavenger_interval_ms = (unsigned)strtoul(flag, NULL, 0);
+		}
+		flag = getenv("MallocScavengerRSSTarget");
+		if (flag) {
+			malloc_scavenger_rss_target = (size_t)strtoull(flag, NULL, 0);
+		}
+		flag = getenv("MallocScavengerPages");
+		if (flag && strtoul(flag, NULL, 0)) {
+			malloc_scavenger_max_pages = (size_t)strtoull(flag, NULL, 0);
+		}
+	}
+#endif // CONFIG_MAGAZINE_SCAVENGER
+#if CONFIG_HUGE_PAGE_REGIONS
+	flag = getenv("MallocHugePages");
+	if (flag && flag[0] != '0') {
+		malloc_debug_flags |= MALLOC_HUGE_PAGES;
+	}
+	flag = getenv("MallocHugePageSplit");
+	if (flag) {
+		if (!strcmp(flag, "never")) {
+			mvm_huge_page_split = MVM_HUGE_SPLIT_NEVER;
+		} else if (!strcmp(flag, "pressure")) {
+			mvm_huge_page_split = MVM_HUGE_SPLIT_PRESSURE;
+		} else if (!strcmp(flag, "always")) {
+			mvm_huge_page_split = MVM_HUGE_SPLIT_ALWAYS;
+		}
+	}
+#endif // CONFIG_HUGE_PAGE_REGIONS
+#if CONFIG_NUMA_MAGAZINES
+	flag = getenv("MallocNUMA");
+	if (flag && flag[0] != '0') {
+		malloc_debug_flags |= MALLOC_NUMA_MAGAZINES;
+	}
+#endif // CONFIG_NUMA_MAGAZINES
+}
+
+static void
+_malloc_fork_prepare(void)
+{
+	default_zone->introspect->force_lock(default_zone);
+}
+
+static void
+_malloc_fork_parent(void)
+{
+	default_zone->introspect->force_unlock(default_zone);
+}
+
+static void
+_malloc_fork_child(void)
+{
+	default_zone->introspect->reinit_lock(default_zone);
+}
+
+static void
+_malloc_initialize(void)
+{
+	malloc_zone_t *zone;
+
+	if (getrandom(malloc_entropy, sizeof(malloc_entropy), GRND_NONBLOCK) != sizeof(malloc_entropy)) {
+		malloc_entropy[0] = (uint64_t)(uintptr_t)&zone ^ (uint64_t)getpid();
+		malloc_entropy[1] = (uint64_t)(uintptr_t)&_malloc_initialize;
+	}
+	mvm_aslr_init();
+	set_flags_from_environment();
+
+	zone = create_scalable_zone(0, malloc_debug_flags);
+	if (!zone) {
+		MALLOC_PRINTF_FATAL_ERROR(0, "unable to create the default zone");
+	}
+	malloc_zone_owner_set_registered(zone, TRUE);
+	__atomic_store_n(&default_zone, zone, __ATOMIC_RELEASE);
+
+	// Registering the handlers may itself allocate; the default zone is
+	// already published, so those allocations do not re-enter the once.
+	pthread_atfork(_malloc_fork_prepare, _malloc_fork_parent, _malloc_fork_child);
+#if CONFIG_MAGAZINE_SCAVENGER
+	szone_scavenger_start((szone_t *)zone);
+#endif
+}
+
+static inline malloc_zone_t *
+inline_malloc_default_zone(void)
+{
+	malloc_zone_t *zone = __atomic_load_n(&default_zone, __ATOMIC_ACQUIRE);
+
+	if (__builtin_expect(!zone, 0)) {
+		pthread_once(&_malloc_initialize_pred, _malloc_initialize);
+		zone = default_zone;
+	}
+	return zone;
+}
+
+/*
+ * malloc_zone_for_ptr - The zone that allocated ptr, or the default zone if
+ * the ownership map does not know it.
+ */
+static inline malloc_zone_t *
+malloc_zone_for_ptr(const void *ptr)
+{
+	malloc_zone_t *zone = malloc_zone_owner_lookup(ptr);
+
+	return zone ? zone : inline_malloc_default_zone();
+}
+
+#pragma mark zone API
+
+malloc_zone_t *
+malloc_default_zone(void)
+{
+	return inline_malloc_default_zone();
+}
+
+malloc_zone_t *
+malloc_create_zone(vm_size_t start_size, unsigned flags)
+{
+	inline_malloc_default_zone(); // picks up the environment flags
+	malloc_zone_t *zone = create_scalable_zone(start_size, flags | malloc_debug_flags);
+
+	if (zone) {
+		malloc_zone_owner_set_registered(zone, TRUE);
+	}
+	return zone;
+}
+
+void
+malloc_destroy_zone(malloc_zone_t *zone)
+{
+	malloc_zone_owner_set_registered(zone, FALSE);
+	zone->destroy(zone);
+}
+
+void *
+malloc_zone_malloc(malloc_zone_t *zone, size_t size)
+{
+	return zone->malloc(zone, size);
+}
+
+void *
+malloc_zone_calloc(malloc_zone_t *zone, size_t num_items, size_t size)
+{
+	return zone->calloc(zone, num_items, size);
+}
+
+void *
+malloc_zone_valloc(malloc_zone_t *zone, size_t size)
+{
+	return zone->valloc(zone, size);
+}
+
+void *
+malloc_zone_realloc(malloc_zone_t *zone, void *ptr, size_t size)
+{
+	return zone->realloc(zone, ptr, size);
+}
+
+void
+malloc_zone_free(malloc_zone_t *zone, void *ptr)
+{
+	zone->free(zone, ptr);
+}
+
+void *
+malloc_zone_memalign(malloc_zone_t *zone, size_t alignment, size_t size)
+{
+	if (alignment < sizeof(void *) || (alignment & (alignment - 1))) {
+		return NULL;
+	}
+	return zone->memalign(zone, alignment, size);
+}
+
+size_t
+malloc_size(const void *ptr)
+{
+	malloc_zone_t *zone = malloc_zone_for_ptr(ptr);
+	return zone->size(zone, ptr);
+}
+
+size_t
+malloc_good_size(size_t size)
+{
+	malloc_zone_t *zone = inline_malloc_default_zone();
+	return zone->introspect->good_size(zone, size);
+}
+
+size_t
+malloc_zone_pressure_relief(malloc_zone_t *zone, size_t goal)
+{
+	if (!zone) {
+		zone = inline_malloc_default_zone();
+	}
+	return zone->pressure_relief(zone, goal);
+}
+
+#if MALLOC_PRELOAD
+#pragma mark C library entry points
+
+void *
+malloc(size_t size)
+{
+	malloc_zone_t *zone = inline_malloc_default_zone();
+	void *ptr = zone->malloc(zone, size);
+
+	if (__builtin_expect(!ptr, 0)) {
+		errno = ENOMEM;
+	}
+	return ptr;
+}
+
+void *
+calloc(size_t num_items, size_t size)
+{
+	malloc_zone_t *zone = inline_malloc_default_zone();
+	void *ptr = zone->calloc(zone, num_items, size);
+
+	if (__builtin_expect(!ptr, 0)) {
+		errno = ENOMEM;
+	}
+	return ptr;
+}
+
+void *
+realloc(void *old_ptr, size_t new_size)
+{
+	malloc_zone_t *zone = old_ptr ? malloc_zone_for_ptr(old_ptr) : inline_malloc_default_zone();
+	void *ptr = zone->realloc(zone, old_ptr, new_size);
+
+	if (__builtin_expect(!ptr, 0)) {
+		errno = ENOMEM;
+	}
+	return ptr;
+}
+
+void
+free(void *ptr)
+{
+	if (!ptr) {
+		return;
+	}
+	malloc_zone_t *zone = malloc_zone_for_ptr(ptr);
+	zone->free(zone, ptr);
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	malloc_zone_t *zone = inline_malloc_default_zone();
+	void *ptr;
+
+	if (alignment < sizeof(void *) || (alignment & (alignment - 1))) {
+		return EINVAL;
+	}
+	ptr = zone->memalign(zone, alignment, size);
+	if (!ptr) {
+		return ENOMEM;
+	}
+	*memptr = ptr;
+	return 0;
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+	void *ptr = NULL;
+	int err = posix_memalign(&ptr, MAX(alignment, sizeof(void *)), size);
+
+	if (err) {
+		errno = err;
+		return NULL;
+	}
+	return ptr;
+}
+
+void *
+memalign(size_t alignment, size_t size)
+{
+	return aligned_alloc(alignment, size);
+}
+
+void *
+valloc(size_t size)
+{
+	malloc_zone_t *zone = inline_malloc_default_zone();
+	void *ptr = zone->valloc(zone, size);
+
+	if (__builtin_expect(!ptr, 0)) {
+		errno = ENOMEM;
+	}
+	return ptr;
+}
+
+void *
+pvalloc(size_t size)
+{
+	return valloc(round_page(size));
+}
+
+size_t
+malloc_usable_size(void *ptr)
+{
+	return ptr ? malloc_size(ptr) : 0;
+}
+
+int
+malloc_trim(size_t pad)
+{
+	(void)pad;
+	return malloc_zone_pressure_relief(NULL, 0) != 0;
+}
+
+#endif // MALLOC_PRELOAD
+
+#endif // MALLOC_TARGET_LINUX
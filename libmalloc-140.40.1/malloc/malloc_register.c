@@ -92,6 +92,7 @@ malloc_zone_register_while_locked(malloc_zone_t *zone)
 	 */
 	malloc_zones[malloc_num_zones] = zone;
 	OSAtomicIncrement32Barrier(&malloc_num_zones);
+	malloc_zone_owner_set_registered(zone, TRUE);
 	
 	/* Finally, now that the zone is registered, disallow write access to the
 	 * malloc_zones array */
@@ -130,6 +131,7 @@ void malloc_zone_unregister(malloc_zone_t *z)
 		
 		malloc_zones[index] = malloc_zones[malloc_num_zones - 1];
 		--malloc_num_zones;
+		malloc_zone_owner_set_registered(z, FALSE);
 		
 		mprotect(malloc_zones, protect_size, PROT_READ);
 		
@@ -58,3 +58,5 @@ typedef kern_return_t memory_reader_t(task_t remote_task, vm_address_t remote_ad
 
 typedef void vm_range_recorder_t(task_t, void *, unsigned type, vm_range_t *, unsigned);
 /* given a task and context, "records" the specified addresses */
+
+#endif /* malloc_zone_h */
@@ -11,7 +11,10 @@ _malloc_initialize(void *context __unused)
 {
 	MALLOC_LOCK();
 	unsigned n;
-	malloc_zone_t *zone;
+	malloc_zone_t *zone, *scalable_zone;
+#if CONFIG_NANOZONE
+	malloc_zone_t *nano_zone;
+#endif
 	
 	if (!_malloc_entropy_initialized) {
 		// Lazy initialization may occur before __malloc_init (rdar://27075409)
@@ -24,7 +27,9 @@ _malloc_initialize(void *context __unused)
 	
 #if CONFIG_NANOZONE
 	malloc_zone_t *helper_zone = create_scalable_zone(0, malloc_debug_flags);
+	scalable_zone = helper_zone;
 	zone = create_nano_zone(0, helper_zone, malloc_debug_flags);
+	nano_zone = zone;
 	if (zone) {
 		malloc_zone_register_while_locked(zone);
 		malloc_zone_register_while_locked(helper_zone);
@@ -39,6 +44,7 @@ _malloc_initialize(void *context __unused)
 	}
 #else
 	zone = create_scalable_zone(0, malloc_debug_flags);
+	scalable_zone = zone;
 	malloc_zone_register_while_locked(zone);
 	malloc_set_zone_name(zone, DEFAULT_MALLOC_ZONE_STRING);
 #endif
@@ -84,6 +90,15 @@ _malloc_initialize(void *context __unused)
 	// _malloc_printf(ASL_LEVEL_INFO, "malloc_zones is at %p; malloc_num_zones is at %p\n", (unsigned)&malloc_zones,
 	// (unsigned)&malloc_num_zones);
 	MALLOC_UNLOCK();
+
+#if CONFIG_MAGAZINE_SCAVENGER
+	szone_scavenger_start((szone_t *)scalable_zone);
+#endif
+#if CONFIG_NANO_BAND_PREFETCH
+	if (nano_zone) {
+		nano_band_prefetch_start((nanozone_t *)nano_zone);
+	}
+#endif
 }
 MALLOC_ALWAYS_INLINE
 static inline void
@@ -240,6 +255,7 @@ set_flags_from_environment(void)
 #endif
 	stack_logging_enable_logging = 0;
 	stack_logging_dontcompact = 0;
+	stack_logging_thread_buffers = 0;
 	malloc_logger = NULL;
 	malloc_check_start = 0;
 	malloc_check_each = 1000;
@@ -294,6 +310,11 @@ set_flags_from_environment(void)
 			_malloc_printf(ASL_LEVEL_INFO, "... but not protecting postlude guard page\n");
 		}
 	}
+	// Lite mode, whether turned on here or later, samples allocations if asked to.
+	flag = getenv("MallocStackLoggingSampleInterval");
+	if (flag && strtoull(flag, NULL, 0)) {
+		stack_logging_sample_interval = strtoull(flag, NULL, 0);
+	}
 	flag = getenv("MallocStackLogging");
 	if (!flag) {
 		flag = getenv("MallocStackLoggingNoCompact");
@@ -304,13 +325,22 @@ set_flags_from_environment(void)
 		// including those from _malloc_printf and malloc zone setup.  Make sure to set
 		// __syscall_logger after this, because prepare_to_log_stacks() itself makes VM
 		// allocations that we aren't prepared to log yet.
-		boolean_t lite_mode = strcmp(flag, "lite") == 0;
+		boolean_t sample_mode = strcmp(flag, "sample") == 0;
+		boolean_t lite_mode = sample_mode || strcmp(flag, "lite") == 0;
 		
+		if (sample_mode && !stack_logging_sample_interval) {
+			stack_logging_sample_interval = STACK_LOGGING_SAMPLE_INTERVAL;
+		}
 		__prepare_to_log_stacks(lite_mode);
 		
-		if (strcmp(flag, "lite") == 0) {
+		if (lite_mode) {
 			stack_logging_mode = stack_logging_mode_lite;
-			_malloc_printf(ASL_LEVEL_INFO, "recording malloc and VM allocation stacks using lite mode\n");
+			if (stack_logging_sample_interval) {
+				_malloc_printf(ASL_LEVEL_INFO, "recording malloc stacks sampled every %llu bytes and VM allocation stacks using lite mode\n",
+							   stack_logging_sample_interval);
+			} else {
+				_malloc_printf(ASL_LEVEL_INFO, "recording malloc and VM allocation stacks using lite mode\n");
+			}
 		} else if (strcmp(flag,"malloc") == 0) {
 			stack_logging_mode = stack_logging_mode_malloc;
 			_malloc_printf(ASL_LEVEL_INFO, "recording malloc (but not VM allocation) stacks to disk using standard recorder\n");
@@ -322,6 +352,10 @@ set_flags_from_environment(void)
 			_malloc_printf(ASL_LEVEL_INFO, "recording malloc and VM allocation stacks to disk using standard recorder\n");
 		}
 		stack_logging_enable_logging = 1;
+		if (stack_logging_mode != stack_logging_mode_lite && getenv("MallocStackLoggingThreadBuffers")) {
+			stack_logging_thread_buffers = 1;
+			_malloc_printf(ASL_LEVEL_INFO, "buffering stack logging events per thread\n");
+		}
 		if (stack_logging_dontcompact) {
 			if (stack_logging_mode == stack_logging_mode_all || stack_logging_mode == stack_logging_mode_malloc) {
 				_malloc_printf(
@@ -342,6 +376,77 @@ set_flags_from_environment(void)
 	if (getenv("MallocTracing")) {
 		malloc_tracing_enabled = true;
 	}
+	if (getenv("MallocThreadCache")) {
+		malloc_debug_flags |= MALLOC_THREAD_CACHE;
+		_malloc_printf(ASL_LEVEL_INFO, "enabling per-thread caching of tiny and small blocks\n");
+	}
+	flag = getenv("MallocMaxMagazines");
+	if (flag) {
+		unsigned long max_magazines = strtoul(flag, NULL, 0);
+		if (max_magazines) {
+			rack_max_magazines = (uint32_t)MIN(max_magazines, TINY_MAX_MAGAZINES);
+			_malloc_printf(ASL_LEVEL_INFO, "using at most %u magazines per rack\n", rack_max_magazines);
+		} else {
+			malloc_printf("MallocMaxMagazines must be a positive number\n");
+		}
+	}
+	if (getenv("MallocSmallClasses")) {
+		malloc_debug_flags |= MALLOC_SMALL_CLASSES;
+		_malloc_printf(ASL_LEVEL_INFO, "enabling size-class runs for small blocks\n");
+	}
+#if CONFIG_MAGAZINE_SCAVENGER
+	if (getenv("MallocScavenger")) {
+		malloc_debug_flags |= MALLOC_SCAVENGER;
+		flag = getenv("MallocScavengerInterval");
+		if (flag && strtoul(flag, NULL, 0)) {
+			malloc_scavenger_interval_ms = (unsigned)strtoul(flag, NULL, 0);
+		}
+		flag = getenv("MallocScavengerRSSTarget");
+		if (flag) {
+			malloc_scavenger_rss_target = (size_t)strtoull(flag, NULL, 0);
+		}
+		flag = getenv("MallocScavengerPages");
+		if (flag && strtoul(flag, NULL, 0)) {
+			malloc_scavenger_max_pages = (size_t)strtoull(flag, NULL, 0);
+		}
+		_malloc_printf(ASL_LEVEL_INFO, "scavenging idle pages every %ums\n", malloc_scavenger_interval_ms);
+	}
+#endif // CONFIG_MAGAZINE_SCAVENGER
+#if CONFIG_HUGE_PAGE_REGIONS
+	if (getenv("MallocHugePages")) {
+		malloc_debug_flags |= MALLOC_HUGE_PAGES;
+		_malloc_printf(ASL_LEVEL_INFO, "backing tiny and small regions with huge pages\n");
+	}
+	flag = getenv("MallocHugePageSplit");
+	if (flag) {
+		if (!strcmp(flag, "never")) {
+			mvm_huge_page_split = MVM_HUGE_SPLIT_NEVER;
+		} else if (!strcmp(flag, "pressure")) {
+			mvm_huge_page_split = MVM_HUGE_SPLIT_PRESSURE;
+		} else if (!strcmp(flag, "always")) {
+			mvm_huge_page_split = MVM_HUGE_SPLIT_ALWAYS;
+		} else {
+			malloc_printf("MallocHugePageSplit must be one of never, pressure or always\n");
+		}
+	}
+#endif // CONFIG_HUGE_PAGE_REGIONS
+#if CONFIG_NUMA_MAGAZINES
+	if (getenv("MallocNUMA")) {
+		malloc_debug_flags |= MALLOC_NUMA_MAGAZINES;
+		_malloc_printf(ASL_LEVEL_INFO, "grouping tiny and small magazines per NUMA node\n");
+	}
+#endif // CONFIG_NUMA_MAGAZINES
+#if CONFIG_NANO_BAND_PREFETCH
+	if (getenv("MallocNanoPrefetch")) {
+		malloc_debug_flags |= MALLOC_NANO_PREFETCH;
+		nano_prefault_pages = NANO_PREFAULT_PAGES;
+		_malloc_printf(ASL_LEVEL_INFO, "growing nano bands ahead of use\n");
+	}
+	flag = getenv("MallocNanoPrefault");
+	if (flag) {
+		nano_prefault_pages = (unsigned)strtoul(flag, NULL, 0);
+	}
+#endif // CONFIG_NANO_BAND_PREFETCH
 	
 #if __LP64__
 	/* initialization above forces MALLOC_ABORT_ON_CORRUPTION of 64-bit processes */
@@ -404,6 +509,8 @@ set_flags_from_environment(void)
 					   "- MallocStackLogging to record all stacks.  Tools like leaks can then be applied\n"
 					   "- MallocStackLoggingNoCompact to record all stacks.  Needed for malloc_history\n"
 					   "- MallocStackLoggingDirectory to set location of stack logs, which can grow large; default is /tmp\n"
+					   "- MallocStackLoggingThreadBuffers to buffer stack logging events per thread instead of under one lock\n"
+					   "- MallocStackLoggingSampleInterval <b> to record only allocations sampled every <b> bytes on average in lite mode\n"
 					   "- MallocScribble to detect writing on free blocks and missing initializers:\n"
 					   "  0x55 is written upon free and 0xaa is written on allocation\n"
 					   "- MallocCheckHeapStart <n> to start checking the heap after <n> operations\n"
@@ -414,6 +521,18 @@ set_flags_from_environment(void)
 					   "  MallocCorruptionAbort is always set on 64-bit processes\n"
 					   "- MallocErrorAbort to abort on any malloc error, including out of memory\n"\
 					   "- MallocTracing to emit kdebug trace points on malloc entry points\n"\
+					   "- MallocMaxMagazines <n> to use at most <n> tiny and small magazines; default one per CPU up to 256\n"\
+					   "- MallocThreadCache to keep a per-thread cache of free tiny and small blocks\n"\
+					   "- MallocSmallClasses to allocate small blocks from per-size-class runs\n"\
+					   "- MallocScavenger to return idle tiny and small pages to the system from a background thread\n"\
+					   "- MallocScavengerInterval <ms> to run the scavenger every <ms> milliseconds; default 250\n"\
+					   "- MallocScavengerRSSTarget <b> to leave the scavenger idle while resident memory is at most <b> bytes\n"\
+					   "- MallocScavengerPages <n> to return at most <n> pages per scavenger run; default 512\n"\
+					   "- MallocHugePages to back tiny and small regions with transparent huge pages\n"\
+					   "- MallocHugePageSplit never|pressure|always to say when freeing may split a huge page; default pressure\n"\
+					   "- MallocNUMA to group tiny and small magazines per NUMA node and keep their regions on it\n"\
+					   "- MallocNanoPrefetch to map and fault in the next nano band from a background thread\n"\
+					   "- MallocNanoPrefault <n> to fault in the first <n> pages of each new nano band; default 4 with MallocNanoPrefetch\n"\
 					   "- MallocHelp - this help!\n");
 	}
 }
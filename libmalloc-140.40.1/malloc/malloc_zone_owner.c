@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#include "internal.h"
+
+malloc_zone_owner_mid_t *volatile malloc_zone_owner_map[1 << MALLOC_ZONE_OWNER_ROOT_SHIFT];
+malloc_zone_owner_t malloc_zone_owners[MALLOC_ZONE_OWNER_MAX];
+
+// Serializes slot allocation, registration changes and node allocation.
+// Claims and releases of ranges already covered by nodes do not take it:
+// each page is only ever written by the zone that has it mapped.
+static _malloc_lock_s malloc_zone_owner_lock = _MALLOC_LOCK_INIT;
+
+malloc_zone_owner_index_t
+malloc_zone_owner_add(malloc_zone_t *zone)
+{
+	malloc_zone_owner_index_t owner;
+
+	_malloc_lock_lock(&malloc_zone_owner_lock);
+	for (owner = 1; owner < MALLOC_ZONE_OWNER_MAX; owner++) {
+		if (!malloc_zone_owners[owner].zone) {
+			malloc_zone_owners[owner].registered = FALSE;
+			malloc_zone_owners[owner].zone = zone;
+			_malloc_lock_unlock(&malloc_zone_owner_lock);
+			return owner;
+		}
+	}
+	_malloc_lock_unlock(&malloc_zone_owner_lock);
+	return 0;
+}
+
+void
+malloc_zone_owner_remove(malloc_zone_owner_index_t owner)
+{
+	if (!owner) {
+		return;
+	}
+	_malloc_lock_lock(&malloc_zone_owner_lock);
+	malloc_zone_owners[owner].registered = FALSE;
+	malloc_zone_owners[owner].zone = NULL;
+	_malloc_lock_unlock(&malloc_zone_owner_lock);
+}
+
+void
+malloc_zone_owner_set_registered(malloc_zone_t *zone, boolean_t registered)
+{
+	malloc_zone_owner_index_t owner;
+
+	_malloc_lock_lock(&malloc_zone_owner_lock);
+	for (owner = 1; owner < MALLOC_ZONE_OWNER_MAX; owner++) {
+		if (malloc_zone_owners[owner].zone == zone) {
+			OSMemoryBarrier();
+			malloc_zone_owners[owner].registered = registered;
+			break;
+		}
+	}
+	_malloc_lock_unlock(&malloc_zone_owner_lock);
+}
+
+/*
+ * malloc_zone_owner_leaf_for_page - Returns the leaf covering page, allocating
+ * the path to it if create is set. NULL if it does not exist (or could not be
+ * allocated).
+ */
+static malloc_zone_owner_leaf_t *
+malloc_zone_owner_leaf_for_page(uintptr_t page, boolean_t create)
+{
+	uintptr_t root_index = page >> (MALLOC_ZONE_OWNER_MID_SHIFT + MALLOC_ZONE_OWNER_LEAF_SHIFT);
+	uintptr_t mid_index = (page >> MALLOC_ZONE_OWNER_LEAF_SHIFT) & ((1 << MALLOC_ZONE_OWNER_MID_SHIFT) - 1);
+	malloc_zone_owner_mid_t *mid = malloc_zone_owner_map[root_index];
+	malloc_zone_owner_leaf_t *leaf = mid ? mid->leaves[mid_index] : NULL;
+
+	if (leaf || !create) {
+		return leaf;
+	}
+
+	_malloc_lock_lock(&malloc_zone_owner_lock);
+	mid = malloc_zone_owner_map[root_index];
+	if (!mid) {
+		mid = mvm_allocate_pages(round_page_quanta(sizeof(malloc_zone_owner_mid_t)), 0, 0, VM_MEMORY_MALLOC);
+		if (mid) {
+			// Publish the (zero-filled) node only once it is visible in full.
+			OSMemoryBarrier();
+			malloc_zone_owner_map[root_index] = mid;
+		}
+	}
+	if (mid) {
+		leaf = mid->leaves[mid_index];
+		if (!leaf) {
+			leaf = mvm_allocate_pages(round_page_quanta(sizeof(malloc_zone_owner_leaf_t)), 0, 0, VM_MEMORY_MALLOC);
+			if (leaf) {
+				OSMemoryBarrier();
+				mid->leaves[mid_index] = leaf;
+			}
+		}
+	}
+	_malloc_lock_unlock(&malloc_zone_owner_lock);
+	return leaf;
+}
+
+static void
+malloc_zone_owner_set(malloc_zone_owner_index_t owner, const void *address, size_t size)
+{
+	uintptr_t page = (uintptr_t)address >> MALLOC_ZONE_OWNER_PAGE_SHIFT;
+	uintptr_t end = ((uintptr_t)address + size + (1 << MALLOC_ZONE_OWNER_PAGE_SHIFT) - 1) >> MALLOC_ZONE_OWNER_PAGE_SHIFT;
+
+	if (!size || (end - 1) >> MALLOC_ZONE_OWNER_PAGE_BITS) {
+		return;
+	}
+	while (page < end) {
+		malloc_zone_owner_leaf_t *leaf = malloc_zone_owner_leaf_for_page(page, owner != 0);
+		uintptr_t leaf_end = (page | ((1 << MALLOC_ZONE_OWNER_LEAF_SHIFT) - 1)) + 1;
+		uintptr_t stop = MIN(end, leaf_end);
+
+		if (leaf) {
+			for (; page < stop; page++) {
+				leaf->owners[page & ((1 << MALLOC_ZONE_OWNER_LEAF_SHIFT) - 1)] = owner;
+			}
+		}
+		page = stop;
+	}
+}
+
+void
+malloc_zone_owner_claim(malloc_zone_owner_index_t owner, const void *address, size_t size)
+{
+	if (owner) {
+		malloc_zone_owner_set(owner, address, size);
+	}
+}
+
+void
+malloc_zone_owner_release(const void *address, size_t size)
+{
+	malloc_zone_owner_set(0, address, size);
+}
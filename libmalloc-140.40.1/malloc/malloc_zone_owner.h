@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __MALLOC_ZONE_OWNER_H
+#define __MALLOC_ZONE_OWNER_H
+
+/*******************************************************************************
+ * Zone ownership map
+ *
+ * A process-wide three-level radix map from every page of the address space to
+ * the zone that mapped it, so that free() and malloc_size() of a pointer from
+ * any participating zone find the zone with one lookup instead of asking each
+ * registered zone in turn.
+ *
+ * A zone participates by taking an owner slot with malloc_zone_owner_add() and
+ * then claiming the address ranges it maps (and releasing them before it
+ * unmaps them). Pages hold the 16-bit slot index rather than the zone pointer;
+ * the slot additionally records whether the zone is currently registered, and
+ * lookups only ever return registered zones. Nodes are allocated on first use
+ * and never freed, so lookups take no lock.
+ ******************************************************************************/
+
+#define MALLOC_ZONE_OWNER_PAGE_SHIFT 12
+#if MALLOC_TARGET_64BIT
+#define MALLOC_ZONE_OWNER_ADDRESS_BITS 48
+#else // MALLOC_TARGET_64BIT
+#define MALLOC_ZONE_OWNER_ADDRESS_BITS 32
+#endif // MALLOC_TARGET_64BIT
+#define MALLOC_ZONE_OWNER_PAGE_BITS (MALLOC_ZONE_OWNER_ADDRESS_BITS - MALLOC_ZONE_OWNER_PAGE_SHIFT)
+#define MALLOC_ZONE_OWNER_LEAF_SHIFT (MALLOC_ZONE_OWNER_PAGE_BITS / 3)
+#define MALLOC_ZONE_OWNER_MID_SHIFT (MALLOC_ZONE_OWNER_PAGE_BITS / 3)
+#define MALLOC_ZONE_OWNER_ROOT_SHIFT \
+		(MALLOC_ZONE_OWNER_PAGE_BITS - MALLOC_ZONE_OWNER_MID_SHIFT - MALLOC_ZONE_OWNER_LEAF_SHIFT)
+
+// Owner slots; slot 0 means "no owner".
+#define MALLOC_ZONE_OWNER_MAX 1024
+
+typedef uint16_t malloc_zone_owner_index_t;
+
+typedef struct malloc_zone_owner_s {
+	malloc_zone_t *volatile zone;
+	volatile boolean_t registered;
+} malloc_zone_owner_t;
+
+typedef struct malloc_zone_owner_leaf_s {
+	volatile malloc_zone_owner_index_t owners[1 << MALLOC_ZONE_OWNER_LEAF_SHIFT];
+} malloc_zone_owner_leaf_t;
+
+typedef struct malloc_zone_owner_mid_s {
+	malloc_zone_owner_leaf_t *volatile leaves[1 << MALLOC_ZONE_OWNER_MID_SHIFT];
+} malloc_zone_owner_mid_t;
+
+MALLOC_NOEXPORT
+extern malloc_zone_owner_mid_t *volatile malloc_zone_owner_map[1 << MALLOC_ZONE_OWNER_ROOT_SHIFT];
+
+MALLOC_NOEXPORT
+extern malloc_zone_owner_t malloc_zone_owners[MALLOC_ZONE_OWNER_MAX];
+
+/*
+ * malloc_zone_owner_add - Gives zone an owner slot. Returns 0, meaning the
+ * zone does not participate, if all slots are taken.
+ */
+MALLOC_NOEXPORT
+malloc_zone_owner_index_t
+malloc_zone_owner_add(malloc_zone_t *zone);
+
+/*
+ * malloc_zone_owner_remove - Returns the slot; the zone must have released
+ * everything it claimed.
+ */
+MALLOC_NOEXPORT
+void
+malloc_zone_owner_remove(malloc_zone_owner_index_t owner);
+
+/*
+ * malloc_zone_owner_set_registered - Called as a zone is registered or
+ * unregistered. A no-op for zones that do not participate.
+ */
+MALLOC_NOEXPORT
+void
+malloc_zone_owner_set_registered(malloc_zone_t *zone, boolean_t registered);
+
+MALLOC_NOEXPORT
+void
+malloc_zone_owner_claim(malloc_zone_owner_index_t owner, const void *address, size_t size);
+
+MALLOC_NOEXPORT
+void
+malloc_zone_owner_release(const void *address, size_t size);
+
+/*
+ * malloc_zone_owner_lookup - Returns the registered zone that mapped the page
+ * holding ptr, or NULL if there is none (or it does not participate).
+ */
+static inline malloc_zone_t *
+malloc_zone_owner_lookup(const void *ptr)
+{
+	uintptr_t page = (uintptr_t)ptr >> MALLOC_ZONE_OWNER_PAGE_SHIFT;
+	malloc_zone_owner_mid_t *mid;
+	malloc_zone_owner_leaf_t *leaf;
+	malloc_zone_owner_index_t owner;
+
+	if (page >> MALLOC_ZONE_OWNER_PAGE_BITS) {
+		return NULL;
+	}
+	mid = malloc_zone_owner_map[page >> (MALLOC_ZONE_OWNER_MID_SHIFT + MALLOC_ZONE_OWNER_LEAF_SHIFT)];
+	if (!mid) {
+		return NULL;
+	}
+	leaf = mid->leaves[(page >> MALLOC_ZONE_OWNER_LEAF_SHIFT) & ((1 << MALLOC_ZONE_OWNER_MID_SHIFT) - 1)];
+	if (!leaf) {
+		return NULL;
+	}
+	owner = leaf->owners[page & ((1 << MALLOC_ZONE_OWNER_LEAF_SHIFT) - 1)];
+	if (!owner || !malloc_zone_owners[owner].registered) {
+		return NULL;
+	}
+	return malloc_zone_owners[owner].zone;
+}
+
+#endif // __MALLOC_ZONE_OWNER_H
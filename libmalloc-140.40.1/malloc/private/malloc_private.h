@@ -27,7 +27,9 @@
 /* Here be dragons (SPIs) */
 
 #include <sys/cdefs.h>
+#if !defined(__linux__)
 #include <Availability.h>
+#endif // !__linux__
 
 /*********	Callbacks	************/
 
@@ -51,4 +53,32 @@ __OSX_AVAILABLE(10.12) __IOS_AVAILABLE(10.0)
 __TVOS_AVAILABLE(10.0) __WATCHOS_AVAILABLE(3.0)
 void * reallocarrayf(void * in_ptr, size_t nmemb, size_t size) __DARWIN_EXTSN(reallocarrayf) __result_use_check;
 
+/*********	Statistics	************/
+
+typedef struct {
+	unsigned long long	hits;		/* large allocations satisfied from death row */
+	unsigned long long	misses;		/* large allocations that found no fit there */
+	unsigned long long	evictions;	/* blocks pushed off death row to make room */
+	unsigned		entries;	/* blocks currently on death row */
+	size_t			bytes;		/* bytes currently on death row */
+	unsigned long long	clear_avoided;	/* calloc bytes of reused blocks known to be zero */
+} malloc_large_cache_statistics_t;
+
+typedef struct {
+	unsigned long long	calls;		/* pressure relief requests */
+	unsigned long long	ranges;		/* free page ranges found to advise */
+	unsigned long long	syscalls;	/* madvise system calls made for them */
+	unsigned long long	bytes;		/* bytes advised */
+} malloc_pressure_relief_statistics_t;
+
+struct _malloc_zone_t;
+
+boolean_t scalable_zone_large_cache_statistics(struct _malloc_zone_t *zone, malloc_large_cache_statistics_t *stats);
+	/* Fills in the large block cache counters of a scalable zone. Returns
+	 * false if the zone was built without a large cache. */
+
+boolean_t scalable_zone_pressure_relief_statistics(struct _malloc_zone_t *zone, malloc_pressure_relief_statistics_t *stats);
+	/* Fills in the tiny and small pressure relief counters of a scalable
+	 * zone. Returns false if the zone does not madvise under pressure. */
+
 #endif /* _MALLOC_PRIVATE_H_ */
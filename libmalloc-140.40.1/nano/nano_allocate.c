@@ -32,6 +32,18 @@ allocate_based_pages(nanozone_t *nanozone,
 	if (!vm_addr) {
 		vm_addr = vm_page_size;
 	}
+#if CONFIG_MVM_POSIX
+	addr = (uintptr_t)mvm_allocate_pages_at((uintptr_t)vm_addr, allocation_size, FALSE);
+	if (addr & allocation_mask) {
+		// The hint could not be honoured; let the VM layer find aligned space.
+		munmap((void *)addr, allocation_size);
+		return mvm_allocate_pages(size, align, debug_flags, vm_page_label);
+	}
+	if (!addr) {
+		nanozone_error(nanozone, 0, "can't allocate pages", NULL, "*** mmap(size=%lu) failed (errno=%d)\n", size, errno);
+		return NULL;
+	}
+#else // CONFIG_MVM_POSIX
 	kr = mach_vm_map(mach_task_self(),
 					 &vm_addr,
 					 allocation_size,
@@ -47,6 +59,7 @@ allocate_based_pages(nanozone_t *nanozone,
 		return NULL;
 	}
 	addr = (uintptr_t)vm_addr;
+#endif // CONFIG_MVM_POSIX
 	
 	if (add_guard_pages) {
 		addr += vm_page_size;
@@ -75,7 +88,11 @@ nano_deallocate_pages(nanozone_t *nanozone, void *addr, size_t size, unsigned de
 		vm_addr -= vm_page_size;
 		allocation_size += 2 * vm_page_size;
 	}
+#if CONFIG_MVM_POSIX
+	kr = munmap((void *)(uintptr_t)vm_addr, allocation_size) ? KERN_FAILURE : KERN_SUCCESS;
+#else // CONFIG_MVM_POSIX
 	kr = mach_vm_deallocate(mach_task_self(), vm_addr, allocation_size);
+#endif // CONFIG_MVM_POSIX
 	if (kr && nanozone) {
 		nanozone_error(nanozone, 0, "Can't deallocate_pages at", addr, NULL);
 	}
@@ -106,6 +123,9 @@ nano_preallocate_band_vm(void)
 	mach_vm_address_t vm_addr = s;
 	mach_vm_size_t vm_size = (e - s);
 	
+#if CONFIG_MVM_POSIX
+	return mvm_allocate_pages_at((uintptr_t)vm_addr, (size_t)vm_size, TRUE) != NULL; // Must get exactly what we asked for
+#else // CONFIG_MVM_POSIX
 	kern_return_t kr = mach_vm_map(mach_task_self(),
 								   &vm_addr, vm_size, 0,
 								   VM_MAKE_TAG(VM_MEMORY_MALLOC_NANO),
@@ -122,5 +142,6 @@ nano_preallocate_band_vm(void)
 		return FALSE;
 	}
 	return TRUE;
+#endif // CONFIG_MVM_POSIX
 }
 #endif
@@ -17,8 +17,17 @@ _nano_malloc_check_clear(nanozone_t *nanozone,
 	
 	nano_meta_admin_t pMeta = &(nanozone->meta_data[mag_index][slot_key]);
 	
-	ptr = OSAtomicDequeue(&(pMeta->slot_LIFO),
-						  offsetof(struct chained_block_s, next));
+	// The owner of the slot's lists pops without a lock; anyone who can't have
+	// them right now falls through to the bump allocator.
+	ptr = NULL;
+	if (pMeta->slot_lists.free || pMeta->slot_lists.remote_free) {
+		nano_slot_owner_t owner = nano_slot_acquire(nanozone, pMeta);
+		
+		if (owner) {
+			ptr = nano_slot_pop(&pMeta->slot_lists);
+			nano_slot_exit(owner);
+		}
+	}
 	if (ptr) {
 #if NANO_FREE_DEQUEUE_DILIGENCE
 		size_t gotSize;
@@ -71,14 +80,17 @@ _nano_malloc_check_clear(nanozone_t *nanozone,
 //#endif /* DEBUG */
 #endif /* NANO_FREE_DEQUEUE_DILIGENCE */
 		
-		((chained_block_t)ptr)->double_free_guard = 0;
-		((chained_block_t)ptr)->next = NULL; // clear out next pointer to protect free list
+		// A cleared block has its free list header zeroed below along with the rest.
+		if (!cleared_requested) {
+			((chained_block_t)ptr)->double_free_guard = 0;
+			((chained_block_t)ptr)->next = NULL; // clear out next pointer to protect free list
+		}
 	} else {
 		ptr = segregated_next_block(nanozone, pMeta, slot_bytes, mag_index);
 	}
 	
 	if (cleared_requested && ptr) {
-		memset(ptr, 0, slot_bytes); // TODO: Needs a memory barrier after memset to ensure zeroes land first?
+		malloc_clear(ptr, slot_bytes); // TODO: Needs a memory barrier after memset to ensure zeroes land first?
 	}
 	return ptr;
 }
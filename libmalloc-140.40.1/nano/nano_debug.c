@@ -74,7 +74,7 @@ nano_statistics(nanozone_t *nanozone, malloc_statistics_t *stats)
 		p.fields.nano_slot = 0;
 		p.fields.nano_offset = 0;
 		
-		for (j = 0; j < NANO_SLOT_SIZE; p.addr += SLOT_IN_BAND_SIZE, // Advance to next slot base
+		for (j = 0; j < NANO_SLOT_COUNT; p.addr += SLOT_IN_BAND_SIZE, // Advance to next slot base
 			 ++j) {
 			nano_meta_admin_t pMeta = &nanozone->meta_data[i][j];
 			uintptr_t offset = pMeta->slot_bump_addr - p.addr;
@@ -86,8 +86,8 @@ nano_statistics(nanozone_t *nanozone, malloc_statistics_t *stats)
 				unsigned blocks_now_free = count_free(nanozone, pMeta);
 				unsigned blocks_in_use = blocks_touched - blocks_now_free;
 				
-				size_t size_hiwater = ((j + 1) << SHIFT_NANO_QUANTUM) * blocks_touched;
-				size_t size_in_use = ((j + 1) << SHIFT_NANO_QUANTUM) * blocks_in_use;
+				size_t size_hiwater = nano_slot_bytes[j] * blocks_touched;
+				size_t size_in_use = nano_slot_bytes[j] * blocks_in_use;
 				size_t size_allocated = ((offset / BAND_SIZE) + 1) * SLOT_IN_BAND_SIZE;
 				
 				stats->blocks_in_use += blocks_in_use;
@@ -7,6 +7,8 @@
 
 #include "nano_introspection.h"
 
+#if CONFIG_NANOZONE
+
 /****************           introspection methods         *********************/
 
 static kern_return_t
@@ -83,35 +85,20 @@ nanozone_check(nanozone_t *nanozone)
 static unsigned
 count_free(nanozone_t *nanozone, nano_meta_admin_t pMeta)
 {
-	chained_block_t head = NULL, tail = NULL, t;
+	chained_block_t t;
 	unsigned count = 0;
 	
+	nano_slot_lock(nanozone, pMeta);
 	unsigned stoploss = (unsigned)pMeta->slot_objects_mapped;
-	while ((t = OSAtomicDequeue(&(pMeta->slot_LIFO), offsetof(struct chained_block_s, next)))) {
+	for (t = pMeta->slot_lists.free; t; t = t->next) {
 		if (0 == stoploss) {
-			nanozone_error(nanozone, 1, "Free list walk in count_free exceeded object count.", (void *)&(pMeta->slot_LIFO), NULL);
+			nanozone_error(nanozone, 1, "Free list walk in count_free exceeded object count.", (void *)&(pMeta->slot_lists.free), NULL);
 		}
 		stoploss--;
 		
-		if (NULL == head) {
-			head = t;
-		} else {
-			tail->next = t;
-		}
-		tail = t;
-		
 		count++;
 	}
-	if (tail) {
-		tail->next = NULL;
-	}
-	
-	// push the free list extracted above back onto the LIFO, all at once
-	if (head) {
-		OSAtomicEnqueue(&(pMeta->slot_LIFO),
-						head,
-						(uintptr_t)tail - (uintptr_t)head + offsetof(struct chained_block_s, next));
-	}
+	_malloc_lock_unlock(&pMeta->slot_lock);
 	
 	return count;
 }
@@ -136,7 +123,7 @@ nano_print(nanozone_t *nanozone, boolean_t verbose)
 		p.fields.nano_slot = 0;
 		p.fields.nano_offset = 0;
 		
-		for (slot_key = 0; slot_key < SLOT_KEY_LIMIT; p.addr += SLOT_IN_BAND_SIZE, // Advance to next slot base
+		for (slot_key = 0; slot_key < NANO_SLOT_COUNT; p.addr += SLOT_IN_BAND_SIZE, // Advance to next slot base
 			 slot_key++) {
 			nano_meta_admin_t pMeta = &(nanozone->meta_data[mag_index][slot_key]);
 			uintptr_t slot_bump_addr = pMeta->slot_bump_addr;		 // capture this volatile pointer
@@ -144,7 +131,7 @@ nano_print(nanozone_t *nanozone, boolean_t verbose)
 			
 			if (0 == slot_objects_mapped) { // Nothing allocated in this magazine for this slot?
 				_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "Magazine %2d(%3d) Unrealized\n", mag_index,
-							   (slot_key + 1) << SHIFT_NANO_QUANTUM);
+							   nano_slot_bytes[slot_key]);
 				continue;
 			}
 			
@@ -153,13 +140,13 @@ nano_print(nanozone_t *nanozone, boolean_t verbose)
 			unsigned blocks_now_free = count_free(nanozone, pMeta);
 			unsigned blocks_in_use = blocks_touched - blocks_now_free;
 			
-			size_t size_hiwater = ((slot_key + 1) << SHIFT_NANO_QUANTUM) * blocks_touched;
-			size_t size_in_use = ((slot_key + 1) << SHIFT_NANO_QUANTUM) * blocks_in_use;
+			size_t size_hiwater = nano_slot_bytes[slot_key] * blocks_touched;
+			size_t size_in_use = nano_slot_bytes[slot_key] * blocks_in_use;
 			size_t size_allocated = ((offset / BAND_SIZE) + 1) * SLOT_IN_BAND_SIZE;
 			
 			_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX,
 						   "Magazine %2d(%3d) [%p, %3dKB] \t Allocations in use=%4d \t Bytes in use=%db \t Untouched=%dKB\n", mag_index,
-						   (slot_key + 1) << SHIFT_NANO_QUANTUM, p, (size_allocated >> 10), blocks_in_use, size_in_use,
+						   nano_slot_bytes[slot_key], p, (size_allocated >> 10), blocks_in_use, size_in_use,
 						   (size_allocated - size_hiwater) >> 10);
 			
 			if (!verbose) {
@@ -174,9 +161,10 @@ nano_print(nanozone_t *nanozone, boolean_t verbose)
 					return;
 				}
 				
-				chained_block_t head = NULL, tail = NULL, t;
+				chained_block_t t;
 				unsigned stoploss = (unsigned)slot_objects_mapped;
-				while ((t = OSAtomicDequeue(&(pMeta->slot_LIFO), offsetof(struct chained_block_s, next)))) {
+				nano_slot_lock(nanozone, pMeta);
+				for (t = pMeta->slot_lists.free; t; t = t->next) {
 					if (0 == stoploss) {
 						malloc_printf("Free list walk in nano_print exceeded object count.");
 						break;
@@ -186,20 +174,11 @@ nano_print(nanozone_t *nanozone, boolean_t verbose)
 					uintptr_t offset = ((uintptr_t)t - p.addr); // offset from beginning of slot
 					index_t block_index = offset_to_index(nanozone, pMeta, offset);
 					
-					if (NULL == head) {
-						head = t;
-					} else {
-						tail->next = t;
-					}
-					tail = t;
-					
 					if (block_index < slot_objects_mapped) {
 						bitarray_set(slot_bitarray, log_size, block_index);
 					}
 				}
-				if (tail) {
-					tail->next = NULL;
-				}
+				_malloc_lock_unlock(&pMeta->slot_lock);
 				
 				index_t i;
 				for (i = 0; i < slot_objects_mapped; ++i) {
@@ -228,12 +207,6 @@ nano_print(nanozone_t *nanozone, boolean_t verbose)
 				_malloc_printf(MALLOC_PRINTF_NOLOG | MALLOC_PRINTF_NOPREFIX, "\n");
 				
 				free(slot_bitarray);
-				
-				// push the free list extracted above back onto the LIFO, all at once
-				if (head) {
-					OSAtomicEnqueue(
-									&(pMeta->slot_LIFO), head, (uintptr_t)tail - (uintptr_t)head + offsetof(struct chained_block_s, next));
-				}
 			}
 		}
 	}
@@ -248,30 +221,40 @@ nano_log(malloc_zone_t *zone, void *log_address)
 static void
 nano_force_lock(nanozone_t *nanozone)
 {
-	int i;
+	int i, j;
 	
 	for (i = 0; i < nanozone->phys_ncpus; ++i) {
 		_malloc_lock_lock(&nanozone->band_resupply_lock[i]);
+		for (j = 0; j < NANO_SLOT_SIZE; ++j) {
+			_malloc_lock_lock(&nanozone->meta_data[i][j].slot_lock);
+			nano_slot_revoke(&nanozone->meta_data[i][j].slot_lists, NULL);
+		}
 	}
 }
 
 static void
 nano_force_unlock(nanozone_t *nanozone)
 {
-	int i;
+	int i, j;
 	
 	for (i = 0; i < nanozone->phys_ncpus; ++i) {
 		_malloc_lock_unlock(&nanozone->band_resupply_lock[i]);
+		for (j = 0; j < NANO_SLOT_SIZE; ++j) {
+			_malloc_lock_unlock(&nanozone->meta_data[i][j].slot_lock);
+		}
 	}
 }
 
 static void
 nano_reinit_lock(nanozone_t *nanozone)
 {
-	int i;
+	int i, j;
 	
 	for (i = 0; i < nanozone->phys_ncpus; ++i) {
 		_malloc_lock_init(&nanozone->band_resupply_lock[i]);
+		for (j = 0; j < NANO_SLOT_SIZE; ++j) {
+			_malloc_lock_init(&nanozone->meta_data[i][j].slot_lock);
+		}
 	}
 }
 
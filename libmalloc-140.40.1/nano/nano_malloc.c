@@ -7,7 +7,7 @@
 /*
  * These methods are called with "ptr" known to possess the nano signature (from
  * which we can additionally infer "ptr" is not NULL), and with "size" bounded to
- * the extent of the nano allocation regime -- (0, 256].
+ * the extent of the nano allocation regime -- (0, NANO_MAX_SIZE].
  */
 
 static MALLOC_INLINE void *
@@ -151,7 +151,7 @@ __nano_free_definite_size(nanozone_t *nanozone, void *ptr, size_t size, boolean_
 
 	p.addr = (uint64_t)ptr; // place ptr on the dissecting table
 	if (nanozone->our_signature == p.fields.nano_signature) {
-		if (size == ((p.fields.nano_slot + 1) << SHIFT_NANO_QUANTUM)) { // "Trust but verify."
+		if (size == nano_slot_bytes[p.fields.nano_slot]) { // "Trust but verify."
 			_nano_free_trusted_size_check_scribble(nanozone, ptr, size, do_scribble);
 			return;
 		} else {
@@ -326,7 +326,11 @@ nano_destroy(nanozone_t *nanozone)
 	malloc_zone_t *zone = (malloc_zone_t *)(nanozone->helper_zone);
 	zone->destroy(zone);
 
+#if CONFIG_NANO_BAND_PREFETCH
+	nano_band_prefetch_stop(nanozone);
+#endif
+	nano_slot_owners_destroy(nanozone);
 	_nano_destroy(nanozone);
 }
 
-
+#endif // CONFIG_NANOZONE
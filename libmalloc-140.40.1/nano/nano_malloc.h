@@ -7,11 +7,22 @@
 // Forward decl for the nanozone.
 typedef struct nanozone_s nanozone_t;
 
-boolean_t _malloc_engaged_nano; //in .c
-
-
 // Nano malloc enabled flag
 MALLOC_NOEXPORT
 extern boolean_t _malloc_engaged_nano;
 
+#if CONFIG_NANO_BAND_PREFETCH
+// Pages at the start of each new slot band to fault in ahead of use
+MALLOC_NOEXPORT
+extern unsigned nano_prefault_pages;
+
+MALLOC_NOEXPORT
+void
+nano_band_prefetch_start(nanozone_t *nanozone);
+
+MALLOC_NOEXPORT
+void
+nano_band_prefetch_stop(nanozone_t *nanozone);
+#endif // CONFIG_NANO_BAND_PREFETCH
+
 #endif // __NANO_MALLOC_H
@@ -7,6 +7,11 @@
 
 #include "nano_malloc_caller.h"
 
+boolean_t _malloc_engaged_nano;
+#if CONFIG_NANO_BAND_PREFETCH
+unsigned nano_prefault_pages = 0;
+#endif
+
 //in malloc.c wjf
 // Called in the child process after fork() to resume normal operation.
 void
@@ -140,15 +145,21 @@ create_nano_zone(size_t initial_size,
 			MALLOC_PRINTF_FATAL_ERROR(nanozone->logical_ncpus / nanozone->phys_ncpus, "logical_ncpus / phys_ncpus not 1, 2, or 4");
 	}
 	
-	/* Initialize slot queue heads and resupply locks. */
-	OSQueueHead q0 = OS_ATOMIC_QUEUE_INIT;
+	/* Initialize slot free lists and resupply locks. */
 	for (i = 0; i < nanozone->phys_ncpus; ++i) {
 		_malloc_lock_init(&nanozone->band_resupply_lock[i]);
 		
 		for (j = 0; j < NANO_SLOT_SIZE; ++j) {
-			nanozone->meta_data[i][j].slot_LIFO = q0;
+			_malloc_lock_init(&nanozone->meta_data[i][j].slot_lock);
+			memset(&nanozone->meta_data[i][j].slot_lists, 0, sizeof(nano_slot_lists_t));
 		}
 	}
+	if (!nano_slot_owners_init(nanozone)) {
+		_malloc_printf(ASL_LEVEL_NOTICE, "nano zone abandoned due to inability to create the slot owner key.\n");
+		nano_deallocate_pages(NULL, (void *)nanozone, NANOZONE_PAGED_SIZE, 0);
+		_malloc_engaged_nano = false;
+		return NULL;
+	}
 	
 	/* Initialize the security token. */
 	if (0 == _dyld_get_image_slide((const struct mach_header *)_NSGetMachExecuteHeader())) {
@@ -166,6 +177,7 @@ create_nano_zone(size_t initial_size,
 	
 	nanozone->helper_zone = helper_zone;
 	
+	// The band prefetch thread is started by the caller, once MALLOC_LOCK is dropped.
 	return (malloc_zone_t *)nanozone;
 }
 
@@ -182,6 +194,11 @@ nano_forked_zone(nanozone_t *nanozone)
 	
 	mprotect(nanozone, sizeof(nanozone->basic_zone), PROT_READ | PROT_WRITE);
 	
+#if CONFIG_NANO_BAND_PREFETCH
+	// The prefetch thread did not survive the fork, and nothing is allocated from the bands any more.
+	nanozone->band_prefetch_running = FALSE;
+#endif
+	
 	nanozone->basic_zone.size = (void *)nano_size; /* Unchanged. */
 	nanozone->basic_zone.malloc = (void *)nano_forked_malloc;
 	nanozone->basic_zone.calloc = (void *)nano_forked_calloc;
@@ -23,7 +23,7 @@ nano_try_madvise(nanozone_t *nanozone, size_t goal)
 		p.fields.nano_slot = 0;
 		p.fields.nano_offset = 0;
 		
-		for (slot_key = 0; slot_key < SLOT_KEY_LIMIT; p.addr += SLOT_IN_BAND_SIZE, // Advance to next slot base
+		for (slot_key = 0; slot_key < NANO_SLOT_COUNT; p.addr += SLOT_IN_BAND_SIZE, // Advance to next slot base
 			 slot_key++) {
 			// _malloc_printf(ASL_LEVEL_WARNING,"nano_try_madvise examining slot base %p\n", p.addr);
 			nano_meta_admin_t pMeta = &(nanozone->meta_data[mag_index][slot_key]);
@@ -56,14 +56,19 @@ nano_try_madvise(nanozone_t *nanozone, size_t goal)
 					return bytes_toward_goal;
 				}
 				
-				chained_block_t head = NULL, tail = NULL, t;
+				chained_block_t head = NULL, tail = NULL, t, rest;
 				unsigned stoploss = (unsigned)slot_objects_mapped;
-				while ((t = OSAtomicDequeue(&(pMeta->slot_LIFO), offsetof(struct chained_block_s, next)))) {
+				nano_slot_lock(nanozone, pMeta);
+				rest = pMeta->slot_lists.free;
+				pMeta->slot_lists.free = NULL;
+				_malloc_lock_unlock(&pMeta->slot_lock);
+				while ((t = rest)) {
 					if (0 == stoploss) {
 						malloc_printf("Free list walk in nano_try_madvise exceeded object count.");
 						break;
 					}
 					stoploss--;
+					rest = t->next;
 					
 					uintptr_t offset = ((uintptr_t)t - p.addr); // offset from beginning of slot
 					index_t block_index = offset_to_index(nanozone, pMeta, offset);
@@ -198,16 +203,14 @@ nano_try_madvise(nanozone_t *nanozone, size_t goal)
 						new_tail->next = NULL;
 					}
 					
-					// push the free list extracted above back onto the LIFO, all at once
+					// hand the free list extracted above back to the magazine, all at once
 					if (new_head) {
-						OSAtomicEnqueue(&(pMeta->slot_LIFO), new_head,
-										(uintptr_t)new_tail - (uintptr_t)new_head + offsetof(struct chained_block_s, next));
+						nano_slot_push_remote(&pMeta->slot_lists, new_head, new_tail);
 					}
 				} else {
 					// _malloc_printf(ASL_LEVEL_WARNING,"Reinstating free list since no pages were madvised (%d).\n", num_advised);
 					if (head) {
-						OSAtomicEnqueue(&(pMeta->slot_LIFO), head,
-										(uintptr_t)tail - (uintptr_t)head + offsetof(struct chained_block_s, next));
+						nano_slot_push_remote(&pMeta->slot_lists, head, tail);
 					}
 				}
 				
@@ -18,7 +18,7 @@ nano_malloc_scribble(nanozone_t *nanozone, size_t size)
 			 * Scribble on allocated memory.
 			 */
 			if (size) {
-				memset(ptr, SCRIBBLE_BYTE, _nano_vet_and_size_of_live(nanozone, ptr));
+				malloc_fill(ptr, SCRIBBLE_BYTE, _nano_vet_and_size_of_live(nanozone, ptr));
 			}
 			
 			return ptr;
@@ -55,16 +55,14 @@ _nano_free_trusted_size_check_scribble(nanozone_t *nanozone, void *ptr, size_t t
 {
 	if (trusted_size) {
 		nano_blk_addr_t p; // happily, the compiler holds this in a register
-		nano_meta_admin_t pMeta;
 		
 		if (do_scribble) {
-			(void)memset(ptr, SCRABBLE_BYTE, trusted_size);
+			malloc_fill(ptr, SCRABBLE_BYTE, trusted_size);
 		}
 		((chained_block_t)ptr)->double_free_guard = (0xBADDC0DEDEADBEADULL ^ nanozone->cookie);
 		
 		p.addr = (uint64_t)ptr; // place ptr on the dissecting table
-		pMeta = &(nanozone->meta_data[p.fields.nano_mag_index][p.fields.nano_slot]);
-		OSAtomicEnqueue(&(pMeta->slot_LIFO), ptr, offsetof(struct chained_block_s, next));
+		nano_slot_free(nanozone, (chained_block_t)ptr, p.fields.nano_mag_index, p.fields.nano_slot);
 	} else {
 		nanozone_error(nanozone, 1, "Freeing unallocated pointer", ptr, NULL);
 	}
@@ -87,7 +85,7 @@ _nano_malloc_check_scribble(nanozone_t *nanozone, size_t size)
 	 * Scribble on allocated memory when requested.
 	 */
 	if ((nanozone->debug_flags & MALLOC_DO_SCRIBBLE) && ptr && size) {
-		memset(ptr, SCRIBBLE_BYTE, _nano_vet_and_size_of_live(nanozone, ptr));
+		malloc_fill(ptr, SCRIBBLE_BYTE, _nano_vet_and_size_of_live(nanozone, ptr));
 	}
 	
 	return ptr;
@@ -11,6 +11,48 @@
  * calls this the "segregated policy".
  */
 
+/*
+ * Makes sure the band holding slot base p is mapped. Bands are mapped in
+ * order, so only the one past band_max_mapped_baseaddr can be new. Caller
+ * holds band_resupply_lock[mag_index].
+ */
+static boolean_t
+segregated_band_map(nanozone_t *nanozone, unsigned int mag_index, uintptr_t p)
+{
+	mach_vm_address_t vm_addr = p & ~((uintptr_t)(BAND_SIZE - 1)); // Address of the band covering this slot
+	
+	if (nanozone->band_max_mapped_baseaddr[mag_index] >= vm_addr) {
+		return TRUE;
+	}
+#if !NANO_PREALLOCATE_BAND_VM
+	// Obtain the next band to cover this slot
+#if CONFIG_MVM_POSIX
+	if (!mvm_allocate_pages_at((uintptr_t)vm_addr, BAND_SIZE, TRUE)) { // Must get exactly what we asked for
+		return FALSE;
+	}
+#else // CONFIG_MVM_POSIX
+	kern_return_t kr = mach_vm_map(mach_task_self(),
+								   &vm_addr,
+								   BAND_SIZE, 0,
+								   VM_MAKE_TAG(VM_MEMORY_MALLOC_NANO),
+								   MEMORY_OBJECT_NULL, 0, FALSE,
+								   VM_PROT_DEFAULT,
+								   VM_PROT_ALL,
+								   VM_INHERIT_DEFAULT);
+	
+	void *q = (void *)vm_addr;
+	if (kr || q != (void *)(p & ~((uintptr_t)(BAND_SIZE - 1)))) { // Must get exactly what we asked for
+		if (!kr) {
+			mach_vm_deallocate(mach_task_self(), vm_addr, BAND_SIZE);
+		}
+		return FALSE;
+	}
+#endif // CONFIG_MVM_POSIX
+#endif
+	nanozone->band_max_mapped_baseaddr[mag_index] = vm_addr;
+	return TRUE;
+}
+
 static boolean_t
 segregated_band_grow(nanozone_t *nanozone,
 					 nano_meta_admin_t pMeta,
@@ -26,7 +68,7 @@ segregated_band_grow(nanozone_t *nanozone,
 		u.fields.nano_signature = NANOZONE_SIGNATURE;
 		u.fields.nano_mag_index = mag_index;
 		u.fields.nano_band = 0;
-		u.fields.nano_slot = (slot_bytes >> SHIFT_NANO_QUANTUM) - 1;
+		u.fields.nano_slot = nano_slot_key_of_quanta[slot_bytes >> SHIFT_NANO_QUANTUM];
 		u.fields.nano_offset = 0;
 		
 		p = u.addr;
@@ -44,28 +86,8 @@ segregated_band_grow(nanozone_t *nanozone,
 	}
 	pMeta->slot_current_base_addr = p;
 	
-	mach_vm_address_t vm_addr = p & ~((uintptr_t)(BAND_SIZE - 1)); // Address of the (2MB) band covering this (128KB) slot
-	if (nanozone->band_max_mapped_baseaddr[mag_index] < vm_addr) {
-#if !NANO_PREALLOCATE_BAND_VM
-		// Obtain the next band to cover this slot
-		kern_return_t kr = mach_vm_map(mach_task_self(),
-									   &vm_addr,
-									   BAND_SIZE, 0,
-									   VM_MAKE_TAG(VM_MEMORY_MALLOC_NANO),
-									   MEMORY_OBJECT_NULL, 0, FALSE,
-									   VM_PROT_DEFAULT,
-									   VM_PROT_ALL,
-									   VM_INHERIT_DEFAULT);
-		
-		void *q = (void *)vm_addr;
-		if (kr || q != (void *)(p & ~((uintptr_t)(BAND_SIZE - 1)))) { // Must get exactly what we asked for
-			if (!kr) {
-				mach_vm_deallocate(mach_task_self(), vm_addr, BAND_SIZE);
-			}
-			return FALSE;
-		}
-#endif
-		nanozone->band_max_mapped_baseaddr[mag_index] = vm_addr;
+	if (!segregated_band_map(nanozone, mag_index, p)) {
+		return FALSE;
 	}
 	
 	// Randomize the starting allocation from this slot (introduces 11 to 14 bits of entropy)
@@ -79,6 +101,14 @@ segregated_band_grow(nanozone_t *nanozone,
 	pMeta->slot_limit_addr = p + (SLOT_IN_BAND_SIZE / slot_bytes) * slot_bytes;
 	pMeta->slot_objects_mapped += (SLOT_IN_BAND_SIZE / slot_bytes);
 	
+#if CONFIG_NANO_BAND_PREFETCH
+	// Without the prefetch thread, take the first faults of the band here, all at once.
+	if (nano_prefault_pages && !nanozone->band_prefetch_running) {
+		mvm_prefault((void *)pMeta->slot_bump_addr,
+				MIN(nano_prefault_pages * vm_page_size, pMeta->slot_limit_addr - pMeta->slot_bump_addr));
+	}
+#endif // CONFIG_NANO_BAND_PREFETCH
+	
 	u.fields.nano_signature = NANOZONE_SIGNATURE;
 	u.fields.nano_mag_index = mag_index;
 	u.fields.nano_band = 0;
@@ -96,6 +126,303 @@ segregated_band_grow(nanozone_t *nanozone,
 
 
 
+#if CONFIG_NANO_BAND_PREFETCH
+/*
+ * Band prefetch. An allocation that leaves fewer than NANO_PREFETCH_WATERMARK
+ * bytes in its slot's band flags the magazine in band_prefetch_pending, once
+ * per band. The prefetch thread then maps the band the slot will grow into and
+ * faults in its first nano_prefault_pages pages, so that the allocation which
+ * finally crosses into it finds nothing left to do under band_resupply_lock.
+ */
+static MALLOC_NOINLINE void
+segregated_band_prefetch_request(nanozone_t *nanozone, nano_meta_admin_t pMeta, unsigned int mag_index)
+{
+	uintptr_t base = pMeta->slot_current_base_addr;
+	
+	if (pMeta->slot_prefetch_base == base || pMeta->slot_exhausted) {
+		return;
+	}
+	pMeta->slot_prefetch_base = base;
+	
+	__atomic_fetch_or(&nanozone->band_prefetch_pending, 1ULL << mag_index, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&nanozone->band_prefetch_mutex);
+	pthread_cond_signal(&nanozone->band_prefetch_cond);
+	pthread_mutex_unlock(&nanozone->band_prefetch_mutex);
+}
+
+static void
+segregated_band_prefetch(nanozone_t *nanozone, unsigned int mag_index)
+{
+	unsigned int slot_key;
+	
+	for (slot_key = 0; slot_key < NANO_SLOT_COUNT; slot_key++) {
+		nano_meta_admin_t pMeta = &(nanozone->meta_data[mag_index][slot_key]);
+		uintptr_t base = pMeta->slot_prefetch_base;
+		nano_blk_addr_t u;
+		boolean_t mapped;
+		
+		// Skip slots that did not ask, were served already or have since grown.
+		if (!base || pMeta->slot_prefetched_base == base || pMeta->slot_current_base_addr != base) {
+			continue;
+		}
+		pMeta->slot_prefetched_base = base;
+		
+		u.addr = (uint64_t)(base + BAND_SIZE);
+		if (0 == u.fields.nano_band) { // No band left to grow into
+			continue;
+		}
+		
+		_malloc_lock_lock(&nanozone->band_resupply_lock[mag_index]);
+		mapped = segregated_band_map(nanozone, mag_index, u.addr);
+		_malloc_lock_unlock(&nanozone->band_resupply_lock[mag_index]);
+		
+		if (mapped && nano_prefault_pages) {
+			mvm_prefault((void *)u.addr, MIN(nano_prefault_pages * vm_page_size, SLOT_IN_BAND_SIZE));
+		}
+	}
+}
+
+static void *
+segregated_band_prefetch_main(void *arg)
+{
+	nanozone_t *nanozone = arg;
+	uint64_t pending;
+	
+	pthread_mutex_lock(&nanozone->band_prefetch_mutex);
+	while (!nanozone->band_prefetch_stop) {
+		pending = __atomic_exchange_n(&nanozone->band_prefetch_pending, 0, __ATOMIC_ACQUIRE);
+		if (!pending) {
+			pthread_cond_wait(&nanozone->band_prefetch_cond, &nanozone->band_prefetch_mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&nanozone->band_prefetch_mutex);
+		
+		while (pending) {
+			unsigned int mag_index = (unsigned int)__builtin_ctzll(pending);
+			pending &= pending - 1;
+			segregated_band_prefetch(nanozone, mag_index);
+		}
+		
+		pthread_mutex_lock(&nanozone->band_prefetch_mutex);
+	}
+	pthread_mutex_unlock(&nanozone->band_prefetch_mutex);
+	return NULL;
+}
+
+void
+nano_band_prefetch_start(nanozone_t *nanozone)
+{
+	sigset_t all, saved;
+	int err;
+	
+	if (!(nanozone->debug_flags & MALLOC_NANO_PREFETCH) || nanozone->band_prefetch_running) {
+		return;
+	}
+	
+	pthread_mutex_init(&nanozone->band_prefetch_mutex, NULL);
+	pthread_cond_init(&nanozone->band_prefetch_cond, NULL);
+	nanozone->band_prefetch_pending = 0;
+	nanozone->band_prefetch_stop = FALSE;
+	
+	// Keep the process's signals off the prefetch thread.
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+	err = pthread_create(&nanozone->band_prefetch_thread, NULL, segregated_band_prefetch_main, nanozone);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (err) {
+		malloc_printf("*** can't start the nano band prefetch thread (error %d)\n", err);
+		return;
+	}
+	nanozone->band_prefetch_running = TRUE;
+}
+
+void
+nano_band_prefetch_stop(nanozone_t *nanozone)
+{
+	if (!nanozone->band_prefetch_running) {
+		return;
+	}
+	pthread_mutex_lock(&nanozone->band_prefetch_mutex);
+	nanozone->band_prefetch_stop = TRUE;
+	pthread_cond_signal(&nanozone->band_prefetch_cond);
+	pthread_mutex_unlock(&nanozone->band_prefetch_mutex);
+	pthread_join(nanozone->band_prefetch_thread, NULL);
+	nanozone->band_prefetch_running = FALSE;
+}
+#endif // CONFIG_NANO_BAND_PREFETCH
+
+/*********************	SLOT OWNERS	************************/
+
+static nano_slot_owner_t
+nano_slot_owner_create(nanozone_t *nanozone)
+{
+	nano_slot_owner_t self, page;
+	size_t i, count = vm_page_size / sizeof(struct nano_slot_owner_s);
+	
+	_malloc_lock_lock(&nanozone->slot_owner_lock);
+	if (!nanozone->slot_owner_spare) {
+		// Straight from the VM, so a thread's first nano malloc can't recurse.
+		page = nano_allocate_pages(nanozone, vm_page_size, 0, 0, VM_MEMORY_MALLOC);
+		if (!page) {
+			_malloc_lock_unlock(&nanozone->slot_owner_lock);
+			return NULL;
+		}
+		page->next = nanozone->slot_owner_pages;
+		nanozone->slot_owner_pages = page;
+		for (i = 1; i < count; i++) {
+			page[i].next = nanozone->slot_owner_spare;
+			nanozone->slot_owner_spare = &page[i];
+		}
+	}
+	self = nanozone->slot_owner_spare;
+	nanozone->slot_owner_spare = self->next;
+	_malloc_lock_unlock(&nanozone->slot_owner_lock);
+	
+	self->busy = NULL;
+	self->next = NULL;
+	self->zone = nanozone;
+	if (pthread_setspecific(nanozone->slot_owner_key, self)) {
+		_malloc_lock_lock(&nanozone->slot_owner_lock);
+		self->next = nanozone->slot_owner_spare;
+		nanozone->slot_owner_spare = self;
+		_malloc_lock_unlock(&nanozone->slot_owner_lock);
+		return NULL;
+	}
+	return self;
+}
+
+// Sends the batch pMeta's lists keep on to the magazine it is for.
+static void
+nano_slot_flush(nanozone_t *nanozone, nano_meta_admin_t pMeta)
+{
+	unsigned int slot_key = (unsigned int)((pMeta - &nanozone->meta_data[0][0]) % NANO_SLOT_SIZE);
+	nano_slot_lists_t *lists = &pMeta->slot_lists;
+	
+	if (lists->batch_count) {
+		nano_slot_flush_batch(lists, &nanozone->meta_data[lists->batch_mag][slot_key].slot_lists);
+	}
+}
+
+// Thread exit. The lists the thread still owns are flushed and left to no
+// thread, so no block waits on a batch nobody will fill.
+static void
+nano_slot_owner_exit(void *arg)
+{
+	nano_slot_owner_t self = arg;
+	nanozone_t *nanozone = self->zone;
+	unsigned int i, j;
+	
+	for (i = 0; i < nanozone->phys_ncpus; i++) {
+		for (j = 0; j < NANO_SLOT_SIZE; j++) {
+			nano_meta_admin_t pMeta = &nanozone->meta_data[i][j];
+			
+			if (pMeta->slot_lists.owner != self) {
+				continue;
+			}
+			_malloc_lock_lock(&pMeta->slot_lock);
+			if (pMeta->slot_lists.owner == self) {
+				nano_slot_flush(nanozone, pMeta);
+				pMeta->slot_lists.owner = NULL;
+			}
+			_malloc_lock_unlock(&pMeta->slot_lock);
+		}
+	}
+	
+	_malloc_lock_lock(&nanozone->slot_owner_lock);
+	self->next = nanozone->slot_owner_spare;
+	nanozone->slot_owner_spare = self;
+	_malloc_lock_unlock(&nanozone->slot_owner_lock);
+}
+
+boolean_t
+nano_slot_owners_init(nanozone_t *nanozone)
+{
+	_malloc_lock_init(&nanozone->slot_owner_lock);
+	nanozone->slot_owner_spare = NULL;
+	nanozone->slot_owner_pages = NULL;
+	return pthread_key_create(&nanozone->slot_owner_key, nano_slot_owner_exit) == 0;
+}
+
+void
+nano_slot_owners_destroy(nanozone_t *nanozone)
+{
+	nano_slot_owner_t page, next;
+	
+	pthread_key_delete(nanozone->slot_owner_key);
+	for (page = nanozone->slot_owner_pages; page; page = next) {
+		next = page->next;
+		nano_deallocate_pages(nanozone, page, vm_page_size, 0);
+	}
+	nanozone->slot_owner_pages = NULL;
+	nanozone->slot_owner_spare = NULL;
+}
+
+/*
+ * Slow path of nano_slot_acquire(): makes 'self', or a new record for the
+ * calling thread, the owner of pMeta's lists, and flushes the batch the old
+ * owner left in them. Never waits: it gives up when slot_lock is taken, when
+ * the thread is busy with other lists already, and when the old owner is busy
+ * with these.
+ */
+nano_slot_owner_t
+nano_slot_take_over(nanozone_t *nanozone, nano_meta_admin_t pMeta, nano_slot_owner_t self)
+{
+	nano_slot_owner_t owner;
+	
+	if (!self && !(self = nano_slot_owner_create(nanozone))) {
+		return NULL;
+	}
+	if (self->busy || !_malloc_lock_trylock(&pMeta->slot_lock)) {
+		return NULL;
+	}
+	if (!nano_slot_try_revoke(&pMeta->slot_lists, self)) {
+		_malloc_lock_unlock(&pMeta->slot_lock);
+		return NULL;
+	}
+	_malloc_lock_unlock(&pMeta->slot_lock);
+	owner = nano_slot_enter(&pMeta->slot_lists, self);
+	if (owner) {
+		nano_slot_flush(nanozone, pMeta);
+	}
+	return owner;
+}
+
+/*
+ * Takes pMeta's lists away from their owner for a walk, returning with
+ * slot_lock held and every free block of the slot on slot_lists.free: the
+ * batches other magazines keep for this one are flushed, and remote_free is
+ * folded in. The lists' own batch goes on to its magazine, as on any change
+ * of owner. Owners take the lists back once slot_lock is dropped. The wait
+ * for an owner is for the one operation it has in flight; nobody allocating
+ * waits behind it, since take-overs only try slot_lock.
+ */
+void
+nano_slot_lock(nanozone_t *nanozone, nano_meta_admin_t pMeta)
+{
+	size_t index = pMeta - &nanozone->meta_data[0][0];
+	unsigned int mag_index = (unsigned int)(index / NANO_SLOT_SIZE);
+	unsigned int slot_key = (unsigned int)(index % NANO_SLOT_SIZE);
+	unsigned int i;
+	
+	for (i = 0; i < nanozone->phys_ncpus; i++) {
+		nano_meta_admin_t other = &nanozone->meta_data[i][slot_key];
+		
+		if (i == mag_index || !other->slot_lists.batch_count || other->slot_lists.batch_mag != mag_index) {
+			continue;
+		}
+		_malloc_lock_lock(&other->slot_lock);
+		nano_slot_revoke(&other->slot_lists, NULL);
+		if (other->slot_lists.batch_mag == mag_index) {
+			nano_slot_flush_batch(&other->slot_lists, &pMeta->slot_lists);
+		}
+		_malloc_lock_unlock(&other->slot_lock);
+	}
+	_malloc_lock_lock(&pMeta->slot_lock);
+	nano_slot_revoke(&pMeta->slot_lists, NULL);
+	nano_slot_flush(nanozone, pMeta);
+	nano_slot_collect_remote(&pMeta->slot_lists);
+}
+
 static MALLOC_INLINE void *
 segregated_next_block(nanozone_t *nanozone,
 					  nano_meta_admin_t pMeta,
@@ -107,6 +434,11 @@ segregated_next_block(nanozone_t *nanozone,
 		b -= slot_bytes; // Atomic op returned addr of *next* free block. Subtract to get addr for *this* allocation.
 		
 		if (b < theLimit) {   // Did we stay within the bound of the present slot allocation?
+#if CONFIG_NANO_BAND_PREFETCH
+			if (theLimit - b <= NANO_PREFETCH_WATERMARK && nanozone->band_prefetch_running) {
+				segregated_band_prefetch_request(nanozone, pMeta, mag_index);
+			}
+#endif // CONFIG_NANO_BAND_PREFETCH
 			return (void *)b; // Yep, so the slot_bump_addr this thread incremented is good to go
 		} else {
 			if (pMeta->slot_exhausted) { // exhausted all the bands availble for this slot?
@@ -137,16 +469,13 @@ segregated_next_block(nanozone_t *nanozone,
 static MALLOC_INLINE size_t
 segregated_size_to_fit(nanozone_t *nanozone, size_t size, size_t *pKey)
 {
-	size_t k, slot_bytes;
+	size_t k, key;
 	
-	if (0 == size) {
-		size = NANO_REGIME_QUANTA_SIZE; // Historical behavior
-	}
 	k = (size + NANO_REGIME_QUANTA_SIZE - 1) >> SHIFT_NANO_QUANTUM; // round up and shift for number of quanta
-	slot_bytes = k << SHIFT_NANO_QUANTUM;							// multiply by power of two quanta size
-	*pKey = k - 1;													// Zero-based!
+	key = nano_slot_key_of_quanta[k];								// smallest slot that fits (zero maps to the first)
+	*pKey = key;
 	
-	return slot_bytes;
+	return nano_slot_bytes[key];
 }
 
 
@@ -193,7 +522,7 @@ segregated_in_use_enumerator(task_t task,
 		}
 		
 		for (slot_key = 0;
-			 slot_key < SLOT_KEY_LIMIT;
+			 slot_key < NANO_SLOT_COUNT;
 			 p.addr += SLOT_IN_BAND_SIZE, // Advance to next slot base for remote
 			 	clone_slot_base += SLOT_IN_BAND_SIZE,							   // Advance to next slot base for ourselves
 			 	slot_key++) {
@@ -251,25 +580,40 @@ segregated_in_use_enumerator(task_t task,
 					return errno;
 				}
 				
+				// The owner's list, the blocks returned by other CPUs, and those other CPUs
+				// still batch up for this magazine are all free. Links are read from the
+				// clone, so the remote task's lists are not disturbed.
 				chained_block_t t;
 				unsigned stoploss = (unsigned)slot_objects_mapped;
-				while ((t = OSAtomicDequeue(
-							&(pMeta->slot_LIFO),
-							offsetof(struct chained_block_s, next) + (clone_slot_base - p.addr)))) {
-					if (0 == stoploss) {
-						malloc_printf("Free list walk in segregated_in_use_enumerator exceeded object count.");
-						break;
+				unsigned l;
+				for (l = 0; l < nanozone->phys_ncpus + 2; ++l) {
+					nano_slot_lists_t *lists = &pMeta->slot_lists;
+					if (l == 0) {
+						t = lists->free;
+					} else if (l == 1) {
+						t = lists->remote_free;
+					} else {
+						lists = &nanozone->meta_data[l - 2][slot_key].slot_lists;
+						if (l - 2 == mag_index || !lists->batch_count || lists->batch_mag != mag_index) {
+							continue;
+						}
+						t = lists->batch;
 					}
-					stoploss--;
-					
-					uintptr_t offset = ((uintptr_t)t - p.addr); // offset from beginning of slot, task-independent
-					index_t block_index = offset_to_index(nanozone, pMeta, offset);
-					
-					if (block_index < slot_objects_mapped) {
-						bitarray_set(slot_bitarray, log_size, block_index);
+					for (; t; t = ((chained_block_t)((uintptr_t)t + (clone_slot_base - p.addr)))->next) {
+						if (0 == stoploss) {
+							malloc_printf("Free list walk in segregated_in_use_enumerator exceeded object count.");
+							break;
+						}
+						stoploss--;
+						
+						uintptr_t offset = ((uintptr_t)t - p.addr); // offset from beginning of slot, task-independent
+						index_t block_index = offset_to_index(nanozone, pMeta, offset);
+						
+						if (block_index < slot_objects_mapped) {
+							bitarray_set(slot_bitarray, log_size, block_index);
+						}
 					}
 				}
-				// N.B. pMeta->slot_LIFO in *this* task is now drained (remote free list has *not* been disturbed)
 				
 				// Copy the bitarray_t denoting madvise()'d pages (if any) into *this* task's address space
 				bitarray_t madv_page_bitarray;
@@ -317,7 +661,7 @@ segregated_in_use_enumerator(task_t task,
 					
 					if (!bitarray_get(slot_bitarray, log_size, i)) {
 						buffer[count].address = p.addr + block_offset;
-						buffer[count].size = (slot_key + 1) << SHIFT_NANO_QUANTUM;
+						buffer[count].size = nano_slot_bytes[slot_key];
 						count++;
 						if (count >= MAX_RECORDER_BUFFER) {
 							recorder(task, context, MALLOC_PTR_IN_USE_RANGE_TYPE, buffer, count);
@@ -37,42 +37,29 @@ _nano_block_inuse_p(nanozone_t *nanozone, const void *ptr)
 {
 	nano_blk_addr_t p; // happily, the compiler holds this in a register
 	nano_meta_admin_t pMeta;
-	chained_block_t head = NULL, tail = NULL, t;
+	chained_block_t t;
 	boolean_t inuse = TRUE;
 	
 	p.addr = (uint64_t)ptr; // place ptr on the dissecting table
 	
 	pMeta = &(nanozone->meta_data[p.fields.nano_mag_index][p.fields.nano_slot]);
 	
-	// pop elements off the free list all the while looking for ptr.
+	// walk the free lists, all the while looking for ptr.
+	nano_slot_lock(nanozone, pMeta);
 	unsigned stoploss = (unsigned)pMeta->slot_objects_mapped;
-	while ((t = OSAtomicDequeue(&(pMeta->slot_LIFO), offsetof(struct chained_block_s, next)))) {
+	for (t = pMeta->slot_lists.free; t; t = t->next) {
 		if (0 == stoploss) {
 			nanozone_error(
-						   nanozone, 1, "Free list walk in _nano_block_inuse_p exceeded object count.", (void *)&(pMeta->slot_LIFO), NULL);
+						   nanozone, 1, "Free list walk in _nano_block_inuse_p exceeded object count.", (void *)&(pMeta->slot_lists.free), NULL);
 		}
 		stoploss--;
 		
-		if (NULL == head) {
-			head = t;
-		} else {
-			tail->next = t;
-		}
-		tail = t;
-		
 		if (ptr == t) {
 			inuse = FALSE;
 			break;
 		}
 	}
-	if (tail) {
-		tail->next = NULL;
-	}
-	
-	// push the free list extracted above back onto the LIFO, all at once
-	if (head) {
-		OSAtomicEnqueue(&(pMeta->slot_LIFO), head, (uintptr_t)tail - (uintptr_t)head + offsetof(struct chained_block_s, next));
-	}
+	_malloc_lock_unlock(&pMeta->slot_lock);
 	
 	return inuse;
 }
@@ -132,8 +119,7 @@ _nano_vet_and_size_of_free(nanozone_t *nanozone, const void *ptr)
 static MALLOC_INLINE size_t
 _nano_good_size(nanozone_t *nanozone, size_t size)
 {
-	return (size <= NANO_REGIME_QUANTA_SIZE) ? NANO_REGIME_QUANTA_SIZE
-	: (((size + NANO_REGIME_QUANTA_SIZE - 1) >> SHIFT_NANO_QUANTUM) << SHIFT_NANO_QUANTUM);
+	return nano_slot_bytes[nano_slot_key_of_quanta[(size + NANO_REGIME_QUANTA_SIZE - 1) >> SHIFT_NANO_QUANTUM]];
 }
 
 
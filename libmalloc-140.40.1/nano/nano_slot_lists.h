@@ -0,0 +1,206 @@
+//
+//  nano_slot_lists.h
+//  libsystem_malloc
+//
+
+#ifndef __NANO_SLOT_LISTS_H
+#define __NANO_SLOT_LISTS_H
+
+/*
+ * Free lists of a nano [mag][slot]
+ *
+ * 'free' belongs to one thread at a time, the owner named by 'owner', which
+ * pushes and pops on it with plain loads and stores. Blocks of the slot that
+ * the owner frees on behalf of other magazines collect on 'batch' until
+ * NANO_SLOT_BATCH of them are there or one for a different magazine comes
+ * along; the whole chain then goes onto that magazine's 'remote_free' with a
+ * single compare-and-swap. The owner takes remote_free over in one exchange
+ * once 'free' runs dry. Nothing but the owner pops, so neither list has an
+ * ABA hazard.
+ *
+ * Ownership is checked without a lock: the owner marks its record busy with
+ * the lists and only then looks at 'owner' again. Taking the lists over
+ * stores the new owner and then looks at the old owner's record; both sides
+ * use sequentially consistent accesses, so one of the two always sees the
+ * other's store and they never use the lists at once. That is a store-release
+ * and a load-acquire on arm64, with no barrier in between. A thread taking
+ * the lists over for itself does not wait for an old owner that is busy with
+ * them: it puts the old owner back and tries again later
+ * (nano_slot_try_revoke). Only a walk, which has to have the lists, waits out
+ * the operation in flight (nano_slot_revoke); the old owner cannot start
+ * another one once it has been revoked. Records must stay mapped as long as
+ * the lists do, since the old owner may have exited.
+ *
+ * Callers keep revokers apart from one another, and provide yield().
+ */
+
+typedef struct chained_block_s {
+    uintptr_t			double_free_guard;
+    struct chained_block_s	*next;
+} *chained_block_t;
+
+struct nano_slot_lists_s;
+
+// One per thread; see above.
+typedef struct nano_slot_owner_s {
+    struct nano_slot_lists_s * volatile busy MALLOC_NANO_CACHE_ALIGN; // lists in use, or NULL
+    struct nano_slot_owner_s	*next;		// spare, or page, chain of the zone
+    void			*zone;		// the zone that handed the record out
+} *nano_slot_owner_t;
+
+#define NANO_SLOT_BATCH			16	// blocks handed to another magazine at once
+
+typedef struct nano_slot_lists_s {
+    nano_slot_owner_t volatile	owner MALLOC_NANO_CACHE_ALIGN;
+    chained_block_t		free;
+    chained_block_t		batch;		// blocks of magazine batch_mag, newest first
+    chained_block_t		batch_tail;
+    unsigned int		batch_count;
+    unsigned int		batch_mag;
+    // position on cache line distinct from that of the owner's fields
+    chained_block_t volatile	remote_free MALLOC_NANO_CACHE_ALIGN;
+} nano_slot_lists_t;
+
+static MALLOC_INLINE void yield(void);
+
+/*
+ * Marks 'self' busy with 'lists' if it owns them, returning it, or returns
+ * NULL. A thread already busy with some lists, as when a signal handler
+ * allocates in the middle of a push, is turned away.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE nano_slot_owner_t
+nano_slot_enter(nano_slot_lists_t *lists, nano_slot_owner_t self)
+{
+	if (!self || self->busy || lists->owner != self) {
+		return NULL;
+	}
+	__atomic_store_n(&self->busy, lists, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&lists->owner, __ATOMIC_SEQ_CST) != self) {
+		self->busy = NULL;
+		return NULL;
+	}
+	return self;
+}
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+nano_slot_exit(nano_slot_owner_t self)
+{
+	__atomic_store_n(&self->busy, NULL, __ATOMIC_RELEASE);
+}
+
+/*
+ * Hands 'lists' to 'owner', or to no thread when NULL, unless the thread that
+ * owns them is busy with them right now, in which case it keeps them. Returns
+ * whether the lists changed hands.
+ */
+static MALLOC_INLINE boolean_t
+nano_slot_try_revoke(nano_slot_lists_t *lists, nano_slot_owner_t owner)
+{
+	nano_slot_owner_t old = lists->owner;
+
+	__atomic_store_n(&lists->owner, owner, __ATOMIC_SEQ_CST);
+	if (old && old != owner && __atomic_load_n(&old->busy, __ATOMIC_SEQ_CST) == lists) {
+		lists->owner = old;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Hands 'lists' to 'owner', or to no thread when NULL, and returns once the
+ * thread that owned them before has let go of them.
+ */
+static MALLOC_INLINE void
+nano_slot_revoke(nano_slot_lists_t *lists, nano_slot_owner_t owner)
+{
+	nano_slot_owner_t old = lists->owner;
+
+	__atomic_store_n(&lists->owner, owner, __ATOMIC_SEQ_CST);
+	if (old && old != owner) {
+		while (__atomic_load_n(&old->busy, __ATOMIC_SEQ_CST) == lists) {
+			yield();
+		}
+	}
+}
+
+// The owner's, or with the lists revoked anyone's, from here on.
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE chained_block_t
+nano_slot_pop(nano_slot_lists_t *lists)
+{
+	chained_block_t t = lists->free;
+
+	if (!t) {
+		if (!lists->remote_free) {
+			return NULL;
+		}
+		t = __atomic_exchange_n(&lists->remote_free, NULL, __ATOMIC_ACQUIRE);
+	}
+	lists->free = t->next;
+	return t;
+}
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+nano_slot_push(nano_slot_lists_t *lists, chained_block_t t)
+{
+	t->next = lists->free;
+	lists->free = t;
+}
+
+// Anyone's: hands a chain of blocks to the lists in one compare-and-swap.
+static MALLOC_INLINE void
+nano_slot_push_remote(nano_slot_lists_t *lists, chained_block_t head, chained_block_t tail)
+{
+	chained_block_t old = lists->remote_free;
+
+	do {
+		tail->next = old;
+	} while (!__atomic_compare_exchange_n(&lists->remote_free, &old, head, TRUE, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Hands the batch, if any, to 'dest', the lists of magazine batch_mag.
+static MALLOC_INLINE void
+nano_slot_flush_batch(nano_slot_lists_t *lists, nano_slot_lists_t *dest)
+{
+	if (lists->batch_count) {
+		nano_slot_push_remote(dest, lists->batch, lists->batch_tail);
+		lists->batch = NULL;
+		lists->batch_tail = NULL;
+		lists->batch_count = 0;
+	}
+}
+
+/*
+ * Adds 't', a block of magazine 'mag', to the batch, which must be empty or
+ * hold blocks of 'mag' already. Returns whether the batch is now full.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE boolean_t
+nano_slot_batch_push(nano_slot_lists_t *lists, chained_block_t t, unsigned int mag)
+{
+	if (!lists->batch_count) {
+		lists->batch_tail = t;
+		lists->batch_mag = mag;
+	}
+	t->next = lists->batch;
+	lists->batch = t;
+	return ++lists->batch_count == NANO_SLOT_BATCH;
+}
+
+// Folds remote_free into 'free', so that one list holds every free block.
+static MALLOC_INLINE void
+nano_slot_collect_remote(nano_slot_lists_t *lists)
+{
+	chained_block_t head, tail;
+
+	if (!lists->remote_free) {
+		return;
+	}
+	head = __atomic_exchange_n(&lists->remote_free, NULL, __ATOMIC_ACQUIRE);
+	for (tail = head; tail->next; tail = tail->next) {
+		;
+	}
+	tail->next = lists->free;
+	lists->free = head;
+}
+
+#endif // __NANO_SLOT_LISTS_H
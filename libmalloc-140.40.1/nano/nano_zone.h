@@ -15,13 +15,52 @@
    #define NANOZONE_SIGNATURE	 0x6ULL
 // (0x6 << 44) == 0x00006nnnnnnnnnnn the 4096gb address range devoted to us.
 #define NANO_MAG_BITS			6
-#define NANO_BAND_BITS			17
-#define NANO_SLOT_BITS			4
-#define NANO_OFFSET_BITS		17
 #else
 #error Unknown Architecture
 #endif
 
+/*
+ * Slot geometry. NANO_SLOT_CLASSES lists the block size of each slot key in
+ * ascending order. Every size is a multiple of the quantum and the last one is
+ * NANO_MAX_SIZE. NANO_SLOT_BITS must cover the number of classes, and the band,
+ * slot and offset fields share what the signature and magazine leave of the
+ * 64 address bits. Each field may be overridden at build time.
+ */
+#if CONFIG_NANO_1K_SLOTS
+#ifndef NANO_MAX_SIZE
+#define NANO_MAX_SIZE			1024 /* Buckets sized {16, 32, .. 128, 160, 192, .. 512, 576, 640, .. 1024} */
+#define NANO_SLOT_CLASSES(X, a) \
+	X(16, a) X(32, a) X(48, a) X(64, a) X(80, a) X(96, a) X(112, a) X(128, a) \
+	X(160, a) X(192, a) X(224, a) X(256, a) X(288, a) X(320, a) X(352, a) X(384, a) \
+	X(416, a) X(448, a) X(480, a) X(512, a) \
+	X(576, a) X(640, a) X(704, a) X(768, a) X(832, a) X(896, a) X(960, a) X(1024, a)
+#endif
+#ifndef NANO_SLOT_BITS
+#define NANO_SLOT_BITS			5
+#endif
+#ifndef NANO_BAND_BITS
+#define NANO_BAND_BITS			16
+#endif
+#else // CONFIG_NANO_1K_SLOTS
+#ifndef NANO_MAX_SIZE
+#define NANO_MAX_SIZE			256 /* Buckets sized {16, 32, 48, 64, 80, 96, 112, ...} */
+#define NANO_SLOT_CLASSES(X, a) \
+	X(16, a) X(32, a) X(48, a) X(64, a) X(80, a) X(96, a) X(112, a) X(128, a) \
+	X(144, a) X(160, a) X(176, a) X(192, a) X(208, a) X(224, a) X(240, a) X(256, a)
+#endif
+#ifndef NANO_SLOT_BITS
+#define NANO_SLOT_BITS			4
+#endif
+#ifndef NANO_BAND_BITS
+#define NANO_BAND_BITS			17
+#endif
+#endif // CONFIG_NANO_1K_SLOTS
+#ifndef NANO_OFFSET_BITS
+#define NANO_OFFSET_BITS		17
+#endif
+
+MALLOC_STATIC_ASSERT(NANO_SIGNATURE_BITS + NANO_MAG_BITS + NANO_BAND_BITS + NANO_SLOT_BITS + NANO_OFFSET_BITS == 64,
+		"nano address fields must cover exactly 64 bits");
 
 // clang-format really dislikes the bitfields here
 // clang-format off
@@ -38,9 +77,9 @@ struct nano_blk_addr_s {
 // least significant bits declared first
 struct nano_blk_addr_s {
     uint64_t
-	nano_offset:NANO_OFFSET_BITS,		// locates the block 	17 块的位置
-	nano_slot:NANO_SLOT_BITS,		// bucket of homogenous均质的 quanta-multiple blocks	4
-	nano_band:NANO_BAND_BITS, 		//17
+	nano_offset:NANO_OFFSET_BITS,		// locates the block 	块的位置
+	nano_slot:NANO_SLOT_BITS,		// bucket of homogenous均质的 quanta-multiple blocks
+	nano_band:NANO_BAND_BITS,
 	nano_mag_index:NANO_MAG_BITS,	// the core that allocated this block 物理CPUn内核标号	6
 	nano_signature:NANO_SIGNATURE_BITS;	// the address range devoted to us. 		20
 };
@@ -52,7 +91,6 @@ typedef union  {
 } nano_blk_addr_t;
 
 
-#define NANO_MAX_SIZE			256 /* Buckets sized {16, 32, 48, 64, 80, 96, 112, ...} */
 #define SHIFT_NANO_QUANTUM		4 //16
 #define NANO_REGIME_QUANTA_SIZE		(1 << SHIFT_NANO_QUANTUM)	// 16
 #define NANO_QUANTA_MASK		0xFULL				// NANO_REGIME_QUANTA_SIZE - 1
@@ -61,10 +99,43 @@ typedef union  {
 #define SLOT_KEY_LIMIT 		(1 << NANO_SLOT_BITS) /* Must track nano_slot width */
 #define BAND_SIZE 		(1 << (NANO_SLOT_BITS + NANO_OFFSET_BITS)) /*  == Number of bytes covered by a page table entry */
 #define NANO_MAG_SIZE 		(1 << NANO_MAG_BITS) //2^6
-#define NANO_SLOT_SIZE 		(1 << NANO_SLOT_BITS)//2^4
+#define NANO_SLOT_SIZE 		(1 << NANO_SLOT_BITS)
+
+#define NANO_SLOT_ONE(bytes, a)		+ 1
+#define NANO_SLOT_BELOW(bytes, limit)	+ ((bytes) < (limit))
+#define NANO_SLOT_COUNT			(0 NANO_SLOT_CLASSES(NANO_SLOT_ONE, 0))
+#define NANO_MAX_QUANTA			(NANO_MAX_SIZE >> SHIFT_NANO_QUANTUM)
+
+MALLOC_STATIC_ASSERT(NANO_SLOT_COUNT <= SLOT_KEY_LIMIT, "NANO_SLOT_BITS too narrow for the slot table");
+MALLOC_STATIC_ASSERT(NANO_MAX_QUANTA <= 64, "nano_slot_key_of_quanta covers at most 1KB");
+MALLOC_STATIC_ASSERT(NANO_MAG_SIZE <= 64, "band_prefetch_pending holds one bit per magazine");
+
+/*
+ * Slot key -> block size, and request size in quanta -> the smallest slot
+ * that holds it. Both are built at compile time from NANO_SLOT_CLASSES so that
+ * segregated_size_to_fit() and nano_size() are single table lookups. A request
+ * of zero quanta maps to the first slot, as it always has.
+ */
+#define NANO_SLOT_BYTES(bytes, a)	(bytes),
+#define NANO_SLOT_KEY_OF(q)		(0 NANO_SLOT_CLASSES(NANO_SLOT_BELOW, (q) << SHIFT_NANO_QUANTUM))
+#define NANO_SLOT_KEYS_8(q) \
+	NANO_SLOT_KEY_OF((q) + 0), NANO_SLOT_KEY_OF((q) + 1), NANO_SLOT_KEY_OF((q) + 2), NANO_SLOT_KEY_OF((q) + 3), \
+	NANO_SLOT_KEY_OF((q) + 4), NANO_SLOT_KEY_OF((q) + 5), NANO_SLOT_KEY_OF((q) + 6), NANO_SLOT_KEY_OF((q) + 7)
+
+static const uint16_t nano_slot_bytes[NANO_SLOT_SIZE] = {
+	NANO_SLOT_CLASSES(NANO_SLOT_BYTES, 0)
+};
+
+static const uint8_t nano_slot_key_of_quanta[64 + 1] = {
+	NANO_SLOT_KEYS_8(0), NANO_SLOT_KEYS_8(8), NANO_SLOT_KEYS_8(16), NANO_SLOT_KEYS_8(24),
+	NANO_SLOT_KEYS_8(32), NANO_SLOT_KEYS_8(40), NANO_SLOT_KEYS_8(48), NANO_SLOT_KEYS_8(56),
+	NANO_SLOT_KEY_OF(64)
+};
 
 #ifdef __INTERNAL_H
 
+#include "nano_slot_lists.h"
+
 /****************************** zone itself ***********************************/
 
 /*
@@ -72,21 +143,19 @@ typedef union  {
  * individually in the nano_in_use_enumeration() routines.
  */
 
-typedef struct chained_block_s {
-    uintptr_t			double_free_guard;
-    struct chained_block_s	*next;
-} *chained_block_t;
-
-
 typedef struct nano_meta_s {
-    OSQueueHead			slot_LIFO MALLOC_NANO_CACHE_ALIGN;
+    nano_slot_lists_t		slot_lists;
+    _malloc_lock_s		slot_lock MALLOC_NANO_CACHE_ALIGN; // keeps those taking slot_lists over apart
     unsigned int		slot_madvised_log_page_count;
     volatile uintptr_t		slot_current_base_addr;
     volatile uintptr_t		slot_limit_addr;
     volatile size_t		slot_objects_mapped;
     volatile size_t		slot_objects_skipped;
     bitarray_t			slot_madvised_pages;
-    // position on cache line distinct from that of slot_LIFO
+#if CONFIG_NANO_BAND_PREFETCH
+    volatile uintptr_t		slot_prefetch_base;	// band base whose successor was requested
+    volatile uintptr_t		slot_prefetched_base;	// band base whose successor is ready
+#endif
     volatile uintptr_t		slot_bump_addr MALLOC_NANO_CACHE_ALIGN;
     volatile boolean_t		slot_exhausted;
     unsigned int		slot_bytes;
@@ -101,13 +170,13 @@ typedef struct nanozone_s {
 
     // remainder of structure is R/W (contains no function pointers)
     // page-aligned
-    // max: NANO_MAG_SIZE cores x NANO_SLOT_SIZE slots for nano blocks {16 .. 256}
-    struct nano_meta_s		meta_data[NANO_MAG_SIZE][NANO_SLOT_SIZE];//[2^6][2^4]
+    // max: NANO_MAG_SIZE cores x NANO_SLOT_SIZE slots for nano blocks {16 .. NANO_MAX_SIZE}
+    struct nano_meta_s		meta_data[NANO_MAG_SIZE][NANO_SLOT_SIZE];//[2^6][2^NANO_SLOT_BITS]
     _malloc_lock_s			band_resupply_lock[NANO_MAG_SIZE];//[2^6]
     uintptr_t           band_max_mapped_baseaddr[NANO_MAG_SIZE];//[2^6]
     size_t			core_mapped_size[NANO_MAG_SIZE];//[2^6]
 //#define NANO_MAG_SIZE 		(1 << NANO_MAG_BITS) //2^6
-//#define NANO_SLOT_SIZE 		(1 << NANO_SLOT_BITS)//2^4
+//#define NANO_SLOT_SIZE 		(1 << NANO_SLOT_BITS)
 	
     unsigned			debug_flags;
     unsigned			our_signature;
@@ -115,6 +184,25 @@ typedef struct nanozone_s {
     unsigned			logical_ncpus;
     unsigned			hyper_shift;
 
+#if CONFIG_NANO_BAND_PREFETCH
+    // One bit per magazine with a slot near the end of its band
+    volatile uint64_t		band_prefetch_pending;
+    boolean_t			band_prefetch_running;
+    volatile boolean_t		band_prefetch_stop;
+    pthread_t			band_prefetch_thread;
+    pthread_mutex_t		band_prefetch_mutex;
+    pthread_cond_t		band_prefetch_cond;
+#endif
+
+    // Owners of the slot lists: the calling thread's under slot_owner_key,
+    // those of exited threads, which own nothing, for reuse on
+    // slot_owner_spare. Each page of them starts with one more that links
+    // the pages, on slot_owner_pages.
+    pthread_key_t		slot_owner_key;
+    _malloc_lock_s		slot_owner_lock;
+    nano_slot_owner_t		slot_owner_spare;
+    nano_slot_owner_t		slot_owner_pages;
+
     /* security cookie */
     uintptr_t			cookie;
 
@@ -127,6 +215,83 @@ typedef struct nanozone_s {
 
 #define NANOZONE_PAGED_SIZE	((sizeof(nanozone_t) + vm_page_size - 1) & ~ (vm_page_size - 1))
 
+/***************************** slot free lists ********************************/
+
+MALLOC_NOEXPORT
+nano_slot_owner_t
+nano_slot_take_over(nanozone_t *nanozone, nano_meta_admin_t pMeta, nano_slot_owner_t self);
+
+MALLOC_NOEXPORT
+void
+nano_slot_lock(nanozone_t *nanozone, nano_meta_admin_t pMeta);
+
+MALLOC_NOEXPORT
+boolean_t
+nano_slot_owners_init(nanozone_t *nanozone);
+
+MALLOC_NOEXPORT
+void
+nano_slot_owners_destroy(nanozone_t *nanozone);
+
+// The calling thread's record, or NULL before its first take-over. Darwin's
+// pthread keys index the thread's TSD, so there it is a single load rather
+// than a call into libpthread.
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE nano_slot_owner_t
+nano_slot_owner_self(nanozone_t *nanozone)
+{
+#if MALLOC_TARGET_LINUX
+	return pthread_getspecific(nanozone->slot_owner_key);
+#else // MALLOC_TARGET_LINUX
+	return _os_tsd_get_direct(nanozone->slot_owner_key);
+#endif // MALLOC_TARGET_LINUX
+}
+
+/*
+ * The calling thread's hold on the lists of pMeta, a slot of its own
+ * magazine, or NULL if they cannot be had right now. The owner of the lists
+ * gets them without a lock or an atomic read-modify-write; anyone else takes
+ * them over. Let go with nano_slot_exit().
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE nano_slot_owner_t
+nano_slot_acquire(nanozone_t *nanozone, nano_meta_admin_t pMeta)
+{
+	nano_slot_owner_t self = nano_slot_owner_self(nanozone);
+	nano_slot_owner_t owner = nano_slot_enter(&pMeta->slot_lists, self);
+
+	return owner ? owner : nano_slot_take_over(nanozone, pMeta, self);
+}
+
+/*
+ * Frees 't', a block of slot_key in magazine mag_index. A block of the
+ * caller's own magazine goes on its free list; any other joins the batch
+ * the caller's magazine keeps for mag_index. Only if the caller's lists
+ * cannot be had does the block go to its magazine on its own.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+nano_slot_free(nanozone_t *nanozone, chained_block_t t, unsigned int mag_index, unsigned int slot_key)
+{
+	unsigned int here = NANO_MAG_INDEX(nanozone);
+	nano_meta_admin_t pMeta = &nanozone->meta_data[here][slot_key];
+	nano_slot_lists_t *lists = &pMeta->slot_lists;
+	nano_slot_owner_t owner = nano_slot_acquire(nanozone, pMeta);
+
+	if (!owner) {
+		nano_slot_push_remote(&nanozone->meta_data[mag_index][slot_key].slot_lists, t, t);
+		return;
+	}
+	if (mag_index == here) {
+		nano_slot_push(lists, t);
+	} else {
+		if (lists->batch_count && lists->batch_mag != mag_index) {
+			nano_slot_flush_batch(lists, &nanozone->meta_data[lists->batch_mag][slot_key].slot_lists);
+		}
+		if (nano_slot_batch_push(lists, t, mag_index)) {
+			nano_slot_flush_batch(lists, &nanozone->meta_data[mag_index][slot_key].slot_lists);
+		}
+	}
+	nano_slot_exit(owner);
+}
+
 #endif // __INTERNAL_H
 #endif // CONFIG_NANOZONE
 #endif // __NANO_ZONE_H
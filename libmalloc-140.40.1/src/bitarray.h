@@ -100,4 +100,83 @@ BITARRAY_BIT(uint32_t *bits, msize_t index)
 /* returns bit # of least-significant one bit, starting at 0 (undefined if !bitmap) */
 #define BITMAP32_CTZ(bitmap) (__builtin_ctz(bitmap[0]))
 
+/*
+ * BITMAPN_FFS_FROM returns the index of the first bit set at or above slot in
+ * the 256-bit (8 x 32) mag_bitmap, or -1 if there is none. slot must be below
+ * 256.
+ *
+ * The word holding slot is checked first, since a nearby larger free list is
+ * the common case on a busy magazine. If that misses, all eight words are
+ * tested for zero at once and the first non-empty word above it is a single
+ * ctz away, however far up the bitmap it is.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BITMAPN_NONEMPTY_WORDS 1
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE unsigned
+_bitmapn_nonempty_words(const unsigned *bitmap)
+{
+	__m256i words = _mm256_loadu_si256((const __m256i *)bitmap);
+	__m256i empty = _mm256_cmpeq_epi32(words, _mm256_setzero_si256());
+	return ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(empty)) & 0xff;
+}
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BITMAPN_NONEMPTY_WORDS 1
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE unsigned
+_bitmapn_nonempty_words(const unsigned *bitmap)
+{
+	__m128i lo = _mm_loadu_si128((const __m128i *)bitmap);
+	__m128i hi = _mm_loadu_si128((const __m128i *)(bitmap + 4));
+	unsigned empty_lo = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lo, _mm_setzero_si128())));
+	unsigned empty_hi = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(hi, _mm_setzero_si128())));
+	return ~(empty_lo | (empty_hi << 4)) & 0xff;
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BITMAPN_NONEMPTY_WORDS 1
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE unsigned
+_bitmapn_nonempty_words(const unsigned *bitmap)
+{
+	uint32x4_t lo = vld1q_u32(bitmap);
+	uint32x4_t hi = vld1q_u32(bitmap + 4);
+	// Narrow each word's non-zero flag to a byte, then pick one bit per byte.
+	uint8x8_t flags = vmovn_u16(vcombine_u16(vmovn_u32(vtstq_u32(lo, lo)), vmovn_u32(vtstq_u32(hi, hi))));
+	static const uint8_t weights[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+	return vaddv_u8(vand_u8(flags, vld1_u8(weights)));
+}
+
+#endif
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE int
+BITMAPN_FFS_FROM(const unsigned *bitmap, unsigned slot)
+{
+	unsigned idx = slot >> 5;
+	unsigned bits = bitmap[idx] & (~0U << (slot & 31));
+
+	if (bits) {
+		return (int)(idx * 32 + __builtin_ctz(bits));
+	}
+#if BITMAPN_NONEMPTY_WORDS
+	unsigned above = _bitmapn_nonempty_words(bitmap) & (0xfeU << idx);
+	if (!above) {
+		return -1;
+	}
+	idx = __builtin_ctz(above);
+	return (int)(idx * 32 + __builtin_ctz(bitmap[idx]));
+#else
+	while (++idx < 8) {
+		if (bitmap[idx]) {
+			return (int)(idx * 32 + __builtin_ctz(bitmap[idx]));
+		}
+	}
+	return -1;
+#endif
+}
+
 #endif // __BITARRAY_H
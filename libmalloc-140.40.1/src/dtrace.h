@@ -24,9 +24,9 @@
 #ifndef __DTRACE_H
 #define __DTRACE_H
 
-#ifndef DARWINTEST
+#if !defined(DARWINTEST) && !defined(__linux__)
 #include "magmallocProvider.h"
-#else
+#else // !DARWINTEST && !__linux__
 #define	MAGMALLOC_ALLOCREGION(arg0, arg1, arg2, arg3)
 #define	MAGMALLOC_ALLOCREGION_ENABLED() (0)
 #define	MAGMALLOC_DEALLOCREGION(arg0, arg1, arg2)
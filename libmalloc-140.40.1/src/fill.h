@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 1999, 2000, 2003, 2005, 2008, 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef __FILL_H
+#define __FILL_H
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Fill kernels for the paths that clear or scribble whole blocks: calloc and
+ * the tiny, small and nano MALLOC_DO_SCRIBBLE paths.
+ *
+ * Blocks are multiples of the 16-byte tiny quantum. Sizes of up to 16 quanta
+ * switch to a memset of constant size, which the compiler unrolls into a
+ * handful of vector stores with no call, length dispatch or tail handling.
+ * Blocks of MALLOC_FILL_NONTEMPORAL_BYTES and more would not fit in the cache
+ * anyway, so they are filled with non-temporal stores that leave the caller's
+ * working set in place. Everything in between goes to memset.
+ */
+
+#if defined(__x86_64__)
+static MALLOC_NOINLINE void
+malloc_fill_nontemporal(void *ptr, int c, size_t bytes)
+{
+	__m128i v = _mm_set1_epi8((char)c);
+	uintptr_t p = (uintptr_t)ptr;
+	uintptr_t end = p + bytes;
+	size_t head = (0 - p) & 63;
+
+	// Store whole cache lines; bytes is far larger than the unaligned head.
+	memset((void *)p, c, head);
+	for (p += head; p + 64 <= end; p += 64) {
+		_mm_stream_si128((__m128i *)p, v);
+		_mm_stream_si128((__m128i *)(p + 16), v);
+		_mm_stream_si128((__m128i *)(p + 32), v);
+		_mm_stream_si128((__m128i *)(p + 48), v);
+	}
+	// Order the streaming stores before the block is handed out.
+	_mm_sfence();
+	memset((void *)p, c, end - p);
+}
+#endif // __x86_64__
+
+#define MALLOC_FILL_CASE(q) \
+	case (q) << SHIFT_TINY_QUANTUM: \
+		memset(ptr, c, (q) << SHIFT_TINY_QUANTUM); \
+		return;
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+malloc_fill(void *ptr, int c, size_t bytes)
+{
+	switch (bytes) {
+	MALLOC_FILL_CASE(1) MALLOC_FILL_CASE(2) MALLOC_FILL_CASE(3) MALLOC_FILL_CASE(4)
+	MALLOC_FILL_CASE(5) MALLOC_FILL_CASE(6) MALLOC_FILL_CASE(7) MALLOC_FILL_CASE(8)
+	MALLOC_FILL_CASE(9) MALLOC_FILL_CASE(10) MALLOC_FILL_CASE(11) MALLOC_FILL_CASE(12)
+	MALLOC_FILL_CASE(13) MALLOC_FILL_CASE(14) MALLOC_FILL_CASE(15) MALLOC_FILL_CASE(16)
+	default:
+		break;
+	}
+#if defined(__x86_64__)
+	if (bytes >= MALLOC_FILL_NONTEMPORAL_BYTES) {
+		malloc_fill_nontemporal(ptr, c, bytes);
+		return;
+	}
+#endif // __x86_64__
+	memset(ptr, c, bytes);
+}
+
+#undef MALLOC_FILL_CASE
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+malloc_clear(void *ptr, size_t bytes)
+{
+	malloc_fill(ptr, 0, bytes);
+}
+
+#endif // __FILL_H
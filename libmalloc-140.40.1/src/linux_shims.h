@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __LINUX_SHIMS_H
+#define __LINUX_SHIMS_H
+
+/*
+ * Linux stand-ins for the Darwin primitives used by the zone engines: the
+ * os_unfair_lock and _os_cpu_number() fast paths from libplatform, the
+ * OSAtomic operations from libkern, and the Mach VM names that survive the
+ * switch to the POSIX VM backend (CONFIG_MVM_POSIX). Included from internal.h
+ * in place of the Darwin system headers.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1 // sched_getcpu()
+#endif
+
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#pragma mark Availability
+
+#define __OSX_AVAILABLE(v)
+#define __IOS_AVAILABLE(v)
+#define __TVOS_AVAILABLE(v)
+#define __WATCHOS_AVAILABLE(v)
+#define __OSX_AVAILABLE_STARTING(osx, ios)
+#define __DARWIN_EXTSN(sym)
+#define API_AVAILABLE(...)
+#define API_DEPRECATED(...)
+#define API_UNAVAILABLE(...)
+#define OS_ENUM(_name, _type, ...) \
+		enum { __VA_ARGS__ }; typedef _type _name##_t
+#ifndef __result_use_check
+#define __result_use_check __attribute__((__warn_unused_result__))
+#endif
+#ifndef __printflike
+#define __printflike(fmtarg, firstvararg) __attribute__((__format__(__printf__, fmtarg, firstvararg)))
+#endif
+#ifndef __unused
+#define __unused __attribute__((__unused__))
+#endif
+
+#pragma mark Mach types
+
+typedef int kern_return_t;
+typedef int boolean_t;
+typedef unsigned int mach_port_t;
+typedef mach_port_t task_t;
+typedef uintptr_t vm_address_t;
+typedef uintptr_t vm_size_t;
+typedef uintptr_t vm_offset_t;
+typedef uint64_t mach_vm_address_t;
+typedef uint64_t mach_vm_size_t;
+typedef uint64_t mach_vm_offset_t;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define KERN_SUCCESS 0
+#define KERN_INVALID_ADDRESS 1
+#define KERN_NO_SPACE 3
+#define KERN_FAILURE 5
+
+#define TASK_NULL ((task_t)0)
+#define mach_task_self() ((task_t)0)
+
+#ifndef SIZE_T_MAX
+#define SIZE_T_MAX SIZE_MAX
+#endif
+
+#pragma mark VM
+
+// Linux has no per-mapping VM tags; the labels are accepted and ignored.
+#define VM_MAKE_TAG(tag) ((tag) << 24)
+#define VM_MEMORY_MALLOC 1
+#define VM_MEMORY_MALLOC_SMALL 2
+#define VM_MEMORY_MALLOC_LARGE 3
+#define VM_MEMORY_MALLOC_HUGE 4
+#define VM_MEMORY_REALLOC 6
+#define VM_MEMORY_MALLOC_TINY 7
+#define VM_MEMORY_MALLOC_LARGE_REUSABLE 8
+#define VM_MEMORY_MALLOC_LARGE_REUSED 9
+#define VM_MEMORY_ANALYSIS_TOOL 10
+#define VM_MEMORY_MALLOC_NANO 11
+
+// Compile-time bound on the runtime page size, used to size regions.
+#if defined(__aarch64__)
+#define PAGE_MAX_SIZE 65536
+#else
+#define PAGE_MAX_SIZE 4096
+#endif
+
+// glibc keeps the page size in the dynamic linker's globals, so this is a
+// load rather than a system call.
+#define vm_page_size ((vm_size_t)getpagesize())
+#define vm_page_shift ((unsigned)__builtin_ctzl(vm_page_size))
+#define vm_kernel_page_size vm_page_size
+#define vm_kernel_page_shift vm_page_shift
+#define vm_kernel_page_mask (vm_page_size - 1)
+#define trunc_page(x) ((uintptr_t)(x) & ~(uintptr_t)(vm_page_size - 1))
+#define round_page(x) trunc_page((uintptr_t)(x) + (vm_page_size - 1))
+#define trunc_page_kernel(x) trunc_page(x)
+#define round_page_kernel(x) round_page(x)
+
+// No copy-on-write remapping of pages; callers fall back to memcpy().
+static inline kern_return_t
+vm_copy(task_t task, vm_address_t source, vm_size_t size, vm_address_t dest)
+{
+	(void)task;
+	(void)source;
+	(void)size;
+	(void)dest;
+	return KERN_FAILURE;
+}
+
+// Pages released with MADV_FREE (or MADV_DONTNEED) refault on the next touch,
+// so there is no reuse handshake; MADV_NORMAL keeps the large cache's
+// MADV_FREE_REUSE calls harmless.
+#define MADV_FREE_REUSABLE CONFIG_MADVISE_STYLE
+#define MADV_FREE_REUSE MADV_NORMAL
+#define MADV_CAN_REUSE MADV_NORMAL
+
+// There are no purgeable mappings; every block is permanently nonvolatile.
+#define VM_PURGABLE_SET_STATE 0
+#define VM_PURGABLE_GET_STATE 1
+#define VM_PURGABLE_NONVOLATILE 0
+#define VM_PURGABLE_VOLATILE 1
+#define VM_PURGABLE_EMPTY 2
+
+static inline kern_return_t
+vm_purgable_control(task_t task, vm_address_t address, int control, int *state)
+{
+	(void)task;
+	(void)address;
+	if (control == VM_PURGABLE_GET_STATE) {
+		*state = VM_PURGABLE_NONVOLATILE;
+	}
+	return KERN_SUCCESS;
+}
+
+#pragma mark dyld
+
+// Nothing records the libSystem an image was linked against.
+#define NSVersionOfLinkTimeLibrary(name) ((int32_t)-1)
+
+#pragma mark Thread self
+
+#define __TSD_THREAD_SELF 0
+
+static inline void *
+_os_tsd_get_direct(unsigned long slot)
+{
+	(void)slot;
+	return (void *)pthread_self();
+}
+
+#pragma mark Crash reporting
+
+// No crash reporter to hand a message to; the message has already been
+// written to stderr by the time these are reached.
+#define _os_set_crash_log_message(msg) ((void)(msg))
+#define _os_set_crash_log_message_dynamic(msg) ((void)(msg))
+#define _os_set_crash_log_cause_and_message(cause, msg) ((void)(cause), (void)(msg))
+
+#pragma mark _simple
+
+/*
+ * The allocation-free string and logging helpers libsystem_c provides to
+ * libmalloc on Darwin, implemented in linux_simple.c. There is no ASL, so
+ * _simple_asl_log() drops messages that _malloc_vprintf() has already written
+ * to the debug file descriptor.
+ */
+#define ASL_LEVEL_EMERG 0
+#define ASL_LEVEL_ALERT 1
+#define ASL_LEVEL_CRIT 2
+#define ASL_LEVEL_ERR 3
+#define ASL_LEVEL_WARNING 4
+#define ASL_LEVEL_NOTICE 5
+#define ASL_LEVEL_INFO 6
+#define ASL_LEVEL_DEBUG 7
+
+typedef void *_SIMPLE_STRING;
+
+#pragma GCC visibility push(hidden)
+_SIMPLE_STRING _simple_salloc(void);
+int _simple_sprintf(_SIMPLE_STRING b, const char *fmt, ...);
+int _simple_vsprintf(_SIMPLE_STRING b, const char *fmt, va_list ap);
+int _simple_sappend(_SIMPLE_STRING b, const char *str);
+char *_simple_string(_SIMPLE_STRING b);
+void _simple_sfree(_SIMPLE_STRING b);
+void _simple_put(_SIMPLE_STRING b, int fd);
+void _simple_dprintf(int fd, const char *fmt, ...);
+void _simple_vdprintf(int fd, const char *fmt, va_list ap);
+void _simple_asl_log(int level, const char *facility, const char *message);
+const char *_simple_getenv(const char *envp[], const char *var);
+#pragma GCC visibility pop
+
+#pragma mark os_unfair_lock
+
+/*
+ * A three-state futex mutex: 0 unlocked, 1 locked, 2 locked with (possible)
+ * waiters. Unlock only enters the kernel when somebody may be asleep.
+ */
+typedef struct os_unfair_lock_s {
+	uint32_t _os_unfair_lock_opaque;
+} os_unfair_lock, *os_unfair_lock_t;
+
+typedef uint32_t os_unfair_lock_options_t;
+
+#define OS_UNFAIR_LOCK_INIT ((os_unfair_lock){0})
+#define OS_UNFAIR_LOCK_NONE 0x00000000
+#define OS_UNFAIR_LOCK_DATA_SYNCHRONIZATION 0x00010000
+
+#define _OS_UNFAIR_LOCK_UNLOCKED 0
+#define _OS_UNFAIR_LOCK_LOCKED 1
+#define _OS_UNFAIR_LOCK_CONTENDED 2
+
+// Bounded spin before sleeping: magazine critical sections are short, so the
+// owner usually lets go well before a futex round trip would complete.
+#define _OS_UNFAIR_LOCK_SPIN_COUNT 100
+
+static inline void
+_os_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+static __attribute__((noinline)) void
+_os_unfair_lock_lock_slow(os_unfair_lock_t lock)
+{
+	uint32_t *value = &lock->_os_unfair_lock_opaque;
+
+	for (int spins = 0; spins < _OS_UNFAIR_LOCK_SPIN_COUNT; spins++) {
+		uint32_t expected = _OS_UNFAIR_LOCK_UNLOCKED;
+		if (__atomic_load_n(value, __ATOMIC_RELAXED) == _OS_UNFAIR_LOCK_UNLOCKED &&
+				__atomic_compare_exchange_n(value, &expected, _OS_UNFAIR_LOCK_LOCKED, false, __ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED)) {
+			return;
+		}
+		_os_cpu_relax();
+	}
+
+	// Taking the lock in the contended state is conservative: the eventual
+	// unlock may issue one unnecessary wake, but no waiter is ever missed.
+	while (__atomic_exchange_n(value, _OS_UNFAIR_LOCK_CONTENDED, __ATOMIC_ACQUIRE) != _OS_UNFAIR_LOCK_UNLOCKED) {
+		syscall(SYS_futex, value, FUTEX_WAIT_PRIVATE, _OS_UNFAIR_LOCK_CONTENDED, NULL, NULL, 0);
+	}
+}
+
+static inline void
+os_unfair_lock_lock_with_options(os_unfair_lock_t lock, os_unfair_lock_options_t options)
+{
+	uint32_t expected = _OS_UNFAIR_LOCK_UNLOCKED;
+
+	(void)options;
+	if (!__atomic_compare_exchange_n(&lock->_os_unfair_lock_opaque, &expected, _OS_UNFAIR_LOCK_LOCKED, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		_os_unfair_lock_lock_slow(lock);
+	}
+}
+
+static inline void
+os_unfair_lock_lock(os_unfair_lock_t lock)
+{
+	os_unfair_lock_lock_with_options(lock, OS_UNFAIR_LOCK_NONE);
+}
+
+static inline bool
+os_unfair_lock_trylock(os_unfair_lock_t lock)
+{
+	uint32_t expected = _OS_UNFAIR_LOCK_UNLOCKED;
+
+	return __atomic_compare_exchange_n(&lock->_os_unfair_lock_opaque, &expected, _OS_UNFAIR_LOCK_LOCKED, false,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void
+os_unfair_lock_unlock(os_unfair_lock_t lock)
+{
+	uint32_t *value = &lock->_os_unfair_lock_opaque;
+
+	if (__atomic_exchange_n(value, _OS_UNFAIR_LOCK_UNLOCKED, __ATOMIC_RELEASE) == _OS_UNFAIR_LOCK_CONTENDED) {
+		syscall(SYS_futex, value, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+#pragma mark _os_cpu_number
+
+/*
+ * sched_getcpu() is served from the vDSO (or the rseq area on newer glibc), so
+ * like the Darwin commpage read it does not enter the kernel. As on Darwin the
+ * answer may be stale by the time it is used; callers only use it to spread
+ * load across magazines.
+ */
+static inline unsigned int
+_os_cpu_number(void)
+{
+	int cpu = sched_getcpu();
+	return cpu < 0 ? 0 : (unsigned int)cpu;
+}
+
+#pragma mark OSAtomic
+
+#define OSMemoryBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#define OSAtomicIncrement32(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define OSAtomicIncrement32Barrier(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define OSAtomicDecrement32Barrier(p) __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define OSAtomicIncrement64(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define OSAtomicAdd64Barrier(v, p) __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define OSAtomicOr32Barrier(m, p) __atomic_or_fetch((p), (m), __ATOMIC_SEQ_CST)
+#define OSAtomicAnd32Barrier(m, p) __atomic_and_fetch((p), (m), __ATOMIC_SEQ_CST)
+
+static inline bool
+OSAtomicCompareAndSwapLong(long old_value, long new_value, volatile long *value)
+{
+	return __atomic_compare_exchange_n(value, &old_value, new_value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static inline bool
+OSAtomicCompareAndSwapPtrBarrier(void *old_value, void *new_value, void *volatile *value)
+{
+	return __atomic_compare_exchange_n(value, &old_value, new_value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * OSQueueHead: a LIFO whose head pairs the top element with a generation count
+ * so that a pop racing with a pop/push of the same element fails its
+ * double-width compare-and-swap instead of corrupting the list (ABA).
+ */
+typedef struct {
+	void *opaque1; // top element
+	long opaque2; // generation
+} __attribute__((aligned(16))) OSQueueHead;
+
+#define OS_ATOMIC_QUEUE_INIT {NULL, 0}
+
+typedef union {
+	OSQueueHead head;
+	unsigned __int128 word;
+} _os_queue_word_t;
+
+static inline void
+OSAtomicEnqueue(OSQueueHead *list, void *new_element, size_t offset)
+{
+	_os_queue_word_t old_head, new_head;
+
+	do {
+		old_head.head = *(volatile OSQueueHead *)list;
+		*(void **)((uintptr_t)new_element + offset) = old_head.head.opaque1;
+		new_head.head.opaque1 = new_element;
+		new_head.head.opaque2 = old_head.head.opaque2 + 1;
+	} while (!__sync_bool_compare_and_swap((unsigned __int128 *)list, old_head.word, new_head.word));
+}
+
+static inline void *
+OSAtomicDequeue(OSQueueHead *list, size_t offset)
+{
+	_os_queue_word_t old_head, new_head;
+
+	do {
+		old_head.head = *(volatile OSQueueHead *)list;
+		if (!old_head.head.opaque1) {
+			return NULL;
+		}
+		new_head.head.opaque1 = *(void *volatile *)((uintptr_t)old_head.head.opaque1 + offset);
+		new_head.head.opaque2 = old_head.head.opaque2 + 1;
+	} while (!__sync_bool_compare_and_swap((unsigned __int128 *)list, old_head.word, new_head.word));
+	return old_head.head.opaque1;
+}
+
+#endif // __LINUX_SHIMS_H
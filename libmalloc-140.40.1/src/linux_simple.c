@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#include "internal.h"
+
+#if MALLOC_TARGET_LINUX
+
+/*
+ * Fixed-size string buffers carved straight from the VM, so that error
+ * reporting works even when the heap is what is broken.
+ */
+#define SIMPLE_STRING_SIZE 4096
+
+typedef struct simple_string_s {
+	size_t length;
+	char buf[SIMPLE_STRING_SIZE - sizeof(size_t)];
+} simple_string_t;
+
+/*
+ * simple_translate_format - The Darwin _simple printf family understands %y
+ * (a byte count) and no floating point. Rewrite %y as the matching unsigned
+ * conversion so that vsnprintf() consumes the same arguments.
+ */
+static const char *
+simple_translate_format(const char *fmt, char *out, size_t out_size)
+{
+	const char *p;
+	size_t i = 0;
+
+	if (!strchr(fmt, 'y')) {
+		return fmt;
+	}
+	for (p = fmt; *p && i + 2 < out_size; p++) {
+		out[i++] = *p;
+		if (*p != '%') {
+			continue;
+		}
+		// copy flags, width and length modifiers up to the conversion
+		while (p[1] && strchr("-+ #0123456789.lhqjzt", p[1]) && i + 2 < out_size) {
+			out[i++] = *++p;
+		}
+		if (p[1] == 'y') {
+			out[i++] = 'u';
+			p++;
+		} else if (p[1]) {
+			out[i++] = *++p;
+		}
+	}
+	out[i] = '\0';
+	return out;
+}
+
+_SIMPLE_STRING
+_simple_salloc(void)
+{
+	void *map = mmap(NULL, SIMPLE_STRING_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	simple_string_t *b;
+
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	b = map;
+	b->length = 0;
+	b->buf[0] = '\0';
+	return b;
+}
+
+int
+_simple_vsprintf(_SIMPLE_STRING sb, const char *fmt, va_list ap)
+{
+	simple_string_t *b = sb;
+	char translated[512];
+	size_t room = sizeof(b->buf) - b->length;
+	int n;
+
+	n = vsnprintf(b->buf + b->length, room, simple_translate_format(fmt, translated, sizeof(translated)), ap);
+	if (n > 0) {
+		b->length += MIN((size_t)n, room - 1);
+	}
+	return 0;
+}
+
+int
+_simple_sprintf(_SIMPLE_STRING b, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = _simple_vsprintf(b, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+int
+_simple_sappend(_SIMPLE_STRING b, const char *str)
+{
+	return _simple_sprintf(b, "%s", str);
+}
+
+char *
+_simple_string(_SIMPLE_STRING sb)
+{
+	simple_string_t *b = sb;
+	return b->buf;
+}
+
+void
+_simple_sfree(_SIMPLE_STRING b)
+{
+	if (b) {
+		munmap(b, SIMPLE_STRING_SIZE);
+	}
+}
+
+static void
+simple_write(int fd, const char *buf, size_t length)
+{
+	while (length) {
+		ssize_t n = write(fd, buf, length);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return;
+		}
+		buf += n;
+		length -= (size_t)n;
+	}
+}
+
+void
+_simple_put(_SIMPLE_STRING sb, int fd)
+{
+	simple_string_t *b = sb;
+	simple_write(fd, b->buf, b->length);
+}
+
+void
+_simple_vdprintf(int fd, const char *fmt, va_list ap)
+{
+	char buf[1024];
+	char translated[512];
+	int n;
+
+	n = vsnprintf(buf, sizeof(buf), simple_translate_format(fmt, translated, sizeof(translated)), ap);
+	if (n > 0) {
+		simple_write(fd, buf, MIN((size_t)n, sizeof(buf) - 1));
+	}
+}
+
+void
+_simple_dprintf(int fd, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	_simple_vdprintf(fd, fmt, ap);
+	va_end(ap);
+}
+
+void
+_simple_asl_log(int level, const char *facility, const char *message)
+{
+	(void)level;
+	(void)facility;
+	(void)message;
+}
+
+const char *
+_simple_getenv(const char *envp[], const char *var)
+{
+	size_t var_len = strlen(var);
+
+	if (!envp) {
+		return NULL;
+	}
+	for (; *envp; envp++) {
+		if (!strncmp(*envp, var, var_len) && (*envp)[var_len] == '=') {
+			return *envp + var_len + 1;
+		}
+	}
+	return NULL;
+}
+
+#endif // MALLOC_TARGET_LINUX
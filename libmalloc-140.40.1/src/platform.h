@@ -36,6 +36,22 @@
 #define MALLOC_TARGET_64BIT 0
 #endif
 
+#if defined(__linux__)
+#define MALLOC_TARGET_LINUX 1
+#else // __linux__
+#define MALLOC_TARGET_LINUX 0
+#endif // __linux__
+
+// VM backend: Mach VM on Darwin, mmap/munmap/madvise elsewhere. Build with
+// -DCONFIG_MVM_POSIX=1 to run the POSIX backend on Darwin as well.
+#ifndef CONFIG_MVM_POSIX
+#if MALLOC_TARGET_LINUX
+#define CONFIG_MVM_POSIX 1
+#else // MALLOC_TARGET_LINUX
+#define CONFIG_MVM_POSIX 0
+#endif // MALLOC_TARGET_LINUX
+#endif // CONFIG_MVM_POSIX
+
 // <rdar://problem/12596555>
 #if MALLOC_TARGET_IOS
 # define CONFIG_MADVISE_PRESSURE_RELIEF 0
@@ -56,7 +72,21 @@
 #define CONFIG_RELAXED_INVARIANT_CHECKS 1
 
 // <rdar://problem/19818071>
+#if !CONFIG_MVM_POSIX
 #define CONFIG_MADVISE_STYLE MADV_FREE_REUSABLE
+#elif defined(MADV_FREE)
+#define CONFIG_MADVISE_STYLE MADV_FREE
+#else // MADV_FREE
+#define CONFIG_MADVISE_STYLE MADV_DONTNEED
+#endif // MADV_FREE
+
+// Batches of madvise ranges go to the kernel in one process_madvise() call
+// where the kernel accepts it for the calling process
+#if MALLOC_TARGET_LINUX
+#define CONFIG_PROCESS_MADVISE 1
+#else // MALLOC_TARGET_LINUX
+#define CONFIG_PROCESS_MADVISE 0
+#endif // MALLOC_TARGET_LINUX
 
 // <rdar://problem/13807682>
 #if TARGET_OS_SIMULATOR
@@ -82,6 +112,46 @@
 #define CONFIG_TINY_CACHE 1
 #define CONFIG_SMALL_CACHE 1
 
+// Optional per-thread cache of tiny and small blocks in front of the magazine
+// lock, enabled at runtime with MallocThreadCache (MALLOC_THREAD_CACHE)
+#define CONFIG_MAGAZINE_TCACHE 1
+
+// Frees of blocks owned by another CPU's magazine are queued on a lock-free
+// list and returned by the owning magazine on its next locked operation
+#define CONFIG_MAGAZINE_REMOTE_FREE 1
+
+// Optional segregated-fit mode for the small rack, enabled at runtime with
+// MallocSmallClasses (MALLOC_SMALL_CLASSES)
+#define CONFIG_SMALL_CLASSES 1
+
+// Optional background thread that returns idle tiny and small pages to the
+// system, enabled at runtime with MallocScavenger (MALLOC_SCAVENGER)
+#define CONFIG_MAGAZINE_SCAVENGER 1
+
+// The scavenger runs off the allocation path and is there to bring the
+// resident set down, so it does not use the lazy MADV_FREE
+#if !CONFIG_MVM_POSIX
+#define CONFIG_SCAVENGE_MADVISE_STYLE MADV_FREE_REUSABLE
+#else // CONFIG_MVM_POSIX
+#define CONFIG_SCAVENGE_MADVISE_STYLE MADV_DONTNEED
+#endif // CONFIG_MVM_POSIX
+
+// Tiny and small regions can be carved from huge-page aligned chunks marked
+// MADV_HUGEPAGE, enabled at runtime with MallocHugePages (MALLOC_HUGE_PAGES)
+#if CONFIG_MVM_POSIX && defined(MADV_HUGEPAGE)
+#define CONFIG_HUGE_PAGE_REGIONS 1
+#else // CONFIG_MVM_POSIX && MADV_HUGEPAGE
+#define CONFIG_HUGE_PAGE_REGIONS 0
+#endif // CONFIG_MVM_POSIX && MADV_HUGEPAGE
+
+// Tiny and small magazines can be grouped per memory node, with regions bound
+// to their node, enabled at runtime with MallocNUMA (MALLOC_NUMA_MAGAZINES)
+#if MALLOC_TARGET_LINUX
+#define CONFIG_NUMA_MAGAZINES 1
+#else // MALLOC_TARGET_LINUX
+#define CONFIG_NUMA_MAGAZINES 0
+#endif // MALLOC_TARGET_LINUX
+
 // The large last-free cache (aka. death row cache)
 #if MALLOC_TARGET_IOS
 #define CONFIG_LARGE_CACHE 0
@@ -89,6 +159,24 @@
 #define CONFIG_LARGE_CACHE 1
 #endif
 
+// Death-row arrivals over the reserve limit are given back to the system. On
+// Linux they are dropped outright, so that they come back zero-filled.
+#if MALLOC_TARGET_LINUX
+#define CONFIG_LARGE_MADVISE_STYLE MADV_DONTNEED
+#else // MALLOC_TARGET_LINUX
+#define CONFIG_LARGE_MADVISE_STYLE MADV_FREE_REUSABLE
+#endif // MALLOC_TARGET_LINUX
+
+// calloc() skips clearing memory last given back with advice that drops its
+// contents (MVM_ADVICE_ZEROES): large death-row blocks, and tiny and small
+// granules tracked per region. Darwin's advice keeps page contents until the
+// pages are reclaimed, so there is nothing to track there.
+#if MALLOC_TARGET_LINUX
+#define CONFIG_KNOWN_ZERO_PAGES 1
+#else // MALLOC_TARGET_LINUX
+#define CONFIG_KNOWN_ZERO_PAGES 0
+#endif // MALLOC_TARGET_LINUX
+
 // <rdar://problem/26823590> compile-time MALLOC_SMALL cut-off size
 #if MALLOC_TARGET_IOS
 #define CONFIG_SMALL_CUTTOFF_127KB 0
@@ -103,6 +191,18 @@
 #else
 #define CONFIG_NANO_SMALLMEM_DYNAMIC_DISABLE_35305995 0
 #endif
+
+// Serve blocks up to 1KB from the nano zone with a non-uniform slot table
+// (see nano_zone.h). Off by default, so that nano keeps sixteen 16-byte slots
+// up to 256 bytes, until the wider table has been measured on device.
+#ifndef CONFIG_NANO_1K_SLOTS
+#define CONFIG_NANO_1K_SLOTS 0
+#endif
+
+// Optional background thread that maps and faults in the next band of a slot
+// before the slot runs out, enabled at runtime with MallocNanoPrefetch
+// (MALLOC_NANO_PREFETCH)
+#define CONFIG_NANO_BAND_PREFETCH 1
 #endif
 
 // memory resource exception handling
@@ -113,9 +213,17 @@
 #endif
 
 // presence of commpage memsize
+#if MALLOC_TARGET_LINUX
+#define CONFIG_HAS_COMMPAGE_MEMSIZE 0
+#else // MALLOC_TARGET_LINUX
 #define CONFIG_HAS_COMMPAGE_MEMSIZE 1
+#endif // MALLOC_TARGET_LINUX
 
 // presence of commpage number of cpu count
+#if MALLOC_TARGET_LINUX
+#define CONFIG_HAS_COMMPAGE_NCPUS 0
+#else // MALLOC_TARGET_LINUX
 #define CONFIG_HAS_COMMPAGE_NCPUS 1
+#endif // MALLOC_TARGET_LINUX
 
 #endif // __PLATFORM_H
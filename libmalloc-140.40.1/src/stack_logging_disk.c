@@ -23,6 +23,9 @@
 
 #include "internal.h"
 #include "radix_tree.h"
+#if __has_feature(ptrauth_calls)
+#include <ptrauth.h>
+#endif
 
 #pragma mark -
 #pragma mark Defines
@@ -40,7 +43,14 @@
 #define ASL_LEVEL_INFO stderr
 #endif
 
-#define STACK_LOGGING_BLOCK_WRITING_SIZE 8192
+#define STACK_LOGGING_BLOCK_WRITING_SIZE 32768
+#define STACK_LOGGING_INDEX_FILTER_BITS 8 // per event, in each index block's address filter
+#define STACK_LOGGING_INDEX_FILTER_HASHES 5
+#define STACK_LOGGING_INDEX_GROUP_BLOCKS 32 // index blocks covered by each group record
+#define STACK_LOGGING_THREAD_BUFFER_EVENTS 1024
+#define STACK_LOGGING_WRITER_INTERVAL_USEC 1000
+#define STACK_LOGGING_WRITER_WATERMARK (STACK_LOGGING_THREAD_BUFFER_EVENTS / 2)
+#define STACK_LOGGING_SHADOW_STACKS 16 // for threads logging under stack_logging_lock
 #define STACK_LOGGING_MAX_SIMUL_REMOTE_TASKS_INSPECTED 3
 
 #define BACKTRACE_UNIQUING_DEBUG 0
@@ -52,6 +62,14 @@
 #define EXPAND_FACTOR 2
 #define COLLISION_GROWTH_RATE 3
 
+// The first UNIQUING_TABLE_RESERVED_EXPANSIONS expansions grow the table in place, into address space reserved when
+// it is created; only later ones move it. Node indices never change either way.
+#if __LP64__
+#define UNIQUING_TABLE_RESERVED_EXPANSIONS 4
+#else
+#define UNIQUING_TABLE_RESERVED_EXPANSIONS 0
+#endif
+
 // For a uniquing table, the useful node size is slots := floor(table_byte_size / (2 * sizeof(mach_vm_address_t)))
 // Some useful numbers for the initial max collision value (desiring 66% fill):
 // 16K-23K slots -> 16 collisions
@@ -99,6 +117,104 @@ typedef struct {
 	uint64_t offset_and_flags; // top 8 bits are actually the flags!
 } stack_logging_index_event64;
 
+// The index file is a stack_logging_index_header followed by blocks, each
+// holding the events of one flush of the pre-write buffer:
+//
+//	header	stack_logging_index_block_header
+//	records	one per event, each a run of LEB128 varints: the flags and user
+//		tag, the argument, then the (disguised) address and the stack id
+//		as zigzag deltas from the block's event before, or from 0
+//	filter	bloom filter of the block's addresses, with
+//		STACK_LOGGING_INDEX_FILTER_BITS bits per event
+//	end	STACK_LOGGING_INDEX_END_MAGIC
+//
+// After every STACK_LOGGING_INDEX_GROUP_BLOCKS blocks comes a group record:
+// a header with STACK_LOGGING_INDEX_GROUP_MAGIC and no records, then a bloom
+// filter of the addresses of all the blocks since the group record before,
+// and the end magic.
+//
+// Blocks decode on their own and their headers chain forward from the start
+// of the file, so readers map it and decode just the blocks that may hold an
+// address, passing over a whole group at a time when its filter or address
+// range rules the address out. A block cut short by a crash or a failed
+// write lacks its end magic; readers stop at the last whole block before it.
+//
+// Index files written by libmalloc before there were blocks have no header,
+// just stack_logging_index_event32 or 64 records as the target's pointer
+// size has it. Readers that find no header read those records instead.
+#define STACK_LOGGING_INDEX_MAGIC 0x494c534dU // "MSLI"
+#define STACK_LOGGING_INDEX_VERSION 3
+#define STACK_LOGGING_INDEX_BLOCK_MAGIC 0x424c534dU // "MSLB"
+#define STACK_LOGGING_INDEX_GROUP_MAGIC 0x474c534dU // "MSLG"
+#define STACK_LOGGING_INDEX_END_MAGIC 0x454c534dU // "MSLE"
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+} stack_logging_index_header;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t records_size;
+	uint32_t filter_size;
+	uint32_t event_count;
+	uint64_t min_address; // lowest and highest (disguised) address of the events
+	uint64_t max_address;
+} stack_logging_index_block_header;
+
+// Bounds for the buffer a block is encoded in: up to ten bytes of varint for
+// each 64-bit field, and three for the 16 bits of flags and user tag.
+#define STACK_LOGGING_INDEX_MAX_RECORD_SIZE (3 + 3 * 10)
+#define STACK_LOGGING_INDEX_MAX_EVENTS (STACK_LOGGING_BLOCK_WRITING_SIZE / sizeof(stack_logging_index_event32))
+#define STACK_LOGGING_INDEX_MAX_BLOCK_SIZE                                                                           \
+	(sizeof(stack_logging_index_block_header) +                                                                      \
+			STACK_LOGGING_INDEX_MAX_EVENTS * (STACK_LOGGING_INDEX_MAX_RECORD_SIZE + STACK_LOGGING_INDEX_FILTER_BITS / 8) + \
+			8 + sizeof(uint32_t))
+
+// Filters have STACK_LOGGING_INDEX_FILTER_BITS bits per event, rounded up to
+// whole 64-bit words. A group record's is sized for as many events as its
+// blocks can hold.
+#define STACK_LOGGING_INDEX_FILTER_SIZE(events) (((events)*STACK_LOGGING_INDEX_FILTER_BITS + 63) / 64 * 8)
+#define STACK_LOGGING_INDEX_GROUP_FILTER_SIZE \
+	STACK_LOGGING_INDEX_FILTER_SIZE(STACK_LOGGING_INDEX_GROUP_BLOCKS * (STACK_LOGGING_BLOCK_WRITING_SIZE / sizeof(stack_logging_index_event)))
+_Static_assert(sizeof(stack_logging_index_block_header) + STACK_LOGGING_INDEX_GROUP_FILTER_SIZE + sizeof(uint32_t) <=
+				STACK_LOGGING_INDEX_MAX_BLOCK_SIZE,
+		"group records are encoded in the index block buffer");
+
+// The stack a thread last logged, coldest frame first, along with the node
+// each frame was entered into the uniquing table as: nodes[i] is pcs[i] with
+// parent nodes[i - 1]. The next stack the thread logs usually shares a long
+// cold prefix with it, whose frames then need not be looked up again.
+typedef struct shadow_stack {
+	vm_address_t thread;
+	uint32_t table_instance; // uniquing table the nodes are in
+	uint32_t count;
+	mach_vm_address_t pcs[STACK_LOGGING_MAX_STACK_SIZE];
+	uint64_t nodes[STACK_LOGGING_MAX_STACK_SIZE];
+} shadow_stack_t;
+
+// One thread's pending events, in the order the thread logged them. The
+// sequence number places the event among those of all other threads.
+typedef struct {
+	uint64_t sequence;
+	stack_logging_index_event event; // offset_and_flags of 0: no event, just a used sequence number
+} thread_buffer_entry;
+
+// Single-producer ring of events: the owning thread appends at head without
+// taking stack_logging_lock, and whoever holds the lock drains from tail.
+typedef struct thread_buffer {
+	volatile uint64_t head;
+	struct thread_buffer *next; // on thread_buffers, under stack_logging_lock
+	volatile boolean_t exited;
+	volatile boolean_t logging; // between taking a sequence number and storing it
+	vm_address_t stack_lo; // bounds of the owning thread's stack
+	vm_address_t stack_hi;
+	vm_address_t frames[STACK_LOGGING_MAX_STACK_SIZE];
+	shadow_stack_t shadow;
+	volatile uint64_t tail __attribute__((aligned(64)));
+	thread_buffer_entry entries[STACK_LOGGING_THREAD_BUFFER_EVENTS];
+} thread_buffer_t;
+
 // backtrace uniquing table chunks used in client-side stack log reading code,
 // in case we can't read the whole table in one mach_vm_read() call.
 typedef struct table_chunk_header {
@@ -144,25 +260,67 @@ typedef struct {
 	backtrace_uniquing_table *uniquing_table;
 	struct radix_tree *vm_stackid_table;
 	uint64_t vm_stackid_table_size;
+	uint64_t sample_interval; // lite mode: mean bytes between sampled allocations, 0 when every allocation is recorded
 } stack_buffer_shared_memory;
 #pragma pack(pop)
 
-// target process address -> record table (for __mach_stack_logging_get_frames)
+// The shared memory of a target whose index file holds raw records.
+#define STACK_LOGGING_RAW_BLOCK_WRITING_SIZE 8192
+
+#pragma pack(push, 4)
 typedef struct {
-	uint64_t address;
-	uint64_t index_file_offset;
-} remote_index_node;
+	uint64_t start_index_offset;
+	uint32_t next_free_index_buffer_offset;
+	char index_buffer[STACK_LOGGING_RAW_BLOCK_WRITING_SIZE];
+	backtrace_uniquing_table *uniquing_table;
+	struct radix_tree *vm_stackid_table;
+	uint64_t vm_stackid_table_size;
+} stack_buffer_shared_memory_raw;
+#pragma pack(pop)
+
+// a field both layouts of the shared memory have, from whichever is mapped
+#define REMOTE_SHARED_MEMORY_FIELD(cache, field) ((cache)->raw_shmem ? (cache)->raw_shmem->field : (cache)->shmem->field)
+
+// an index block of the remote process' index file, as found by its header
+typedef struct {
+	uint64_t offset; // of the block's records in the file
+	uint32_t records_size;
+	uint32_t filter_size;
+	uint32_t event_count;
+	uint64_t group; // index of the group record covering the block, or REMOTE_INDEX_NO_GROUP
+	uint64_t min_address;
+	uint64_t max_address;
+} remote_index_block;
+
+// a group record of the remote process' index file, covering the blocks from
+// first_block up to end_block
+typedef struct {
+	uint64_t filter_offset;
+	uint32_t filter_size;
+	uint64_t first_block;
+	uint64_t end_block;
+	uint64_t min_address;
+	uint64_t max_address;
+} remote_index_group;
+
+#define REMOTE_INDEX_NO_GROUP UINT64_MAX
 
 // for caching index information client-side:
 typedef struct {
-	size_t cache_size;
-	size_t cache_node_capacity;
-	uint32_t collision_allowance;
-	remote_index_node *table_memory;	 // this can be malloced; it's on the client side.
+	const uint8_t *index_map;			 // the index file, mapped up to map_size
+	uint64_t map_size;
+	uint64_t index_size;				 // end of the last whole block, in blocks
+	remote_index_block *blocks;			 // oldest first; malloced, on the client side
+	uint64_t block_count;
+	uint64_t block_capacity;
+	remote_index_group *groups;			 // oldest first; malloced, on the client side
+	uint64_t group_count;
+	uint64_t group_capacity;
+	uint64_t first_ungrouped_block;		 // blocks from here on have no group record yet
 	stack_buffer_shared_memory *shmem;   // shared memory
+	stack_buffer_shared_memory_raw *raw_shmem; // shared memory instead, for an index file of raw records
+	uint32_t raw_record_size;			 // size of the index file's records if it has no header, else 0
 	stack_buffer_shared_memory snapshot; // memory snapshot of the remote process' shared memory
-	uint32_t last_pre_written_index_size;
-	uint64_t last_index_file_offset;
 	backtrace_uniquing_table uniquing_table_snapshot; // snapshot of the remote process' uniquing table
 	boolean_t lite_mode;
 	struct radix_tree *vm_stackid_table;
@@ -218,6 +376,8 @@ int stack_logging_dontcompact = 0;
 int stack_logging_finished_init = 0;
 int stack_logging_postponed = 0;
 int stack_logging_mode = stack_logging_mode_none;
+int stack_logging_thread_buffers = 0;
+uint64_t stack_logging_sample_interval = 0;
 
 #define MAX_PARENT_NORMAL
 #define MAX_PARENT_REFCOUNT
@@ -231,8 +391,26 @@ static vm_address_t thread_doing_logging = 0;
 // single-thread access variables
 static stack_buffer_shared_memory *pre_write_buffers;
 static vm_address_t *stack_buffer;
+static shadow_stack_t *shadow_stacks; // STACK_LOGGING_SHADOW_STACKS, by thread
 static uintptr_t last_logged_malloc_address = 0;
 
+// per-thread event buffers (MallocStackLoggingThreadBuffers)
+static volatile boolean_t thread_buffers_enabled = false;
+static pthread_key_t thread_buffer_key;
+static thread_buffer_t *thread_buffers; // under stack_logging_lock
+static volatile uint64_t thread_buffer_sequence = 0; // next sequence number to hand out (atomic)
+static uint64_t thread_buffer_next_sequence = 0; // next sequence number to write, under stack_logging_lock
+static pthread_mutex_t thread_buffer_writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thread_buffer_writer_cond = PTHREAD_COND_INITIALIZER;
+static volatile boolean_t thread_buffer_writer_asleep = false; // every ring was empty when the writer last looked
+static volatile boolean_t thread_buffer_writer_pending = false; // writer signalled, under thread_buffer_writer_mutex
+
+// uniquing table geometry, changed only under stack_logging_lock
+static uint64_t uniquing_table_reserved_size = 0; // bytes mapped at table_address
+static volatile uint32_t uniquing_table_generation = 0; // odd while the geometry is being changed
+static volatile int32_t uniquing_table_inserters = 0; // threads entering frames without stack_logging_lock
+static uint32_t uniquing_table_instance = 0; // bumped for every table created, to invalidate shadow stacks
+
 // Constants to define part of stack logging file path names.
 // File names are of the form stack-logs.<pid>.<address>.<progname>.XXXXXX.index
 // where <address> is the address of the pre_write_buffers VM region in the target
@@ -291,6 +469,26 @@ sld_deallocate_pages(void *memPointer, uint64_t memSize)
 static const uint64_t max_table_size_lite = UINT32_MAX;
 static const uint64_t max_table_size_normal = UINT64_MAX;
 
+// Maps the nodes of a table of 'size' bytes, along with address space for it
+// to grow into. Untouched pages of the reservation cost nothing until the
+// table grows into them.
+static mach_vm_address_t *
+allocate_uniquing_table_nodes(uint64_t size, uint64_t max_table_size, uint64_t *reserved_size)
+{
+	mach_vm_address_t *nodes;
+
+	*reserved_size = size << (EXPAND_FACTOR * UNIQUING_TABLE_RESERVED_EXPANSIONS);
+	while (*reserved_size > max_table_size) {
+		*reserved_size >>= EXPAND_FACTOR;
+	}
+	nodes = (mach_vm_address_t *)(uintptr_t)sld_allocate_pages(*reserved_size);
+	if (!nodes && *reserved_size != size) {
+		*reserved_size = size;
+		nodes = (mach_vm_address_t *)(uintptr_t)sld_allocate_pages(size);
+	}
+	return nodes;
+}
+
 static backtrace_uniquing_table *
 __create_uniquing_table(boolean_t lite_mode)
 {
@@ -303,13 +501,19 @@ __create_uniquing_table(boolean_t lite_mode)
 	uniquing_table->numPages = DEFAULT_UNIQUING_PAGE_SIZE;
 	uniquing_table->tableSize = uniquing_table->numPages * vm_page_size;
 	uniquing_table->numNodes = ((uniquing_table->tableSize / (sizeof(mach_vm_address_t) * 2)) >> 1) << 1; // make sure it's even.
-	uniquing_table->u.table = (mach_vm_address_t *)(uintptr_t)sld_allocate_pages(uniquing_table->tableSize);
+	uniquing_table->max_table_size = (lite_mode) ? max_table_size_lite : max_table_size_normal;
+	uniquing_table->u.table = allocate_uniquing_table_nodes(uniquing_table->tableSize, uniquing_table->max_table_size,
+			&uniquing_table_reserved_size);
+	if (!uniquing_table->u.table) {
+		sld_deallocate_pages(uniquing_table, (uint64_t)round_page(sizeof(backtrace_uniquing_table)));
+		return NULL;
+	}
 	uniquing_table->table_address = (uintptr_t)uniquing_table->u.table;
 	uniquing_table->max_collide = INITIAL_MAX_COLLIDE;
 	uniquing_table->untouchableNodes = 0;
-	uniquing_table->max_table_size = (lite_mode) ? max_table_size_lite : max_table_size_normal;
 	uniquing_table->nodes_use_refcount = lite_mode;
 	uniquing_table->in_client_process = 0;
+	uniquing_table_instance++;
 
 #if BACKTRACE_UNIQUING_DEBUG
 	malloc_printf("create_uniquing_table(): creating. size: %lldKB == %lldMB, numnodes: %lld (%lld untouchable)\n",
@@ -321,12 +525,43 @@ __create_uniquing_table(boolean_t lite_mode)
 	return uniquing_table;
 }
 
+// Geometry changes are bracketed by these, so that threads entering frames
+// without stack_logging_lock work from a consistent copy of it.
+static void
+uniquing_table_begin_update(void)
+{
+	uniquing_table_generation++;
+	OSMemoryBarrier();
+}
+
+static void
+uniquing_table_end_update(void)
+{
+	OSMemoryBarrier();
+	uniquing_table_generation++;
+}
+
+// Called between uniquing_table_begin_update() and uniquing_table_end_update()
+// before the nodes are unmapped; new inserters hold off until the update ends.
+static void
+uniquing_table_wait_for_inserters(void)
+{
+	while (uniquing_table_inserters) {
+		yield();
+	}
+	OSMemoryBarrier();
+}
+
 static void
 __destroy_uniquing_table(backtrace_uniquing_table *table)
 {
 	assert(!table->in_client_process);
-	sld_deallocate_pages(table->u.table, table->tableSize);
+	uniquing_table_begin_update();
+	uniquing_table_wait_for_inserters();
+	sld_deallocate_pages(table->u.table, uniquing_table_reserved_size);
 	sld_deallocate_pages(table, sizeof(backtrace_uniquing_table));
+	uniquing_table_reserved_size = 0;
+	uniquing_table_end_update();
 }
 
 static boolean_t
@@ -336,6 +571,9 @@ __expand_uniquing_table(backtrace_uniquing_table *uniquing_table)
 	mach_vm_address_t *oldTable = uniquing_table->u.table;
 	uint64_t oldsize = uniquing_table->tableSize;
 	uint64_t oldnumnodes = uniquing_table->numNodes;
+	uint64_t oldreservedsize = uniquing_table_reserved_size;
+	uint64_t newreservedsize = oldreservedsize;
+	mach_vm_address_t *newTable = oldTable;
 
 	uint64_t newsize = (uniquing_table->numPages << EXPAND_FACTOR) * vm_page_size;
 	
@@ -343,21 +581,36 @@ __expand_uniquing_table(backtrace_uniquing_table *uniquing_table)
 		malloc_printf("no more space in uniquing table\n");
 		return false;
 	}
-	
+
+	if (newsize > oldreservedsize) {
+		newTable = allocate_uniquing_table_nodes(newsize, uniquing_table->max_table_size, &newreservedsize);
+		if (!newTable) {
+			malloc_printf("expandUniquingTable(): allocation failed\n");
+			return false;
+		}
+	}
+
+	// Growing in place leaves every node where it was, so threads still
+	// entering frames into the old geometry are not disturbed. Moving the
+	// table has to wait for them.
+	uniquing_table_begin_update();
+	if (newTable != oldTable) {
+		uniquing_table_wait_for_inserters();
+		if (mach_vm_copy(mach_task_self(), (mach_vm_address_t)(uintptr_t)oldTable, oldsize, (mach_vm_address_t)(uintptr_t)newTable) !=
+				KERN_SUCCESS) {
+			malloc_printf("expandUniquingTable(): VMCopyFailed\n");
+		}
+		uniquing_table_reserved_size = newreservedsize;
+	}
+
 	uniquing_table->numPages = uniquing_table->numPages << EXPAND_FACTOR;
 	uniquing_table->tableSize = uniquing_table->numPages * vm_page_size;
 	uniquing_table->numNodes = ((uniquing_table->tableSize / (sizeof(mach_vm_address_t) * 2)) >> 1) << 1; // make sure it's even.
-	mach_vm_address_t *newTable = (mach_vm_address_t *)(uintptr_t)sld_allocate_pages(uniquing_table->tableSize);
-
 	uniquing_table->u.table = newTable;
 	uniquing_table->table_address = (uintptr_t)uniquing_table->u.table;
 	uniquing_table->max_collide = uniquing_table->max_collide + COLLISION_GROWTH_RATE;
-
-	if (mach_vm_copy(mach_task_self(), (mach_vm_address_t)(uintptr_t)oldTable, oldsize, (mach_vm_address_t)(uintptr_t)newTable) !=
-			KERN_SUCCESS) {
-		malloc_printf("expandUniquingTable(): VMCopyFailed\n");
-	}
 	uniquing_table->untouchableNodes = oldnumnodes;
+	uniquing_table_end_update();
 
 #if BACKTRACE_UNIQUING_DEBUG
 	malloc_printf(
@@ -367,19 +620,21 @@ __expand_uniquing_table(backtrace_uniquing_table *uniquing_table)
 			uniquing_table->numNodes, uniquing_table->untouchableNodes, uniquing_table->backtracesContained);
 	malloc_printf("expandUniquingTable(): allocate: %p; end: %p\n", newTable,
 			(void *)((uintptr_t)newTable + (uintptr_t)(uniquing_table->tableSize)));
-	malloc_printf("expandUniquingTable(): deallocate: %p; end: %p\n", oldTable, (void *)((uintptr_t)oldTable + (uintptr_t)oldsize));
 	malloc_printf("expandUniquingTable(): new size = %llu\n", newsize);
 #endif
 
-	if (sld_deallocate_pages(oldTable, oldsize) != KERN_SUCCESS) {
-		malloc_printf("expandUniquingTable(): mach_vm_deallocate failed. [%p]\n", uniquing_table->u.table);
+	if (newTable != oldTable && sld_deallocate_pages(oldTable, oldreservedsize) != KERN_SUCCESS) {
+		malloc_printf("expandUniquingTable(): mach_vm_deallocate failed. [%p]\n", oldTable);
 	}
 	
 	return true;
 }
 
-static void
-add_new_slot(table_slot_t *table_slot, mach_vm_address_t address, table_slot_index parent, bool use_refcount, size_t ptr_size)
+// Fills an empty slot with a single 16-byte compare-and-swap, so that threads
+// probing the table without stack_logging_lock never see half a node. If the
+// slot was taken first, returns false with the winner's node in *current.
+static bool
+add_new_slot(table_slot_t *table_slot, table_slot_t *current, mach_vm_address_t address, table_slot_index parent, bool use_refcount, size_t ptr_size)
 {
 	assert(use_refcount == (ptr_size > 0));
 	
@@ -394,17 +649,38 @@ add_new_slot(table_slot_t *table_slot, mach_vm_address_t address, table_slot_ind
 		new_slot.normal_slot.parent = parent;
 	}
 	
+#if __LP64__
+	__uint128_t expected = 0, desired;
+	memcpy(&desired, &new_slot, sizeof(desired));
+	if (__atomic_compare_exchange_n((__uint128_t *)table_slot, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		return true;
+	}
+	memcpy(current, &expected, sizeof(*current));
+	return false;
+#else
+	// Only entered under stack_logging_lock.
+	if (table_slot->slots.slot0 != 0 || table_slot->slots.slot1 != 0) {
+		*current = *table_slot;
+		return false;
+	}
 	*table_slot = new_slot;
+	return true;
+#endif
 }
 
+// Refcounted nodes (lite mode) are only entered under stack_logging_lock.
 static void
 increment_slot_refcount(table_slot_t *table_slot, size_t ptr_size)
 {
 	table_slot->refcount_slot.refcount += ptr_size;
 }
 
+// Enters frames, hottest first, as the descendants of node 'parent' (one of
+// the slot_no_parent values for a whole stack). If 'nodes' is given, it gets
+// the node of every frame, coldest first.
 static int
-enter_frames_in_table(backtrace_uniquing_table *uniquing_table, uint64_t *foundIndex, mach_vm_address_t *frames, int32_t count, size_t ptr_size)
+enter_frames_in_table(backtrace_uniquing_table *uniquing_table, uint64_t *foundIndex, mach_vm_address_t *frames, int32_t count, size_t ptr_size,
+		uint64_t parent, uint64_t *nodes)
 {
 	assert(!uniquing_table->in_client_process);
 	boolean_t use_refcount = (ptr_size > 0);
@@ -412,7 +688,7 @@ enter_frames_in_table(backtrace_uniquing_table *uniquing_table, uint64_t *foundI
 	// The hash values need to be the same size as the addresses (because we use the value -1), for clarity, define a new type
 	typedef mach_vm_address_t hash_index_t;
 	
-	hash_index_t uParent = use_refcount ? slot_no_parent_refcount : slot_no_parent_normal;
+	hash_index_t uParent = parent;
 	hash_index_t modulus = (uniquing_table->numNodes-uniquing_table->untouchableNodes-1);
 	
 	int32_t lcopy = count;
@@ -426,15 +702,20 @@ enter_frames_in_table(backtrace_uniquing_table *uniquing_table, uint64_t *foundI
 
 		while (collisions--) {
 			table_slot_t *table_slot = (table_slot_t *) (uniquing_table->u.table + (hash * 2));
+			table_slot_t current;
 			
-			if (table_slot->slots.slot0 == 0 && table_slot->slots.slot1 == 0) {
-				add_new_slot(table_slot, thisPC, uParent, uniquing_table->nodes_use_refcount, ptr_size);
+			// A slot goes from empty to its final node in one step, so a zero
+			// half means the slot is empty or was being filled as we read it.
+			current.slots.slot0 = __atomic_load_n(&table_slot->slots.slot0, __ATOMIC_ACQUIRE);
+			current.slots.slot1 = __atomic_load_n(&table_slot->slots.slot1, __ATOMIC_ACQUIRE);
+			if ((current.slots.slot0 == 0 || current.slots.slot1 == 0) &&
+					add_new_slot(table_slot, &current, thisPC, uParent, uniquing_table->nodes_use_refcount, ptr_size)) {
 				uParent = hash;
 				break;
 			}
 			
-			slot_address address = use_refcount ? table_slot->refcount_slot.address : table_slot->normal_slot.address;
-			slot_parent parent = use_refcount ? table_slot->refcount_slot.parent : table_slot->normal_slot.parent;
+			slot_address address = use_refcount ? current.refcount_slot.address : current.normal_slot.address;
+			slot_parent parent = use_refcount ? current.refcount_slot.parent : current.normal_slot.parent;
 			
 			if (address == thisPC && parent == uParent) {
 				uParent = hash;
@@ -456,6 +737,9 @@ enter_frames_in_table(backtrace_uniquing_table *uniquing_table, uint64_t *foundI
 			returnVal = 0;
 			break;
 		}
+		if (nodes) {
+			nodes[count - 1 - lcopy] = uParent;
+		}
 	}
 
 	if (returnVal) {
@@ -465,6 +749,304 @@ enter_frames_in_table(backtrace_uniquing_table *uniquing_table, uint64_t *foundI
 	return returnVal;
 }
 
+#if __LP64__
+// enter_frames_in_table() for a caller not holding stack_logging_lock, which
+// works from a copy of the table's geometry taken between updates. Nodes
+// entered after the table has grown in place land in what is now the
+// untouchable part of it, which is as good a place for them as any. On
+// failure *generation is the geometry that was too small.
+static int
+enter_frames_in_table_concurrently(backtrace_uniquing_table *uniquing_table, uint64_t *foundIndex, mach_vm_address_t *frames, int32_t count,
+		uint64_t parent, uint64_t *nodes, uint32_t *generation)
+{
+	backtrace_uniquing_table geometry;
+	int found;
+
+	for (;;) {
+		OSAtomicIncrement32Barrier(&uniquing_table_inserters);
+		*generation = uniquing_table_generation;
+		OSMemoryBarrier();
+		if (!(*generation & 1)) {
+			geometry = *uniquing_table;
+			OSMemoryBarrier();
+			if (uniquing_table_generation == *generation) {
+				break;
+			}
+		}
+		OSAtomicDecrement32Barrier(&uniquing_table_inserters);
+		yield();
+	}
+
+	found = enter_frames_in_table(&geometry, foundIndex, frames, count, 0, parent, nodes);
+	OSAtomicDecrement32Barrier(&uniquing_table_inserters);
+	return found;
+}
+#endif
+
+#pragma mark -
+#pragma mark Stack Walking
+
+// thread_stack_pcs() for a stack whose bounds the caller already has: walks
+// the frame pointers up from its own frame, so buffer[0] is the return address
+// into the caller, and stops at the first frame that is outside the stack,
+// misaligned or no colder than the one before.
+static __attribute__((noinline)) uint32_t
+stack_logging_frame_pcs(vm_address_t *buffer, uint32_t max, vm_address_t stack_lo, vm_address_t stack_hi)
+{
+	vm_address_t *frame = __builtin_frame_address(0);
+	vm_address_t *next;
+	vm_address_t pc;
+	uint32_t count = 0;
+
+	while (count < max && (vm_address_t)frame >= stack_lo && (vm_address_t)(frame + 2) <= stack_hi &&
+			!((vm_address_t)frame & (sizeof(vm_address_t) - 1))) {
+		next = (vm_address_t *)frame[0];
+		pc = frame[1];
+		if (!pc) {
+			break;
+		}
+#if __has_feature(ptrauth_calls)
+		pc = (vm_address_t)ptrauth_strip((void *)pc, ptrauth_key_return_address);
+#endif
+		buffer[count++] = pc;
+		if (next <= frame) {
+			break;
+		}
+		frame = next;
+	}
+	return count;
+}
+
+static void
+stack_logging_thread_bounds(vm_address_t self_thread, vm_address_t *stack_lo, vm_address_t *stack_hi)
+{
+	*stack_hi = (vm_address_t)pthread_get_stackaddr_np((pthread_t)self_thread);
+	*stack_lo = *stack_hi - pthread_get_stacksize_np((pthread_t)self_thread);
+}
+
+// Returns how many of the coldest of frames (hottest first) are those the
+// shadow stack starts with, and forgets the rest of it. The node to enter the
+// others under is shadow_stack_parent() of that.
+static uint32_t
+shadow_stack_match(shadow_stack_t *ss, mach_vm_address_t *frames, uint32_t count)
+{
+	uint32_t common = 0;
+
+	if (ss->table_instance != uniquing_table_instance) {
+		ss->table_instance = uniquing_table_instance;
+		ss->count = 0;
+	}
+	while (common < ss->count && common < count && ss->pcs[common] == frames[count - 1 - common]) {
+		common++;
+	}
+	ss->count = common;
+	return common;
+}
+
+static uint64_t
+shadow_stack_parent(shadow_stack_t *ss, uint32_t common)
+{
+	return common ? ss->nodes[common - 1] : slot_no_parent_normal;
+}
+
+// Makes frames the shadow stack, once the nodes of all but its 'common'
+// coldest have been entered into ss->nodes + common.
+static void
+shadow_stack_update(shadow_stack_t *ss, mach_vm_address_t *frames, uint32_t count, uint32_t common)
+{
+	uint32_t i;
+
+	for (i = common; i < count; i++) {
+		ss->pcs[i] = frames[count - 1 - i];
+	}
+	ss->count = count;
+}
+
+// Threads logging under stack_logging_lock share STACK_LOGGING_SHADOW_STACKS
+// of them; a thread keeps its own for as long as no other hashes to it.
+static shadow_stack_t *
+shadow_stack_for_thread_while_locked(vm_address_t self_thread)
+{
+	shadow_stack_t *ss = &shadow_stacks[(((uint64_t)self_thread * 0x9E3779B97F4A7C15ull) >> 32) % STACK_LOGGING_SHADOW_STACKS];
+
+	if (ss->thread != self_thread) {
+		ss->thread = self_thread;
+		ss->count = 0;
+	}
+	return ss;
+}
+
+#pragma mark -
+#pragma mark Index Blocks
+
+static uint8_t *
+index_append_varint(uint8_t *p, uint64_t value)
+{
+	while (value >= 0x80) {
+		*p++ = (uint8_t)value | 0x80;
+		value >>= 7;
+	}
+	*p++ = (uint8_t)value;
+	return p;
+}
+
+// Returns NULL if the varint runs past 'end'.
+static const uint8_t *
+index_read_varint(const uint8_t *p, const uint8_t *end, uint64_t *value)
+{
+	uint64_t result = 0;
+	unsigned shift = 0;
+
+	while (p < end && shift < 64) {
+		uint8_t byte = *p++;
+		result |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value = result;
+			return p;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+static inline uint64_t
+index_zigzag(uint64_t delta)
+{
+	return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static inline uint64_t
+index_unzigzag(uint64_t value)
+{
+	return (value >> 1) ^ (0 - (value & 1));
+}
+
+// Flags in the low byte and the user tag above them, which for most events
+// is a single byte of varint.
+static inline uint64_t
+index_event_tags(uint64_t offset_and_flags)
+{
+	return (offset_and_flags >> STACK_LOGGING_FLAGS_SHIFT) | ((offset_and_flags >> 40) & 0xff00);
+}
+
+static inline uint64_t
+index_event_offset_and_flags(uint64_t stack_id, uint64_t tags)
+{
+	return (stack_id & STACK_LOGGING_OFFSET_MASK) | ((tags & 0xff) << STACK_LOGGING_FLAGS_SHIFT) | ((tags & 0xff00) << 40);
+}
+
+static uint32_t
+index_filter_size(uint32_t event_count)
+{
+	return STACK_LOGGING_INDEX_FILTER_SIZE(event_count);
+}
+
+static inline uint64_t
+index_filter_hash(uint64_t address)
+{
+	address ^= address >> 33;
+	address *= 0xff51afd7ed558ccdull;
+	address ^= address >> 33;
+	address *= 0xc4ceb9fe1a85ec53ull;
+	address ^= address >> 33;
+	return address;
+}
+
+static void
+index_filter_add(uint8_t *filter, uint32_t filter_size, uint64_t address)
+{
+	uint64_t hash = index_filter_hash(address);
+	uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+	uint32_t i, bit;
+
+	for (i = 0; i < STACK_LOGGING_INDEX_FILTER_HASHES; i++) {
+		bit = (uint32_t)(((uint64_t)(h1 + i * h2) * filter_size * 8) >> 32);
+		filter[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+	}
+}
+
+static bool
+index_filter_may_contain(const uint8_t *filter, uint32_t filter_size, uint64_t address)
+{
+	uint64_t hash = index_filter_hash(address);
+	uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+	uint32_t i, bit;
+
+	for (i = 0; i < STACK_LOGGING_INDEX_FILTER_HASHES; i++) {
+		bit = (uint32_t)(((uint64_t)(h1 + i * h2) * filter_size * 8) >> 32);
+		if (!(filter[bit >> 3] & (1 << (bit & 7)))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Encodes events as an index block at 'block', which has room for
+// STACK_LOGGING_INDEX_MAX_BLOCK_SIZE bytes, and returns its size.
+static size_t
+encode_index_block(uint8_t *block, const stack_logging_index_event *events, uint32_t count)
+{
+	stack_logging_index_block_header header;
+	uint32_t end_magic = STACK_LOGGING_INDEX_END_MAGIC;
+	uint64_t address = 0, stack_id = 0;
+	uint8_t *records = block + sizeof(header);
+	uint8_t *p = records;
+	uint32_t i;
+
+	header.min_address = UINT64_MAX;
+	header.max_address = 0;
+	for (i = 0; i < count; i++) {
+		header.min_address = MIN(header.min_address, (uint64_t)events[i].address);
+		header.max_address = MAX(header.max_address, (uint64_t)events[i].address);
+		p = index_append_varint(p, index_event_tags(events[i].offset_and_flags));
+		p = index_append_varint(p, (uint64_t)events[i].argument);
+		p = index_append_varint(p, index_zigzag((uint64_t)events[i].address - address));
+		p = index_append_varint(p, index_zigzag(STACK_LOGGING_OFFSET(events[i].offset_and_flags) - stack_id));
+		address = (uint64_t)events[i].address;
+		stack_id = STACK_LOGGING_OFFSET(events[i].offset_and_flags);
+	}
+	header.magic = STACK_LOGGING_INDEX_BLOCK_MAGIC;
+	header.records_size = (uint32_t)(p - records);
+	header.filter_size = index_filter_size(count);
+	header.event_count = count;
+	memcpy(block, &header, sizeof(header));
+
+	bzero(p, header.filter_size);
+	for (i = 0; i < count; i++) {
+		index_filter_add(p, header.filter_size, (uint64_t)events[i].address);
+	}
+	p += header.filter_size;
+
+	memcpy(p, &end_magic, sizeof(end_magic));
+	p += sizeof(end_magic);
+	return (size_t)(p - block);
+}
+
+// Encodes a group record at 'block' from the group's filter, which holds
+// STACK_LOGGING_INDEX_GROUP_FILTER_SIZE bytes, and returns its size.
+static size_t
+encode_index_group(uint8_t *block, const uint8_t *filter, uint32_t event_count, uint64_t min_address, uint64_t max_address)
+{
+	stack_logging_index_block_header header;
+	uint32_t end_magic = STACK_LOGGING_INDEX_END_MAGIC;
+	uint8_t *p = block + sizeof(header);
+
+	header.magic = STACK_LOGGING_INDEX_GROUP_MAGIC;
+	header.records_size = 0;
+	header.filter_size = STACK_LOGGING_INDEX_GROUP_FILTER_SIZE;
+	header.event_count = event_count;
+	header.min_address = min_address;
+	header.max_address = max_address;
+	memcpy(block, &header, sizeof(header));
+
+	memcpy(p, filter, header.filter_size);
+	p += header.filter_size;
+
+	memcpy(p, &end_magic, sizeof(end_magic));
+	p += sizeof(end_magic);
+	return (size_t)(p - block);
+}
+
 #pragma mark -
 #pragma mark Disk Stack Logging
 
@@ -472,6 +1054,8 @@ enter_frames_in_table(backtrace_uniquing_table *uniquing_table, uint64_t *foundI
 static void delete_log_files(void);
 static int delete_logging_file(char *log_location);
 static bool getenv_from_process(pid_t pid, char *env_var_name, char *env_var_value_buf, size_t max_path_len);
+static ssize_t robust_write(int fd, const void *buf, size_t nbyte);
+static void reset_index_group(void);
 
 #define BASE10 10
 #define BASE16 16
@@ -694,6 +1278,19 @@ create_log_file()
 	
 	// Securely create the log file.
 	if ((index_file_descriptor = my_mkstemps(__stack_log_file_path__, (int)strlen(stack_log_file_suffix))) != -1) {
+		stack_logging_index_header header = {STACK_LOGGING_INDEX_MAGIC, STACK_LOGGING_INDEX_VERSION};
+		if (robust_write(index_file_descriptor, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+			_malloc_printf(ASL_LEVEL_INFO, "unable to write to stack logs at %s\n", __stack_log_file_path__);
+			close(index_file_descriptor);
+			index_file_descriptor = -1;
+			unlink(__stack_log_file_path__);
+			__stack_log_file_path__[0] = '\0';
+			return NULL;
+		}
+		if (pre_write_buffers) {
+			pre_write_buffers->start_index_offset = sizeof(header);
+		}
+		reset_index_group();
 		_malloc_printf(ASL_LEVEL_INFO, "stack logs being written into %s\n", __stack_log_file_path__);
 		created_log_location = __stack_log_file_path__;
 	} else {
@@ -963,12 +1560,52 @@ robust_write(int fd, const void *buf, size_t nbyte)
 	return written;
 }
 
+static uint8_t *index_block; // flush_data() encodes the pre-write buffer here
+
+// the group record for the blocks written since the last one
+static uint8_t *index_group_filter; // STACK_LOGGING_INDEX_GROUP_FILTER_SIZE bytes
+static uint32_t index_group_blocks;
+static uint32_t index_group_events;
+static uint64_t index_group_min_address;
+static uint64_t index_group_max_address;
+
 static void
-flush_data(void)
+reset_index_group(void)
+{
+	if (index_group_filter) {
+		bzero(index_group_filter, STACK_LOGGING_INDEX_GROUP_FILTER_SIZE);
+	}
+	index_group_blocks = index_group_events = 0;
+	index_group_min_address = UINT64_MAX;
+	index_group_max_address = 0;
+}
+
+// Appends 'size' bytes to the index file; false if the write failed and
+// logging has been turned off.
+static bool
+write_index_bytes(const uint8_t *p, size_t size)
 {
 	ssize_t written; // signed size_t
-	size_t remaining;
-	char *p;
+
+	while (size > 0) {
+		written = robust_write(index_file_descriptor, p, size);
+		if (written == -1) {
+			_malloc_printf(
+					ASL_LEVEL_INFO, "Unable to write to stack logging file %s (%s)\n", __stack_log_file_path__, strerror(errno));
+			disable_stack_logging();
+			return false;
+		}
+		p += written;
+		size -= written;
+	}
+	return true;
+}
+
+static void
+flush_data(void)
+{
+	const stack_logging_index_event *events = (stack_logging_index_event *)pre_write_buffers->index_buffer;
+	uint32_t i;
 
 	if (index_file_descriptor == -1) {
 		if (create_log_file() == NULL) {
@@ -976,35 +1613,91 @@ flush_data(void)
 		}
 	}
 
-	// Write the events before the index so that hopefully the events will be on disk if the index refers to them.
-	p = pre_write_buffers->index_buffer;
-	remaining = (size_t)pre_write_buffers->next_free_index_buffer_offset;
-	while (remaining > 0) {
-		written = robust_write(index_file_descriptor, p, remaining);
-		if (written == -1) {
-			_malloc_printf(
-					ASL_LEVEL_INFO, "Unable to write to stack logging file %s (%s)\n", __stack_log_file_path__, strerror(errno));
+	uint32_t count = pre_write_buffers->next_free_index_buffer_offset / (uint32_t)sizeof(stack_logging_index_event);
+	if (!count) {
+		return;
+	}
+	if (!index_block) {
+		index_block = (uint8_t *)sld_allocate_pages((uint64_t)round_page(STACK_LOGGING_INDEX_MAX_BLOCK_SIZE));
+		index_group_filter = (uint8_t *)sld_allocate_pages((uint64_t)round_page(STACK_LOGGING_INDEX_GROUP_FILTER_SIZE));
+		if (!index_block || !index_group_filter) {
+			_malloc_printf(ASL_LEVEL_INFO, "error while allocating stack logging index block\n");
 			disable_stack_logging();
 			return;
 		}
-		p += written;
-		remaining -= written;
+		reset_index_group();
 	}
 
-	pre_write_buffers->start_index_offset += pre_write_buffers->next_free_index_buffer_offset;
+	size_t block_size = encode_index_block(index_block, events, count);
+	if (!write_index_bytes(index_block, block_size)) {
+		return;
+	}
+
+	// Only once it's all written, since readers take start_index_offset to be
+	// the end of the last whole block.
+	pre_write_buffers->start_index_offset += block_size;
 	pre_write_buffers->next_free_index_buffer_offset = 0;
+
+	for (i = 0; i < count; i++) {
+		index_filter_add(index_group_filter, STACK_LOGGING_INDEX_GROUP_FILTER_SIZE, (uint64_t)events[i].address);
+		index_group_min_address = MIN(index_group_min_address, (uint64_t)events[i].address);
+		index_group_max_address = MAX(index_group_max_address, (uint64_t)events[i].address);
+	}
+	index_group_events += count;
+	if (++index_group_blocks == STACK_LOGGING_INDEX_GROUP_BLOCKS) {
+		block_size = encode_index_group(
+				index_block, index_group_filter, index_group_events, index_group_min_address, index_group_max_address);
+		if (!write_index_bytes(index_block, block_size)) {
+			return;
+		}
+		pre_write_buffers->start_index_offset += block_size;
+		reset_index_group();
+	}
 }
 
-__attribute__((visibility("hidden"))) boolean_t
-__prepare_to_log_stacks(boolean_t lite_mode)
+// Appends one event to the index, dropping it together with the event before
+// it if it frees the block that event allocated.
+static void
+log_index_event_while_locked(const stack_logging_index_event *event)
 {
-	if (!pre_write_buffers) {
+	uint32_t type_flags = STACK_LOGGING_FLAGS(event->offset_and_flags);
+
+	// compaction
+	if (last_logged_malloc_address && (type_flags & stack_logging_type_dealloc) && event->address == last_logged_malloc_address) {
+		// *waves hand* the last allocation never occurred
+		pre_write_buffers->next_free_index_buffer_offset -= (uint32_t)sizeof(stack_logging_index_event);
 		last_logged_malloc_address = 0ul;
-		logging_use_compaction = (stack_logging_dontcompact ? 0 : logging_use_compaction);
+		return;
+	}
+	if (type_flags & stack_logging_type_alloc || type_flags & stack_logging_type_vm_allocate) {
+		if (logging_use_compaction) {
+			last_logged_malloc_address = event->address; // disguised
+		}
+	} else {
+		last_logged_malloc_address = 0ul;
+	}
 
-		// Create a VM region to hold the pre-write index and stack buffers. The address of this VM region will be
-		// encoded into the stack log file name, so that the stack log reading code running in remote analysis
-		// processes can find it and map it into the analysis process. This allows remote analysis processes to access
+	// flush the data buffer to disk if necessary
+	if (pre_write_buffers->next_free_index_buffer_offset + sizeof(stack_logging_index_event) >= STACK_LOGGING_BLOCK_WRITING_SIZE) {
+		flush_data();
+	}
+
+	// store bytes in buffers
+	memcpy(pre_write_buffers->index_buffer + pre_write_buffers->next_free_index_buffer_offset, event,
+			sizeof(stack_logging_index_event));
+	pre_write_buffers->next_free_index_buffer_offset += (uint32_t)sizeof(stack_logging_index_event);
+}
+
+__attribute__((visibility("hidden"))) boolean_t
+__prepare_to_log_stacks(boolean_t lite_mode)
+{
+	if (!pre_write_buffers) {
+		last_logged_malloc_address = 0ul;
+		logging_use_compaction = (stack_logging_dontcompact ? 0 : logging_use_compaction);
+
+		// Create a VM region to hold the pre-write index and stack buffers. The address of this VM region will be
+		// encoded into the stack log file name, so that the stack log reading code running in remote analysis
+		// processes can find it and map it into the analysis process. This allows remote analysis processes to access
 		// these buffers to get logs for even the most recent allocations. The remote process will need to pause this
 		// process to assure that the contents of these buffers don't change while being inspected.
 		//
@@ -1033,6 +1726,7 @@ __prepare_to_log_stacks(boolean_t lite_mode)
 		}
 
 		pre_write_buffers->vm_stackid_table = NULL;
+		pre_write_buffers->sample_interval = lite_mode ? stack_logging_sample_interval : 0;
 
 		uint64_t stack_buffer_sz = (uint64_t)round_page(sizeof(vm_address_t) * STACK_LOGGING_MAX_STACK_SIZE);
 		stack_buffer = (vm_address_t *)sld_allocate_pages(stack_buffer_sz);
@@ -1042,6 +1736,14 @@ __prepare_to_log_stacks(boolean_t lite_mode)
 			return false;
 		}
 
+		uint64_t shadow_stacks_sz = (uint64_t)round_page(sizeof(shadow_stack_t) * STACK_LOGGING_SHADOW_STACKS);
+		shadow_stacks = (shadow_stack_t *)sld_allocate_pages(shadow_stacks_sz);
+		if (!shadow_stacks) {
+			_malloc_printf(ASL_LEVEL_INFO, "error while allocating shadow stacks\n");
+			disable_stack_logging();
+			return false;
+		}
+
 		// lite_mode doesn't use a file
 		if (lite_mode) {
 			__mach_stack_logging_shared_memory_address = (uint64_t) pre_write_buffers;
@@ -1052,6 +1754,8 @@ __prepare_to_log_stacks(boolean_t lite_mode)
 				__destroy_uniquing_table(pre_write_buffers->uniquing_table);
 				sld_deallocate_pages(stack_buffer, stack_buffer_sz);
 				stack_buffer = NULL;
+				sld_deallocate_pages(shadow_stacks, shadow_stacks_sz);
+				shadow_stacks = NULL;
 
 				munmap(pre_write_buffers, full_shared_mem_size);
 				pre_write_buffers = NULL;
@@ -1129,18 +1833,20 @@ __attribute__((visibility("hidden"))) uint64_t
 __enter_stack_into_table_while_locked(vm_address_t self_thread, uint32_t num_hot_to_skip, boolean_t add_thread_id, size_t ptr_size)
 {
 	// gather stack
+	vm_address_t stack_lo, stack_hi;
 	uint32_t count;
-	thread_stack_pcs(stack_buffer, STACK_LOGGING_MAX_STACK_SIZE - 1, &count); // only gather up to STACK_LOGGING_MAX_STACK_SIZE-1 since we append thread id
+	stack_logging_thread_bounds(self_thread, &stack_lo, &stack_hi);
+	count = stack_logging_frame_pcs(stack_buffer, STACK_LOGGING_MAX_STACK_SIZE - 1, stack_lo, stack_hi); // only gather up to STACK_LOGGING_MAX_STACK_SIZE-1 since we append thread id
 	
 	if (add_thread_id) {
 		stack_buffer[count++] = self_thread + 1;   // stuffing thread # in the coldest slot. Add 1 to match what the old stack logging did.
 	}
 	
 	// skip stack frames after the malloc call
-	num_hot_to_skip += 3; // __disk_stack_logging_log_stack | __enter_stack_into_table_while_locked | thread_stack_pcs
+	num_hot_to_skip += 2; // __disk_stack_logging_log_stack | __enter_stack_into_table_while_locked
 	
 	if (count <= num_hot_to_skip) {
-		// Oops!  Didn't get a valid backtrace from thread_stack_pcs().
+		// Oops!  Didn't get a valid backtrace from stack_logging_frame_pcs().
 		return __invalid_stack_id;
 	}
 	
@@ -1159,11 +1865,28 @@ __enter_stack_into_table_while_locked(vm_address_t self_thread, uint32_t num_hot
 	
 	uint64_t uniqueStackIdentifier = __invalid_stack_id;
 	
-	while (!enter_frames_in_table(pre_write_buffers->uniquing_table, &uniqueStackIdentifier, frames, count, ptr_size)) {
+	// Refcounted nodes count every stack they're part of, so lite mode enters
+	// whole stacks; otherwise only what changed since the thread's last one.
+	shadow_stack_t *ss = NULL;
+	uint32_t common = 0;
+	uint64_t parent = slot_no_parent_refcount;
+	
+	if (!ptr_size) {
+		ss = shadow_stack_for_thread_while_locked(self_thread);
+		common = shadow_stack_match(ss, frames, count);
+		parent = shadow_stack_parent(ss, common);
+	}
+	
+	while (!enter_frames_in_table(pre_write_buffers->uniquing_table, &uniqueStackIdentifier, frames, count - common, ptr_size, parent,
+			ss ? ss->nodes + common : NULL)) {
 		if (!__expand_uniquing_table(pre_write_buffers->uniquing_table))
 			return __invalid_stack_id;
 	}
 	
+	if (ss) {
+		shadow_stack_update(ss, frames, count, common);
+	}
+	
 	return uniqueStackIdentifier;
 }
 
@@ -1215,6 +1938,324 @@ __decrement_table_slot_refcount(uint64_t stack_id, size_t ptr_size)
 	__malloc_unlock_stack_logging();
 }
 
+#pragma mark -
+#pragma mark Per-Thread Event Buffers
+
+/*
+ * With MallocStackLoggingThreadBuffers, an event costs its thread the unwind,
+ * an atomic increment for its sequence number and a store into the thread's
+ * own ring. Frames are uniqued without stack_logging_lock on 64-bit, where
+ * the uniquing table takes concurrent inserters; the lock is only taken there
+ * to grow the table. Events reach the index in sequence order, written by
+ * whoever next holds the lock: the writer thread, a thread whose ring is full,
+ * or an in-process reader. The writer sleeps while every ring is empty. The
+ * first event after that wakes it, and it then writes at most every
+ * STACK_LOGGING_WRITER_INTERVAL_USEC, or as soon as a ring reaches
+ * STACK_LOGGING_WRITER_WATERMARK events. Remote readers see events once they
+ * have been written, a few milliseconds late.
+ *
+ * An event logged from a signal handler while its thread is between taking a
+ * sequence number and storing it is dropped, just as the locked path drops
+ * events logged while thread_doing_logging is the current thread; otherwise
+ * it would be stored ahead of the earlier number, and the writer would wait
+ * for that number forever.
+ */
+
+static void
+thread_buffer_exit(void *arg)
+{
+	thread_buffer_t *tb = arg;
+
+	// The writer releases the ring once it has drained it.
+	tb->exited = true;
+}
+
+static thread_buffer_t *
+thread_buffer_create(vm_address_t self_thread)
+{
+	thread_buffer_t *tb;
+
+	_malloc_lock_lock(&stack_logging_lock);
+	thread_doing_logging = self_thread;
+	tb = (thread_buffer_t *)sld_allocate_pages((uint64_t)round_page(sizeof(thread_buffer_t)));
+	if (tb) {
+		stack_logging_thread_bounds(self_thread, &tb->stack_lo, &tb->stack_hi);
+		tb->shadow.thread = self_thread;
+		tb->next = thread_buffers;
+		thread_buffers = tb;
+	}
+	thread_doing_logging = 0;
+	_malloc_lock_unlock(&stack_logging_lock);
+
+	if (tb && pthread_setspecific(thread_buffer_key, tb)) {
+		tb->exited = true;
+		return NULL;
+	}
+	return tb;
+}
+
+// Writes out the buffered events that are next in sequence, stopping at the
+// first sequence number that has been handed out but not yet stored; its
+// thread will store it shortly. Releases the rings of exited threads. Returns
+// true if every ring is now empty.
+static boolean_t
+drain_thread_buffers_while_locked(void)
+{
+	thread_buffer_t *tb, **link;
+	thread_buffer_entry *entry;
+	uint64_t head;
+	boolean_t empty = true;
+
+	for (;;) {
+		for (tb = thread_buffers; tb; tb = tb->next) {
+			head = tb->head;
+			OSMemoryBarrier();
+			if (tb->tail != head &&
+					tb->entries[tb->tail % STACK_LOGGING_THREAD_BUFFER_EVENTS].sequence == thread_buffer_next_sequence) {
+				break;
+			}
+		}
+		if (!tb) {
+			break;
+		}
+
+		// A thread's events are consecutive more often than not; take the run.
+		do {
+			entry = &tb->entries[tb->tail % STACK_LOGGING_THREAD_BUFFER_EVENTS];
+			if (entry->event.offset_and_flags && stack_logging_enable_logging) {
+				log_index_event_while_locked(&entry->event);
+			}
+			thread_buffer_next_sequence++;
+			OSMemoryBarrier();
+			tb->tail++;
+		} while (tb->tail != head &&
+				tb->entries[tb->tail % STACK_LOGGING_THREAD_BUFFER_EVENTS].sequence == thread_buffer_next_sequence);
+	}
+
+	link = &thread_buffers;
+	while ((tb = *link)) {
+		if (tb->exited && tb->tail == tb->head) {
+			*link = tb->next;
+			sld_deallocate_pages(tb, (uint64_t)round_page(sizeof(thread_buffer_t)));
+		} else {
+			empty = empty && tb->tail == tb->head;
+			link = &tb->next;
+		}
+	}
+	return empty;
+}
+
+static boolean_t
+drain_thread_buffers(vm_address_t self_thread)
+{
+	boolean_t empty;
+
+	_malloc_lock_lock(&stack_logging_lock);
+	thread_doing_logging = self_thread;
+	empty = drain_thread_buffers_while_locked();
+	thread_doing_logging = 0;
+	_malloc_lock_unlock(&stack_logging_lock);
+	return empty;
+}
+
+static void
+thread_buffer_writer_wake(void)
+{
+	pthread_mutex_lock(&thread_buffer_writer_mutex);
+	if (!thread_buffer_writer_pending) {
+		thread_buffer_writer_pending = true;
+		pthread_cond_signal(&thread_buffer_writer_cond);
+	}
+	pthread_mutex_unlock(&thread_buffer_writer_mutex);
+}
+
+static void *
+thread_buffer_writer_main(void *arg)
+{
+	vm_address_t self_thread = (vm_address_t)_os_tsd_get_direct(__TSD_THREAD_SELF);
+	struct timespec deadline;
+	boolean_t empty = true;
+
+	pthread_mutex_lock(&thread_buffer_writer_mutex);
+	for (;;) {
+		if (empty) {
+			// Say so before looking at the rings once more: either a thread
+			// storing an event from here on sees the flag and wakes us, or we
+			// see its event.
+			thread_buffer_writer_asleep = true;
+			OSMemoryBarrier();
+			pthread_mutex_unlock(&thread_buffer_writer_mutex);
+			empty = drain_thread_buffers(self_thread);
+			pthread_mutex_lock(&thread_buffer_writer_mutex);
+			while (empty && !thread_buffer_writer_pending) {
+				pthread_cond_wait(&thread_buffer_writer_cond, &thread_buffer_writer_mutex);
+			}
+			thread_buffer_writer_asleep = false;
+			thread_buffer_writer_pending = false;
+		}
+
+		// Give the threads that woke us an interval to log more, unless one
+		// of them fills its ring to the watermark first.
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += STACK_LOGGING_WRITER_INTERVAL_USEC * 1000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while (!thread_buffer_writer_pending &&
+				pthread_cond_timedwait(&thread_buffer_writer_cond, &thread_buffer_writer_mutex, &deadline) != ETIMEDOUT) {
+		}
+		thread_buffer_writer_pending = false;
+
+		pthread_mutex_unlock(&thread_buffer_writer_mutex);
+		empty = drain_thread_buffers(self_thread);
+		pthread_mutex_lock(&thread_buffer_writer_mutex);
+	}
+	return NULL;
+}
+
+// Called with stack_logging_lock held, once the log file exists.
+static void
+start_thread_buffers_while_locked(void)
+{
+	pthread_t writer;
+
+	if (pthread_key_create(&thread_buffer_key, thread_buffer_exit)) {
+		_malloc_printf(ASL_LEVEL_INFO, "unable to create stack logging thread buffer key; logging without them\n");
+		stack_logging_thread_buffers = 0;
+		return;
+	}
+	pthread_mutex_init(&thread_buffer_writer_mutex, NULL);
+	pthread_cond_init(&thread_buffer_writer_cond, NULL);
+	thread_buffer_writer_asleep = thread_buffer_writer_pending = false;
+	if (pthread_create(&writer, NULL, thread_buffer_writer_main, NULL)) {
+		_malloc_printf(ASL_LEVEL_INFO, "unable to start stack logging writer thread; logging without thread buffers\n");
+		pthread_key_delete(thread_buffer_key);
+		stack_logging_thread_buffers = 0;
+		return;
+	}
+	pthread_detach(writer);
+
+	// Everything logged so far is already in the index; sequence numbers
+	// start from here.
+	OSMemoryBarrier();
+	thread_buffers_enabled = true;
+}
+
+__attribute__((visibility("hidden"))) void
+__stack_logging_drain_thread_buffers(void)
+{
+	if (thread_buffers_enabled) {
+		drain_thread_buffers((vm_address_t)_os_tsd_get_direct(__TSD_THREAD_SELF));
+	}
+}
+
+// Not inlined, so that the frames to skip are those of the locked path:
+// __disk_stack_logging_log_stack | log_stack_to_thread_buffer
+static __attribute__((noinline)) void
+log_stack_to_thread_buffer(vm_address_t self_thread, uint32_t type_flags, uintptr_t address, uintptr_t size, uint32_t num_hot_to_skip)
+{
+	thread_buffer_t *tb = pthread_getspecific(thread_buffer_key);
+	thread_buffer_entry *entry;
+	uint64_t uniqueStackIdentifier = __invalid_stack_id;
+	uint64_t sequence;
+	uint32_t count;
+
+	if (!tb && !(tb = thread_buffer_create(self_thread))) {
+		return;
+	}
+	if (tb->logging) {
+		return; // from a signal handler, part way through this thread's last event
+	}
+	tb->logging = true;
+
+	// Take this event's place in the log first, which orders it against other
+	// threads' events just as taking stack_logging_lock here used to.
+	sequence = (uint64_t)OSAtomicIncrement64Barrier((volatile int64_t *)&thread_buffer_sequence) - 1;
+
+	count = stack_logging_frame_pcs(tb->frames, STACK_LOGGING_MAX_STACK_SIZE - 1, tb->stack_lo, tb->stack_hi);
+	tb->frames[count++] = self_thread + 1; // thread # in the coldest slot, as in __enter_stack_into_table_while_locked
+	num_hot_to_skip += 2;
+
+	if (count > num_hot_to_skip) {
+		count -= num_hot_to_skip;
+#if __LP64__
+		mach_vm_address_t *frames = (mach_vm_address_t *)tb->frames + num_hot_to_skip;
+#else
+		mach_vm_address_t frames[STACK_LOGGING_MAX_STACK_SIZE];
+		uint32_t i;
+		for (i = 0; i < count; i++) {
+			frames[i] = tb->frames[i + num_hot_to_skip];
+		}
+#endif
+
+		uint32_t common = shadow_stack_match(&tb->shadow, frames, count);
+		uint64_t parent = shadow_stack_parent(&tb->shadow, common);
+
+#if __LP64__
+		uint32_t generation;
+		boolean_t expanded = true;
+
+		// The lock is only needed to grow the table, unless another thread
+		// already has since this attempt.
+		while (expanded && !enter_frames_in_table_concurrently(pre_write_buffers->uniquing_table, &uniqueStackIdentifier, frames,
+				count - common, parent, tb->shadow.nodes + common, &generation)) {
+			_malloc_lock_lock(&stack_logging_lock);
+			thread_doing_logging = self_thread;
+			expanded = (generation != uniquing_table_generation) || __expand_uniquing_table(pre_write_buffers->uniquing_table);
+			thread_doing_logging = 0;
+			_malloc_lock_unlock(&stack_logging_lock);
+		}
+		if (!expanded) {
+			uniqueStackIdentifier = __invalid_stack_id;
+		}
+#else
+		_malloc_lock_lock(&stack_logging_lock);
+		thread_doing_logging = self_thread;
+		while (!enter_frames_in_table(pre_write_buffers->uniquing_table, &uniqueStackIdentifier, frames, count - common, 0, parent,
+				tb->shadow.nodes + common)) {
+			if (!__expand_uniquing_table(pre_write_buffers->uniquing_table)) {
+				uniqueStackIdentifier = __invalid_stack_id;
+				break;
+			}
+		}
+		thread_doing_logging = 0;
+		_malloc_lock_unlock(&stack_logging_lock);
+#endif
+		if (uniqueStackIdentifier != __invalid_stack_id) {
+			shadow_stack_update(&tb->shadow, frames, count, common);
+		}
+	}
+
+	// A full ring waits for the writer; help it along rather than spin.
+	while (tb->head - tb->tail == STACK_LOGGING_THREAD_BUFFER_EVENTS) {
+		drain_thread_buffers(self_thread);
+		if (tb->head - tb->tail == STACK_LOGGING_THREAD_BUFFER_EVENTS) {
+			yield();
+		}
+	}
+
+	// The sequence number is stored even without a stack, so that the events
+	// after it are not held up.
+	entry = &tb->entries[tb->head % STACK_LOGGING_THREAD_BUFFER_EVENTS];
+	entry->sequence = sequence;
+	entry->event.address = STACK_LOGGING_DISGUISE(address);
+	entry->event.argument = size;
+	entry->event.offset_and_flags = (uniqueStackIdentifier == __invalid_stack_id) ? 0 :
+			STACK_LOGGING_OFFSET_AND_FLAGS(uniqueStackIdentifier, type_flags);
+	OSMemoryBarrier();
+	tb->head++;
+
+	// The barrier orders the store above against reading the writer's flag,
+	// as the writer orders setting it against reading the rings.
+	OSMemoryBarrier();
+	if (!thread_buffer_writer_pending &&
+			(thread_buffer_writer_asleep || tb->head - tb->tail >= STACK_LOGGING_WRITER_WATERMARK)) {
+		thread_buffer_writer_wake();
+	}
+	tb->logging = false;
+}
+
 void
 __disk_stack_logging_log_stack(uint32_t type_flags,
 		uintptr_t zone_ptr,
@@ -1293,6 +2334,13 @@ __disk_stack_logging_log_stack(uint32_t type_flags,
 		return;
 	}
 
+	if (thread_buffers_enabled && stack_logging_mode != stack_logging_mode_lite) {
+		log_stack_to_thread_buffer(self_thread, type_flags,
+				(type_flags & stack_logging_type_alloc || type_flags & stack_logging_type_vm_allocate) ? return_val : ptr_arg, size,
+				num_hot_to_skip);
+		return;
+	}
+
 	// lock and enter
 	_malloc_lock_lock(&stack_logging_lock);
 
@@ -1319,6 +2367,9 @@ __disk_stack_logging_log_stack(uint32_t type_flags,
 		// Only do this second stage of setup when we first record a malloc (as opposed to a VM allocation),
 		// to ensure that the malloc zone has already been created as is necessary for this.
 		__prepare_to_log_stacks_stage2();
+		if (stack_logging_thread_buffers && !thread_buffers_enabled) {
+			start_thread_buffers_while_locked();
+		}
 	}
 
 	// compaction
@@ -1359,31 +2410,15 @@ __disk_stack_logging_log_stack(uint32_t type_flags,
 	}
 
 	stack_logging_index_event current_index;
-	if (type_flags & stack_logging_type_alloc || type_flags & stack_logging_type_vm_allocate) {
-		current_index.address = STACK_LOGGING_DISGUISE(return_val);
-		current_index.argument = size;
-		if (logging_use_compaction) {
-			last_logged_malloc_address = current_index.address; // disguised
-		}
-	} else {
-		current_index.address = STACK_LOGGING_DISGUISE(ptr_arg);
-		current_index.argument = size;
-		last_logged_malloc_address = 0ul;
-	}
+	current_index.address = STACK_LOGGING_DISGUISE((type_flags & stack_logging_type_alloc || type_flags & stack_logging_type_vm_allocate) ?
+			return_val : ptr_arg);
+	current_index.argument = size;
 	current_index.offset_and_flags = STACK_LOGGING_OFFSET_AND_FLAGS(uniqueStackIdentifier, type_flags);
 
 	//	the following line is a good debugging tool for logging each allocation event as it happens.
 	//	malloc_printf("{0x%lx, %lld}\n", STACK_LOGGING_DISGUISE(current_index.address), uniqueStackIdentifier);
 
-	// flush the data buffer to disk if necessary
-	if (pre_write_buffers->next_free_index_buffer_offset + sizeof(stack_logging_index_event) >= STACK_LOGGING_BLOCK_WRITING_SIZE) {
-		flush_data();
-	}
-
-	// store bytes in buffers
-	memcpy(pre_write_buffers->index_buffer + pre_write_buffers->next_free_index_buffer_offset, &current_index,
-			sizeof(stack_logging_index_event));
-	pre_write_buffers->next_free_index_buffer_offset += (uint32_t)sizeof(stack_logging_index_event);
+	log_index_event_while_locked(&current_index);
 
 out:
 	thread_doing_logging = 0;
@@ -1408,6 +2443,14 @@ __stack_logging_fork_child(void)
 	malloc_logger = NULL;
 	stack_logging_enable_logging = 0;
 	_malloc_lock_init(&stack_logging_lock);
+
+	// The writer thread is not carried over; buffering starts afresh if
+	// logging is turned back on.
+	thread_buffers_enabled = false;
+	thread_buffers = NULL;
+	thread_buffer_sequence = thread_buffer_next_sequence = 0;
+	thread_buffer_writer_asleep = thread_buffer_writer_pending = false;
+	uniquing_table_inserters = 0;
 }
 
 void
@@ -1441,8 +2484,8 @@ __stack_logging_locked(void)
  * stack_frames_buffer, uint32_t max_stack_frames, uint32_t *num_frames);
  * //  Gets the last allocation record about address
  *
- * if !address, will load index and iterate through (expensive)
- * else will load just index, search for stack, and then use third function here to retrieve. (also expensive)
+ * if !address, will decode every block of the index
+ * else will decode just the blocks whose address filters may hold address (see stack_logging_index_block_header).
  * extern kern_return_t __mach_stack_logging_enumerate_records(task_t task, mach_vm_address_t address, void
  * enumerator(mach_stack_logging_record_t, void *), void *context);
  * // Applies enumerator to all records involving address sending context as enumerator's second parameter; if !address, applies
@@ -1586,131 +2629,219 @@ unwind_stack_from_table_index(backtrace_uniquing_table *uniquing_table,
 
 #pragma mark - caching
 
-__attribute__((always_inline)) static inline size_t
-hash_index(uint64_t address, size_t max_pos)
+// Kudos to Daniel Delwood for this function.  This is called in an analysis tool process
+// to share a VM region from a target process, without the target process needing to explicitly
+// share the region itself via shm_open().  The VM_FLAGS_RETURN_DATA_ADDR flag is necessary
+// for iOS in case the target process uses a different VM page size than the analysis tool process.
+static mach_vm_address_t
+map_shared_memory_from_task(task_t sourceTask, mach_vm_address_t sourceAddress, mach_vm_size_t sourceSize)
 {
-	return (size_t)((address >> 2) % (max_pos - 1)); // simplicity rules.
+#if TARGET_OS_EMBEDDED
+	int mapRequestFlags = VM_FLAGS_ANYWHERE | VM_FLAGS_RETURN_DATA_ADDR;
+	mach_vm_address_t mapRequestAddress = sourceAddress;
+	mach_vm_size_t mapRequestSize = sourceSize;
+#else
+	// Sadly, VM_FLAGS_RETURN_DATA_ADDR isn't available to us; align everything manually.
+	int mapRequestFlags = VM_FLAGS_ANYWHERE;
+	mach_vm_address_t mapRequestAddress = trunc_page(sourceAddress);
+	mach_vm_size_t mapRequestSize = round_page(sourceAddress + sourceSize) - mapRequestAddress;
+#endif
+	mach_vm_address_t mappedAddress = 0;
+	vm_prot_t outCurrentProt = VM_PROT_NONE;
+	vm_prot_t outMaxProt = VM_PROT_NONE;
+	kern_return_t err = mach_vm_remap(mach_task_self(), &mappedAddress, mapRequestSize, 0, mapRequestFlags, sourceTask,
+			mapRequestAddress, false, &outCurrentProt, &outMaxProt, VM_INHERIT_NONE);
+	if (err != KERN_SUCCESS) {
+		return 0;
+	}
+	return mappedAddress + (sourceAddress - mapRequestAddress);
 }
 
-__attribute__((always_inline)) static inline size_t
-hash_multiplier(size_t capacity, uint32_t allowed_collisions)
+// Makes room for one more element at the end of a malloced array.
+static bool
+remote_index_reserve(void **array, uint64_t count, uint64_t *capacity, size_t element_size)
 {
-	return (capacity / (allowed_collisions * 2 + 1));
+	if (count == *capacity) {
+		uint64_t new_capacity = MAX(*capacity * 2, 64);
+		void *new_array = realloc(*array, (size_t)new_capacity * element_size);
+		if (!new_array) {
+			return false;
+		}
+		*array = new_array;
+		*capacity = new_capacity;
+	}
+	return true;
 }
 
-__attribute__((always_inline)) static inline size_t
-next_hash(size_t hash, size_t multiplier, size_t capacity, uint32_t collisions)
-{
-	hash += multiplier * collisions;
-	if (hash >= capacity) {
-		hash -= capacity;
+// Maps the index file up to 'index_end' and adds the blocks and group records
+// written since the last update to the cache's directory, following their
+// headers forward from the end of the last whole block. A block that runs
+// past 'index_end' or lacks its end magic ends the walk; it is either still
+// being written or was cut short when the target died, and the blocks before
+// it stand on their own.
+static kern_return_t
+map_index_blocks(remote_index_cache *cache, int fd, uint64_t index_end)
+{
+	stack_logging_index_header header;
+	stack_logging_index_block_header block_header;
+	uint32_t end_magic;
+	uint64_t position = MAX(cache->index_size, (uint64_t)sizeof(header));
+	uint64_t block_size, i;
+	remote_index_block *block;
+	remote_index_group *group;
+
+	const uint8_t *map = mmap(NULL, (size_t)index_end, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "error while attempting to map remote stack index file (%d): %s\n", errno, strerror(errno));
+		return KERN_FAILURE;
 	}
-	return hash;
-}
 
-static void
-transfer_node(remote_index_cache *cache, remote_index_node *old_node)
-{
-	uint32_t collisions = 0;
-	size_t pos = hash_index(old_node->address, cache->cache_node_capacity);
-	size_t multiplier = hash_multiplier(cache->cache_node_capacity, cache->collision_allowance);
-	do {
-		if (cache->table_memory[pos].address == old_node->address) { // hit like this shouldn't happen.
-			fprintf(stderr, "impossible collision! two address==address lists! (transfer_node)\n");
+	if (index_end >= sizeof(header)) {
+		memcpy(&header, map, sizeof(header));
+	}
+	if (index_end < sizeof(header) || header.magic != STACK_LOGGING_INDEX_MAGIC || header.version != STACK_LOGGING_INDEX_VERSION) {
+		fprintf(stderr, "remote stack index file is not in a format this reader understands.\n");
+		munmap((void *)map, (size_t)index_end);
+		return KERN_FAILURE;
+	}
+
+	while (index_end - position >= sizeof(block_header) + sizeof(end_magic)) {
+		memcpy(&block_header, map + position, sizeof(block_header));
+		block_size = sizeof(block_header) + (uint64_t)block_header.records_size + block_header.filter_size + sizeof(end_magic);
+		if ((block_header.magic != STACK_LOGGING_INDEX_BLOCK_MAGIC && block_header.magic != STACK_LOGGING_INDEX_GROUP_MAGIC) ||
+				block_size > index_end - position) {
 			break;
-		} else if (cache->table_memory[pos].address == 0) { // empty
-			cache->table_memory[pos] = *old_node;
+		}
+		memcpy(&end_magic, map + position + block_size - sizeof(end_magic), sizeof(end_magic));
+		if (end_magic != STACK_LOGGING_INDEX_END_MAGIC) {
 			break;
+		}
+
+		if (block_header.magic == STACK_LOGGING_INDEX_BLOCK_MAGIC) {
+			if (!remote_index_reserve((void **)&cache->blocks, cache->block_count, &cache->block_capacity, sizeof(remote_index_block))) {
+				munmap((void *)map, (size_t)index_end);
+				return KERN_NO_SPACE;
+			}
+			block = &cache->blocks[cache->block_count++];
+			block->offset = position + sizeof(block_header);
+			block->records_size = block_header.records_size;
+			block->filter_size = block_header.filter_size;
+			block->event_count = block_header.event_count;
+			block->group = REMOTE_INDEX_NO_GROUP;
+			block->min_address = block_header.min_address;
+			block->max_address = block_header.max_address;
 		} else {
-			collisions++;
-			pos = next_hash(pos, multiplier, cache->cache_node_capacity, collisions);
+			if (!remote_index_reserve((void **)&cache->groups, cache->group_count, &cache->group_capacity, sizeof(remote_index_group))) {
+				munmap((void *)map, (size_t)index_end);
+				return KERN_NO_SPACE;
+			}
+			group = &cache->groups[cache->group_count];
+			group->filter_offset = position + sizeof(block_header);
+			group->filter_size = block_header.filter_size;
+			group->first_block = cache->first_ungrouped_block;
+			group->end_block = cache->block_count;
+			group->min_address = block_header.min_address;
+			group->max_address = block_header.max_address;
+			for (i = group->first_block; i < group->end_block; i++) {
+				cache->blocks[i].group = cache->group_count;
+			}
+			cache->group_count++;
+			cache->first_ungrouped_block = cache->block_count;
 		}
-	} while (collisions <= cache->collision_allowance);
+		position += block_size;
+	}
 
-	if (collisions > cache->collision_allowance) {
-		fprintf(stderr, "reporting bad hash function! disk stack logging reader %lu bit. (transfer_node)\n", sizeof(void *) * 8);
+	if (cache->index_map) {
+		munmap((void *)cache->index_map, (size_t)cache->map_size);
 	}
+	cache->index_map = map;
+	cache->map_size = index_end;
+	cache->index_size = position;
+	return KERN_SUCCESS;
 }
 
-static void
-expand_cache(remote_index_cache *cache)
+// Maps an index file of raw records up to 'index_end' and lays them out in
+// the cache's directory as blocks of STACK_LOGGING_INDEX_MAX_EVENTS records,
+// with no filters and no address ranges to pass over them by. The last
+// block of the update before may have been short, so it is laid out again.
+static kern_return_t
+map_index_records(remote_index_cache *cache, int fd, uint64_t index_end)
 {
-	// keep old stats
-	size_t old_node_capacity = cache->cache_node_capacity;
-	remote_index_node *old_table = cache->table_memory;
+	uint64_t record_count = index_end / cache->raw_record_size;
+	uint64_t first;
+	remote_index_block *block;
 
-	// double size
-	cache->cache_size <<= 2;
-	cache->cache_node_capacity <<= 2;
-	cache->collision_allowance += 3;
-	cache->table_memory = (void *)calloc(cache->cache_node_capacity, sizeof(remote_index_node));
+	const uint8_t *map = mmap(NULL, (size_t)index_end, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "error while attempting to map remote stack index file (%d): %s\n", errno, strerror(errno));
+		return KERN_FAILURE;
+	}
 
-	// repopulate (expensive!)
-	size_t i;
-	for (i = 0; i < old_node_capacity; i++) {
-		if (old_table[i].address) {
-			transfer_node(cache, &old_table[i]);
+	if (cache->block_count) {
+		cache->block_count--;
+	}
+	for (first = cache->block_count * STACK_LOGGING_INDEX_MAX_EVENTS; first < record_count; first += STACK_LOGGING_INDEX_MAX_EVENTS) {
+		if (!remote_index_reserve((void **)&cache->blocks, cache->block_count, &cache->block_capacity, sizeof(remote_index_block))) {
+			munmap((void *)map, (size_t)index_end);
+			return KERN_NO_SPACE;
 		}
+		block = &cache->blocks[cache->block_count++];
+		block->offset = first * cache->raw_record_size;
+		block->event_count = (uint32_t)MIN((uint64_t)STACK_LOGGING_INDEX_MAX_EVENTS, record_count - first);
+		block->records_size = block->event_count * cache->raw_record_size;
+		block->filter_size = 0;
+		block->group = REMOTE_INDEX_NO_GROUP;
+		block->min_address = 0;
+		block->max_address = UINT64_MAX;
+	}
+
+	if (cache->index_map) {
+		munmap((void *)cache->index_map, (size_t)cache->map_size);
 	}
-	free(old_table);
-	//	printf("cache expanded to %0.2f mb (eff: %3.0f%%, capacity: %lu, nodes: %llu, llnodes: %llu)\n",
-	//((float)(cache->cache_size))/(1 << 20), ((float)(cache->cache_node_count)*100.0)/((float)(cache->cache_node_capacity)),
-	// cache->cache_node_capacity, cache->cache_node_count, cache->cache_llnode_count);
+	cache->index_map = map;
+	cache->map_size = index_end;
+	cache->index_size = index_end;
+	return KERN_SUCCESS;
 }
 
-static void
-insert_node(remote_index_cache *cache, uint64_t address, uint64_t index_file_offset)
+// The size of the records of the target's index file if it has no header,
+// as those written by libmalloc before there were blocks, or 0. An empty file
+// is taken to be one whose header is still to come.
+static uint32_t
+raw_index_record_size(remote_task_file_streams *descriptors)
 {
-	uint32_t collisions = 0;
-	size_t pos = hash_index(address, cache->cache_node_capacity);
-	size_t multiplier = hash_multiplier(cache->cache_node_capacity, cache->collision_allowance);
+	uint32_t magic = STACK_LOGGING_INDEX_MAGIC;
+	stack_logging_index_header header;
+	ssize_t length;
 
-	while (1) {
-		if (cache->table_memory[pos].address == 0ull || cache->table_memory[pos].address == address) { // hit or empty
-			cache->table_memory[pos].address = address;
-			cache->table_memory[pos].index_file_offset = index_file_offset;
-			// Inserted it!  Break out of the loop.
-			break;
-		}
-
-		collisions++;
-		pos = next_hash(pos, multiplier, cache->cache_node_capacity, collisions);
-
-		if (collisions > cache->collision_allowance) {
-			expand_cache(cache);
-			pos = hash_index(address, cache->cache_node_capacity);
-			multiplier = hash_multiplier(cache->cache_node_capacity, cache->collision_allowance);
-			collisions = 0;
-		}
+	if (!descriptors->index_file_stream) {
+		return 0;
 	}
+	length = pread(fileno(descriptors->index_file_stream), &header, sizeof(header), 0);
+	if (length <= 0 || !memcmp(&header, &magic, MIN((size_t)length, sizeof(magic)))) {
+		return 0;
+	}
+	return descriptors->task_is_64_bit ? sizeof(stack_logging_index_event64) : sizeof(stack_logging_index_event32);
 }
 
-// Kudos to Daniel Delwood for this function.  This is called in an analysis tool process
-// to share a VM region from a target process, without the target process needing to explicitly
-// share the region itself via shm_open().  The VM_FLAGS_RETURN_DATA_ADDR flag is necessary
-// for iOS in case the target process uses a different VM page size than the analysis tool process.
-static mach_vm_address_t
-map_shared_memory_from_task(task_t sourceTask, mach_vm_address_t sourceAddress, mach_vm_size_t sourceSize)
+// Copies the target's shared memory, in whichever layout it has, into the
+// cache's snapshot.
+static void
+snapshot_shared_memory(remote_index_cache *cache)
 {
-#if TARGET_OS_EMBEDDED
-	int mapRequestFlags = VM_FLAGS_ANYWHERE | VM_FLAGS_RETURN_DATA_ADDR;
-	mach_vm_address_t mapRequestAddress = sourceAddress;
-	mach_vm_size_t mapRequestSize = sourceSize;
-#else
-	// Sadly, VM_FLAGS_RETURN_DATA_ADDR isn't available to us; align everything manually.
-	int mapRequestFlags = VM_FLAGS_ANYWHERE;
-	mach_vm_address_t mapRequestAddress = trunc_page(sourceAddress);
-	mach_vm_size_t mapRequestSize = round_page(sourceAddress + sourceSize) - mapRequestAddress;
-#endif
-	mach_vm_address_t mappedAddress = 0;
-	vm_prot_t outCurrentProt = VM_PROT_NONE;
-	vm_prot_t outMaxProt = VM_PROT_NONE;
-	kern_return_t err = mach_vm_remap(mach_task_self(), &mappedAddress, mapRequestSize, 0, mapRequestFlags, sourceTask,
-			mapRequestAddress, false, &outCurrentProt, &outMaxProt, VM_INHERIT_NONE);
-	if (err != KERN_SUCCESS) {
-		return 0;
+	stack_buffer_shared_memory_raw *raw = cache->raw_shmem;
+
+	if (cache->shmem) {
+		memcpy(&cache->snapshot, cache->shmem, sizeof(stack_buffer_shared_memory));
+	} else if (raw) {
+		cache->snapshot.start_index_offset = raw->start_index_offset;
+		cache->snapshot.next_free_index_buffer_offset = MIN(raw->next_free_index_buffer_offset, (uint32_t)sizeof(raw->index_buffer));
+		memcpy(cache->snapshot.index_buffer, raw->index_buffer, cache->snapshot.next_free_index_buffer_offset);
+		cache->snapshot.uniquing_table = raw->uniquing_table;
+		cache->snapshot.vm_stackid_table = raw->vm_stackid_table;
+		cache->snapshot.vm_stackid_table_size = raw->vm_stackid_table_size;
+		cache->snapshot.sample_interval = 0;
 	}
-	return mappedAddress + (sourceAddress - mapRequestAddress);
 }
 
 static kern_return_t
@@ -1721,15 +2852,16 @@ update_cache_for_file_streams(remote_task_file_streams *descriptors)
 	// create from scratch if necessary.
 	if (!cache) {
 		descriptors->cache = cache = (remote_index_cache *)calloc((size_t)1, sizeof(remote_index_cache));
-		cache->cache_node_capacity = 1 << 14;
-		cache->collision_allowance = 17;
-		cache->last_index_file_offset = 0;
-		cache->cache_size = cache->cache_node_capacity * sizeof(remote_index_node);
-		cache->table_memory = (void *)calloc(cache->cache_node_capacity, sizeof(remote_index_node));
-
-		cache->shmem = (stack_buffer_shared_memory *)map_shared_memory_from_task(descriptors->remote_task,
-				descriptors->remote_stack_buffer_shared_memory_address, sizeof(stack_buffer_shared_memory));
-		if (!cache->shmem) {
+
+		cache->raw_record_size = raw_index_record_size(descriptors);
+		if (cache->raw_record_size) {
+			cache->raw_shmem = (stack_buffer_shared_memory_raw *)map_shared_memory_from_task(descriptors->remote_task,
+					descriptors->remote_stack_buffer_shared_memory_address, sizeof(stack_buffer_shared_memory_raw));
+		} else {
+			cache->shmem = (stack_buffer_shared_memory *)map_shared_memory_from_task(descriptors->remote_task,
+					descriptors->remote_stack_buffer_shared_memory_address, sizeof(stack_buffer_shared_memory));
+		}
+		if (!cache->shmem && !cache->raw_shmem) {
 			// failed to connect to the shared memory region; warn and continue.
 			_malloc_printf(ASL_LEVEL_INFO,
 					"warning: unable to map shared memory from %llx in target process %d; no stack backtraces will be available.\n",
@@ -1737,21 +2869,25 @@ update_cache_for_file_streams(remote_task_file_streams *descriptors)
 		}
 		cache->lite_mode = descriptors->task_uses_lite_mode;
 
-		if (cache->shmem && cache->shmem->vm_stackid_table) {
-			cache->vm_stackid_table = (struct radix_tree *)map_shared_memory_from_task(
-				descriptors->remote_task, (mach_vm_address_t) cache->shmem->vm_stackid_table, cache->shmem->vm_stackid_table_size);
+		if ((cache->shmem || cache->raw_shmem) && REMOTE_SHARED_MEMORY_FIELD(cache, vm_stackid_table)) {
+			cache->vm_stackid_table = (struct radix_tree *)map_shared_memory_from_task(descriptors->remote_task,
+					(mach_vm_address_t)REMOTE_SHARED_MEMORY_FIELD(cache, vm_stackid_table),
+					REMOTE_SHARED_MEMORY_FIELD(cache, vm_stackid_table_size));
 			if (!cache->vm_stackid_table) {
 				_malloc_printf(ASL_LEVEL_INFO,
 							   "warning: unable to map vm_stackid table from %llx in target process %d; no VM stack backtraces will be available.\n",
-							   (mach_vm_address_t) cache->shmem->vm_stackid_table, descriptors->remote_pid);
+							   (mach_vm_address_t)REMOTE_SHARED_MEMORY_FIELD(cache, vm_stackid_table), descriptors->remote_pid);
 			}
 		}
 	}
 
-	// suspend and see how much updating there is to do. there are three scenarios, listed below
+	// suspend and see how much updating there is to do.
 	bool update_snapshot = false;
 	if (descriptors->remote_task != mach_task_self()) {
 		task_suspend(descriptors->remote_task);
+	} else {
+		// our own events may still be waiting in thread buffers
+		__stack_logging_drain_thread_buffers();
 	}
 
 	struct stat file_statistics;
@@ -1761,33 +2897,10 @@ update_cache_for_file_streams(remote_task_file_streams *descriptors)
 	} else {
 		file_statistics.st_size = 0;
 	}
-		
-	size_t read_size = (descriptors->task_is_64_bit ? sizeof(stack_logging_index_event64) : sizeof(stack_logging_index_event32));
-	uint64_t read_this_update = 0;
-
-	// the delta indecies is a complex number; there are three cases:
-	// 1. there is no shared memory (or we can't connect); diff the last_index_file_offset from the filesize.
-	// 2. the only updates have been in shared memory; disk file didn't change at all. delta_indecies should be zero, scan snapshot
-	// only.
-	// 3. the updates have flushed to disk, meaning that most likely there is new data on disk that wasn't read from shared memory.
-	//    correct delta_indecies for the pre-scanned amount and read the new data from disk and shmem.
-	uint64_t delta_indecies = (file_statistics.st_size - cache->last_index_file_offset) / read_size;
-	uint32_t last_snapshot_scan_index = 0;
-	if (delta_indecies && cache->shmem) {
-		// case 3: add cache scanned to known from disk and recalc
-		cache->last_index_file_offset += cache->snapshot.next_free_index_buffer_offset;
-		delta_indecies = (file_statistics.st_size - cache->last_index_file_offset) / read_size;
-		update_snapshot = true;
-	} else if (cache->shmem) {
-		// case 2: set the last snapshot scan count so we don't rescan something we've seen.
-		last_snapshot_scan_index = cache->snapshot.next_free_index_buffer_offset / (uint32_t)read_size;
-	}
 
-	// no update necessary for the file; check if need a snapshot.
-	if (delta_indecies == 0) {
-		if (cache->shmem && !update_snapshot) {
-			update_snapshot = (cache->shmem->next_free_index_buffer_offset != cache->snapshot.next_free_index_buffer_offset);
-		}
+	if (cache->shmem || cache->raw_shmem) {
+		update_snapshot = (REMOTE_SHARED_MEMORY_FIELD(cache, start_index_offset) != cache->snapshot.start_index_offset ||
+				REMOTE_SHARED_MEMORY_FIELD(cache, next_free_index_buffer_offset) != cache->snapshot.next_free_index_buffer_offset);
 	}
 
 	// need to update the snapshot if in lite mode and haven't yet read the uniquing table
@@ -1801,12 +2914,12 @@ update_cache_for_file_streams(remote_task_file_streams *descriptors)
 	// worry that the target was suspended with the lock taken.
 	kern_return_t err = KERN_SUCCESS;
 	if (update_snapshot) {
-		memcpy(&cache->snapshot, cache->shmem, sizeof(stack_buffer_shared_memory));
+		snapshot_shared_memory(cache);
 		// also need to update our version of the remote uniquing table
 		vm_address_t local_uniquing_address = 0ul;
 		mach_msg_type_number_t local_uniquing_size = 0;
 		mach_vm_size_t desired_size = round_page(sizeof(backtrace_uniquing_table));
-		if ((err = mach_vm_read(descriptors->remote_task, (mach_vm_address_t)cache->shmem->uniquing_table, desired_size,
+		if ((err = mach_vm_read(descriptors->remote_task, (mach_vm_address_t)cache->snapshot.uniquing_table, desired_size,
 					 &local_uniquing_address, &local_uniquing_size)) != KERN_SUCCESS ||
 				local_uniquing_size != desired_size) {
 			fprintf(stderr, "error while attempting to mach_vm_read remote stack uniquing table (%d): %s\n", err,
@@ -1849,75 +2962,27 @@ update_cache_for_file_streams(remote_task_file_streams *descriptors)
 		return err;
 	}
 
-	if (!update_snapshot && delta_indecies == 0) {
-		return KERN_SUCCESS; // absolutely no updating needed.
+	// The blocks end where the target process says it finished writing the
+	// last one, and events after that are still in its pre-write buffer.
+	// Without the shared memory, the block headers have to tell.
+	uint64_t index_end = (uint64_t)file_statistics.st_size;
+	if (cache->shmem || cache->raw_shmem) {
+		index_end = MIN(index_end, cache->snapshot.start_index_offset);
 	}
-	FILE *the_index = (descriptors->index_file_stream);
-
-	// prepare for the read; target process could be 32 or 64 bit.
 
-	stack_logging_index_event32 *target_32_index = NULL;
-	stack_logging_index_event64 *target_64_index = NULL;
-
-	// perform the update from the file
-	uint32_t i;
-	if (delta_indecies) {
-		char bufferSpace[4096]; // 4 kb
-		target_32_index = (stack_logging_index_event32 *)bufferSpace;
-		target_64_index = (stack_logging_index_event64 *)bufferSpace;
-		size_t number_slots = (size_t)(4096 / read_size);
-
-		size_t read_count = 0;
-		if (fseeko(the_index, (off_t)(cache->last_index_file_offset), SEEK_SET)) {
-			fprintf(stderr,
-					"error while attempting to cache information from remote stack index file. (update_cache_for_file_streams)\n");
-		}
-		off_t current_index_position = cache->last_index_file_offset;
-		do {
-			number_slots = (size_t)MIN(delta_indecies - read_this_update, number_slots);
-			read_count = fread(bufferSpace, read_size, number_slots, the_index);
-			if (descriptors->task_is_64_bit) {
-				for (i = 0; i < read_count; i++) {
-					insert_node(cache, STACK_LOGGING_DISGUISE(target_64_index[i].address), (uint64_t)current_index_position);
-					read_this_update++;
-					current_index_position += read_size;
-				}
-			} else {
-				for (i = 0; i < read_count; i++) {
-					insert_node(cache, (mach_vm_address_t)STACK_LOGGING_DISGUISE(target_32_index[i].address),
-							(uint64_t)current_index_position);
-					read_this_update++;
-					current_index_position += read_size;
-				}
-			}
-		} while (read_count);
-
-		if (read_this_update < delta_indecies) {
-			fprintf(stderr, "insufficient data in remote stack index file; expected more records.\n");
+	// Only the headers of the blocks written since the last update are read;
+	// the blocks themselves are left to the page cache until someone asks.
+	// Raw records have no headers, and only whole ones are read.
+	if (cache->raw_record_size) {
+		index_end -= index_end % cache->raw_record_size;
+		if (index_end > cache->map_size) {
+			err = map_index_records(cache, fileno(descriptors->index_file_stream), index_end);
 		}
-		cache->last_index_file_offset += read_this_update * read_size;
+	} else if (index_end > cache->map_size) {
+		err = map_index_blocks(cache, fileno(descriptors->index_file_stream), index_end);
 	}
 
-	if (update_snapshot) {
-		target_32_index = (stack_logging_index_event32 *)(cache->snapshot.index_buffer);
-		target_64_index = (stack_logging_index_event64 *)(cache->snapshot.index_buffer);
-
-		uint32_t free_snapshot_scan_index = cache->snapshot.next_free_index_buffer_offset / (uint32_t)read_size;
-		off_t current_index_position = cache->snapshot.start_index_offset;
-		if (descriptors->task_is_64_bit) {
-			for (i = last_snapshot_scan_index; i < free_snapshot_scan_index; i++) {
-				insert_node(cache, STACK_LOGGING_DISGUISE(target_64_index[i].address),
-						(uint64_t)(current_index_position + (i * read_size)));
-			}
-		} else {
-			for (i = last_snapshot_scan_index; i < free_snapshot_scan_index; i++) {
-				insert_node(cache, (mach_vm_address_t)STACK_LOGGING_DISGUISE(target_32_index[i].address),
-						(uint64_t)(current_index_position + (i * read_size)));
-			}
-		}
-	}
-
-	return KERN_SUCCESS;
+	return err;
 }
 
 static void
@@ -1929,12 +2994,119 @@ destroy_cache_for_file_streams(remote_task_file_streams *descriptors)
 	if (descriptors->cache->shmem) {
 		munmap(descriptors->cache->shmem, sizeof(stack_buffer_shared_memory));
 	}
-	free(descriptors->cache->table_memory);
+	if (descriptors->cache->raw_shmem) {
+		munmap(descriptors->cache->raw_shmem, sizeof(stack_buffer_shared_memory_raw));
+	}
+	if (descriptors->cache->index_map) {
+		munmap((void *)descriptors->cache->index_map, (size_t)descriptors->cache->map_size);
+	}
+	free(descriptors->cache->blocks);
+	free(descriptors->cache->groups);
 	free_uniquing_table_chunks(&descriptors->cache->uniquing_table_snapshot);
 	free(descriptors->cache);
 	descriptors->cache = NULL;
 }
 
+// Whether the group record covering 'block' rules out events for the
+// (disguised) address in every block of the group. Costs a look at one filter
+// for the group, which otherwise would have been one for each block.
+static bool
+index_group_rules_out(remote_index_cache *cache, uint64_t block, uint64_t address)
+{
+	const remote_index_group *g;
+
+	if (cache->blocks[block].group == REMOTE_INDEX_NO_GROUP) {
+		return false;
+	}
+	g = &cache->groups[cache->blocks[block].group];
+	return address < g->min_address || address > g->max_address ||
+			!index_filter_may_contain(cache->index_map + g->filter_offset, g->filter_size, address);
+}
+
+// Reads the events of 'record_count' raw records, as the pre-write buffer
+// holds them, whose (disguised) address is 'address', or all of them.
+static uint32_t
+read_raw_index_events(const uint8_t *records, uint32_t record_count, bool is_64_bit, bool all_addresses, uint64_t address,
+		stack_logging_index_event64 *events)
+{
+	stack_logging_index_event32 event;
+	uint32_t i, count = 0;
+
+	for (i = 0; i < record_count && count < STACK_LOGGING_INDEX_MAX_EVENTS; i++) {
+		if (is_64_bit) {
+			memcpy(&events[count], records + i * sizeof(stack_logging_index_event64), sizeof(stack_logging_index_event64));
+		} else {
+			memcpy(&event, records + i * sizeof(event), sizeof(event));
+			events[count].address = event.address;
+			events[count].argument = event.argument;
+			events[count].offset_and_flags = event.offset_and_flags;
+		}
+		if (all_addresses || events[count].address == address) {
+			count++;
+		}
+	}
+	return count;
+}
+
+// Decodes the events of a block, or of the pre-write buffer snapshot, whose
+// (disguised) address is 'address', or all of them. Returns how many went
+// into 'events', which has room for STACK_LOGGING_INDEX_MAX_EVENTS. The
+// block's address range, held in the cache, and then its filter are checked
+// before any of its records are touched.
+static uint32_t
+read_index_block(remote_index_cache *cache, uint64_t block, bool all_addresses, uint64_t address, stack_logging_index_event64 *events)
+{
+	const remote_index_block *b = &cache->blocks[block];
+	const uint8_t *p = cache->index_map + b->offset;
+	const uint8_t *end = p + b->records_size;
+	uint64_t tags, argument, delta, event_address = 0, stack_id = 0;
+	uint32_t i, count = 0;
+
+	if (cache->raw_record_size) {
+		return read_raw_index_events(p, b->event_count, cache->raw_record_size == sizeof(stack_logging_index_event64),
+				all_addresses, address, events);
+	}
+	if (!all_addresses && (address < b->min_address || address > b->max_address ||
+			!index_filter_may_contain(end, b->filter_size, address))) {
+		return 0;
+	}
+	for (i = 0; i < b->event_count && count < STACK_LOGGING_INDEX_MAX_EVENTS; i++) {
+		if (!(p = index_read_varint(p, end, &tags)) || !(p = index_read_varint(p, end, &argument)) ||
+				!(p = index_read_varint(p, end, &delta))) {
+			break;
+		}
+		event_address += index_unzigzag(delta);
+		if (!(p = index_read_varint(p, end, &delta))) {
+			break;
+		}
+		stack_id += index_unzigzag(delta);
+		if (all_addresses || event_address == address) {
+			events[count].address = event_address;
+			events[count].argument = argument;
+			events[count].offset_and_flags = index_event_offset_and_flags(stack_id, tags);
+			count++;
+		}
+	}
+	if (i < b->event_count) {
+		fprintf(stderr, "truncated block in remote stack index file at offset %llu.\n", b->offset);
+	}
+	return count;
+}
+
+static uint32_t
+read_index_snapshot(remote_task_file_streams *descriptors, bool all_addresses, uint64_t address, stack_logging_index_event64 *events)
+{
+	remote_index_cache *cache = descriptors->cache;
+	size_t read_size = (descriptors->task_is_64_bit ? sizeof(stack_logging_index_event64) : sizeof(stack_logging_index_event32));
+
+	if (!cache->shmem && !cache->raw_shmem) {
+		return 0;
+	}
+	return read_raw_index_events((const uint8_t *)cache->snapshot.index_buffer,
+			cache->snapshot.next_free_index_buffer_offset / (uint32_t)read_size, descriptors->task_is_64_bit, all_addresses,
+			address, events);
+}
+
 #pragma mark - internal
 
 static FILE *
@@ -2289,69 +3461,31 @@ __mach_stack_logging_get_frames(task_t task,
 		return err;
 	}
 
-	uint32_t collisions = 0;
-	size_t hash = hash_index(address, remote_fd->cache->cache_node_capacity);
-	size_t multiplier = hash_multiplier(remote_fd->cache->cache_node_capacity, remote_fd->cache->collision_allowance);
-	uint64_t located_file_position = 0;
-
+	// The last event for the address is the one that counts: the newest events
+	// are those not yet written out, then the blocks newest first, decoding
+	// only those whose filters may hold the address, and passing over whole
+	// groups of blocks whose group records rule it out.
+	stack_logging_index_event64 *events = malloc(STACK_LOGGING_INDEX_MAX_EVENTS * sizeof(stack_logging_index_event64));
+	uint64_t target_address = STACK_LOGGING_DISGUISE((uint64_t)address);
+	uint64_t stack_identifier = 0;
+	uint64_t block;
+	uint32_t event_count;
 	bool found = false;
-	do {
-		if (remote_fd->cache->table_memory[hash].address == address) { // hit!
-			located_file_position = remote_fd->cache->table_memory[hash].index_file_offset;
-			found = true;
-			break;
-		} else if (remote_fd->cache->table_memory[hash].address == 0ull) { // failure!
-			break;
-		}
-
-		collisions++;
-		hash = next_hash(hash, multiplier, remote_fd->cache->cache_node_capacity, collisions);
-
-	} while (collisions <= remote_fd->cache->collision_allowance);
-
-	if (found) {
-		// prepare for the read; target process could be 32 or 64 bit.
-		stack_logging_index_event32 *target_32_index = NULL;
-		stack_logging_index_event64 *target_64_index = NULL;
-
-		if (located_file_position >= remote_fd->cache->last_index_file_offset) {
-			// must be in shared memory
-			if (remote_fd->cache->shmem) {
-				if (remote_fd->task_is_64_bit) {
-					target_64_index = (stack_logging_index_event64 *)(remote_fd->cache->snapshot.index_buffer +
-																	  (located_file_position -
-																			  remote_fd->cache->snapshot.start_index_offset));
-					located_file_position = STACK_LOGGING_OFFSET(target_64_index->offset_and_flags);
-				} else {
-					target_32_index = (stack_logging_index_event32 *)(remote_fd->cache->snapshot.index_buffer +
-																	  (located_file_position -
-																			  remote_fd->cache->snapshot.start_index_offset));
-					located_file_position = STACK_LOGGING_OFFSET(target_32_index->offset_and_flags);
-				}
-			} else {
-				found = false;
-			}
 
-		} else {
-			// it's written to disk
-			char bufferSpace[128];
-
-			size_t read_size =
-					(remote_fd->task_is_64_bit ? sizeof(stack_logging_index_event64) : sizeof(stack_logging_index_event32));
-			fseeko(remote_fd->index_file_stream, (off_t)located_file_position, SEEK_SET);
-			size_t read_count = fread(bufferSpace, read_size, (size_t)1, remote_fd->index_file_stream);
-			if (read_count) {
-				if (remote_fd->task_is_64_bit) {
-					target_64_index = (stack_logging_index_event64 *)bufferSpace;
-					located_file_position = STACK_LOGGING_OFFSET(target_64_index->offset_and_flags);
-				} else {
-					target_32_index = (stack_logging_index_event32 *)bufferSpace;
-					located_file_position = STACK_LOGGING_OFFSET(target_32_index->offset_and_flags);
-				}
-			} else {
-				found = false;
+	if (events) {
+		event_count = read_index_snapshot(remote_fd, false, target_address, events);
+		for (block = remote_fd->cache->block_count; !event_count && block-- > 0;) {
+			if (index_group_rules_out(remote_fd->cache, block, target_address)) {
+				block = remote_fd->cache->groups[remote_fd->cache->blocks[block].group].first_block;
+				continue;
 			}
+			event_count = read_index_block(remote_fd->cache, block, false, target_address, events);
 		}
+		if (event_count) {
+			stack_identifier = STACK_LOGGING_OFFSET(events[event_count - 1].offset_and_flags);
+			found = true;
+		}
+		free(events);
 	}
 
 	release_file_streams_for_task(task);
@@ -2360,7 +3494,7 @@ __mach_stack_logging_get_frames(task_t task,
 		return KERN_FAILURE;
 	}
 
-	return __mach_stack_logging_get_frames_for_stackid(task, located_file_position, stack_frames_buffer, max_stack_frames, count, NULL);
+	return __mach_stack_logging_get_frames_for_stackid(task, stack_identifier, stack_frames_buffer, max_stack_frames, count, NULL);
 }
 
 kern_return_t
@@ -2385,73 +3519,39 @@ __mach_stack_logging_enumerate_records(task_t task,
 		return err;
 	}
 
-	FILE *the_index = (remote_fd->index_file_stream);
+	// Each block is decoded before its events are passed on, since the
+	// enumerator may well update the cache, and remap the file, itself.
+	stack_logging_index_event64 *events = malloc(STACK_LOGGING_INDEX_MAX_EVENTS * sizeof(stack_logging_index_event64));
+	uint64_t target_address = STACK_LOGGING_DISGUISE((uint64_t)address);
+	uint64_t block_count = remote_fd->cache->block_count;
+	uint64_t block;
+	uint32_t event_count, i;
 
-	// prepare for the read; target process could be 32 or 64 bit.
-	char bufferSpace[2048]; // 2 kb
-	stack_logging_index_event32 *target_32_index = (stack_logging_index_event32 *)bufferSpace;
-	stack_logging_index_event64 *target_64_index = (stack_logging_index_event64 *)bufferSpace;
-	uint32_t target_addr_32 = (uint32_t)STACK_LOGGING_DISGUISE((uint32_t)address);
-	uint64_t target_addr_64 = STACK_LOGGING_DISGUISE((uint64_t)address);
-	size_t read_size = (remote_fd->task_is_64_bit ? sizeof(stack_logging_index_event64) : sizeof(stack_logging_index_event32));
-	size_t number_slots = (size_t)(2048 / read_size);
-	uint64_t total_slots = remote_fd->cache->last_index_file_offset / read_size;
+	if (!events) {
+		release_file_streams_for_task(task);
+		return KERN_NO_SPACE;
+	}
 
-	// perform the search
-	size_t read_count = 0;
-	int64_t current_file_offset = 0;
-	uint32_t i;
-	do {
-		// at this point, we need to read index events; read them from the file until it's necessary to grab them from the shared
-		// memory snapshot
-		// and crop file reading to the point where we last scanned
-		number_slots = (size_t)MIN(number_slots, total_slots);
-
-		// if out of file to read (as of the time we entered this function), try to use shared memory snapshot
-		if (number_slots == 0) {
-			if (remote_fd->cache->shmem &&
-					remote_fd->cache->snapshot.start_index_offset + remote_fd->cache->snapshot.next_free_index_buffer_offset >
-							(uint64_t)current_file_offset) {
-				// use shared memory
-				target_32_index = (stack_logging_index_event32 *)remote_fd->cache->snapshot.index_buffer;
-				target_64_index = (stack_logging_index_event64 *)remote_fd->cache->snapshot.index_buffer;
-				read_count = (uint32_t)(remote_fd->cache->snapshot.start_index_offset +
-										remote_fd->cache->snapshot.next_free_index_buffer_offset - current_file_offset) /
-							 read_size;
-				current_file_offset += read_count * read_size;
-			} else {
-				break;
-			}
-		} else {
-			// get and save index (enumerator could modify)
-			fseeko(the_index, current_file_offset, SEEK_SET);
-			read_count = fread(bufferSpace, read_size, number_slots, the_index);
-			current_file_offset = ftello(the_index);
-			total_slots -= read_count;
-		}
-
-		if (remote_fd->task_is_64_bit) {
-			for (i = 0; i < read_count; i++) {
-				if (reading_all_addresses || target_64_index[i].address == target_addr_64) {
-					pass_record.address = STACK_LOGGING_DISGUISE(target_64_index[i].address);
-					pass_record.argument = target_64_index[i].argument;
-					pass_record.stack_identifier = STACK_LOGGING_OFFSET(target_64_index[i].offset_and_flags);
-					pass_record.type_flags = STACK_LOGGING_FLAGS_AND_USER_TAG(target_64_index[i].offset_and_flags);
-					enumerator(pass_record, context);
-				}
+	// the blocks, oldest first, then whatever the target has yet to write out
+	for (block = 0; block <= block_count; block++) {
+		if (block < block_count) {
+			if (!reading_all_addresses && index_group_rules_out(remote_fd->cache, block, target_address)) {
+				block = remote_fd->cache->groups[remote_fd->cache->blocks[block].group].end_block - 1;
+				continue;
 			}
+			event_count = read_index_block(remote_fd->cache, block, reading_all_addresses, target_address, events);
 		} else {
-			for (i = 0; i < read_count; i++) {
-				if (reading_all_addresses || target_32_index[i].address == target_addr_32) {
-					pass_record.address = STACK_LOGGING_DISGUISE(target_32_index[i].address);
-					pass_record.argument = target_32_index[i].argument;
-					pass_record.stack_identifier = STACK_LOGGING_OFFSET(target_32_index[i].offset_and_flags);
-					pass_record.type_flags = STACK_LOGGING_FLAGS_AND_USER_TAG(target_32_index[i].offset_and_flags);
-					enumerator(pass_record, context);
-				}
-			}
+			event_count = read_index_snapshot(remote_fd, reading_all_addresses, target_address, events);
 		}
-	} while (read_count);
+		for (i = 0; i < event_count; i++) {
+			pass_record.address = STACK_LOGGING_DISGUISE(events[i].address);
+			pass_record.argument = events[i].argument;
+			pass_record.stack_identifier = STACK_LOGGING_OFFSET(events[i].offset_and_flags);
+			pass_record.type_flags = STACK_LOGGING_FLAGS_AND_USER_TAG(events[i].offset_and_flags);
+			enumerator(pass_record, context);
+		}
+	}
+	free(events);
 
 	release_file_streams_for_task(task);
 	return err;
@@ -2481,6 +3581,26 @@ __mach_stack_logging_stackid_for_vm_region(task_t task, mach_vm_address_t addres
 	return stackid;
 }
 
+kern_return_t
+__mach_stack_logging_get_sample_interval(task_t task, uint64_t *sample_interval)
+{
+	remote_task_file_streams *remote_fd = retain_file_streams_for_task(task, 0);
+	if (remote_fd == NULL) {
+		return KERN_FAILURE;
+	}
+
+	kern_return_t err = update_cache_for_file_streams(remote_fd);
+	if (err != KERN_SUCCESS) {
+		release_file_streams_for_task(task);
+		return err;
+	}
+
+	*sample_interval = remote_fd->cache->shmem ? remote_fd->cache->shmem->sample_interval : 0;
+
+	release_file_streams_for_task(task);
+	return KERN_SUCCESS;
+}
+
 kern_return_t
 __mach_stack_logging_frames_for_uniqued_stack(task_t task,
 											  uint64_t stack_identifier,
@@ -2741,6 +3861,8 @@ main()
 	total_globals += sizeof(pre_write_buffers);
 	fprintf(stderr, "sizeof stack_buffer: %lu\n", sizeof(stack_buffer));
 	total_globals += sizeof(stack_buffer);
+	fprintf(stderr, "sizeof shadow_stacks: %lu\n", sizeof(shadow_stacks));
+	total_globals += sizeof(shadow_stacks);
 	fprintf(stderr, "sizeof last_logged_malloc_address: %lu\n", sizeof(last_logged_malloc_address));
 	total_globals += sizeof(last_logged_malloc_address);
 	fprintf(stderr, "sizeof stack_log_file_base_name: %lu\n", sizeof(stack_log_file_base_name));
@@ -29,6 +29,8 @@ extern int stack_logging_dontcompact; /* default is to compact; when set does no
 extern int stack_logging_finished_init; /* set after we've returned from the Libsystem initialiser */
 extern int stack_logging_postponed; /* set if we needed to postpone logging till after initialisation */
 extern int stack_logging_mode;
+extern int stack_logging_thread_buffers; /* when set, threads buffer their events and a writer thread logs them */
+extern uint64_t stack_logging_sample_interval; /* when set, lite mode only records allocations sampled every this many bytes on average */
 
 extern const uint64_t __invalid_stack_id;
 
@@ -53,6 +55,7 @@ extern void __stack_logging_early_finished();
 void __decrement_table_slot_refcount(uint64_t stackID, size_t size);
 
 void __delete_uniquing_table_memory_while_locked();
+void __stack_logging_drain_thread_buffers(void);
 boolean_t __uniquing_table_memory_was_deleted(void);
 
 boolean_t is_stack_logging_lite_enabled(void);
@@ -90,19 +90,31 @@
 #define VM_COPY_THRESHOLD_LARGEMEM (128 * 1024)
 
 /*
- * Large entry cache (death row) sizes. The large cache is bounded with
- * an overall top limit size, each entry is allowed a given slice of
- * that limit.
+ * Large entry cache (death row) sizes. Each shard caches at most
+ * LARGE_ENTRY_CACHE_SIZE blocks (fewer than 255), and all shards together
+ * at most LARGE_CACHE_SIZE_LIMIT bytes; a build may override the latter. Each
+ * entry is allowed a 1/16 slice of that limit.
+ *
+ * Cached blocks are bucketed by size into LARGE_CACHE_BUCKETS classes, four
+ * per power of two pages. A block that has seen LARGE_CACHE_AGE_LIMIT newer
+ * arrivals in its bucket is aged out, and one arrival evicts at most
+ * LARGE_CACHE_EVICT_MAX blocks to make room for itself.
  */
 #if MALLOC_TARGET_64BIT
-#define LARGE_ENTRY_CACHE_SIZE 16
+#define LARGE_ENTRY_CACHE_SIZE 64
+#ifndef LARGE_CACHE_SIZE_LIMIT
 #define LARGE_CACHE_SIZE_LIMIT ((vm_size_t)0x80000000) /* 2Gb */
-#define LARGE_CACHE_SIZE_ENTRY_LIMIT (LARGE_CACHE_SIZE_LIMIT / LARGE_ENTRY_CACHE_SIZE)
+#endif
 #else // MALLOC_TARGET_64BIT
-#define LARGE_ENTRY_CACHE_SIZE 8
+#define LARGE_ENTRY_CACHE_SIZE 16
+#ifndef LARGE_CACHE_SIZE_LIMIT
 #define LARGE_CACHE_SIZE_LIMIT ((vm_size_t)0x02000000) /* 32Mb */
-#define LARGE_CACHE_SIZE_ENTRY_LIMIT (LARGE_CACHE_SIZE_LIMIT / LARGE_ENTRY_CACHE_SIZE)
+#endif
 #endif // MALLOC_TARGET_64BIT
+#define LARGE_CACHE_SIZE_ENTRY_LIMIT (LARGE_CACHE_SIZE_LIMIT / 16)
+#define LARGE_CACHE_BUCKETS 64
+#define LARGE_CACHE_AGE_LIMIT (LARGE_ENTRY_CACHE_SIZE / 4)
+#define LARGE_CACHE_EVICT_MAX 4
 
 /*
  * Large entry cache (death row) "flotsam" limits. Until the large cache
@@ -113,6 +125,100 @@
 #define SZONE_FLOTSAM_THRESHOLD_LOW (1024 * 512)
 #define SZONE_FLOTSAM_THRESHOLD_HIGH (1024 * 1024)
 
+/*
+ * The large table and the death-row cache are split into LARGE_SHARD_COUNT
+ * (1 << LARGE_SHARD_SHIFT, at least 2) shards with a lock each. A shard table
+ * that has grown moves LARGE_ENTRY_MIGRATE_SLOTS slots of its previous table
+ * on every insert and free. Tables grow at 1/4 occupancy and double, so this
+ * must be at least 4 for a migration to finish before the next growth.
+ */
+#define LARGE_SHARD_SHIFT 3
+#define LARGE_SHARD_COUNT (1 << LARGE_SHARD_SHIFT)
+#define LARGE_ENTRY_MIGRATE_SLOTS 16
+
+/*
+ * Per-thread magazine cache (MallocThreadCache). Each thread holds at most
+ * MAGAZINE_TCACHE_BYTES_LIMIT bytes of free blocks per rack, and moves blocks
+ * to and from its magazine MAGAZINE_TCACHE_BATCH at a time under a single
+ * acquisition of the magazine lock. All tiny sizes are cached; small sizes
+ * are cached up to MAGAZINE_TCACHE_SMALL_SLOTS quanta.
+ */
+#define MAGAZINE_TCACHE_BYTES_LIMIT (64 * 1024)
+#define MAGAZINE_TCACHE_BATCH 16
+#define MAGAZINE_TCACHE_SMALL_SLOTS 8
+#define MAGAZINE_TCACHE_MAX_SLOTS NUM_TINY_SLOTS
+
+/*
+ * Background scavenger (MallocScavenger). Every MAGAZINE_SCAVENGE_INTERVAL_MS
+ * the scavenger returns at most MAGAZINE_SCAVENGE_PAGES free pages from tiny
+ * and small regions that have not changed for MAGAZINE_SCAVENGE_IDLE_TICKS
+ * ticks, holding a magazine lock for at most MAGAZINE_SCAVENGE_LOCK_PAGES of
+ * them at a time.
+ */
+#define MAGAZINE_SCAVENGE_INTERVAL_MS 250
+#define MAGAZINE_SCAVENGE_PAGES 512
+#define MAGAZINE_SCAVENGE_IDLE_TICKS 4
+#define MAGAZINE_SCAVENGE_LOCK_PAGES 64
+
+/*
+ * Pressure relief collects the free pages of the regions it moves to the
+ * depot into batches of at most MVM_MADVISE_BATCH_RANGES page ranges, which
+ * are advised outside of all locks. A batch keeps at most
+ * MAGAZINE_RELIEF_BATCH_REGIONS regions pinned to the depot until then.
+ */
+#define MVM_MADVISE_BATCH_RANGES 256
+#define MAGAZINE_RELIEF_BATCH_REGIONS 64
+
+/*
+ * Huge-page backed regions (MallocHugePages). Regions are carved from chunks
+ * of whole MVM_HUGE_PAGE_SIZE pages, aligned to at least that size.
+ */
+#define MVM_HUGE_PAGE_SHIFT 21
+#define MVM_HUGE_PAGE_SIZE ((size_t)1 << MVM_HUGE_PAGE_SHIFT)
+
+/*
+ * NUMA-aware magazines (MallocNUMA). CPUs numbered MAG_NUMA_MAX_CPUS and up,
+ * and nodes numbered MAG_NUMA_MAX_NODES and up, are not placed.
+ */
+#define MAG_NUMA_MAX_CPUS 1024
+#define MAG_NUMA_MAX_NODES 64
+
+/*
+ * malloc_fill() streams blocks of MALLOC_FILL_NONTEMPORAL_BYTES and more past
+ * the cache, about the size of a core's L2.
+ */
+#define MALLOC_FILL_NONTEMPORAL_BYTES (256 * 1024)
+
+/*
+ * Nano band prefetch (MallocNanoPrefetch). Once fewer than
+ * NANO_PREFETCH_WATERMARK bytes are left in a slot's current band, the
+ * prefetch thread maps the next one and faults in its first
+ * NANO_PREFAULT_PAGES pages (MallocNanoPrefault).
+ */
+#define NANO_PREFETCH_WATERMARK (32 * 1024)
+#define NANO_PREFAULT_PAGES 4
+
+/*
+ * Sampled lite stack logging (MallocStackLogging=sample). Allocations are
+ * sampled at exponentially distributed byte intervals with a mean of
+ * STACK_LOGGING_SAMPLE_INTERVAL bytes (MallocStackLoggingSampleInterval).
+ */
+#define STACK_LOGGING_SAMPLE_INTERVAL (512 * 1024)
+
+/*
+ * Small size classes (MallocSmallClasses). Requests of up to
+ * SMALL_CLASS_MAX_MSIZE quanta are rounded up to one of SMALL_CLASS_COUNT
+ * geometric classes (four per doubling, at least two quanta) and carved from
+ * runs of about
+ * SMALL_CLASS_RUN_QUANTA quanta, with at least SMALL_CLASS_RUN_MIN_SLOTS and
+ * at most SMALL_CLASS_RUN_MAX_SLOTS slots per run.
+ */
+#define SMALL_CLASS_COUNT 15
+#define SMALL_CLASS_MAX_MSIZE (LARGE_THRESHOLD >> SHIFT_SMALL_QUANTUM)
+#define SMALL_CLASS_RUN_QUANTA 64
+#define SMALL_CLASS_RUN_MIN_SLOTS 4
+#define SMALL_CLASS_RUN_MAX_SLOTS 64
+
 /*
  * Density threshold used in determining the level of emptiness before
  * moving regions to the recirc depot.
@@ -130,4 +236,24 @@
 #error LARGE_THRESHOLD_LARGEMEM should always be less than NUM_SMALL_SLOTS * SMALL_QUANTUM
 #endif
 
+#if (MAGAZINE_TCACHE_SMALL_SLOTS >= MAGAZINE_TCACHE_MAX_SLOTS)
+#error MAGAZINE_TCACHE_SMALL_SLOTS should always be less than MAGAZINE_TCACHE_MAX_SLOTS
+#endif
+
+#if (SMALL_CLASS_COUNT > 16 || SMALL_CLASS_RUN_MAX_SLOTS > 64)
+#error small class slot metadata holds at most 16 classes of at most 64 slots
+#endif
+
+#if (MVM_MADVISE_BATCH_RANGES > 1024)
+#error process_madvise takes at most UIO_MAXIOV (1024) ranges at a time
+#endif
+
+#if (MAG_NUMA_MAX_NODES > 255)
+#error region trailers and the magazine map hold NUMA node numbers in a byte
+#endif
+
+#if (LARGE_ENTRY_CACHE_SIZE >= 255 || LARGE_CACHE_BUCKETS > 64)
+#error large cache nodes are indexed by a byte and buckets tracked in a 64-bit mask
+#endif
+
 #endif // __THRESHOLDS_H
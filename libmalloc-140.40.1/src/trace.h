@@ -28,7 +28,13 @@
 //   DBG_UMALLOC_EXTERNAL - for external entry points into malloc
 //   DBG_UMALLOC_INTERNAL - for tracing internal malloc state
 
-#ifndef _MALLOC_BUILDING_CODES_
+#if !defined(_MALLOC_BUILDING_CODES_) && defined(__linux__)
+// No kdebug on Linux; the trace points compile away.
+#define MALLOC_TRACE(code,arg1,arg2,arg3,arg4) \
+	{ (void)(code); }
+#define TRACE_CODE(name, subclass, code) \
+	static const int TRACE_##name = (code)
+#elif !defined(_MALLOC_BUILDING_CODES_)
 #include <sys/kdebug.h>
 #define MALLOC_TRACE(code,arg1,arg2,arg3,arg4) \
 	{ if (malloc_tracing_enabled) { kdebug_trace(code, arg1, arg2, arg3, arg4); } }
@@ -42,7 +42,14 @@ void
 mvm_aslr_init(void)
 {
 	// Prepare ASLR
-#if __i386__ || __x86_64__ || __arm64__ || TARGET_OS_EMBEDDED
+#if CONFIG_MVM_POSIX
+	// The kernel randomizes the mmap base itself, so the POSIX backend has no
+	// entropic range of its own to set up.
+	if (!mvm_aslr_enabled()) {
+		malloc_entropy[0] = 0;
+		malloc_entropy[1] = 0;
+	}
+#elif __i386__ || __x86_64__ || __arm64__ || TARGET_OS_EMBEDDED
 #if __i386__
 	uintptr_t stackbase = 0x8fe00000;
 	int entropic_bits = 3;
@@ -74,6 +81,169 @@ mvm_aslr_init(void)
 #endif
 }
 
+#if CONFIG_MVM_POSIX
+
+void *
+mvm_allocate_pages(size_t size, unsigned char align, unsigned debug_flags, int vm_page_label)
+{
+	boolean_t add_guard_pages = debug_flags & MALLOC_ADD_GUARD_PAGES;
+	size_t guard_size = add_guard_pages ? vm_page_quanta_size : 0;
+	size_t allocation_size = round_page_quanta(size);
+	size_t alignment = (size_t)1 << align;
+	size_t reserve_size;
+	uintptr_t addr, aligned;
+	void *map;
+
+	if (!allocation_size) {
+		allocation_size = vm_page_quanta_size;
+	}
+	allocation_size += 2 * guard_size;
+	if (allocation_size < size) { // size_t arithmetic wrapped!
+		return NULL;
+	}
+
+	// mmap only promises page alignment: over-reserve by the alignment, then
+	// trim the leading and trailing excess so that exactly allocation_size
+	// bytes stay mapped, with the payload (not the guard page) aligned.
+	reserve_size = allocation_size;
+	if (alignment > vm_page_quanta_size) {
+		reserve_size += alignment;
+		if (reserve_size < allocation_size) {
+			return NULL;
+		}
+	}
+
+	map = mmap(NULL, reserve_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (map == MAP_FAILED) {
+		szone_error(debug_flags, 0, "can't allocate region", NULL, "*** mmap(size=%lu) failed (errno=%d)\n", size, errno);
+		return NULL;
+	}
+	addr = (uintptr_t)map;
+
+	if (reserve_size != allocation_size) {
+		aligned = (addr + guard_size + alignment - 1) & ~(alignment - 1);
+		size_t leading = aligned - guard_size - addr;
+		size_t trailing = reserve_size - leading - allocation_size;
+
+		if (leading) {
+			munmap((void *)addr, leading);
+		}
+		if (trailing) {
+			munmap((void *)(addr + leading + allocation_size), trailing);
+		}
+		addr = aligned;
+	} else {
+		addr += guard_size;
+	}
+
+	if (add_guard_pages) {
+		mvm_protect((void *)addr, size, PROT_NONE, debug_flags);
+	}
+	return (void *)addr;
+}
+
+#if CONFIG_HUGE_PAGE_REGIONS
+mvm_huge_split_t mvm_huge_page_split = MVM_HUGE_SPLIT_PRESSURE;
+
+// Per alignment, the rest of the last huge-page chunk a region of that
+// alignment was carved from, ready for the next one.
+static void *volatile mvm_huge_spares[sizeof(size_t) * 8];
+
+static void *
+mvm_allocate_huge_pages(size_t size, unsigned char align, int vm_page_label)
+{
+	size_t alignment = (size_t)1 << align;
+	size_t stride = (size + alignment - 1) & ~(alignment - 1);
+	size_t chunk = (size + MVM_HUGE_PAGE_SIZE - 1) & ~(MVM_HUGE_PAGE_SIZE - 1);
+	void *spare;
+	uintptr_t addr;
+
+	// A spare is "alignment" bytes long, enough for any region no longer
+	// than its alignment (a tiny region in the second half of a huge page).
+	if (size <= alignment) {
+		while ((spare = mvm_huge_spares[align])) {
+			if (OSAtomicCompareAndSwapPtrBarrier(spare, NULL, &mvm_huge_spares[align])) {
+				return spare;
+			}
+		}
+	}
+
+	addr = (uintptr_t)mvm_allocate_pages(chunk, MAX(align, MVM_HUGE_PAGE_SHIFT), 0, vm_page_label);
+	if (!addr) {
+		return NULL;
+	}
+	// Fails harmlessly where transparent huge pages are disabled.
+	(void)madvise((void *)addr, chunk, MADV_HUGEPAGE);
+
+	if (chunk > stride) {
+		uintptr_t rest = addr + stride;
+		size_t rest_size = chunk - stride;
+
+		if (size <= alignment && OSAtomicCompareAndSwapPtrBarrier(NULL, (void *)rest, &mvm_huge_spares[align])) {
+			rest += alignment;
+			rest_size -= alignment;
+		}
+		if (rest_size) {
+			mvm_deallocate_pages((void *)rest, rest_size, 0);
+		}
+	}
+	return (void *)addr;
+}
+#endif // CONFIG_HUGE_PAGE_REGIONS
+
+void *
+mvm_allocate_pages_securely(size_t size, unsigned char align, int vm_page_label, uint32_t debug_flags)
+{
+#if CONFIG_HUGE_PAGE_REGIONS
+	if (debug_flags & MALLOC_HUGE_PAGES) {
+		return mvm_allocate_huge_pages(size, align, vm_page_label);
+	}
+#endif // CONFIG_HUGE_PAGE_REGIONS
+	// Placement is already randomized by the kernel's mmap base.
+	return mvm_allocate_pages(size, align, 0, vm_page_label);
+}
+
+void *
+mvm_allocate_pages_at(uintptr_t addr, size_t size, boolean_t exact)
+{
+	int flags = MAP_PRIVATE | MAP_ANON;
+	void *map;
+
+#ifdef MAP_FIXED_NOREPLACE
+	if (exact) {
+		flags |= MAP_FIXED_NOREPLACE;
+	}
+#endif
+	map = mmap((void *)addr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	// Kernels that predate MAP_FIXED_NOREPLACE treat it as a plain hint.
+	if (exact && map != (void *)addr) {
+		munmap(map, size);
+		return NULL;
+	}
+	return map;
+}
+
+void
+mvm_deallocate_pages(void *addr, size_t size, unsigned debug_flags)
+{
+	boolean_t add_guard_pages = debug_flags & MALLOC_ADD_GUARD_PAGES;
+	uintptr_t vm_addr = (uintptr_t)addr;
+	size_t allocation_size = size;
+
+	if (add_guard_pages) {
+		vm_addr -= vm_page_quanta_size;
+		allocation_size += 2 * vm_page_quanta_size;
+	}
+	if (munmap((void *)vm_addr, allocation_size)) {
+		szone_error(debug_flags, 0, "Can't deallocate_pages region", addr, NULL);
+	}
+}
+
+#else // CONFIG_MVM_POSIX
+
 void *
 mvm_allocate_pages(size_t size, unsigned char align, unsigned debug_flags, int vm_page_label)
 {
@@ -231,6 +401,8 @@ mvm_deallocate_pages(void *addr, size_t size, unsigned debug_flags)
 	}
 }
 
+#endif // CONFIG_MVM_POSIX
+
 void
 mvm_protect(void *address, size_t size, unsigned protection, unsigned debug_flags)
 {
@@ -251,9 +423,25 @@ mvm_protect(void *address, size_t size, unsigned protection, unsigned debug_flag
 	}
 }
 
-int
-mvm_madvise_free(rack_t *rack, region_t r, uintptr_t pgLo, uintptr_t pgHi, uintptr_t *last)
+// Narrows [pgLo, pgHi) to the huge pages it covers whole, unless the split
+// policy lets this advice break up a partly free huge page.
+static inline void
+mvm_huge_page_clip(rack_t *rack, uintptr_t *pgLo, uintptr_t *pgHi, boolean_t pressure)
 {
+#if CONFIG_HUGE_PAGE_REGIONS
+	if (!(rack->debug_flags & MALLOC_HUGE_PAGES) || mvm_huge_page_split == MVM_HUGE_SPLIT_ALWAYS ||
+		(pressure && mvm_huge_page_split == MVM_HUGE_SPLIT_PRESSURE)) {
+		return;
+	}
+	*pgLo = (*pgLo + MVM_HUGE_PAGE_SIZE - 1) & ~(MVM_HUGE_PAGE_SIZE - 1);
+	*pgHi &= ~(MVM_HUGE_PAGE_SIZE - 1);
+#endif // CONFIG_HUGE_PAGE_REGIONS
+}
+
+static int
+mvm_madvise_range(rack_t *rack, region_t r, uintptr_t pgLo, uintptr_t pgHi, uintptr_t *last, int advice)
+{
+	mvm_huge_page_clip(rack, &pgLo, &pgHi, FALSE);
 	if (pgHi > pgLo) {
 		size_t len = pgHi - pgLo;
 
@@ -272,19 +460,132 @@ mvm_madvise_free(rack_t *rack, region_t r, uintptr_t pgLo, uintptr_t pgHi, uintp
 #endif
 
 		MAGMALLOC_MADVFREEREGION((void *)rack, (void *)r, (void *)pgLo, (int)len); // DTrace USDT Probe
-		if (-1 == madvise((void *)pgLo, len, CONFIG_MADVISE_STYLE)) {
+		int err = madvise((void *)pgLo, len, advice);
+		if (-1 == err) {
 			/* -1 return: VM map entry change makes this unfit for reuse. Something evil lurks. */
 #if DEBUG_MADVISE
 			szone_error(NULL, 0, "madvise_free_range madvise(..., MADV_FREE_REUSABLE) failed", (void *)pgLo, "length=%d\n", len);
 #endif
 		}
+#if CONFIG_KNOWN_ZERO_PAGES
+		if (0 == err && MVM_ADVICE_ZEROES(advice)) {
+			rack_zero_granules_mark(rack, pgLo, pgHi);
+		}
+#endif // CONFIG_KNOWN_ZERO_PAGES
 	}
 	return 0;
 }
 
+int
+mvm_madvise_free(rack_t *rack, region_t r, uintptr_t pgLo, uintptr_t pgHi, uintptr_t *last)
+{
+	return mvm_madvise_range(rack, r, pgLo, pgHi, last, CONFIG_MADVISE_STYLE);
+}
+
+#if CONFIG_PROCESS_MADVISE && defined(SYS_process_madvise)
+#ifndef PIDFD_SELF
+#define PIDFD_SELF -10000
+#endif
+
+// Cleared the first time the kernel turns process_madvise() down, after
+// which batches fall back to one madvise() per range.
+static boolean_t mvm_process_madvise_ok = TRUE;
+
+// Returns how many leading bytes of the batch have been advised; the kernel
+// may stop short of the whole batch.
+static size_t
+mvm_process_madvise(mvm_madvise_batch_t *batch)
+{
+	ssize_t r;
+
+	if (!mvm_process_madvise_ok || !batch->count) {
+		return 0;
+	}
+	batch->syscalls++;
+	r = syscall(SYS_process_madvise, PIDFD_SELF, batch->ranges, batch->count, CONFIG_MADVISE_STYLE, 0);
+	if (r <= 0) {
+		// Too old a kernel, no PIDFD_SELF, or advice it only takes for other
+		// processes.
+		mvm_process_madvise_ok = FALSE;
+		return 0;
+	}
+	return r;
+}
+#endif // CONFIG_PROCESS_MADVISE
+
+void
+mvm_madvise_batch_flush(rack_t *rack, mvm_madvise_batch_t *batch)
+{
+	size_t done = 0;
+	unsigned i, n;
+
+	for (i = n = 0; i < batch->count; i++) {
+		uintptr_t pgLo = (uintptr_t)batch->ranges[i].iov_base;
+		uintptr_t pgHi = pgLo + batch->ranges[i].iov_len;
+
+		mvm_huge_page_clip(rack, &pgLo, &pgHi, batch->pressure);
+		if (pgLo < pgHi) {
+			batch->ranges[n].iov_base = (void *)pgLo;
+			batch->ranges[n].iov_len = pgHi - pgLo;
+			n++;
+		}
+	}
+	batch->count = n;
+
+	for (i = 0; i < batch->count; i++) {
+		if (rack->debug_flags & MALLOC_DO_SCRIBBLE) {
+			memset(batch->ranges[i].iov_base, SCRUBBLE_BYTE, batch->ranges[i].iov_len); // Scribble on MADV_FREEd memory
+		}
+		MAGMALLOC_MADVFREEREGION((void *)rack, NULL, batch->ranges[i].iov_base, (int)batch->ranges[i].iov_len); // DTrace USDT Probe
+		batch->bytes += batch->ranges[i].iov_len;
+	}
+
+#if CONFIG_PROCESS_MADVISE && defined(SYS_process_madvise)
+	done = mvm_process_madvise(batch);
+#endif // CONFIG_PROCESS_MADVISE
+	for (i = 0; i < batch->count; i++) {
+		uintptr_t pgLo = (uintptr_t)batch->ranges[i].iov_base;
+		size_t len = batch->ranges[i].iov_len;
+
+		if (done >= len) {
+			done -= len;
+		} else {
+			batch->syscalls++;
+			if (-1 == madvise((void *)(pgLo + done), len - done, CONFIG_MADVISE_STYLE)) {
+#if DEBUG_MADVISE
+				szone_error(NULL, 0, "madvise_batch_flush madvise(..., MADV_FREE_REUSABLE) failed", (void *)(pgLo + done),
+						"length=%d\n", len - done);
+#endif
+				done = 0;
+				continue;
+			}
+			done = 0;
+		}
+#if CONFIG_KNOWN_ZERO_PAGES
+		if (MVM_ADVICE_ZEROES(CONFIG_MADVISE_STYLE)) {
+			rack_zero_granules_mark(rack, pgLo, pgLo + len);
+		}
+#endif // CONFIG_KNOWN_ZERO_PAGES
+	}
+	batch->count = 0;
+}
+
+#if CONFIG_MAGAZINE_SCAVENGER
+int
+mvm_madvise_release(rack_t *rack, region_t r, uintptr_t pgLo, uintptr_t pgHi)
+{
+	return mvm_madvise_range(rack, r, pgLo, pgHi, NULL, CONFIG_SCAVENGE_MADVISE_STYLE);
+}
+#endif // CONFIG_MAGAZINE_SCAVENGER
+
 int
 mvm_madvise_reuse(region_t r, uintptr_t pgLo, uintptr_t phHi, uint32_t debug_flags)
 {
+#if CONFIG_MVM_POSIX
+	// MADV_FREE and MADV_DONTNEED pages simply refault on the next touch; there
+	// is no reuse handshake with the kernel.
+	return 0;
+#else // CONFIG_MVM_POSIX
 	if (phHi > pgLo) {
 		size_t len = phHi - pgLo;
 
@@ -298,4 +599,79 @@ mvm_madvise_reuse(region_t r, uintptr_t pgLo, uintptr_t phHi, uint32_t debug_fla
 		}
 	}
 	return 0;
+#endif // CONFIG_MVM_POSIX
+}
+
+#if CONFIG_NUMA_MAGAZINES
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+void
+mvm_numa_bind(void *address, size_t size, unsigned numa_node)
+{
+#if defined(SYS_mbind)
+	unsigned long mask[(MAG_NUMA_MAX_NODES + 63) / 64] = { 0 };
+
+	mask[numa_node / 64] = 1UL << (numa_node % 64);
+	// The kernel reads one bit less than maxnode.
+	(void)syscall(SYS_mbind, address, size, MPOL_PREFERRED, mask, MAG_NUMA_MAX_NODES + 1, 0);
+#endif // SYS_mbind
+}
+#endif // CONFIG_NUMA_MAGAZINES
+
+void
+mvm_prefault(void *address, size_t size)
+{
+	uintptr_t p = (uintptr_t)address & ~((uintptr_t)vm_page_size - 1);
+	uintptr_t end = (uintptr_t)address + size;
+
+#if defined(MADV_POPULATE_WRITE)
+	if (madvise((void *)p, end - p, MADV_POPULATE_WRITE) == 0) {
+		return;
+	}
+#endif // MADV_POPULATE_WRITE
+	(void)madvise((void *)p, end - p, MADV_WILLNEED);
+	// An atomic add of zero takes a write fault without disturbing a block
+	// that another thread may be using.
+	for (; p < end; p += vm_page_size) {
+		(void)__atomic_fetch_add((volatile char *)p, 0, __ATOMIC_RELAXED);
+	}
+}
+
+size_t
+mvm_resident_bytes(void)
+{
+#if CONFIG_MVM_POSIX
+	// The second field of /proc/self/statm is the resident set in pages. Read
+	// it without stdio, which could allocate.
+	char buf[128];
+	size_t pages = 0;
+	ssize_t len, i = 0;
+	int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return 0;
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0) {
+		return 0;
+	}
+	while (i < len && buf[i] != ' ') {
+		i++;
+	}
+	for (i++; i < len && buf[i] >= '0' && buf[i] <= '9'; i++) {
+		pages = pages * 10 + (size_t)(buf[i] - '0');
+	}
+	return pages << vm_page_shift;
+#else // CONFIG_MVM_POSIX
+	task_vm_info_data_t info;
+	mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+
+	if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+		return 0;
+	}
+	return (size_t)info.phys_footprint;
+#endif // CONFIG_MVM_POSIX
 }
@@ -29,7 +29,11 @@
 static inline bool
 mvm_aslr_enabled(void)
 {
+#if CONFIG_MVM_POSIX
+	return true;
+#else // CONFIG_MVM_POSIX
 	return _dyld_get_image_slide((const struct mach_header *)_NSGetMachExecuteHeader()) != 0;
+#endif // CONFIG_MVM_POSIX
 }
 
 
@@ -49,18 +53,120 @@ MALLOC_NOEXPORT
 void
 mvm_deallocate_pages(void *addr, size_t size, unsigned debug_flags);
 
+#if CONFIG_MVM_POSIX
+// Maps "size" bytes at (or, unless "exact", near) "addr". An exact request
+// either lands at addr or maps nothing.
+MALLOC_NOEXPORT
+void *
+mvm_allocate_pages_at(uintptr_t addr, size_t size, boolean_t exact);
+#endif // CONFIG_MVM_POSIX
+
+
+
+#if CONFIG_HUGE_PAGE_REGIONS
+// When advising pages of a MALLOC_HUGE_PAGES rack may split a huge page that
+// is only partly free back into base pages (MallocHugePageSplit).
+typedef enum {
+	MVM_HUGE_SPLIT_NEVER,	 // only whole huge pages are ever advised
+	MVM_HUGE_SPLIT_PRESSURE, // partial ones too, to relieve memory pressure
+	MVM_HUGE_SPLIT_ALWAYS,	 // partial ones whenever pages are advised
+} mvm_huge_split_t;
+
+MALLOC_NOEXPORT
+extern mvm_huge_split_t mvm_huge_page_split;
+#endif // CONFIG_HUGE_PAGE_REGIONS
 
+#if CONFIG_KNOWN_ZERO_PAGES
+// Advice after which private anonymous pages read back as zero. The tiny and
+// small pages advised with it are marked in their region's zero_granules.
+#define MVM_ADVICE_ZEROES(advice) ((advice) == MADV_DONTNEED)
+#endif // CONFIG_KNOWN_ZERO_PAGES
 
 MALLOC_NOEXPORT
 int
 mvm_madvise_free(rack_t *szone, region_t r, uintptr_t pgLo, uintptr_t pgHi, uintptr_t *last);
+#if CONFIG_MAGAZINE_SCAVENGER
+// As mvm_madvise_free, but with advice that takes the pages out of the
+// resident set straight away.
+MALLOC_NOEXPORT
+int
+mvm_madvise_release(rack_t *rack, region_t r, uintptr_t pgLo, uintptr_t pgHi);
+#endif // CONFIG_MAGAZINE_SCAVENGER
 MALLOC_NOEXPORT
 int
 mvm_madvise_reuse(region_t r, uintptr_t pgLo, uintptr_t phHi, uint32_t debug_flags);
 
+// Page ranges collected under a lock and advised (with CONFIG_MADVISE_STYLE)
+// once it has been dropped. Ranges are added in ascending address order; one
+// that starts where the previous one ends extends it instead.
+struct mvm_madvise_batch_s {
+	unsigned count;
+	struct iovec ranges[MVM_MADVISE_BATCH_RANGES];
+	uint64_t added;		// ranges handed to mvm_madvise_batch_add, totals
+	uint64_t syscalls;	// over the life of the batch
+	uint64_t bytes;
+	boolean_t pressure; // advised to relieve memory pressure (see mvm_huge_page_split)
+};
+
+static inline void
+mvm_madvise_batch_init(mvm_madvise_batch_t *batch)
+{
+	batch->count = 0;
+	batch->added = batch->syscalls = batch->bytes = 0;
+	batch->pressure = FALSE;
+}
+
+// Returns FALSE, adding nothing, if the batch is full.
+static inline boolean_t
+mvm_madvise_batch_add(mvm_madvise_batch_t *batch, uintptr_t pgLo, uintptr_t pgHi)
+{
+	struct iovec *last = batch->count ? &batch->ranges[batch->count - 1] : NULL;
+
+	if (last && (uintptr_t)last->iov_base + last->iov_len == pgLo) {
+		last->iov_len += pgHi - pgLo;
+	} else if (batch->count < MVM_MADVISE_BATCH_RANGES) {
+		batch->ranges[batch->count].iov_base = (void *)pgLo;
+		batch->ranges[batch->count].iov_len = pgHi - pgLo;
+		batch->count++;
+	} else {
+		return FALSE;
+	}
+	batch->added++;
+	return TRUE;
+}
+
+// Advises and empties the batch. Must be called without holding any lock
+// that keeps the ranges' pages from being reused; the caller keeps them in
+// place some other way (see pinned_to_depot).
+MALLOC_NOEXPORT
+void
+mvm_madvise_batch_flush(rack_t *rack, mvm_madvise_batch_t *batch);
+
 
 MALLOC_NOEXPORT
 void
 mvm_protect(void *address, size_t size, unsigned protection, unsigned debug_flags);
 
+#if CONFIG_NUMA_MAGAZINES
+// Asks for the pages of [address, address + size) to come from numa_node
+// (MPOL_PREFERRED) when they are first touched. Failure is not an error; the
+// pages are then placed as usual.
+MALLOC_NOEXPORT
+void
+mvm_numa_bind(void *address, size_t size, unsigned numa_node);
+#endif // CONFIG_NUMA_MAGAZINES
+
+// Faults in the pages of [address, address + size) ahead of their first use
+// without changing their contents, so that it is safe on memory that may
+// already be handed out.
+MALLOC_NOEXPORT
+void
+mvm_prefault(void *address, size_t size);
+
+// The process's resident memory (its physical footprint on Darwin), in bytes,
+// or 0 if it cannot be determined.
+MALLOC_NOEXPORT
+size_t
+mvm_resident_bytes(void);
+
 #endif // __VM_H
@@ -27,26 +27,36 @@
 #include "CPUCount.h"
 #include "balloon.h"
 #include "big.h"
+#include "calloc.h"
 #include "churn.h"
 #include "fragment.h"
 #include "list.h"
 #include "medium.h"
 #include "memalign.h"
 #include "message.h"
+#include "producer_consumer.h"
 #include "realloc.h"
 #include "stress.h"
 #include "stress_aligned.h"
 #include "tree.h"
-#include <dispatch/dispatch.h>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
-#include <mach/mach.h>
-#include <mach/task_info.h>
 #include <map>
+#include <stdio.h>
 #include <string>
+#include <strings.h>
 #include <sys/time.h>
 #include <thread>
 #include <unistd.h>
+#include <vector>
+#if defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#include <mach/mach.h>
+#include <mach/task_info.h>
+#else
+#include <sys/resource.h>
+#endif
 
 #include "mbmalloc.h"
 
@@ -60,6 +70,7 @@ struct BenchmarkPair {
 static const BenchmarkPair benchmarkPairs[] = {
     { "balloon", benchmark_balloon },
     { "big", benchmark_big },
+    { "calloc", benchmark_calloc },
     { "churn", benchmark_churn },
     { "fragment", benchmark_fragment },
     { "fragment_iterate", benchmark_fragment_iterate },
@@ -69,6 +80,7 @@ static const BenchmarkPair benchmarkPairs[] = {
     { "memalign", benchmark_memalign },
     { "message_many", benchmark_message_many },
     { "message_one", benchmark_message_one },
+    { "producer_consumer", benchmark_producer_consumer },
     { "realloc", benchmark_realloc },
     { "stress", benchmark_stress },
     { "stress_aligned", benchmark_stress_aligned },
@@ -146,6 +158,7 @@ void Benchmark::runOnce()
         return;
     }
 
+#if defined(__APPLE__)
     dispatch_group_t group = dispatch_group_create();
 
     for (size_t i = 0; i < cpuCount(); ++i) {
@@ -157,6 +170,18 @@ void Benchmark::runOnce()
     dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
 
     dispatch_release(group);
+#else
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < cpuCount(); ++i) {
+        threads.emplace_back([this] {
+            m_benchmarkPair->function(m_isParallel);
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+#endif
 }
 
 void Benchmark::run()
@@ -189,6 +214,13 @@ void Benchmark::printReport()
 	const char *env = getenv("BATS_TMP_DIR") ?: "/tmp";
 	std::string name(m_isParallel ? "parallel-" : "single-");
 	name += m_benchmarkPair->name;
+	if (m_isParallel && getenv("MALLOCBENCH_THREADS"))
+		name += "-" + std::to_string(cpuCount()) + "threads";
+
+	cout << "Time: " << m_elapsedTime << " ms";
+	if (m_isParallel)
+		cout << " on " << cpuCount() << " threads";
+	cout << endl;
 
 	/*
 	 * Must prepend files with dtres_ to get them picked up by BATS until
@@ -227,6 +259,7 @@ Benchmark::Memory Benchmark::currentMemoryBytes()
 {
     Memory memory;
 
+#if defined(__APPLE__)
     task_vm_info_data_t vm_info;
     mach_msg_type_number_t vm_size = TASK_VM_INFO_COUNT;
     if (KERN_SUCCESS != task_info(mach_task_self(), TASK_VM_INFO_PURGEABLE, (task_info_t)(&vm_info), &vm_size)) {
@@ -237,5 +270,25 @@ Benchmark::Memory Benchmark::currentMemoryBytes()
     memory.resident = vm_info.internal - vm_info.purgeable_volatile_pmap;
     memory.residentMax = vm_info.resident_size_peak;
     memory.physicalFootprint = vm_info.phys_footprint;
+#else
+    // statm reports pages: size resident shared text lib data dt. Anonymous
+    // resident memory (resident - shared) is the closest match for the
+    // internal pages counted above.
+    size_t pages[7] = { };
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (!statm || fscanf(statm, "%zu %zu %zu %zu %zu %zu %zu", &pages[0], &pages[1], &pages[2], &pages[3], &pages[4], &pages[5], &pages[6]) != 7) {
+        cout << "Failed to read /proc/self/statm" << endl;
+        exit(1);
+    }
+    fclose(statm);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    memory.resident = (pages[1] - pages[2]) * pageSize;
+    memory.residentMax = usage.ru_maxrss * 1024;
+    memory.physicalFootprint = pages[1] * pageSize;
+#endif
     return memory;
 }
@@ -26,8 +26,12 @@
 #include "CPUCount.h"
 #include <stdlib.h>
 #include <sys/param.h>
-#include <sys/sysctl.h>
 #include <sys/types.h>
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#else
+#include <unistd.h>
+#endif
 
 static size_t count;
 
@@ -36,6 +40,15 @@ size_t cpuCount()
     if (count)
         return count;
 
+    // Parallel benchmarks run one thread per CPU unless told otherwise, which
+    // lets a script trace how they scale from 1 to N threads.
+    if (const char* threads = getenv("MALLOCBENCH_THREADS")) {
+        count = strtoul(threads, 0, 0);
+        if (count)
+            return count;
+    }
+
+#if defined(__APPLE__)
     size_t length = sizeof(count);
     int name[] = {
             CTL_HW,
@@ -44,6 +57,12 @@ size_t cpuCount()
     int sysctlResult = sysctl(name, sizeof(name) / sizeof(int), &count, &length, 0, 0);
     if (sysctlResult < 0)
         abort();
+#else
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online < 1)
+        abort();
+    count = online;
+#endif
 
     return count;
 }
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2014 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ */
+#include "CPUCount.h"
+#include "calloc.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <string.h>
+#include <strings.h>
+
+#include "mbmalloc.h"
+
+using namespace std;
+
+struct Object {
+    unsigned char* p;
+    size_t size;
+};
+
+// Tiny, small and large requests, so that every rack's calloc path recycles
+// memory that an earlier round dirtied and freed.
+static const size_t objectSizeMax[] = { 1024, 64 * 1024, 1024 * 1024 };
+
+static void validate(const Object& object)
+{
+    // calloc must hand back zeroes everywhere: at the edges, where free blocks
+    // keep their linkage, and wherever coalescing buried older linkage.
+    for (size_t offset = 0; offset < object.size; ++offset) {
+        if (object.p[offset])
+            abort();
+    }
+}
+
+void benchmark_calloc(bool isParallel)
+{
+    size_t times = 8;
+
+    size_t vmSize = 256ul * 1024 * 1024;
+    size_t objectSizeMin = 16;
+    if (isParallel)
+        vmSize /= cpuCount();
+
+    size_t objectCount = vmSize / objectSizeMin;
+
+    srandom(0); // For consistency between runs.
+
+    Object* objects = (Object*)mbmalloc(objectCount * sizeof(Object));
+
+    for (size_t t = 0; t < times; ++t) {
+        bzero(objects, objectCount * sizeof(Object));
+
+        size_t count = 0;
+        for (size_t remaining = vmSize; remaining > objectSizeMin; ++count) {
+            size_t sizeMax = objectSizeMax[count % (sizeof(objectSizeMax) / sizeof(objectSizeMax[0]))];
+            size_t size = min(remaining, max(objectSizeMin, random() % sizeMax));
+            objects[count] = { (unsigned char*)mbcalloc(1, size), size };
+            validate(objects[count]);
+            memset(objects[count].p, 0xa5, size);
+            remaining -= size;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+            mbfree(objects[i].p, objects[i].size);
+    }
+
+    mbfree(objects, objectCount * sizeof(Object));
+}
@@ -26,7 +26,11 @@
 #include <limits>
 #include <stdio.h>
 #include <stdlib.h>
+#if defined(__APPLE__)
 #import <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
 
 extern "C" {
 
@@ -35,6 +39,11 @@ void* mbmalloc(size_t size)
     return malloc(size);
 }
 
+void* mbcalloc(size_t count, size_t size)
+{
+    return calloc(count, size);
+}
+
 void* mbmemalign(size_t alignment, size_t size)
 {
     void* result;
@@ -54,7 +63,11 @@ void* mbrealloc(void* p, size_t, size_t newSize)
 
 void mbscavenge()
 {
+#if defined(__APPLE__)
     malloc_zone_pressure_relief(nullptr, 0);
+#else
+    malloc_trim(0);
+#endif
 }
 
 } // extern "C"
@@ -35,6 +35,7 @@
 extern "C" {
 
 void* mbmalloc(size_t);
+void* mbcalloc(size_t, size_t);
 void* mbmemalign(size_t, size_t);
 void mbfree(void*, size_t);
 void* mbrealloc(void*, size_t, size_t);
@@ -47,6 +48,7 @@ void mbscavenge();
 // benchmarking against.
 
 #define malloc error
+#define calloc error
 #define free error
 #define realloc error
 
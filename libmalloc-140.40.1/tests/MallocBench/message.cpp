@@ -25,9 +25,18 @@
 
 #include "CPUCount.h"
 #include "message.h"
-#include <dispatch/dispatch.h>
 #include <stdlib.h>
 #include <strings.h>
+#if defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#endif
 
 #include "mbmalloc.h"
 
@@ -108,6 +117,71 @@ private:
     Node** m_buffer;
 };
 
+#if !defined(__APPLE__)
+// Serial queue with one worker thread, standing in for a serial dispatch queue.
+class WorkQueue {
+public:
+    WorkQueue()
+        : m_busy()
+        , m_done()
+        , m_thread([this] { run(); })
+    {
+    }
+
+    ~WorkQueue()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_done = true;
+        }
+        m_condition.notify_all();
+        m_thread.join();
+    }
+
+    void async(std::function<void()> work)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_work.push_back(std::move(work));
+        }
+        m_condition.notify_all();
+    }
+
+    // Waits for all previously queued work to finish.
+    void sync()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this] { return m_work.empty() && !m_busy; });
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_condition.wait(lock, [this] { return m_done || !m_work.empty(); });
+            if (m_work.empty())
+                return;
+            std::function<void()> work = std::move(m_work.front());
+            m_work.pop_front();
+            m_busy = true;
+            lock.unlock();
+            work();
+            lock.lock();
+            m_busy = false;
+            m_condition.notify_all();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::function<void()>> m_work;
+    bool m_busy;
+    bool m_done;
+    std::thread m_thread;
+};
+#endif
+
 } // namespace
 
 void benchmark_message_one(bool isParallel)
@@ -118,6 +192,7 @@ void benchmark_message_one(bool isParallel)
     const size_t times = 2048;
     const size_t quantum = 16;
 
+#if defined(__APPLE__)
     dispatch_queue_t queue = dispatch_queue_create("message", 0);
 
     for (size_t i = 0; i < times; i += quantum) {
@@ -136,6 +211,24 @@ void benchmark_message_one(bool isParallel)
     dispatch_sync(queue, ^{ });
 
     dispatch_release(queue);
+#else
+    WorkQueue queue;
+
+    for (size_t i = 0; i < times; i += quantum) {
+        for (size_t j = 0; j < quantum; ++j) {
+            Message* message = new Message;
+            queue.async([message] {
+                size_t hash = message->hash();
+                if (hash)
+                    abort();
+                delete message;
+            });
+        }
+        queue.sync();
+    }
+
+    queue.sync();
+#endif
 }
 
 void benchmark_message_many(bool isParallel)
@@ -147,6 +240,7 @@ void benchmark_message_many(bool isParallel)
     const size_t quantum = 16;
 
     const size_t queueCount = cpuCount() - 1;
+#if defined(__APPLE__)
     dispatch_queue_t queues[queueCount];
     for (size_t i = 0; i < queueCount; ++i)
         queues[i] = dispatch_queue_create("message", 0);
@@ -173,4 +267,27 @@ void benchmark_message_many(bool isParallel)
 
     for (size_t i = 0; i < queueCount; ++i)
         dispatch_release(queues[i]);
+#else
+    std::unique_ptr<WorkQueue[]> queues(new WorkQueue[queueCount]);
+
+    for (size_t i = 0; i < times; i += quantum) {
+        for (size_t j = 0; j < quantum; ++j) {
+            for (size_t k = 0; k < queueCount; ++k) {
+                Message* message = new Message;
+                queues[k].async([message] {
+                    size_t hash = message->hash();
+                    if (hash)
+                        abort();
+                    delete message;
+                });
+            }
+        }
+
+        for (size_t i = 0; i < queueCount; ++i)
+            queues[i].sync();
+    }
+
+    for (size_t i = 0; i < queueCount; ++i)
+        queues[i].sync();
+#endif
 }
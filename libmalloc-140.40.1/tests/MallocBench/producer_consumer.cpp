@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2014 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+#include "CPUCount.h"
+#include "producer_consumer.h"
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "mbmalloc.h"
+
+// One thread allocates messages and a second thread frees them, so nearly
+// every free lands on a block owned by another CPU's magazine.
+
+namespace {
+
+static const size_t ringSize = 4096; // Must be a power of two.
+static const size_t sizes[] = { 16, 48, 128, 256, 512, 1024, 2048 };
+static const size_t sizesCount = sizeof(sizes) / sizeof(sizes[0]);
+
+// Single-producer, single-consumer ring, so that the hand-off itself takes
+// no lock and the allocator is what shows up in the profile.
+class Ring {
+public:
+    Ring()
+        : m_head(0)
+        , m_tail(0)
+    {
+    }
+
+    void push(void* object)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        while (head - m_tail.load(std::memory_order_acquire) == ringSize)
+            std::this_thread::yield();
+        m_objects[head & (ringSize - 1)] = object;
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    void* pop()
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        while (m_head.load(std::memory_order_acquire) == tail)
+            std::this_thread::yield();
+        void* object = m_objects[tail & (ringSize - 1)];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return object;
+    }
+
+private:
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+    void* m_objects[ringSize];
+};
+
+struct Message {
+    size_t size;
+    char payload[1];
+};
+
+} // namespace
+
+void benchmark_producer_consumer(bool isParallel)
+{
+    size_t times = 8000000;
+    if (isParallel)
+        times /= cpuCount();
+
+    // Plain new need not honor the cache line alignment of the ring's members.
+    Ring* ring = new (mbmemalign(alignof(Ring), sizeof(Ring))) Ring;
+
+    std::thread consumer([ring, times] {
+        size_t checksum = 0;
+        for (size_t i = 0; i < times; ++i) {
+            Message* message = static_cast<Message*>(ring->pop());
+            checksum += message->payload[0];
+            mbfree(message, message->size);
+        }
+        if (checksum != times)
+            abort();
+    });
+
+    for (size_t i = 0; i < times; ++i) {
+        size_t size = sizes[i % sizesCount];
+        Message* message = static_cast<Message*>(mbmalloc(size));
+        message->size = size;
+        message->payload[0] = 1;
+        ring->push(message);
+    }
+
+    consumer.join();
+    ring->~Ring();
+    mbfree(ring, sizeof(Ring));
+}
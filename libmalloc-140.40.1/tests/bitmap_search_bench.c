@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * bitmap_search_bench: compares BITMAPN_FFS_FROM with the word-at-a-time scan
+ * small_malloc_from_free_list used before it, on mag_bitmap snapshots shaped
+ * like fragmented small magazines.
+ *
+ * Each scenario fills a set of 256-slot bitmaps with a given number of
+ * non-empty free lists and then asks for the first usable slot at or above a
+ * random request slot, the lookup done on every exact-size miss. Both
+ * searches must agree on every (bitmap, slot) pair.
+ *
+ * usage: bitmap_search_bench [lookups]
+ *
+ * Exits with status 0 if the searches agree, 1 otherwise.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__APPLE__)
+#include <mach/boolean.h>
+#else
+typedef int boolean_t;
+#endif
+
+#include "base.h"
+#include "bitarray.h"
+
+#define BITMAP_WORDS 8
+#define BITMAP_SLOTS (BITMAP_WORDS * 32)
+#define BITMAP_COUNT 1024
+
+typedef struct {
+	const char *name;
+	unsigned nonempty;  // free lists with blocks on them
+	bool last_slot;     // coalesced blocks parked on the last slot
+	unsigned low_slots; // requests are drawn from [0, low_slots)
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+	{ "sparse, last slot only", 0, true, 64 },
+	{ "sparse, 4 lists", 4, true, 64 },
+	{ "fragmented, 16 lists", 16, true, 128 },
+	{ "fragmented, 64 lists", 64, true, 256 },
+	{ "dense, 192 lists", 192, false, 256 },
+};
+
+// The scan small_malloc_from_free_list used under MALLOC_EXTENDED_SMALL_SLOTS.
+static int
+bitmap_search_loop(const unsigned *mag_bitmap, unsigned slot)
+{
+	unsigned idx = slot >> 5;
+	unsigned bitmap = 0;
+	unsigned mask = ~((1U << (slot & 31)) - 1);
+	for (; idx < BITMAP_WORDS; ++idx) {
+		bitmap = mag_bitmap[idx] & mask;
+		if (bitmap != 0) {
+			break;
+		}
+		mask = ~0U;
+	}
+	if ((bitmap == 0) && (idx == BITMAP_WORDS)) {
+		return -1;
+	}
+	return BITMAP32_CTZ((&bitmap)) + (idx * 32);
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+fill_bitmap(unsigned *bitmap, const scenario_t *sc)
+{
+	for (unsigned i = 0; i < BITMAP_WORDS; i++) {
+		bitmap[i] = 0;
+	}
+	for (unsigned n = 0; n < sc->nonempty; n++) {
+		BITMAPN_SET(bitmap, random() % BITMAP_SLOTS);
+	}
+	if (sc->last_slot) {
+		BITMAPN_SET(bitmap, BITMAP_SLOTS - 1);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	static unsigned bitmaps[BITMAP_COUNT][BITMAP_WORDS];
+	static unsigned short slots[BITMAP_COUNT];
+	unsigned long lookups = (argc > 1) ? strtoul(argv[1], NULL, 0) : 20000000;
+	int status = 0;
+
+	srandom(0x5eed);
+	printf("%-26s %12s %12s %8s\n", "scenario", "loop ns", "ffs_from ns", "speedup");
+
+	for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+		const scenario_t *sc = &scenarios[s];
+		long checksum_loop = 0, checksum_ffs = 0;
+		double start, loop_ns, ffs_ns;
+
+		for (unsigned i = 0; i < BITMAP_COUNT; i++) {
+			fill_bitmap(bitmaps[i], sc);
+			slots[i] = random() % sc->low_slots;
+			for (unsigned slot = 0; slot < BITMAP_SLOTS; slot++) {
+				int expected = bitmap_search_loop(bitmaps[i], slot);
+				int found = BITMAPN_FFS_FROM(bitmaps[i], slot);
+				if (expected != found) {
+					printf("FAIL: %s: bitmap %u slot %u: loop %d, ffs_from %d\n", sc->name, i, slot, expected,
+							found);
+					status = 1;
+				}
+			}
+		}
+
+		start = now_ns();
+		for (unsigned long n = 0; n < lookups; n++) {
+			unsigned i = n % BITMAP_COUNT;
+			checksum_loop += bitmap_search_loop(bitmaps[i], slots[i]);
+		}
+		loop_ns = (now_ns() - start) / lookups;
+
+		start = now_ns();
+		for (unsigned long n = 0; n < lookups; n++) {
+			unsigned i = n % BITMAP_COUNT;
+			checksum_ffs += BITMAPN_FFS_FROM(bitmaps[i], slots[i]);
+		}
+		ffs_ns = (now_ns() - start) / lookups;
+
+		if (checksum_loop != checksum_ffs) {
+			printf("FAIL: %s: checksums differ\n", sc->name);
+			status = 1;
+		}
+		printf("%-26s %12.2f %12.2f %7.2fx\n", sc->name, loop_ns, ffs_ns, loop_ns / ffs_ns);
+	}
+
+	return status;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * calloc_zero_granules_test: checks that tiny and small calloc() hand back
+ * zeroes when they reuse memory whose zero granules were marked by the
+ * scavenger (CONFIG_KNOWN_ZERO_PAGES), and that frees and coalescing take
+ * those marks away again.
+ *
+ * Each scenario fills a fresh zone with dirty blocks of one size, frees all
+ * but one block in every KEEP_BYTES and runs scavenger ticks until the free
+ * pages have been given back. It then checks every byte of:
+ *
+ *   - blocks calloc()ed from the advised pages, which must have skipped
+ *     clearing (mag_bytes_clear_avoided grows);
+ *   - blocks three times the size, calloc()ed once those blocks have been
+ *     freed untouched, coalesced, and advised again, so that the only dirt
+ *     is free list linkage left inside the coalesced blocks;
+ *   - blocks calloc()ed after half of those were written to and freed.
+ *
+ * usage: calloc_zero_granules_test
+ *
+ * Exits with status 0 if every byte was zero and the clears were skipped,
+ * 1 otherwise.
+ */
+
+#include "internal.h"
+#include "malloc_zone_block.h"
+#include "malloc_zone_create.h"
+
+#define FILL_BYTES (8 << 20)
+#define KEEP_BYTES (256 << 10)
+#define DIRT 0xa5
+
+typedef struct {
+	const char *name;
+	size_t size;
+	rack_t *(*rack)(szone_t *szone);
+} scenario_t;
+
+static rack_t *
+tiny_rack_of(szone_t *szone)
+{
+	return &szone->tiny_rack;
+}
+
+static rack_t *
+small_rack_of(szone_t *szone)
+{
+	return &szone->small_rack;
+}
+
+static const scenario_t scenarios[] = {
+	{ "tiny, 128 bytes", 128, tiny_rack_of },
+	{ "small, 2 KB", 2048, small_rack_of },
+};
+
+static int status;
+
+static size_t
+clear_avoided(rack_t *rack)
+{
+	size_t avoided = 0;
+	mag_index_t mag_index;
+
+	for (mag_index = -1; mag_index < rack->num_magazines; mag_index++) {
+		avoided += rack->magazines[mag_index].mag_bytes_clear_avoided;
+	}
+	return avoided;
+}
+
+// Runs scavenger ticks until the idle regions have given back all they can.
+static size_t
+scavenge(szone_t *szone)
+{
+	size_t pages = 0, tick_pages;
+	int ticks;
+
+	for (ticks = 0; ticks < 1000; ticks++) {
+		tick_pages = szone_scavenge(szone);
+		if (!tick_pages && pages && ticks > MAGAZINE_SCAVENGE_IDLE_TICKS) {
+			break;
+		}
+		pages += tick_pages;
+	}
+	return pages;
+}
+
+static void
+check_zero(const scenario_t *sc, const char *phase, const unsigned char *p, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (p[i]) {
+			printf("FAIL: %s: %s: byte %zu of %zu-byte block %p is 0x%02x\n", sc->name, phase, i, size, (void *)p, p[i]);
+			status = 1;
+			return;
+		}
+	}
+}
+
+// calloc()s up to 'count' blocks of 'size' into 'ptrs', checking each; returns how many were had.
+static size_t
+calloc_blocks(malloc_zone_t *zone, const scenario_t *sc, const char *phase, void **ptrs, size_t count, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		ptrs[i] = malloc_zone_calloc(zone, 1, size);
+		if (!ptrs[i]) {
+			break;
+		}
+		check_zero(sc, phase, ptrs[i], size);
+	}
+	return i;
+}
+
+static void
+run(const scenario_t *sc)
+{
+	size_t count = FILL_BYTES / sc->size, keep = KEEP_BYTES / sc->size;
+	size_t i, n, freed, pages, avoided;
+	malloc_zone_t *zone = malloc_create_zone(0, 0);
+	szone_t *szone = (szone_t *)zone;
+	rack_t *rack = sc->rack(szone);
+	void **kept = calloc(count, sizeof(void *));
+	void **ptrs = calloc(count, sizeof(void *));
+
+	if (!zone || !kept || !ptrs) {
+		printf("FAIL: %s: out of memory\n", sc->name);
+		status = 1;
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		kept[i] = malloc_zone_malloc(zone, sc->size);
+		memset(kept[i], DIRT, sc->size);
+	}
+	for (i = freed = 0; i < count; i++) {
+		if (i % keep) {
+			malloc_zone_free(zone, kept[i]);
+			kept[i] = NULL;
+			freed++;
+		}
+	}
+
+	pages = scavenge(szone);
+	avoided = clear_avoided(rack);
+	n = calloc_blocks(zone, sc, "advised", ptrs, freed, sc->size);
+	printf("%-16s advised %zu pages, %zu blocks calloc()ed, %zu bytes clear avoided\n", sc->name, pages, n,
+			clear_avoided(rack) - avoided);
+	if (!pages || clear_avoided(rack) == avoided) {
+		printf("FAIL: %s: calloc() of advised blocks cleared them all\n", sc->name);
+		status = 1;
+	}
+
+	// Untouched blocks freed next to one another coalesce, burying the
+	// linkage of each inside the larger free block.
+	for (i = 0; i < n; i++) {
+		malloc_zone_free(zone, ptrs[i]);
+	}
+	pages = scavenge(szone);
+	n = calloc_blocks(zone, sc, "coalesced", ptrs, n / 3, 3 * sc->size);
+	printf("%-16s advised %zu pages, %zu coalesced blocks calloc()ed\n", sc->name, pages, n);
+
+	// Written and freed without advice in between, so nothing is known zero.
+	for (i = 0; i < n; i += 2) {
+		memset(ptrs[i], DIRT, 3 * sc->size);
+		malloc_zone_free(zone, ptrs[i]);
+	}
+	for (i = 0; i < n; i += 2) {
+		ptrs[i] = malloc_zone_calloc(zone, 1, 3 * sc->size);
+		check_zero(sc, "dirty", ptrs[i], 3 * sc->size);
+	}
+
+	for (i = 0; i < n; i++) {
+		malloc_zone_free(zone, ptrs[i]);
+	}
+	for (i = 0; i < count; i++) {
+		if (kept[i]) {
+			malloc_zone_free(zone, kept[i]);
+		}
+	}
+	free(ptrs);
+	free(kept);
+	malloc_destroy_zone(zone);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		run(&scenarios[i]);
+	}
+	return status;
+}
@@ -0,0 +1,154 @@
+#include <darwintest.h>
+#include <malloc/malloc.h>
+#include <malloc_private.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Enough live blocks to grow every shard table several times.
+#define LARGE_TEST_BLOCKS 4096
+#define LARGE_TEST_THREADS 8
+#define LARGE_TEST_SIZE(i) (128 * 1024 + ((i) % 32) * 4096)
+
+T_DECL(large_table_growth, "large blocks stay findable while shard tables grow",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	void **ptrs = calloc(LARGE_TEST_BLOCKS, sizeof(void *));
+	T_QUIET; T_ASSERT_NOTNULL(ptrs, "calloc");
+
+	for (int i = 0; i < LARGE_TEST_BLOCKS; i++) {
+		ptrs[i] = malloc(LARGE_TEST_SIZE(i));
+		T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "malloc(%d)", LARGE_TEST_SIZE(i));
+		*(int *)ptrs[i] = i;
+
+		// Free every third block as we go, so that entries leave the tables
+		// while earlier ones are still being migrated.
+		if (i % 3 == 2) {
+			free(ptrs[i - 1]);
+			ptrs[i - 1] = NULL;
+		}
+	}
+
+	for (int i = 0; i < LARGE_TEST_BLOCKS; i++) {
+		if (ptrs[i]) {
+			T_QUIET; T_ASSERT_GE(malloc_size(ptrs[i]), (size_t)LARGE_TEST_SIZE(i), "malloc_size(ptrs[%d])", i);
+			T_QUIET; T_ASSERT_EQ(*(int *)ptrs[i], i, "contents of ptrs[%d]", i);
+			free(ptrs[i]);
+		}
+	}
+	free(ptrs);
+	T_PASS("all large blocks found and freed");
+}
+
+T_DECL(large_realloc, "large realloc keeps the table entry in step",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	size_t size = 256 * 1024;
+	char *ptr = malloc(size);
+	T_QUIET; T_ASSERT_NOTNULL(ptr, "malloc");
+	memset(ptr, 0x5a, size);
+
+	for (int i = 0; i < 8; i++) {
+		ptr = realloc(ptr, size * 2);
+		T_QUIET; T_ASSERT_NOTNULL(ptr, "realloc grow");
+		T_QUIET; T_ASSERT_GE(malloc_size(ptr), size * 2, "grown size");
+		T_QUIET; T_ASSERT_EQ_CHAR(ptr[size - 1], (char)0x5a, "contents survive growth");
+		memset(ptr, 0x5a, size * 2);
+		size *= 2;
+	}
+
+	ptr = realloc(ptr, 256 * 1024);
+	T_QUIET; T_ASSERT_NOTNULL(ptr, "realloc shrink");
+	T_EXPECT_GE(malloc_size(ptr), (size_t)256 * 1024, "shrunk size");
+	free(ptr);
+}
+
+static void *
+large_thread(void *arg)
+{
+	void *ptrs[64];
+
+	for (int round = 0; round < 200; round++) {
+		for (int i = 0; i < 64; i++) {
+			ptrs[i] = malloc(LARGE_TEST_SIZE(i));
+			T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "malloc");
+			*(void **)ptrs[i] = ptrs[i];
+		}
+		for (int i = 0; i < 64; i++) {
+			T_QUIET; T_ASSERT_EQ_PTR(*(void **)ptrs[i], ptrs[i], "block not handed out twice");
+			free(ptrs[i]);
+		}
+	}
+	return NULL;
+}
+
+T_DECL(large_parallel, "large malloc/free from many threads",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	pthread_t threads[LARGE_TEST_THREADS];
+
+	for (int i = 0; i < LARGE_TEST_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, large_thread, NULL), "pthread_create");
+	}
+	for (int i = 0; i < LARGE_TEST_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+
+	malloc_statistics_t stats;
+	malloc_zone_statistics(malloc_default_zone(), &stats);
+	T_EXPECT_LT(stats.size_in_use, (size_t)LARGE_TEST_THREADS * 64 * 128 * 1024, "large blocks all accounted as freed");
+}
+
+T_DECL(large_cache_reuse, "large death row reuses blocks of two very different sizes",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	malloc_large_cache_statistics_t before, after;
+	void *small[8], *big[8];
+
+	if (!scalable_zone_large_cache_statistics(malloc_default_zone(), &before)) {
+		T_SKIP("no large cache");
+	}
+
+	for (int round = 0; round < 16; round++) {
+		for (int i = 0; i < 8; i++) {
+			small[i] = malloc(256 * 1024);
+			big[i] = malloc(8 * 1024 * 1024);
+			T_QUIET; T_ASSERT_NOTNULL(small[i], "malloc small");
+			T_QUIET; T_ASSERT_NOTNULL(big[i], "malloc big");
+			T_QUIET; T_ASSERT_GE(malloc_size(big[i]), (size_t)8 * 1024 * 1024, "big block size");
+		}
+		for (int i = 0; i < 8; i++) {
+			free(small[i]);
+			free(big[i]);
+		}
+	}
+
+	T_ASSERT_TRUE(scalable_zone_large_cache_statistics(malloc_default_zone(), &after), "statistics");
+	// The first round misses; every later round should find both sizes on
+	// death row instead of one size evicting the other.
+	T_EXPECT_GE(after.hits - before.hits, 15ULL * 16, "hits");
+	T_EXPECT_GE(after.misses - before.misses, 16ULL, "misses");
+	T_EXPECT_GT(after.entries, 0U, "blocks cached");
+	T_EXPECT_LE(after.bytes, (size_t)after.entries * 8 * 1024 * 1024, "cached bytes");
+}
+
+T_DECL(large_cache_calloc, "calloc of a block reused from death row is zero",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	const size_t size = 512 * 1024;
+	unsigned char *ptrs[32];
+
+	for (int round = 0; round < 8; round++) {
+		for (int i = 0; i < 32; i++) {
+			ptrs[i] = calloc(1, size);
+			T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "calloc");
+			for (size_t j = 0; j < size; j += 64) {
+				T_QUIET; T_ASSERT_EQ(ptrs[i][j] | ptrs[i][j + 63], 0, "calloc block is zero");
+			}
+			memset(ptrs[i], 0xa5, size);
+		}
+		for (int i = 0; i < 32; i++) {
+			free(ptrs[i]);
+		}
+	}
+}
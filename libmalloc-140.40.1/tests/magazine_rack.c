@@ -31,3 +31,22 @@ T_DECL(basic_magazine_deinit, "allocate deallocate magazines")
 	rack_destroy(&rack);
 	T_ASSERT_NULL(rack.magazines, "magazine deinit");
 }
+
+T_DECL(large_magazine_counts, "racks of more than 32 magazines")
+{
+	static const int counts[] = { 3, 33, 96, 192, TINY_MAX_MAGAZINES };
+	struct rack_s rack;
+
+	for (int i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		int n = counts[i];
+
+		memset(&rack, 'a', sizeof(rack));
+		rack_init(&rack, RACK_TYPE_NONE, n, 0);
+		T_ASSERT_NOTNULL(rack.magazines, "%d magazine initialisation", n);
+		T_EXPECT_EQ((rack.num_magazines_mask + 1) & rack.num_magazines_mask, 0U, "%d magazine mask is a power of 2 less 1", n);
+		T_EXPECT_GE((int)rack.num_magazines_mask + 1, n, "%d magazine mask covers every magazine", n);
+		T_EXPECT_LT((int)rack.num_magazines_mask + 1, 2 * n, "%d magazine mask folds back once", n);
+		T_EXPECT_LT(rack_get_thread_index(&rack), n, "%d magazine thread index", n);
+		rack_destroy(&rack);
+	}
+}
@@ -0,0 +1,130 @@
+#include <darwintest.h>
+#include <malloc/malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <stdio.h>
+#else
+#include <mach/mach.h>
+#endif
+
+#define SCAVENGER_TEST_BLOCKS 40000
+#define SCAVENGER_TEST_SIZE 2048
+
+static size_t
+resident_bytes(void)
+{
+#if defined(__linux__)
+	char buf[128] = { 0 };
+	size_t size, resident = 0;
+	int fd = open("/proc/self/statm", O_RDONLY);
+
+	if (fd >= 0) {
+		if (read(fd, buf, sizeof(buf) - 1) > 0) {
+			sscanf(buf, "%zu %zu", &size, &resident);
+		}
+		close(fd);
+	}
+	return resident * (size_t)getpagesize();
+#else
+	task_vm_info_data_t info;
+	mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+
+	if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+		return 0;
+	}
+	return (size_t)info.phys_footprint;
+#endif
+}
+
+T_DECL(scavenger_returns_idle_pages, "the scavenger returns the free pages of idle small regions",
+	   T_META_ENVVAR("MallocScavenger=1"),
+	   T_META_ENVVAR("MallocScavengerInterval=10"),
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	void **ptrs = calloc(SCAVENGER_TEST_BLOCKS, sizeof(void *));
+	T_QUIET; T_ASSERT_NOTNULL(ptrs, "calloc");
+
+	for (int i = 0; i < SCAVENGER_TEST_BLOCKS; i++) {
+		ptrs[i] = malloc(SCAVENGER_TEST_SIZE);
+		T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "malloc");
+		memset(ptrs[i], i & 0xff, SCAVENGER_TEST_SIZE);
+	}
+
+	// Keep one block in sixteen so that every region stays in use, and only
+	// the scavenger can give the rest of its pages back.
+	for (int i = 0; i < SCAVENGER_TEST_BLOCKS; i++) {
+		if (i % 16) {
+			free(ptrs[i]);
+			ptrs[i] = NULL;
+		}
+	}
+	size_t before = resident_bytes();
+
+	// Well over MAGAZINE_SCAVENGE_IDLE_TICKS ticks, and enough ticks to
+	// return at least half of the freed pages at the default budget.
+	usleep(1000 * 1000);
+	size_t after = resident_bytes();
+
+	size_t freed = (size_t)SCAVENGER_TEST_BLOCKS * SCAVENGER_TEST_SIZE / 16 * 15;
+	T_EXPECT_LT(after, before - freed / 4, "resident memory dropped from %zu to %zu", before, after);
+
+	for (int i = 0; i < SCAVENGER_TEST_BLOCKS; i++) {
+		if (ptrs[i]) {
+			unsigned char *p = ptrs[i];
+			T_QUIET; T_ASSERT_EQ(p[0], (unsigned char)(i & 0xff), "start of block %d intact", i);
+			T_QUIET; T_ASSERT_EQ(p[SCAVENGER_TEST_SIZE - 1], (unsigned char)(i & 0xff), "end of block %d intact", i);
+			free(p);
+		}
+	}
+	free(ptrs);
+}
+
+T_DECL(scavenger_skips_class_runs, "the scavenger steps over size-class runs in regions whose blocks moved",
+	   T_META_ENVVAR("MallocScavenger=1"),
+	   T_META_ENVVAR("MallocScavengerInterval=1"),
+	   T_META_ENVVAR("MallocSmallClasses=1"),
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	void **ptrs = calloc(SCAVENGER_TEST_BLOCKS, sizeof(void *));
+	T_QUIET; T_ASSERT_NOTNULL(ptrs, "calloc");
+
+	for (int i = 0; i < SCAVENGER_TEST_BLOCKS; i++) {
+		ptrs[i] = malloc(SCAVENGER_TEST_SIZE);
+		T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "malloc");
+		memset(ptrs[i], i & 0xff, SCAVENGER_TEST_SIZE);
+	}
+	for (int i = 0; i < SCAVENGER_TEST_BLOCKS; i++) {
+		if (i % 16) {
+			free(ptrs[i]);
+			ptrs[i] = NULL;
+		}
+	}
+
+	// Let the scavenger start on the idle regions, then swap blocks between
+	// ordinary allocations and class-run slots of the same total size so
+	// that bytes_used is unchanged but the saved scan offsets go stale.
+	for (int round = 0; round < 50; round++) {
+		usleep(20 * 1000);
+		for (int i = 0; i < SCAVENGER_TEST_BLOCKS; i += 16) {
+			unsigned char *p = malloc(SCAVENGER_TEST_SIZE);
+			T_QUIET; T_ASSERT_NOTNULL(p, "malloc");
+			memset(p, i & 0xff, SCAVENGER_TEST_SIZE);
+			free(ptrs[i]);
+			ptrs[i] = p;
+		}
+		for (int i = 0; i < SCAVENGER_TEST_BLOCKS; i += 16) {
+			unsigned char *p = ptrs[i];
+			T_QUIET; T_ASSERT_EQ(p[0], (unsigned char)(i & 0xff), "start of block %d intact", i);
+			T_QUIET; T_ASSERT_EQ(p[SCAVENGER_TEST_SIZE - 1], (unsigned char)(i & 0xff), "end of block %d intact", i);
+		}
+	}
+
+	for (int i = 0; i < SCAVENGER_TEST_BLOCKS; i += 16) {
+		free(ptrs[i]);
+	}
+	free(ptrs);
+	T_PASS("blocks survived scavenging with class runs enabled");
+}
@@ -12,13 +12,19 @@
 #include "magazine_testing.h"
 
 static inline void
-test_rack_setup(rack_t *rack)
+test_rack_setup_with_flags(rack_t *rack, uint32_t debug_flags)
 {
-	memset(rack, 'a', sizeof(rack));
-	rack_init(rack, RACK_TYPE_SMALL, 1, 0);
+	memset(rack, 'a', sizeof(*rack));
+	rack_init(rack, RACK_TYPE_SMALL, 1, debug_flags);
 	T_QUIET; T_ASSERT_NOTNULL(rack->magazines, "magazine initialisation");
 }
 
+static inline void
+test_rack_setup(rack_t *rack)
+{
+	test_rack_setup_with_flags(rack, 0);
+}
+
 T_DECL(basic_small_alloc, "small rack init and alloc")
 {
 	struct rack_s rack;
@@ -129,3 +135,86 @@ T_DECL(basic_small_realloc_in_place, "small rack realloc in place")
 	size_t nsz = small_size(&rack, ptr);
 	T_ASSERT_EQ((int)nsz, 1024, "realloc size == 1024");
 }
+
+static inline void
+test_class_rack_setup(rack_t *rack)
+{
+	test_rack_setup_with_flags(rack, MALLOC_SMALL_CLASSES);
+}
+
+T_DECL(small_class_alloc, "small rack size-class run alloc")
+{
+	struct rack_s rack;
+	test_class_rack_setup(&rack);
+
+	// 9 quanta rounds up to the 10 quantum class
+	void *ptr = small_malloc_should_clear(&rack, 9, false);
+	T_ASSERT_NOTNULL(ptr, "allocation");
+	T_ASSERT_TRUE(*SMALL_METADATA_FOR_PTR(ptr) & SMALL_IS_CLASS, "allocation is a run slot");
+
+	size_t sz = small_size(&rack, ptr);
+	T_ASSERT_EQ((int)sz, 10 * SMALL_QUANTUM, "size == 5120");
+
+	void *ptr2 = small_malloc_should_clear(&rack, 10, false);
+	T_ASSERT_EQ_PTR(ptr2, (void *)((uintptr_t)ptr + 10 * SMALL_QUANTUM), "adjacent slots");
+}
+
+T_DECL(small_class_free_reuse, "small rack size-class run free and reuse")
+{
+	struct rack_s rack;
+	test_class_rack_setup(&rack);
+
+	void *ptr = small_malloc_should_clear(&rack, 4, false);
+	void *ptr2 = small_malloc_should_clear(&rack, 4, false);
+	T_ASSERT_NOTNULL(ptr2, "allocation");
+
+	free_small(&rack, ptr, SMALL_REGION_FOR_PTR(ptr), 0);
+	T_ASSERT_EQ((int)small_size(&rack, ptr), 0, "slot freed (sz == 0)");
+
+	void *ptr3 = small_malloc_should_clear(&rack, 4, false);
+	T_ASSERT_EQ_PTR(ptr, ptr3, "freed slot reused");
+}
+
+T_DECL(small_class_run_release, "small rack size-class run release")
+{
+	struct rack_s rack;
+	test_class_rack_setup(&rack);
+
+	magazine_t *mag = &rack.magazines[0];
+	void *ptr = small_malloc_should_clear(&rack, 30, false);
+	T_ASSERT_NOTNULL(ptr, "allocation");
+
+	// fill the first run so that a second one is carved for the class
+	void *last = ptr;
+	unsigned slots = small_class_run_slots(30);
+	for (unsigned i = 1; i <= slots; i++) {
+		last = small_malloc_should_clear(&rack, 30, false);
+	}
+	T_ASSERT_NE_PTR(small_class_run_for_slot(ptr, *SMALL_METADATA_FOR_PTR(ptr)),
+			small_class_run_for_slot(last, *SMALL_METADATA_FOR_PTR(last)), "second run");
+
+	// with a partial run left on the class list, the emptied run is released
+	free_small(&rack, ptr, SMALL_REGION_FOR_PTR(ptr), 0);
+
+	small_class_run_t *run = small_class_run_for_slot(last, *SMALL_METADATA_FOR_PTR(last));
+	size_t bytes_before = mag->mag_num_bytes_in_objects;
+	free_small(&rack, last, SMALL_REGION_FOR_PTR(last), 0);
+	T_ASSERT_EQ(mag->mag_num_bytes_in_objects, bytes_before - 30 * SMALL_QUANTUM,
+			"slot accounting released");
+	T_ASSERT_TRUE(*SMALL_METADATA_FOR_PTR(run) & SMALL_IS_FREE, "run released as a free block");
+}
+
+T_DECL(small_class_shrink, "small rack size-class shrink")
+{
+	struct rack_s rack;
+	test_class_rack_setup(&rack);
+
+	void *ptr = small_malloc_should_clear(&rack, 16, false);
+	T_ASSERT_NOTNULL(ptr, "allocation");
+	memset(ptr, 'b', 16 * SMALL_QUANTUM);
+
+	void *nptr = small_try_shrink_in_place(&rack, ptr, 16 * SMALL_QUANTUM, 4 * SMALL_QUANTUM);
+	T_ASSERT_NOTNULL(nptr, "shrink");
+	T_ASSERT_EQ((int)small_size(&rack, nptr), 4 * SMALL_QUANTUM, "nsz == 2048");
+	T_ASSERT_EQ(((char *)nptr)[4 * SMALL_QUANTUM - 1], 'b', "contents preserved");
+}
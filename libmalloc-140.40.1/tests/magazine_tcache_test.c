@@ -0,0 +1,79 @@
+#include <darwintest.h>
+#include <malloc/malloc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TCACHE_TEST_BLOCKS 256
+#define TCACHE_TEST_THREADS 8
+
+T_DECL(tcache_reuse, "thread cache hands back the last freed block",
+	   T_META_ENVVAR("MallocThreadCache=1"),
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	size_t sizes[] = { 16, 64, 496, 1008, 1024, 4096 };
+
+	for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		void *ptr = malloc(sizes[i]);
+		T_QUIET; T_ASSERT_NOTNULL(ptr, "malloc(%zu)", sizes[i]);
+		free(ptr);
+
+		void *ptr2 = malloc(sizes[i]);
+		T_EXPECT_EQ_PTR(ptr, ptr2, "malloc(%zu) reuses the cached block", sizes[i]);
+		T_EXPECT_GE(malloc_size(ptr2), sizes[i], "cached block keeps its size");
+		free(ptr2);
+	}
+}
+
+T_DECL(tcache_calloc, "calloc from the thread cache is zero-filled",
+	   T_META_ENVVAR("MallocThreadCache=1"),
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	char *ptr = malloc(256);
+	T_QUIET; T_ASSERT_NOTNULL(ptr, "malloc");
+	memset(ptr, 0xa, 256);
+	free(ptr);
+
+	char *zeroed = calloc(1, 256);
+	T_QUIET; T_ASSERT_NOTNULL(zeroed, "calloc");
+	for (int i = 0; i < 256; i++) {
+		T_QUIET; T_ASSERT_EQ_CHAR(zeroed[i], 0, "zeroed[%d]", i);
+	}
+	free(zeroed);
+}
+
+static void *
+tcache_thread(void *arg)
+{
+	void *ptrs[TCACHE_TEST_BLOCKS];
+
+	for (int round = 0; round < 100; round++) {
+		for (int i = 0; i < TCACHE_TEST_BLOCKS; i++) {
+			ptrs[i] = malloc(16 * (1 + (i % 64)));
+			T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "malloc");
+			memset(ptrs[i], i, 16);
+		}
+		for (int i = 0; i < TCACHE_TEST_BLOCKS; i++) {
+			free(ptrs[i]);
+		}
+	}
+	return NULL;
+}
+
+T_DECL(tcache_thread_exit, "thread caches survive exiting threads and pressure relief",
+	   T_META_ENVVAR("MallocThreadCache=1"),
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	pthread_t threads[TCACHE_TEST_THREADS];
+
+	for (int i = 0; i < TCACHE_TEST_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, tcache_thread, NULL), "pthread_create");
+	}
+	for (int i = 0; i < TCACHE_TEST_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+
+	malloc_zone_pressure_relief(malloc_default_zone(), 0);
+	tcache_thread(NULL);
+	T_PASS("allocations from exited threads were returned");
+}
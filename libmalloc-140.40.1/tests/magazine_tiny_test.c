@@ -54,6 +54,27 @@ T_DECL(basic_tiny_teardown, "tiny rack init, alloc, teardown")
 	T_ASSERT_NULL(rack.magazines, "magazines destroyed");
 }
 
+T_DECL(tiny_region_map, "tiny regions resolve to their rack through the region map")
+{
+	struct rack_s rack, other;
+	test_rack_setup(&rack);
+	test_rack_setup(&other);
+
+	void *ptr = tiny_malloc_should_clear(&rack, TINY_MSIZE_FOR_BYTES(32), false);
+	void *optr = tiny_malloc_should_clear(&other, TINY_MSIZE_FOR_BYTES(32), false);
+	T_ASSERT_NOTNULL(ptr, "allocation");
+	T_ASSERT_NOTNULL(optr, "allocation in second rack");
+
+	T_ASSERT_EQ_PTR(region_map_lookup(ptr), (void *)&rack, "region map owner");
+	T_ASSERT_EQ_PTR(region_map_lookup(optr), (void *)&other, "second region map owner");
+	T_ASSERT_NULL(tiny_region_for_ptr_no_lock(&rack, optr), "region of another rack not found");
+	T_ASSERT_NULL(region_map_lookup(&rack), "stack address not mapped");
+
+	rack_destroy_regions(&rack, TINY_REGION_SIZE);
+	T_ASSERT_NULL(region_map_lookup(ptr), "destroyed region unmapped");
+	T_ASSERT_NULL(tiny_region_for_ptr_no_lock(&rack, ptr), "destroyed region not found");
+}
+
 T_DECL(basic_tiny_free, "tiny free")
 {
 	struct rack_s rack;
@@ -129,3 +150,32 @@ T_DECL(basic_tiny_realloc_in_place, "tiny rack realloc in place")
 	size_t nsz = tiny_size(&rack, ptr);
 	T_ASSERT_EQ((int)nsz, 32, "realloc size == 32");
 }
+
+T_DECL(tiny_calloc_clear, "tiny calloc skips the clear only for pristine blocks")
+{
+	struct rack_s rack;
+	test_rack_setup(&rack);
+
+	magazine_t *mag = &rack.magazines[0];
+	unsigned char *ptr = tiny_malloc_should_clear(&rack, TINY_MSIZE_FOR_BYTES(64), true);
+	T_ASSERT_NOTNULL(ptr, "allocation");
+	for (int i = 0; i < 64; i++) {
+		T_QUIET; T_ASSERT_EQ(ptr[i], 0, "fresh block is zero");
+	}
+	size_t avoided = mag->mag_bytes_clear_avoided;
+	T_ASSERT_GE(avoided, (size_t)64, "clear of fresh block avoided");
+
+	unsigned char *ptr2 = tiny_malloc_should_clear(&rack, TINY_MSIZE_FOR_BYTES(64), true);
+	T_ASSERT_NOTNULL(ptr2, "allocation 2");
+	T_ASSERT_EQ(mag->mag_bytes_clear_avoided, avoided + 64, "clear of free_at_end block avoided");
+
+	// A recycled block has been written to and must be cleared.
+	memset(ptr, 'a', 64);
+	free_tiny(&rack, ptr, TINY_REGION_FOR_PTR(ptr), 0);
+	unsigned char *ptr3 = tiny_malloc_should_clear(&rack, TINY_MSIZE_FOR_BYTES(64), true);
+	T_ASSERT_EQ_PTR(ptr3, ptr, "freed block reused");
+	for (int i = 0; i < 64; i++) {
+		T_QUIET; T_ASSERT_EQ(ptr3[i], 0, "recycled block is zero");
+	}
+	T_ASSERT_EQ(mag->mag_bytes_clear_avoided, avoided + 64, "recycled block was cleared");
+}
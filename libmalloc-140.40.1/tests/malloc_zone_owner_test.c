@@ -0,0 +1,47 @@
+#include <stdlib.h>
+
+#include <malloc/malloc.h>
+
+#include <darwintest.h>
+
+#define NUM_ZONES 12
+
+static const size_t sizes[] = { 32, 4096, 1024 * 1024 };
+
+T_DECL(zone_owner_lookup, "pointers resolve to the zone that allocated them",
+	   T_META_CHECK_LEAKS(NO))
+{
+	malloc_zone_t *zones[NUM_ZONES];
+	void *ptrs[NUM_ZONES][3];
+
+	for (int i = 0; i < NUM_ZONES; i++) {
+		zones[i] = malloc_create_zone(0, 0);
+		T_QUIET; T_ASSERT_NOTNULL(zones[i], "zone %d created", i);
+		for (int j = 0; j < 3; j++) {
+			ptrs[i][j] = malloc_zone_malloc(zones[i], sizes[j]);
+			T_QUIET; T_ASSERT_NOTNULL(ptrs[i][j], "allocation");
+		}
+	}
+
+	for (int i = 0; i < NUM_ZONES; i++) {
+		for (int j = 0; j < 3; j++) {
+			T_QUIET; T_EXPECT_EQ_PTR(malloc_zone_from_ptr(ptrs[i][j]), zones[i], "zone %d owns its %zu byte block", i, sizes[j]);
+			T_QUIET; T_EXPECT_GE(malloc_size(ptrs[i][j]), sizes[j], "malloc_size");
+		}
+	}
+
+	// free() finds the owning zone; a block grown in place stays with it
+	for (int i = 0; i < NUM_ZONES; i++) {
+		void *grown = realloc(ptrs[i][2], 4 * sizes[2]);
+		T_QUIET; T_ASSERT_NOTNULL(grown, "realloc");
+		T_QUIET; T_EXPECT_EQ_PTR(malloc_zone_from_ptr(grown), zones[i], "realloc stays in zone %d", i);
+		T_QUIET; T_EXPECT_EQ_PTR(malloc_zone_from_ptr((char *)grown + 3 * sizes[2]), NULL, "interior pointer unclaimed");
+		ptrs[i][2] = grown;
+
+		for (int j = 0; j < 3; j++) {
+			free(ptrs[i][j]);
+		}
+		malloc_destroy_zone(zones[i]);
+	}
+	T_PASS("%d zones resolved", NUM_ZONES);
+}
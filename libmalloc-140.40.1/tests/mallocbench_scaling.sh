@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# mallocbench_scaling.sh: runs parallel MallocBench benchmarks with 1, 2, 4,
+# ... up to N threads (MALLOCBENCH_THREADS) and prints how their time scales.
+# Most parallel benchmarks split a fixed amount of work over their threads,
+# and ideally speed up by the thread count; the tree benchmarks give every
+# thread the same work, and ideally keep a speedup of 1.
+#
+# usage: mallocbench_scaling.sh <build dir> [max threads [benchmark ...]]
+#
+# N defaults to the number of online CPUs, and the benchmarks to every
+# parallel-* executable in the build directory. Extra malloc environment
+# variables (MallocMaxMagazines, MallocThreadCache, ...) are passed through.
+
+set -e
+
+if [ $# -lt 1 ]; then
+	sed -n 's/^# usage: /usage: /p' "$0"
+	exit 1
+fi
+
+build=$1
+max=${2:-$(getconf _NPROCESSORS_ONLN)}
+[ $# -gt 1 ] && shift 2 || shift 1
+
+if [ $# -eq 0 ]; then
+	set -- $(cd "$build" && ls parallel-* | sed 's/^parallel-//')
+fi
+
+counts=
+n=1
+while [ "$n" -lt "$max" ]; do
+	counts="$counts $n"
+	n=$((n * 2))
+done
+counts="$counts $max"
+
+tmp=${TMPDIR:-/tmp}
+printf '%-20s %8s %12s %8s\n' benchmark threads "time (ms)" speedup
+for benchmark in "$@"; do
+	base=
+	for threads in $counts; do
+		ms=$(MALLOCBENCH_THREADS=$threads BATS_TMP_DIR=$tmp "$build/parallel-$benchmark" |
+			sed -n 's/^Time: \([0-9.e+-]*\) ms.*/\1/p')
+		[ -n "$base" ] || base=$ms
+		printf '%-20s %8d %12.2f %8.2f\n' "$benchmark" "$threads" "$ms" \
+			"$(echo "$base $ms" | awk '{ print ($2 > 0) ? $1 / $2 : 0 }')"
+	done
+done
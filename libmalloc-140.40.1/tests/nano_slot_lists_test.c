@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * nano_slot_lists_test: drives the nano slot list protocol of
+ * nano_slot_lists.h the way nano_malloc and nano_free do, with more threads
+ * than magazines and every thread landing on a random magazine for each
+ * operation, so that owners are taken over all the time. Frees of blocks of
+ * other magazines go through the batches. A walker thread keeps taking
+ * slots away from their owners the way nano_slot_lock does and checks what
+ * it finds there. Threads give up their lists on the way out, so that once
+ * they are all gone no batch may hold a block.
+ *
+ * Every block records whether it is held or free; handing out a block that
+ * is not free, or finding a block twice, fails the test. At the end every
+ * block carved from a magazine must be on that magazine's free list once.
+ *
+ * usage: nano_slot_lists_test [operations per thread]
+ *
+ * Exits with status 0 if no block was lost or handed out twice, 1 otherwise.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__APPLE__)
+#include <mach/boolean.h>
+#else
+typedef int boolean_t;
+#define TRUE 1
+#define FALSE 0
+#endif
+
+#include "base.h"
+#include "nano_slot_lists.h"
+
+#define MAGAZINES 4
+#define THREADS 8
+#define BLOCKS_PER_MAGAZINE 4096
+#define HELD_PER_THREAD 64
+
+typedef struct {
+	struct chained_block_s link;
+	int volatile held;
+	unsigned int mag;
+} block_t;
+
+typedef struct {
+	nano_slot_lists_t lists;
+	pthread_mutex_t slot_lock;
+	block_t blocks[BLOCKS_PER_MAGAZINE];
+	unsigned int volatile carved;
+} slot_magazine_t;
+
+static slot_magazine_t magazines[MAGAZINES];
+static struct nano_slot_owner_s owners[THREADS];
+static unsigned long operations = 200000;
+static int volatile running;
+static int volatile failed;
+
+static MALLOC_INLINE void
+yield(void)
+{
+	sched_yield();
+}
+
+static void
+fail(const char *what, block_t *b)
+{
+	printf("FAIL: %s: block %p of magazine %u\n", what, (void *)b, b->mag);
+	failed = 1;
+}
+
+static unsigned int
+next_random(unsigned int *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	return *seed;
+}
+
+// nano_slot_flush()
+static void
+flush(slot_magazine_t *mag)
+{
+	if (mag->lists.batch_count) {
+		nano_slot_flush_batch(&mag->lists, &magazines[mag->lists.batch_mag].lists);
+	}
+}
+
+// nano_slot_acquire() and nano_slot_take_over()
+static nano_slot_owner_t
+acquire(slot_magazine_t *mag, nano_slot_owner_t self)
+{
+	nano_slot_owner_t owner = nano_slot_enter(&mag->lists, self);
+
+	if (owner) {
+		return owner;
+	}
+	if (self->busy || pthread_mutex_trylock(&mag->slot_lock)) {
+		return NULL;
+	}
+	if (!nano_slot_try_revoke(&mag->lists, self)) {
+		pthread_mutex_unlock(&mag->slot_lock);
+		return NULL;
+	}
+	pthread_mutex_unlock(&mag->slot_lock);
+	owner = nano_slot_enter(&mag->lists, self);
+	if (owner) {
+		flush(mag);
+	}
+	return owner;
+}
+
+// nano_slot_owner_exit()
+static void
+owner_exit(nano_slot_owner_t self)
+{
+	unsigned int m;
+
+	for (m = 0; m < MAGAZINES; m++) {
+		slot_magazine_t *mag = &magazines[m];
+
+		if (mag->lists.owner != self) {
+			continue;
+		}
+		pthread_mutex_lock(&mag->slot_lock);
+		if (mag->lists.owner == self) {
+			flush(mag);
+			mag->lists.owner = NULL;
+		}
+		pthread_mutex_unlock(&mag->slot_lock);
+	}
+}
+
+// nano_slot_lock()
+static void
+lock_slot(unsigned int m)
+{
+	slot_magazine_t *mag = &magazines[m];
+	unsigned int i;
+
+	for (i = 0; i < MAGAZINES; i++) {
+		slot_magazine_t *other = &magazines[i];
+
+		if (i == m || !other->lists.batch_count || other->lists.batch_mag != m) {
+			continue;
+		}
+		pthread_mutex_lock(&other->slot_lock);
+		nano_slot_revoke(&other->lists, NULL);
+		if (other->lists.batch_mag == m) {
+			nano_slot_flush_batch(&other->lists, &mag->lists);
+		}
+		pthread_mutex_unlock(&other->slot_lock);
+	}
+	pthread_mutex_lock(&mag->slot_lock);
+	nano_slot_revoke(&mag->lists, NULL);
+	flush(mag);
+	nano_slot_collect_remote(&mag->lists);
+}
+
+// nano_malloc()
+static block_t *
+test_malloc(unsigned int here, nano_slot_owner_t self)
+{
+	slot_magazine_t *mag = &magazines[here];
+	block_t *b = NULL;
+
+	if (mag->lists.free || mag->lists.remote_free) {
+		nano_slot_owner_t owner = acquire(mag, self);
+
+		if (owner) {
+			b = (block_t *)nano_slot_pop(&mag->lists);
+			nano_slot_exit(owner);
+		}
+	}
+	if (!b) {
+		unsigned int i = __atomic_fetch_add(&mag->carved, 1, __ATOMIC_RELAXED);
+
+		if (i >= BLOCKS_PER_MAGAZINE) {
+			__atomic_fetch_sub(&mag->carved, 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+		b = &mag->blocks[i];
+		b->mag = here;
+	} else if (b->mag != here) {
+		fail("block popped from another magazine's lists", b);
+	}
+	if (__atomic_exchange_n(&b->held, 1, __ATOMIC_ACQ_REL)) {
+		fail("block handed out twice", b);
+	}
+	return b;
+}
+
+// nano_slot_free()
+static void
+test_free(unsigned int here, nano_slot_owner_t self, block_t *b)
+{
+	nano_slot_lists_t *lists = &magazines[here].lists;
+	chained_block_t t = &b->link;
+	nano_slot_owner_t owner;
+
+	if (!__atomic_exchange_n(&b->held, 0, __ATOMIC_ACQ_REL)) {
+		fail("block freed twice", b);
+	}
+	owner = acquire(&magazines[here], self);
+	if (!owner) {
+		nano_slot_push_remote(&magazines[b->mag].lists, t, t);
+		return;
+	}
+	if (b->mag == here) {
+		nano_slot_push(lists, t);
+	} else {
+		if (lists->batch_count && lists->batch_mag != b->mag) {
+			nano_slot_flush_batch(lists, &magazines[lists->batch_mag].lists);
+		}
+		if (nano_slot_batch_push(lists, t, b->mag)) {
+			nano_slot_flush_batch(lists, &magazines[b->mag].lists);
+		}
+	}
+	nano_slot_exit(owner);
+}
+
+static void *
+thread_main(void *arg)
+{
+	nano_slot_owner_t self = arg;
+	unsigned int seed = (unsigned int)(self - owners) + 1;
+	block_t *held[HELD_PER_THREAD];
+	unsigned int count = 0;
+	unsigned long i;
+
+	for (i = 0; i < operations; i++) {
+		unsigned int r = next_random(&seed);
+		unsigned int here = r % MAGAZINES;
+
+		if (count < HELD_PER_THREAD && (count == 0 || (r >> 4) & 1)) {
+			block_t *b = test_malloc(here, self);
+
+			if (b) {
+				held[count++] = b;
+			}
+		} else {
+			unsigned int j = (r >> 5) % count;
+
+			test_free(here, self, held[j]);
+			held[j] = held[--count];
+		}
+	}
+	while (count) {
+		test_free(next_random(&seed) % MAGAZINES, self, held[--count]);
+	}
+	owner_exit(self);
+	return NULL;
+}
+
+// Walks the free list of a slot taken away from its owner; returns its length.
+static unsigned int
+walk_slot(unsigned int m, unsigned char *seen)
+{
+	chained_block_t t;
+	unsigned int count = 0;
+
+	for (t = magazines[m].lists.free; t; t = t->next) {
+		block_t *b = (block_t *)t;
+
+		if (count++ > BLOCKS_PER_MAGAZINE) {
+			fail("free list walk exceeded block count", b);
+			break;
+		}
+		if (b->mag != m) {
+			fail("free list holds another magazine's block", b);
+		}
+		if (b->held) {
+			fail("free list holds a block in use", b);
+		}
+		if (seen) {
+			if (seen[b - magazines[m].blocks]++) {
+				fail("block on the free lists twice", b);
+			}
+		}
+	}
+	return count;
+}
+
+static void *
+walker_main(void *arg)
+{
+	unsigned int seed = 12345;
+
+	while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+		unsigned int m = next_random(&seed) % MAGAZINES;
+
+		lock_slot(m);
+		walk_slot(m, NULL);
+		pthread_mutex_unlock(&magazines[m].slot_lock);
+		yield();
+	}
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	pthread_t threads[THREADS], walker;
+	unsigned char seen[BLOCKS_PER_MAGAZINE];
+	unsigned int i, m;
+
+	if (argc > 1) {
+		operations = strtoul(argv[1], NULL, 0);
+	}
+	for (m = 0; m < MAGAZINES; m++) {
+		pthread_mutex_init(&magazines[m].slot_lock, NULL);
+	}
+
+	running = 1;
+	pthread_create(&walker, NULL, walker_main, NULL);
+	for (i = 0; i < THREADS; i++) {
+		pthread_create(&threads[i], NULL, thread_main, &owners[i]);
+	}
+	for (i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	__atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+	pthread_join(walker, NULL);
+
+	for (m = 0; m < MAGAZINES; m++) {
+		if (magazines[m].lists.batch_count) {
+			printf("FAIL: magazine %u still batches %u blocks for magazine %u\n", m,
+					magazines[m].lists.batch_count, magazines[m].lists.batch_mag);
+			failed = 1;
+		}
+	}
+	for (m = 0; m < MAGAZINES; m++) {
+		unsigned int free_count;
+
+		memset(seen, 0, sizeof(seen));
+		lock_slot(m);
+		free_count = walk_slot(m, seen);
+		pthread_mutex_unlock(&magazines[m].slot_lock);
+		printf("magazine %u: %u blocks carved, %u free\n", m, magazines[m].carved, free_count);
+		if (free_count != magazines[m].carved) {
+			printf("FAIL: magazine %u lost %d blocks\n", m, (int)(magazines[m].carved - free_count));
+			failed = 1;
+		}
+	}
+	return failed;
+}
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * numa_bench: reports how many tiny and small blocks end up on a memory node
+ * other than the one of the CPU that allocated them, which is the share of
+ * that thread's accesses to them that are remote.
+ *
+ * For every node with CPUs the process may run on, the bench pins itself to
+ * one of that node's CPUs, fills a fresh zone with blocks of a scenario's size
+ * and asks the kernel (move_pages) which node holds the page of each block.
+ * A second pass then frees seven in eight of the blocks allocated on one
+ * node, so that their regions recirculate through the depot, and allocates
+ * the same amount again on the next node.
+ *
+ * Run it with and without MallocNUMA=1 to compare.
+ *
+ * usage: numa_bench [rounds [max remote percent]]
+ *
+ * Exits with status 0 if every block kept its contents and, when a limit is
+ * given, no pass saw more remote blocks than that; 1 otherwise.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#else
+typedef struct _malloc_zone_t malloc_zone_t;
+
+// As declared in malloc.h.
+extern malloc_zone_t *malloc_create_zone(size_t start_size, unsigned flags);
+extern void malloc_destroy_zone(malloc_zone_t *zone);
+extern void *malloc_zone_malloc(malloc_zone_t *zone, size_t size);
+extern void malloc_zone_free(malloc_zone_t *zone, void *ptr);
+#endif
+
+#define MAX_NODES 64
+#define QUERY_PAGES 1024
+
+typedef struct {
+	const char *name;
+	size_t size;  // block size
+	size_t bytes; // allocated per node and round
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+	{ "tiny, 128 bytes", 128, 32 << 20 },
+	{ "small, 4 KB", 4096, 64 << 20 },
+};
+
+typedef struct {
+	unsigned long long blocks;
+	unsigned long long remote;
+	unsigned long long unknown;
+} placement_t;
+
+static int node_cpu[MAX_NODES];
+static int node_id[MAX_NODES];
+static unsigned num_nodes;
+
+#if defined(__linux__)
+static int
+current_node(void)
+{
+	unsigned cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+		return -1;
+	}
+	return (int)node;
+}
+
+static bool
+pin(int cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// Finds one CPU we may run on for every node.
+static void
+find_nodes(void)
+{
+	cpu_set_t allowed;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return;
+	}
+	for (int cpu = 0; cpu < CPU_SETSIZE && num_nodes < MAX_NODES; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed) || !pin(cpu)) {
+			continue;
+		}
+		int node = current_node();
+		bool seen = false;
+		for (unsigned n = 0; n < num_nodes; n++) {
+			seen |= (node_id[n] == node);
+		}
+		if (!seen) {
+			node_cpu[num_nodes] = cpu;
+			node_id[num_nodes++] = node;
+		}
+	}
+	sched_setaffinity(0, sizeof(allowed), &allowed);
+}
+
+// Counts the blocks whose pages are not on node.
+static void
+measure(void **ptrs, size_t count, int node, placement_t *p)
+{
+	void *pages[QUERY_PAGES];
+	int status[QUERY_PAGES];
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	for (size_t i = 0; i < count; i += QUERY_PAGES) {
+		size_t n = (count - i < QUERY_PAGES) ? count - i : QUERY_PAGES;
+
+		for (size_t j = 0; j < n; j++) {
+			pages[j] = (void *)((uintptr_t)ptrs[i + j] & ~(uintptr_t)(page_size - 1));
+		}
+		if (syscall(SYS_move_pages, 0, n, pages, NULL, status, 0) != 0) {
+			p->unknown += n;
+			continue;
+		}
+		for (size_t j = 0; j < n; j++) {
+			if (status[j] < 0) {
+				p->unknown++;
+			} else if (status[j] != node) {
+				p->remote++;
+			}
+		}
+		p->blocks += n;
+	}
+}
+#else // __linux__
+static bool
+pin(int cpu)
+{
+	return true;
+}
+
+static void
+find_nodes(void)
+{
+	node_cpu[0] = 0;
+	node_id[0] = 0;
+	num_nodes = 1;
+}
+
+static void
+measure(void **ptrs, size_t count, int node, placement_t *p)
+{
+	p->blocks += count;
+}
+#endif // __linux__
+
+static bool
+fill(malloc_zone_t *zone, void **ptrs, size_t count, size_t size, const char *name)
+{
+	for (size_t i = 0; i < count; i++) {
+		ptrs[i] = malloc_zone_malloc(zone, size);
+		if (!ptrs[i]) {
+			printf("FAIL: %s: out of memory\n", name);
+			return false;
+		}
+		*(size_t *)ptrs[i] = i;
+	}
+	return true;
+}
+
+static bool
+check(void **ptrs, size_t count, size_t stride, const char *name)
+{
+	for (size_t i = 0; i < count; i += stride) {
+		if (*(size_t *)ptrs[i] != i) {
+			printf("FAIL: %s: block %zu overwritten\n", name, i);
+			return false;
+		}
+	}
+	return true;
+}
+
+static double
+percent(const placement_t *p)
+{
+	return p->blocks ? 100.0 * p->remote / p->blocks : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned rounds = (argc > 1) ? (unsigned)strtoul(argv[1], NULL, 0) : 4;
+	double limit = (argc > 2) ? strtod(argv[2], NULL) : 100;
+	int status = 0;
+
+	find_nodes();
+	if (!num_nodes) {
+		printf("FAIL: cannot tell which node we run on\n");
+		return 1;
+	}
+	printf("%u node(s)\n", num_nodes);
+	printf("%-16s %14s %14s %10s\n", "scenario", "local remote%", "recirc remote%", "unknown");
+
+	for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+		const scenario_t *sc = &scenarios[s];
+		size_t count = sc->bytes / sc->size;
+		placement_t local = { 0 }, recirc = { 0 };
+		void **ptrs[MAX_NODES];
+
+		for (unsigned n = 0; n < num_nodes; n++) {
+			ptrs[n] = calloc(count, sizeof(void *));
+		}
+
+		for (unsigned round = 0; round < rounds && !status; round++) {
+			malloc_zone_t *zone = malloc_create_zone(0, 0);
+
+			// Every node fills its own magazines.
+			for (unsigned n = 0; n < num_nodes && !status; n++) {
+				pin(node_cpu[n]);
+				if (!fill(zone, ptrs[n], count, sc->size, sc->name)) {
+					status = 1;
+					break;
+				}
+				measure(ptrs[n], count, node_id[n], &local);
+			}
+
+			// Each node in turn frees most of its blocks, and the next one
+			// allocates as much again, drawing on the depot.
+			for (unsigned n = 0; n + 1 < num_nodes && !status; n++) {
+				pin(node_cpu[n]);
+				for (size_t i = 0; i < count; i++) {
+					if (i % 8) {
+						malloc_zone_free(zone, ptrs[n][i]);
+					}
+				}
+				if (!check(ptrs[n], count, 8, sc->name)) {
+					status = 1;
+					break;
+				}
+
+				pin(node_cpu[n + 1]);
+				void **more = calloc(count, sizeof(void *));
+				if (!fill(zone, more, count, sc->size, sc->name) || !check(more, count, 1, sc->name) ||
+						!check(ptrs[n + 1], count, 1, sc->name)) {
+					status = 1;
+				}
+				measure(more, count, node_id[n + 1], &recirc);
+				free(more);
+			}
+
+			malloc_destroy_zone(zone);
+		}
+
+		for (unsigned n = 0; n < num_nodes; n++) {
+			free(ptrs[n]);
+		}
+
+		printf("%-16s %14.2f %14.2f %10llu\n", sc->name, percent(&local), percent(&recirc),
+				local.unknown + recirc.unknown);
+		if (percent(&local) > limit || percent(&recirc) > limit) {
+			printf("FAIL: %s: more than %.2f%% of blocks are remote\n", sc->name, limit);
+			status = 1;
+		}
+	}
+
+	return status;
+}
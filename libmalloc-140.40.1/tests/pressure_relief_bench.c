@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * pressure_relief_bench: times malloc_zone_pressure_relief() on a zone whose
+ * tiny and small regions are full of multi-page holes, and reports how many
+ * free page ranges it found and how many madvise system calls it took to
+ * return them.
+ *
+ * Each round fills a fresh zone with blocks of a scenario's size, frees all
+ * but one block in every HOLE_BYTES, relieves the zone and checks that the
+ * blocks that were kept are intact.
+ *
+ * usage: pressure_relief_bench [rounds]
+ *
+ * Exits with status 0 if the kept blocks survive and the pages were advised
+ * with system calls, 1 otherwise.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#include <malloc_private.h>
+#else
+typedef int boolean_t;
+typedef struct _malloc_zone_t malloc_zone_t;
+
+// As declared in malloc.h and malloc_private.h.
+typedef struct {
+	unsigned long long calls;
+	unsigned long long ranges;
+	unsigned long long syscalls;
+	unsigned long long bytes;
+} malloc_pressure_relief_statistics_t;
+
+extern malloc_zone_t *malloc_create_zone(size_t start_size, unsigned flags);
+extern void malloc_destroy_zone(malloc_zone_t *zone);
+extern void *malloc_zone_malloc(malloc_zone_t *zone, size_t size);
+extern void malloc_zone_free(malloc_zone_t *zone, void *ptr);
+extern size_t malloc_zone_pressure_relief(malloc_zone_t *zone, size_t goal);
+extern boolean_t scalable_zone_pressure_relief_statistics(malloc_zone_t *zone, malloc_pressure_relief_statistics_t *stats);
+#endif
+
+#define HOLE_BYTES (16 * 1024)
+
+typedef struct {
+	const char *name;
+	size_t size;  // block size
+	size_t bytes; // allocated per round
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+	{ "tiny, 128 bytes", 128, 64 << 20 },
+	{ "small, 2 KB", 2048, 128 << 20 },
+};
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned rounds = (argc > 1) ? (unsigned)strtoul(argv[1], NULL, 0) : 8;
+	int status = 0;
+
+	printf("%-16s %10s %10s %10s %10s\n", "scenario", "ranges", "syscalls", "advised MB", "relief ms");
+
+	for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+		const scenario_t *sc = &scenarios[s];
+		size_t count = sc->bytes / sc->size;
+		size_t keep = HOLE_BYTES / sc->size;
+		malloc_pressure_relief_statistics_t total = { 0 };
+		double relief_ns = 0;
+		void **ptrs = calloc(count, sizeof(void *));
+
+		for (unsigned round = 0; round < rounds; round++) {
+			malloc_zone_t *zone = malloc_create_zone(0, 0);
+			malloc_pressure_relief_statistics_t stats;
+			double start;
+
+			for (size_t i = 0; i < count; i++) {
+				ptrs[i] = malloc_zone_malloc(zone, sc->size);
+				*(size_t *)ptrs[i] = i;
+			}
+			for (size_t i = 0; i < count; i++) {
+				if (i % keep) {
+					malloc_zone_free(zone, ptrs[i]);
+				}
+			}
+
+			start = now_ns();
+			malloc_zone_pressure_relief(zone, 0);
+			relief_ns += now_ns() - start;
+
+			for (size_t i = 0; i < count; i += keep) {
+				if (*(size_t *)ptrs[i] != i) {
+					printf("FAIL: %s: block %zu overwritten\n", sc->name, i);
+					status = 1;
+					break;
+				}
+			}
+			if (scalable_zone_pressure_relief_statistics(zone, &stats)) {
+				if (stats.bytes && !stats.syscalls) {
+					printf("FAIL: %s: %llu bytes advised without a system call\n", sc->name, stats.bytes);
+					status = 1;
+				}
+				total.ranges += stats.ranges;
+				total.syscalls += stats.syscalls;
+				total.bytes += stats.bytes;
+			}
+			malloc_destroy_zone(zone);
+		}
+		free(ptrs);
+
+		printf("%-16s %10llu %10llu %10.1f %10.2f\n", sc->name, total.ranges / rounds, total.syscalls / rounds,
+				total.bytes / rounds / 1048576.0, relief_ns / rounds / 1e6);
+	}
+
+	return status;
+}
@@ -1,9 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 #include <malloc/malloc.h>
 #include <mach/mach.h>
 #include <mach/mach_vm.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
 #include <stack_logging.h>
 #include <sys/stat.h>
 #include <sys/event.h>
@@ -802,6 +808,329 @@ T_DECL(msl_test_lite_atstart_with_nano, "Test lite mode of malloc stack logging
 	do_test(stack_logging_mode_none, validate_stacks, nano_allocator_enabled, lite_mode_enabled);
 }
 
+T_DECL(msl_test_full_atstart_thread_buffers, "Test full mode of malloc stack logging enabled at start - with per-thread event buffers", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocStackLoggingThreadBuffers=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	boolean_t validate_stacks = true;
+	boolean_t nano_allocator_enabled = false;
+	boolean_t lite_mode_enabled = false;
+	
+	do_test(stack_logging_mode_none, validate_stacks, nano_allocator_enabled, lite_mode_enabled);
+}
+
+#define THREAD_BUFFER_TEST_THREADS 16
+#define THREAD_BUFFER_TEST_EVENTS 200000
+
+/*
+ * Runs 'body' on 'nthreads' threads, each handed the slot for the last
+ * allocation it keeps, and logs the rate of the 'events' each thread makes,
+ * named 'what'. The stack of every thread's last allocation, exited or not,
+ * must be readable afterwards.
+ */
+static void
+log_events_from_threads(int nthreads, void *(*body)(void *), double events, const char *what)
+{
+	pthread_t threads[THREAD_BUFFER_TEST_THREADS];
+	char *kept[THREAD_BUFFER_TEST_THREADS];
+
+	T_QUIET; T_ASSERT_LE(nthreads, THREAD_BUFFER_TEST_THREADS, "thread count");
+	uint64_t start = clock_gettime_nsec_np(CLOCK_MONOTONIC_RAW);
+	for (int i = 0; i < nthreads; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, body, &kept[i]), "pthread_create");
+	}
+	for (int i = 0; i < nthreads; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+	uint64_t elapsed = clock_gettime_nsec_np(CLOCK_MONOTONIC_RAW) - start;
+
+	T_LOG("%d threads: %.0f %s/sec", nthreads, nthreads * events * NSEC_PER_SEC / elapsed, what);
+
+	check_stacks(kept, nthreads, false);
+	for (int i = 0; i < nthreads; i++) {
+		free(kept[i]);
+	}
+}
+
+static void *
+thread_buffer_stress_thread(void *arg)
+{
+	char **kept = arg;
+
+	for (int i = 0; i < THREAD_BUFFER_TEST_EVENTS / 2; i++) {
+		void *ptr = malloc(16 + (i % 64));
+		free(ptr);
+	}
+	*kept = malloc(32);
+	return NULL;
+}
+
+T_DECL(msl_stress_threads, "Log malloc events from many threads under one lock", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	log_events_from_threads(THREAD_BUFFER_TEST_THREADS, thread_buffer_stress_thread, THREAD_BUFFER_TEST_EVENTS, "events");
+}
+
+T_DECL(msl_stress_thread_buffers, "Log malloc events from many threads through per-thread event buffers", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocStackLoggingThreadBuffers=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	log_events_from_threads(THREAD_BUFFER_TEST_THREADS, thread_buffer_stress_thread, THREAD_BUFFER_TEST_EVENTS, "events");
+}
+
+static void
+malloc_in_signal_handler(int sig)
+{
+	free(malloc(48));
+}
+
+T_DECL(msl_thread_buffers_signal_handlers, "Log malloc events through per-thread event buffers from signal handlers that interrupt logging", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocStackLoggingThreadBuffers=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO), T_META_TIMEOUT(120))
+{
+	pthread_t threads[THREAD_BUFFER_TEST_THREADS];
+	char *kept[THREAD_BUFFER_TEST_THREADS];
+	struct sigaction sa = { .sa_handler = malloc_in_signal_handler };
+
+	T_ASSERT_POSIX_SUCCESS(sigaction(SIGUSR1, &sa, NULL), "sigaction");
+	for (int i = 0; i < THREAD_BUFFER_TEST_THREADS; i++) {
+		kept[i] = NULL;
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, thread_buffer_stress_thread, &kept[i]), "pthread_create");
+	}
+
+	// Keep interrupting the threads part way through their events; a handler
+	// that runs between an event's sequence number and its store must not
+	// hold up every other thread's events.
+	for (int round = 0; round < 2000; round++) {
+		for (int i = 0; i < THREAD_BUFFER_TEST_THREADS; i++) {
+			pthread_kill(threads[i], SIGUSR1);
+		}
+		usleep(100);
+	}
+	for (int i = 0; i < THREAD_BUFFER_TEST_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+	signal(SIGUSR1, SIG_IGN);
+
+	check_stacks(kept, THREAD_BUFFER_TEST_THREADS, false);
+	for (int i = 0; i < THREAD_BUFFER_TEST_THREADS; i++) {
+		free(kept[i]);
+	}
+}
+
+// Deep stacks that only change at the hot end, as most programs' do: every
+// allocation is made DEEP_STACK_DEPTH calls down, so all but the last few
+// frames of each stack are those of the thread's previous one.
+#define DEEP_STACK_THREADS 8
+#define DEEP_STACK_EVENTS 200000
+#define DEEP_STACK_DEPTH 128
+
+static __attribute__((noinline)) void
+deep_stack_frame(int depth, char **kept)
+{
+	if (depth == 0) {
+		for (int i = 0; i < DEEP_STACK_EVENTS / 2; i++) {
+			void *ptr = malloc(16 + (i % 64));
+			free(ptr);
+		}
+		*kept = malloc(32);
+	} else {
+		deep_stack_frame(depth - 1, kept);
+	}
+	__asm__ volatile("" ::: "memory"); // no tail calls, every frame stays on the stack
+}
+
+static void *
+deep_stack_thread(void *arg)
+{
+	deep_stack_frame(DEEP_STACK_DEPTH, arg);
+	return NULL;
+}
+
+T_DECL(msl_stress_deep_stacks, "Log malloc events with deep, slowly changing stacks from many threads under one lock", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	log_events_from_threads(DEEP_STACK_THREADS, deep_stack_thread, DEEP_STACK_EVENTS, "deep-stack events");
+}
+
+T_DECL(msl_stress_deep_stacks_thread_buffers, "Log malloc events with deep, slowly changing stacks from many threads through per-thread event buffers", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocStackLoggingThreadBuffers=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	log_events_from_threads(DEEP_STACK_THREADS, deep_stack_thread, DEEP_STACK_EVENTS, "deep-stack events");
+}
+
+// Synthetic stacks for the uniquing table: each allocation is made at the
+// bottom of SYNTHETIC_STACK_DEPTH calls, each through one of eight distinct
+// frames chosen by the bits of a per-thread pseudo-random path, for up to
+// 8^SYNTHETIC_STACK_DEPTH different stacks.
+#define SYNTHETIC_STACK_THREADS 8
+#define SYNTHETIC_STACK_ALLOCATIONS 250000
+#define SYNTHETIC_STACK_DEPTH 8
+
+typedef void (*synthetic_frame_t)(uint64_t path, int depth, char **kept);
+static synthetic_frame_t synthetic_frames[8];
+
+#define SYNTHETIC_FRAME(n) \
+static __attribute__((noinline)) void \
+synthetic_frame_##n(uint64_t path, int depth, char **kept) \
+{ \
+	if (depth == 0) { \
+		free(*kept); \
+		*kept = malloc(16 + (path & 63)); \
+	} else { \
+		synthetic_frames[path & 7](path >> 3, depth - 1, kept); \
+	} \
+	__asm__ volatile("" ::: "memory"); /* no tail calls, every frame stays on the stack */ \
+}
+
+SYNTHETIC_FRAME(0) SYNTHETIC_FRAME(1) SYNTHETIC_FRAME(2) SYNTHETIC_FRAME(3)
+SYNTHETIC_FRAME(4) SYNTHETIC_FRAME(5) SYNTHETIC_FRAME(6) SYNTHETIC_FRAME(7)
+
+static synthetic_frame_t synthetic_frames[8] = {
+	synthetic_frame_0, synthetic_frame_1, synthetic_frame_2, synthetic_frame_3,
+	synthetic_frame_4, synthetic_frame_5, synthetic_frame_6, synthetic_frame_7,
+};
+
+static void *
+synthetic_stack_thread(void *arg)
+{
+	char **kept = arg;
+	uint64_t path = (uint64_t)(uintptr_t)kept;
+
+	*kept = NULL;
+	for (int i = 0; i < SYNTHETIC_STACK_ALLOCATIONS; i++) {
+		path = path * 6364136223846793005ULL + 1442695040888963407ULL;
+		synthetic_frames[path >> 61](path >> 32, SYNTHETIC_STACK_DEPTH - 1, kept);
+	}
+	return NULL;
+}
+
+T_DECL(msl_uniquing_synthetic_stacks, "Unique millions of synthetic stacks from many threads under one lock", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	// An allocation and a free for each.
+	log_events_from_threads(SYNTHETIC_STACK_THREADS, synthetic_stack_thread, 2.0 * SYNTHETIC_STACK_ALLOCATIONS, "synthetic stacks");
+}
+
+T_DECL(msl_uniquing_synthetic_stacks_concurrent, "Unique millions of synthetic stacks from many threads without the logging lock", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocStackLoggingThreadBuffers=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	// An allocation and a free for each.
+	log_events_from_threads(SYNTHETIC_STACK_THREADS, synthetic_stack_thread, 2.0 * SYNTHETIC_STACK_ALLOCATIONS, "synthetic stacks");
+}
+
+#define SAMPLE_TEST_INTERVAL 4096
+#define SAMPLE_TEST_ALLOCATIONS 200000
+#define SAMPLE_TEST_SIZE 64
+
+T_DECL(msl_lite_sampled, "Test that sampled lite mode records a sample of allocations whose sizes estimate the live bytes", T_META_ENVVAR("MallocStackLogging=sample"), T_META_ENVVAR("MallocStackLoggingSampleInterval=4096"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	static char *ptrs[SAMPLE_TEST_ALLOCATIONS];
+	boolean_t lite_mode;
+	uint64_t sample_interval = 0;
+	int sampled = 0;
+
+	kern_return_t kr = __mach_stack_logging_start_reading(mach_task_self(), __mach_stack_logging_shared_memory_address, &lite_mode);
+	T_ASSERT_MACH_SUCCESS(kr, "start reading");
+	T_ASSERT_TRUE(lite_mode, "sampling is a lite mode");
+	kr = __mach_stack_logging_get_sample_interval(mach_task_self(), &sample_interval);
+	T_ASSERT_MACH_SUCCESS(kr, "get sample interval");
+	T_ASSERT_EQ(sample_interval, (uint64_t)SAMPLE_TEST_INTERVAL, "sample interval");
+
+	for (int i = 0; i < SAMPLE_TEST_ALLOCATIONS; i++) {
+		ptrs[i] = malloc(SAMPLE_TEST_SIZE);
+		T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "malloc");
+	}
+
+	// Sampled blocks are the lite zone's; their stacks must be readable.
+	for (int i = 0; i < SAMPLE_TEST_ALLOCATIONS; i++) {
+		const char *zone_name = malloc_get_zone_name(malloc_zone_from_ptr(ptrs[i]));
+		if (!zone_name || strcmp(zone_name, "MallocStackLoggingLiteZone")) {
+			continue;
+		}
+
+		// the requested size and the stack id follow the block
+		size_t ptr_size = malloc_size(ptrs[i]) + 2 * sizeof(uint64_t);
+		uint64_t stack_id = *(uint64_t *)(ptrs[i] + ptr_size - sizeof(uint64_t));
+		T_QUIET; T_ASSERT_EQ(*(uint64_t *)(ptrs[i] + ptr_size - 2 * sizeof(uint64_t)), (uint64_t)SAMPLE_TEST_SIZE, "requested size");
+
+		mach_vm_address_t frames[MAX_FRAMES];
+		uint32_t frames_count;
+		kr = __mach_stack_logging_get_frames_for_stackid(mach_task_self(), stack_id, frames, MAX_FRAMES, &frames_count, NULL);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "get frames");
+		T_QUIET; T_ASSERT_GT(frames_count, 0, "frames not empty");
+		sampled++;
+	}
+
+	// Each block was sampled with probability p = 1 - exp(-size / interval);
+	// the sampled ones stand for size / p bytes each.
+	double p = 1 - exp(-(double)SAMPLE_TEST_SIZE / SAMPLE_TEST_INTERVAL);
+	double estimate = sampled * SAMPLE_TEST_SIZE / p;
+	double live = (double)SAMPLE_TEST_ALLOCATIONS * SAMPLE_TEST_SIZE;
+	T_LOG("%d of %d allocations sampled, %.0f live bytes estimated for %.0f", sampled, SAMPLE_TEST_ALLOCATIONS, estimate, live);
+	T_EXPECT_GT(estimate, live * 0.9, "estimate not too low");
+	T_EXPECT_LT(estimate, live * 1.1, "estimate not too high");
+
+	for (int i = 0; i < SAMPLE_TEST_ALLOCATIONS; i++) {
+		free(ptrs[i]);
+	}
+	__mach_stack_logging_stop_reading(mach_task_self());
+}
+
+#define INDEX_TEST_ALLOCATIONS 100000
+
+typedef struct {
+	uint64_t allocations;
+	uint64_t matches;
+	uint64_t size;
+} index_test_context;
+
+static void
+count_index_records(mach_stack_logging_record_t record, void *context)
+{
+	index_test_context *counts = (index_test_context *)context;
+	if (record.type_flags & stack_logging_type_alloc) {
+		counts->allocations++;
+		if (counts->size && record.argument == counts->size) {
+			counts->matches++;
+		}
+	}
+}
+
+T_DECL(msl_index_blocks, "Test that records can be found in and enumerated from many written index blocks", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	static char *ptrs[INDEX_TEST_ALLOCATIONS];
+	boolean_t lite_mode;
+
+	kern_return_t kr = __mach_stack_logging_start_reading(mach_task_self(), __mach_stack_logging_shared_memory_address, &lite_mode);
+	T_ASSERT_MACH_SUCCESS(kr, "start reading");
+
+	// distinct sizes, so that each pointer's record can be told apart
+	for (int i = 0; i < INDEX_TEST_ALLOCATIONS; i++) {
+		ptrs[i] = malloc(16 + (i % 1024));
+		T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "malloc");
+	}
+
+	// the oldest pointers are many blocks back from the end of the index
+	for (int i = 0; i < INDEX_TEST_ALLOCATIONS; i += INDEX_TEST_ALLOCATIONS / 100) {
+		mach_vm_address_t frames[MAX_FRAMES];
+		uint32_t frames_count;
+		kr = __mach_stack_logging_get_frames(mach_task_self(), (mach_vm_address_t)ptrs[i], frames, MAX_FRAMES, &frames_count);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "get frames");
+		T_QUIET; T_ASSERT_GT(frames_count, 0, "frames not empty");
+
+		index_test_context counts = { .size = 16 + (i % 1024) };
+		kr = __mach_stack_logging_enumerate_records(mach_task_self(), (mach_vm_address_t)ptrs[i], count_index_records, &counts);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "enumerate records for address");
+		T_QUIET; T_ASSERT_GT(counts.matches, 0ULL, "allocation record found");
+	}
+
+	// an address that was never allocated has no records in any block
+	mach_vm_address_t frames[MAX_FRAMES];
+	uint32_t frames_count = 0;
+	kr = __mach_stack_logging_get_frames(mach_task_self(), (mach_vm_address_t)&ptrs[1], frames, MAX_FRAMES, &frames_count);
+	T_EXPECT_NE(kr, KERN_SUCCESS, "no frames for an address never allocated");
+
+	index_test_context counts = { 0 };
+	kr = __mach_stack_logging_enumerate_records(mach_task_self(), 0, count_index_records, &counts);
+	T_ASSERT_MACH_SUCCESS(kr, "enumerate all records");
+	T_EXPECT_GE(counts.allocations, (uint64_t)INDEX_TEST_ALLOCATIONS, "all allocations enumerated");
+
+	for (int i = 0; i < INDEX_TEST_ALLOCATIONS; i++) {
+		free(ptrs[i]);
+	}
+	__mach_stack_logging_stop_reading(mach_task_self());
+}
+
 T_DECL(msl_test_serialize_uniquing_table, "Test that that stack uniquing table can be serialized, deserialized and read", T_META_ENVVAR("MallocStackLogging=lite"))
 {
 	uintptr_t *foo = malloc(sizeof(uintptr_t));
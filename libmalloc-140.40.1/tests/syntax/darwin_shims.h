@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __DARWIN_SHIMS_H
+#define __DARWIN_SHIMS_H
+
+/*
+ * Declarations for the darwin_syntax target, which syntax-checks the Darwin
+ * only sources (nano, disk stack logging, remote introspection) on Linux.
+ * Forced in ahead of each source with -include: it pulls in internal.h, which
+ * the split-out sources expect to have been included already, and declares
+ * the Mach, BSD and libSystem names that src/linux_shims.h leaves out. None
+ * of this is ever linked.
+ */
+
+#include "internal.h"
+
+#ifndef __has_feature
+#define __has_feature(x) 0
+#endif
+
+#pragma mark Mach
+
+typedef int vm_prot_t;
+typedef unsigned int vm_inherit_t;
+typedef unsigned int mach_msg_type_number_t;
+typedef uintptr_t vm_map_t;
+
+#define MACH_PORT_NULL ((mach_port_t)0)
+#define VM_FLAGS_ANYWHERE 0x0001
+#define VM_FLAGS_ALIAS_MASK 0xFF000000
+#define VM_PROT_NONE ((vm_prot_t)0x00)
+#define VM_INHERIT_NONE ((vm_inherit_t)2)
+
+extern kern_return_t mach_vm_allocate(vm_map_t target, mach_vm_address_t *address, mach_vm_size_t size, int flags);
+extern kern_return_t mach_vm_deallocate(vm_map_t target, mach_vm_address_t address, mach_vm_size_t size);
+extern kern_return_t mach_vm_copy(vm_map_t target, mach_vm_address_t source, mach_vm_size_t size, mach_vm_address_t dest);
+extern kern_return_t mach_vm_read(vm_map_t target, mach_vm_address_t address, mach_vm_size_t size, vm_offset_t *data,
+		mach_msg_type_number_t *count);
+extern kern_return_t mach_vm_remap(vm_map_t target, mach_vm_address_t *address, mach_vm_size_t size, mach_vm_offset_t mask,
+		int flags, vm_map_t src_task, mach_vm_address_t src_address, boolean_t copy, vm_prot_t *cur_protection,
+		vm_prot_t *max_protection, vm_inherit_t inheritance);
+extern kern_return_t task_suspend(task_t task);
+extern kern_return_t task_resume(task_t task);
+extern kern_return_t pid_for_task(mach_port_t task, int *pid);
+extern char *mach_error_string(kern_return_t error);
+
+#pragma mark Commpage and dyld
+
+#define _COMM_PAGE_VERSION_REQD 0
+#define _COMM_PAGE_VERSION 0
+#define _COMM_PAGE_PHYSICAL_CPUS 0
+#define _COMM_PAGE_LOGICAL_CPUS 0
+
+struct mach_header;
+extern intptr_t _dyld_get_image_slide(const struct mach_header *mh);
+extern const void *_NSGetMachExecuteHeader(void);
+extern char ***_NSGetEnviron(void);
+extern bool dyld_process_is_restricted(void);
+
+#pragma mark libplatform
+
+typedef long os_once_t;
+
+extern void os_once(os_once_t *predicate, void *context, void (*function)(void *));
+
+#pragma mark BSD
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE vm_page_size
+#endif
+
+#define _CS_DARWIN_USER_TEMP_DIR 65537
+#define CTL_KERN 1
+#define KERN_ARGMAX 8
+#define KERN_PROC 14
+#define KERN_PROC_PID 1
+#define KERN_PROCARGS2 49
+#define P_LP64 0x00000004
+
+struct kinfo_proc {
+	struct {
+		int p_flag;
+	} kp_proc;
+};
+
+extern int sysctl(int *name, unsigned namelen, void *oldp, size_t *oldlenp, void *newp, size_t newlen);
+extern size_t strlcpy(char *dst, const char *src, size_t size);
+extern size_t strlcat(char *dst, const char *src, size_t size);
+extern const char *getprogname(void);
+extern int issetugid(void);
+extern void *pthread_get_stackaddr_np(pthread_t thread);
+extern size_t pthread_get_stacksize_np(pthread_t thread);
+
+#pragma mark libSystem
+
+#define OSAtomicAdd64(v, p) __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#define OSAtomicIncrement64Barrier(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+
+extern size_t malloc_size(const void *ptr);
+
+#endif // __DARWIN_SHIMS_H
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * malloc_register.c, malloc.c, stack_logging.c and malloc_zone_create.c are
+ * pieces of the one malloc.c translation unit, checked together by the
+ * darwin_syntax target. The other pieces lean on blocks, kevent and kdebug,
+ * which are beyond what GCC and tests/syntax/darwin_shims.h provide.
+ */
+
+#include "malloc_zone_block.h"
+#include "nano_malloc_caller.h"
+
+#include "malloc/malloc_register.c"
+#include "malloc/malloc.c"
+#include "magazine/stack_logging.c"
+#include "malloc/malloc_zone_create.c"
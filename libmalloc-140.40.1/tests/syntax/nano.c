@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * The nano/ sources are pieces of the one nano_malloc.c translation unit and
+ * share its static functions, so the darwin_syntax target checks them
+ * together, in an order that defines most statics before their first use.
+ */
+
+// nano_check.h declares _nano_malloc_check_clear() without a return type, and
+// nano_introspection.h builds nano_introspect from the functions defined in
+// nano_introspection.c; the one is declared below, the other included later.
+#define nano_check_h
+#define nano_introspection_h
+
+static void *_nano_malloc_check_clear(nanozone_t *nanozone, size_t size, boolean_t cleared_requested);
+static size_t _nano_vet_and_size_of_live(nanozone_t *nanozone, const void *ptr);
+static boolean_t _nano_block_inuse_p(nanozone_t *nanozone, const void *ptr);
+static void __nano_free_definite_size(nanozone_t *nanozone, void *ptr, size_t size, boolean_t do_scribble);
+static void __nano_free(nanozone_t *nanozone, void *ptr, boolean_t do_scribble);
+static unsigned count_free(nanozone_t *nanozone, nano_meta_admin_t pMeta);
+
+// nano_malloc_caller.c carries code from the malloc.c pieces.
+extern os_once_t _malloc_initialize_pred;
+extern malloc_zone_t *inline_malloc_default_zone(void);
+extern void _malloc_reinit_lock_all(void (*callout)(void));
+
+#include "nano/nano_util.c"
+#include "nano/nano_debug.c"
+#include "nano/nano_allocate.c"
+#include "nano/nano_size.c"
+#include "nano/nano_segregated.c"
+#include "nano/nano_check.c"
+#include "nano/nano_scribble.c"
+#include "nano/nano_malloc.c"
+#include "nano/nano_batch.c"
+#include "nano/nano_relief.c"
+#include "nano/nano_introspection.c"
+
+#undef nano_introspection_h
+#include "nano_introspection.h"
+
+#include "nano/nano_malloc_caller.c"